@@ -0,0 +1,11 @@
+CREATE TABLE apicache (
+       url TEXT PRIMARY KEY,
+       provider TEXT,
+       payload BLOB,
+       etag TEXT,
+       mtime INTEGER,
+       expire INTEGER,
+       negative INTEGER DEFAULT 0
+       );
+
+CREATE INDEX apicache_expire_idx ON apicache(expire);
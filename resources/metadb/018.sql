@@ -0,0 +1,11 @@
+-- Full text search index over titles, artists and albums.
+-- The index is keyed on item id (docid) and holds casefolded text
+-- without diacritics. It's populated by metadb.c as the index can't
+-- be folded using SQL alone.
+
+CREATE VIRTUAL TABLE itemsearch USING fts4(title, artist, album);
+
+CREATE TRIGGER itemsearch_delete AFTER DELETE ON item
+BEGIN
+  DELETE FROM itemsearch WHERE docid = OLD.id;
+END;
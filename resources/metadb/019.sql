@@ -0,0 +1,13 @@
+-- Drop search index rows when the audio or video metadata they were
+-- built from is deleted. metadb.c indexes whatever is left of the item
+-- again (the text can't be folded using SQL alone)
+
+CREATE TRIGGER itemsearch_audioitem_delete AFTER DELETE ON audioitem
+BEGIN
+  DELETE FROM itemsearch WHERE docid = OLD.item_id;
+END;
+
+CREATE TRIGGER itemsearch_videoitem_delete AFTER DELETE ON videoitem
+BEGIN
+  DELETE FROM itemsearch WHERE docid = OLD.item_id;
+END;
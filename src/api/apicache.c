@@ -0,0 +1,345 @@
+/*
+ *  Cache of responses from online metadata providers
+ *  Copyright (C) 2013 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "showtime.h"
+#include "fileaccess/fileaccess.h"
+#include "networking/http.h"
+#include "htsmsg/htsbuf.h"
+#include "metadata/metadata.h"
+#include "db/db_support.h"
+#include "apicache.h"
+
+/**
+ * Responses from online metadata providers are stored in the metadb.
+ *
+ * A fresh response is returned without asking the provider at all.
+ * An expired response is revalidated using the ETag / Last-Modified
+ * headers that came with it, and if the provider can't be reached we
+ * return the expired response rather than nothing.
+ *
+ * Providers flag responses that did not give any match using
+ * apicache_set_negative(). Those expire after ap_negative_ttl instead.
+ * This should only be done for responses that were just fetched (see the
+ * 'fetched' argument to apicache_load()), cached ones already carry
+ * their expiry.
+ *
+ * Requests to each provider go through a token bucket holding ap_burst
+ * requests, refilled by one every ap_interval ms. Nothing waits for the
+ * bucket: when it is empty the expired response is returned if there
+ * is one, otherwise the load fails as if the provider was unreachable
+ * and it's up to the caller to try again later.
+ */
+
+#define APICACHE_PURGE_AGE (90 * 86400) // Drop entries expired this long ago
+
+static hts_mutex_t apicache_mutex;
+
+
+/**
+ *
+ */
+static char *
+make_url(const char *url, const char **arguments)
+{
+  htsbuf_queue_t q;
+  char *r;
+
+  htsbuf_queue_init(&q, 0);
+  htsbuf_append(&q, url, strlen(url));
+
+  if(arguments != NULL) {
+    char prefix = '?';
+
+    for(; arguments[0] != NULL; arguments += 2) {
+      if(arguments[1] == NULL)
+        continue;
+      htsbuf_append(&q, &prefix, 1);
+      htsbuf_append_and_escape_url(&q, arguments[0]);
+      htsbuf_append(&q, "=", 1);
+      htsbuf_append_and_escape_url(&q, arguments[1]);
+      prefix = '&';
+    }
+  }
+
+  r = htsbuf_to_string(&q);
+  htsbuf_queue_flush(&q);
+  return r;
+}
+
+
+/**
+ *
+ */
+static buf_t *
+cache_get(void *db, const char *url, char **etag, time_t *mtime,
+          time_t *expire, int *negative)
+{
+  sqlite3_stmt *stmt;
+  buf_t *b = NULL;
+  const char *s;
+
+  if(db_prepare(db, &stmt,
+                "SELECT payload, etag, mtime, expire, negative "
+                "FROM apicache "
+                "WHERE url = ?1"))
+    return NULL;
+
+  sqlite3_bind_text(stmt, 1, url, -1, SQLITE_STATIC);
+
+  if(db_step(stmt) == SQLITE_ROW) {
+    b = buf_create_and_copy(sqlite3_column_bytes(stmt, 0),
+                            sqlite3_column_blob(stmt, 0));
+    s = (const char *)sqlite3_column_text(stmt, 1);
+    *etag     = s ? strdup(s) : NULL;
+    *mtime    = sqlite3_column_int64(stmt, 2);
+    *expire   = sqlite3_column_int64(stmt, 3);
+    *negative = sqlite3_column_int(stmt, 4);
+  }
+  db_finalize(stmt);
+  return b;
+}
+
+
+/**
+ *
+ */
+static void
+cache_put(void *db, const apicache_provider_t *ap, const char *url,
+          const buf_t *b, const char *etag, time_t mtime, time_t expire)
+{
+  sqlite3_stmt *stmt;
+
+  if(db_prepare(db, &stmt,
+                "INSERT OR REPLACE INTO apicache "
+                "(url, provider, payload, etag, mtime, expire, negative) "
+                "VALUES "
+                "(?1, ?2, ?3, ?4, ?5, ?6, 0)"))
+    return;
+
+  sqlite3_bind_text(stmt, 1, url, -1, SQLITE_STATIC);
+  sqlite3_bind_text(stmt, 2, ap->ap_name, -1, SQLITE_STATIC);
+  sqlite3_bind_blob(stmt, 3, b->b_ptr, b->b_size, SQLITE_STATIC);
+  sqlite3_bind_text(stmt, 4, etag, -1, SQLITE_STATIC);
+  sqlite3_bind_int64(stmt, 5, mtime);
+  sqlite3_bind_int64(stmt, 6, expire);
+  db_step(stmt);
+  db_finalize(stmt);
+}
+
+
+/**
+ *
+ */
+static void
+cache_set_expire(void *db, const char *url, time_t expire, int negative)
+{
+  sqlite3_stmt *stmt;
+
+  if(db_prepare(db, &stmt,
+                "UPDATE apicache "
+                "SET expire = ?2, negative = ?3 "
+                "WHERE url = ?1"))
+    return;
+
+  sqlite3_bind_text(stmt, 1, url, -1, SQLITE_STATIC);
+  sqlite3_bind_int64(stmt, 2, expire);
+  sqlite3_bind_int(stmt, 3, negative);
+  db_step(stmt);
+  db_finalize(stmt);
+}
+
+
+/**
+ * The bucket is kept as the time at which it will be full again, so
+ * nothing needs to run to refill it.
+ *
+ * Returns 0 and takes a request from the bucket if there is one,
+ * otherwise returns the number of µs until there is
+ */
+static int64_t
+apicache_ratelimit(apicache_provider_t *ap)
+{
+  int64_t now, delay;
+  int64_t interval = ap->ap_interval * 1000LL;
+
+  hts_mutex_lock(&apicache_mutex);
+  now = showtime_get_ts();
+  if(ap->ap_bucket_full < now)
+    ap->ap_bucket_full = now;
+
+  delay = ap->ap_bucket_full + interval - now -
+    interval * MAX(ap->ap_burst, 1);
+
+  if(delay <= 0) {
+    ap->ap_bucket_full += interval;
+    delay = 0;
+  }
+  hts_mutex_unlock(&apicache_mutex);
+  return delay;
+}
+
+
+/**
+ * If 'fetched' is not NULL it is set to 1 if the response was loaded or
+ * revalidated from the provider, and to 0 if it came from the cache only
+ */
+buf_t *
+apicache_load(apicache_provider_t *ap, const char *url0,
+              const char **arguments, char *errbuf, size_t errlen,
+              int flags, int *fetched)
+{
+  char *url = make_url(url0, arguments);
+  char *etag = NULL;
+  time_t mtime = 0, expire = 0;
+  int negative = 0;
+  time_t now = time(NULL);
+  struct http_header_list headers_in, headers_out;
+  buf_t *b = NULL, *cached = NULL;
+  const char *s;
+  char txt[40];
+  int64_t delay;
+  int r;
+  void *db = metadb_get();
+
+  if(fetched != NULL)
+    *fetched = 0;
+
+  if(db != NULL)
+    cached = cache_get(db, url, &etag, &mtime, &expire, &negative);
+
+  if(cached != NULL && expire > now) {
+    b = cached;
+    goto done;
+  }
+
+  if((delay = apicache_ratelimit(ap)) != 0) {
+    b = cached;
+    if(b != NULL)
+      TRACE(TRACE_DEBUG, "apicache",
+            "%s: Rate limited, using expired response for %s",
+            ap->ap_name, url);
+    else
+      snprintf(errbuf, errlen, "Rate limited by %s, retry in %d ms",
+               ap->ap_name, (int)(delay / 1000));
+    goto done;
+  }
+
+  LIST_INIT(&headers_in);
+  LIST_INIT(&headers_out);
+
+  if(cached != NULL) {
+    if(etag != NULL)
+      http_header_add(&headers_in, "If-None-Match", etag, 0);
+    if(mtime) {
+      http_asctime(mtime, txt, sizeof(txt));
+      http_header_add(&headers_in, "If-Modified-Since", txt, 0);
+    }
+  }
+
+  r = http_request(url, NULL, &b, errbuf, errlen, NULL, NULL, flags,
+                   &headers_out, &headers_in, NULL, NULL, NULL);
+
+  if(r == 304 && cached != NULL) {
+
+    if(db != NULL)
+      cache_set_expire(db, url,
+                       now + (negative ? ap->ap_negative_ttl : ap->ap_ttl),
+                       negative);
+    b = cached;
+    if(fetched != NULL)
+      *fetched = 1;
+
+  } else if(r == 0 && b != NULL) {
+
+    free(etag);
+    s = http_header_get(&headers_out, "etag");
+    etag = s ? strdup(s) : NULL;
+
+    mtime = 0;
+    if((s = http_header_get(&headers_out, "last-modified")) != NULL)
+      http_ctime(&mtime, s);
+
+    if(db != NULL)
+      cache_put(db, ap, url, b, etag, mtime, now + ap->ap_ttl);
+    buf_release(cached);
+    if(fetched != NULL)
+      *fetched = 1;
+
+  } else {
+
+    b = cached;
+    if(b != NULL)
+      TRACE(TRACE_DEBUG, "apicache", "%s: Using expired response for %s -- %s",
+            ap->ap_name, url, errbuf);
+  }
+
+  http_headers_free(&headers_in);
+  http_headers_free(&headers_out);
+
+ done:
+  metadb_close(db);
+  free(etag);
+  free(url);
+  return b;
+}
+
+
+/**
+ * Flag a response as not giving any match
+ */
+void
+apicache_set_negative(apicache_provider_t *ap, const char *url0,
+                      const char **arguments)
+{
+  char *url = make_url(url0, arguments);
+  void *db = metadb_get();
+
+  if(db != NULL) {
+    cache_set_expire(db, url, time(NULL) + ap->ap_negative_ttl, 1);
+    metadb_close(db);
+  }
+  free(url);
+}
+
+
+/**
+ *
+ */
+static void
+apicache_init(void)
+{
+  sqlite3_stmt *stmt;
+  void *db;
+
+  hts_mutex_init(&apicache_mutex);
+
+  if((db = metadb_get()) == NULL)
+    return;
+
+  if(!db_prepare(db, &stmt, "DELETE FROM apicache WHERE expire < ?1")) {
+    sqlite3_bind_int64(stmt, 1, time(NULL) - APICACHE_PURGE_AGE);
+    db_step(stmt);
+    db_finalize(stmt);
+  }
+  metadb_close(db);
+}
+
+INITME(INIT_GROUP_API, apicache_init);
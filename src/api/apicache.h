@@ -0,0 +1,45 @@
+/*
+ *  Cache of responses from online metadata providers
+ *  Copyright (C) 2013 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct buf;
+
+/**
+ * Describes a provider. Usually statically allocated by the provider
+ */
+typedef struct apicache_provider {
+  const char *ap_name;
+  int ap_ttl;             // Seconds a response is fresh
+  int ap_negative_ttl;    // Seconds a response without a match is fresh
+  int ap_interval;        // ms to earn another request
+  int ap_burst;           // Requests that can be made back to back
+
+  int64_t ap_bucket_full; // Private to apicache
+} apicache_provider_t;
+
+
+struct buf *apicache_load(apicache_provider_t *ap, const char *url,
+                          const char **arguments, char *errbuf, size_t errlen,
+                          int flags, int *fetched);
+
+void apicache_set_negative(apicache_provider_t *ap, const char *url,
+                           const char **arguments);
@@ -382,17 +382,22 @@ hc_logfile(http_connection_t *hc, const char *remain, void *opaque,
   const int n = atoi(remain);
   const char *mode = http_arg_get_req(hc, "mode");
 
-  char p1[500];
+  char p1[500], p2[100];
   snprintf(p1, sizeof(p1), "%s/log/showtime.log.%d", gconf.cache_path, n);
+
+  if (mode != NULL && !strcmp(mode, "download")) {
+    snprintf(p2, sizeof(p2), "attachment; filename=\"showtime.log.%d\"", n);
+    http_set_response_hdr(hc, "Content-Disposition", p2);
+  }
+
+  if(!http_send_file(hc, p1, "text/plain", 0))
+    return 0;
+
   buf_t *buf = fa_load(p1, NULL, NULL, 0, NULL, 0, NULL, NULL);
 
   if(buf == NULL)
     return 404;
   htsbuf_append_buf(&out, buf);
-  if (mode != NULL && !strcmp(mode, "download")) {
-    snprintf(p1, sizeof(p1), "attachment; filename=\"showtime.log.%d\"", n);
-    http_set_response_hdr(hc, "Content-Disposition", p1);
-  }
   return http_send_reply(hc, 0, "text/plain", NULL, NULL, 0, &out);
 }
 
@@ -561,6 +566,11 @@ hc_serve_file(http_connection_t *hc, const char *file, const char *contenttype)
     }
   }
 
+  // Local files are sent straight from disk, anything else (such as
+  // resources bundled in the binary) goes via fa_load()
+  if(!http_send_file(hc, file, contenttype, 0))
+    return 0;
+
   buf_t *b = fa_load(file, NULL, NULL, 0, NULL, 0, NULL, NULL);
   if(b == NULL)
     return 404;
@@ -28,12 +28,15 @@
 #include "backend/backend.h"
 #include "db/db_support.h"
 #include "settings.h"
+#include "apicache.h"
 
 // http://help.themoviedb.org/kb/api/about-3
 
 // Showtimes TMDB APIKEY
 #define TMDB_APIKEY "a0d71cffe2d6693d462af9e4f336bc06"
 
+#define TMDB_SEARCH_URL "http://api.themoviedb.org/3/search/movie"
+
 
 static hts_mutex_t tmdb_mutex;
 static metadata_source_t *tmdb;
@@ -42,6 +45,14 @@ static int tmdb_configured;
 static char tmdb_language[3];
 static int tmdb_use_orig_title;
 
+static apicache_provider_t tmdb_api = {
+  .ap_name = "tmdb",
+  .ap_ttl = 14 * 86400,
+  .ap_negative_ttl = 86400,
+  .ap_interval = 500,   // TMDB allows 30 requests per 10 seconds,
+  .ap_burst = 10,       // this gives at most 10 + 10000 / 500
+};
+
 typedef struct tmdb_image_size {
   struct tmdb_image_size *next;
   int width;
@@ -165,13 +176,13 @@ tmdb_configure(void)
 
     buf_t *result;
     char errbuf[256];
-    result = fa_load_query("http://api.themoviedb.org/3/configuration",
-			   errbuf, sizeof(errbuf), NULL,
+    result = apicache_load(&tmdb_api,
+			   "http://api.themoviedb.org/3/configuration",
 			   (const char *[]){
 			     "api_key", TMDB_APIKEY,
 			       "language", getlang(),
 			       NULL, NULL},
-			   FA_COMPRESSION);
+			   errbuf, sizeof(errbuf), FA_COMPRESSION, NULL);
 
     if(result == NULL) {
       TRACE(TRACE_INFO, "TMDB", "Unable to get configuration -- %s", errbuf);
@@ -210,13 +221,12 @@ tmdb_load_movie_cast(const char *lookup_id)
   snprintf(url, sizeof(url), "http://api.themoviedb.org/3/movie/%s/casts",
 	   lookup_id);
 
-  result = fa_load_query(url, errbuf, sizeof(errbuf),
-			 NULL,
+  result = apicache_load(&tmdb_api, url,
 			 (const char *[]){
 			   "api_key", TMDB_APIKEY,
 			     "language", getlang(),
 			     NULL, NULL},
-			 FA_COMPRESSION);
+			 errbuf, sizeof(errbuf), FA_COMPRESSION, NULL);
   if(result == NULL) {
     TRACE(TRACE_INFO, "TMDB", "Load error %s", errbuf);
     return NULL;
@@ -304,13 +314,12 @@ tmdb_load_movie_info(void *db, const char *item_url, const char *lookup_id,
 
   snprintf(url, sizeof(url), "http://api.themoviedb.org/3/movie/%s", lookup_id);
 
-  result = fa_load_query(url, errbuf, sizeof(errbuf),
-			 NULL,
+  result = apicache_load(&tmdb_api, url,
 			 (const char *[]){
 			   "api_key", TMDB_APIKEY,
 			     "language", getlang(),
 			     NULL, NULL},
-			 FA_COMPRESSION);
+			 errbuf, sizeof(errbuf), FA_COMPRESSION, NULL);
   if(result == NULL) {
     TRACE(TRACE_INFO, "TMDB", "Load error %s", errbuf);
     return METADATA_TEMPORARY_ERROR;
@@ -401,6 +410,7 @@ tmdb_query_by_title_and_year(void *db, const char *item_url,
   char errbuf[256];
   buf_t *result;
   char yeartxt[20];
+  int fetched;
 
   if(tmdb == NULL)
     return METADATA_TEMPORARY_ERROR;
@@ -410,19 +420,33 @@ tmdb_query_by_title_and_year(void *db, const char *item_url,
   else
     yeartxt[0] = 0;
 
-  result = fa_load_query("http://api.themoviedb.org/3/search/movie",
-			 errbuf, sizeof(errbuf), NULL,
-			 (const char *[]){"query", title,
-			     "year", *yeartxt ? yeartxt : NULL,
-			     "api_key", TMDB_APIKEY,
-			     "language", getlang(),
-			     NULL, NULL},
-			 FA_COMPRESSION);
+  const char *args[] = {"query", title,
+			"year", *yeartxt ? yeartxt : NULL,
+			"api_key", TMDB_APIKEY,
+			"language", getlang(),
+			NULL, NULL};
+
+  result = apicache_load(&tmdb_api, TMDB_SEARCH_URL, args,
+			 errbuf, sizeof(errbuf), FA_COMPRESSION, &fetched);
 
   if(result == NULL)
     return METADATA_TEMPORARY_ERROR;
 
-  htsmsg_t *doc = htsmsg_json_deserialize(buf_cstr(result));
+  // Search results carry lots of fields we don't care about
+  static const char *paths[] = {
+    "total_results",
+    "total_pages",
+    "results/*/id",
+    "results/*/title",
+    "results/*/original_title",
+    "results/*/release_date",
+    "results/*/popularity",
+    "results/*/poster_path",
+    "results/*/backdrop_path",
+    NULL
+  };
+
+  htsmsg_t *doc = htsmsg_json_deserialize_paths(buf_cstr(result), paths);
   buf_release(result);
   if(doc == NULL)
     return METADATA_TEMPORARY_ERROR;
@@ -475,6 +499,9 @@ tmdb_query_by_title_and_year(void *db, const char *item_url,
     rval = 0;
   }
   htsmsg_destroy(doc);
+
+  if(rval == METADATA_PERMANENT_ERROR && fetched)
+    apicache_set_negative(&tmdb_api, TMDB_SEARCH_URL, args);
   return rval;
 }
 
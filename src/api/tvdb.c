@@ -26,12 +26,23 @@
 #include "fileaccess/fileaccess.h"
 #include "misc/dbl.h"
 #include "settings.h"
+#include "apicache.h"
 
 static metadata_source_t *tvdb;
 static char tvdb_language[3];
 
 #define TVDB_APIKEY "0ADF8BA762FED295"
 
+#define TVDB_SEARCH_URL "http://www.thetvdb.com/api/GetSeries.php"
+
+static apicache_provider_t tvdb_api = {
+  .ap_name = "tvdb",
+  .ap_ttl = 7 * 86400,
+  .ap_negative_ttl = 86400,
+  .ap_interval = 250,
+  .ap_burst = 4,
+};
+
 
 /**
  *
@@ -59,8 +70,8 @@ loadxml(const char *fmt, ...)
   vsnprintf(url+strlen(url), sizeof(url)-strlen(url), fmt, ap);
   va_end(ap);
 
-  buf_t *result = fa_load_query(url, errbuf, sizeof(errbuf), NULL,
-                                NULL, FA_COMPRESSION);
+  buf_t *result = apicache_load(&tvdb_api, url, NULL,
+                                errbuf, sizeof(errbuf), FA_COMPRESSION, NULL);
 
   if(result == NULL) {
     TRACE(TRACE_INFO, "TVDB", "Unable to query for %s -- %s", url, errbuf);
@@ -363,13 +374,12 @@ tvdb_query_by_episode(void *db, const char *item_url,
 {
   buf_t *result;
   char errbuf[256];
+  int fetched;
   
-  result = fa_load_query("http://www.thetvdb.com/api/GetSeries.php",
-			 errbuf, sizeof(errbuf), NULL,
-			 (const char *[]){
-			   "seriesname", title,
-			     NULL, NULL},
-			 FA_COMPRESSION);
+  const char *args[] = {"seriesname", title, NULL, NULL};
+
+  result = apicache_load(&tvdb_api, TVDB_SEARCH_URL, args,
+			 errbuf, sizeof(errbuf), FA_COMPRESSION, &fetched);
 
   if(result == NULL) {
     TRACE(TRACE_INFO, "TVDB", "Unable to search for %s -- %s", title, errbuf);
@@ -393,6 +403,8 @@ tvdb_query_by_episode(void *db, const char *item_url,
   if(series_id == NULL) {
     TRACE(TRACE_INFO, "TVDB", "No series id in response");
     htsmsg_destroy(gs);
+    if(fetched)
+      apicache_set_negative(&tvdb_api, TVDB_SEARCH_URL, args);
     return METADATA_TEMPORARY_ERROR;
   }
 
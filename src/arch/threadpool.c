@@ -0,0 +1,328 @@
+/*
+ *  Pool of worker threads for short lived tasks
+ *  Copyright (C) 2013 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "showtime.h"
+#include "arch/threads.h"
+#include "misc/queue.h"
+
+/**
+ * Tasks are queued in three priority classes derived from the
+ * THREAD_PRIO_* value passed by the caller. Each class has its own
+ * workers, running at the lowest priority of the class, so a task is
+ * never run at a higher priority than it asked for.
+ *
+ * A task started from a worker of the same class goes onto the tail of
+ * that worker's own deque and is picked from the tail (LIFO), which
+ * keeps related work on the same thread. Other tasks go onto the
+ * global queue of their class. An idle worker first looks in its own
+ * deque, then the global queue, and then steals from the head of the
+ * deques of the other workers in its class.
+ *
+ * The first class keeps gconf.concurrency (at least two) workers
+ * around, the others start workers on demand. Tasks may block (on I/O
+ * for example), so if a task is queued while no worker in its class is
+ * idle the pool grows, up to TASK_MAX_WORKERS in total. Beyond that,
+ * tasks get a detached thread of their own so they never wait for a
+ * worker that may not come back. Surplus workers exit after
+ * TASK_IDLE_TIMEOUT ms without work.
+ *
+ * Tasks should not run for the lifetime of a page or longer, use
+ * hts_thread_create_detached() for that.
+ */
+
+#define TASK_MAX_WORKERS  64
+#define TASK_IDLE_TIMEOUT 10000
+#define TASK_CLASSES      3
+
+TAILQ_HEAD(task_queue, task);
+
+typedef struct task {
+  TAILQ_ENTRY(task) t_link;
+  const char *t_name;
+  void *(*t_func)(void *aux);
+  void *t_aux;
+} task_t;
+
+
+typedef struct worker {
+  hts_mutex_t w_mutex;
+  struct task_queue w_queue;
+  int w_active;
+  int w_class;
+} worker_t;
+
+
+typedef struct task_class {
+  struct task_queue tc_queue;
+  hts_cond_t tc_cond;
+  int tc_prio;      // Priority the workers run at
+  int tc_workers;   // Number of worker threads
+  int tc_starting;  // Created but not yet looking for work
+  int tc_idle;      // Waiting for work
+  int tc_pending;   // Queued tasks
+  int tc_core;      // Workers that never exit
+} task_class_t;
+
+
+static worker_t workers[TASK_MAX_WORKERS];
+static task_class_t classes[TASK_CLASSES];
+
+static hts_mutex_t pool_mutex;
+
+static unsigned int worker_key;
+
+
+/**
+ *
+ */
+static int
+prio_to_class(int prio)
+{
+  if(prio <= THREAD_PRIO_MODEL)
+    return 0;
+  if(prio <= THREAD_PRIO_UI_WORKER_LOW)
+    return 1;
+  return 2;
+}
+
+
+/**
+ *
+ */
+static task_t *
+queue_take(hts_mutex_t *m, struct task_queue *q, int from_tail)
+{
+  task_t *t;
+  hts_mutex_lock(m);
+  t = from_tail ? TAILQ_LAST(q, task_queue) : TAILQ_FIRST(q);
+  if(t != NULL)
+    TAILQ_REMOVE(q, t, t_link);
+  hts_mutex_unlock(m);
+  return t;
+}
+
+
+/**
+ *
+ */
+static task_t *
+find_task(worker_t *self)
+{
+  task_t *t;
+  int i;
+  const int me = self - workers;
+
+  if((t = queue_take(&self->w_mutex, &self->w_queue, 1)) != NULL)
+    return t;
+
+  if((t = queue_take(&pool_mutex, &classes[self->w_class].tc_queue, 0))
+     != NULL)
+    return t;
+
+  for(i = 1; i < TASK_MAX_WORKERS; i++) {
+    worker_t *victim = &workers[(me + i) % TASK_MAX_WORKERS];
+    if(victim->w_class != self->w_class ||
+       TAILQ_FIRST(&victim->w_queue) == NULL)
+      continue; // Unlocked peek, we'll recheck under the lock
+    if((t = queue_take(&victim->w_mutex, &victim->w_queue, 0)) != NULL)
+      return t;
+  }
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static void
+task_exec(task_t *t)
+{
+  t->t_func(t->t_aux);
+  free(t);
+}
+
+
+/**
+ *
+ */
+static void *
+worker_thread(void *aux)
+{
+  worker_t *w = aux;
+  task_class_t *tc = &classes[w->w_class];
+  task_t *t;
+
+  hts_thread_set_specific(worker_key, w);
+
+  hts_mutex_lock(&pool_mutex);
+  tc->tc_starting--;
+
+  while(1) {
+
+    if(tc->tc_pending > 0) {
+      hts_mutex_unlock(&pool_mutex);
+      t = find_task(w);
+      hts_mutex_lock(&pool_mutex);
+
+      if(t == NULL)
+        continue; // Someone else took it before us
+
+      tc->tc_pending--;
+      hts_mutex_unlock(&pool_mutex);
+
+      task_exec(t);
+
+      hts_mutex_lock(&pool_mutex);
+      continue;
+    }
+
+    tc->tc_idle++;
+    int timeout = hts_cond_wait_timeout(&tc->tc_cond, &pool_mutex,
+                                        TASK_IDLE_TIMEOUT);
+    tc->tc_idle--;
+
+    if(timeout && tc->tc_pending == 0 && tc->tc_workers > tc->tc_core)
+      break;
+  }
+
+  w->w_active = 0;
+  tc->tc_workers--;
+  hts_mutex_unlock(&pool_mutex);
+  return NULL;
+}
+
+
+/**
+ * Runs a task that did not get a worker
+ */
+static void *
+overflow_thread(void *aux)
+{
+  task_exec(aux);
+  return NULL;
+}
+
+
+/**
+ * Must be called with pool_mutex held
+ *
+ * Returns -1 if all worker slots are in use
+ */
+static int
+spawn_worker(int c)
+{
+  task_class_t *tc = &classes[c];
+  int i;
+  for(i = 0; i < TASK_MAX_WORKERS; i++) {
+    worker_t *w = &workers[i];
+    if(w->w_active)
+      continue;
+
+    hts_mutex_lock(&w->w_mutex);
+    // An exited worker may have left stolen-from work behind
+    assert(TAILQ_FIRST(&w->w_queue) == NULL);
+    w->w_class = c;
+    hts_mutex_unlock(&w->w_mutex);
+
+    w->w_active = 1;
+    tc->tc_workers++;
+    tc->tc_starting++;
+    hts_thread_create_detached("worker", worker_thread, w, tc->tc_prio);
+    return 0;
+  }
+  return -1;
+}
+
+
+/**
+ * Run func(aux) on a pool thread. 'prio' is one of THREAD_PRIO_*
+ */
+void
+hts_task_run(const char *name, void *(*func)(void *), void *aux, int prio)
+{
+  task_t *t = malloc(sizeof(task_t));
+  const int c = prio_to_class(prio);
+  task_class_t *tc = &classes[c];
+  worker_t *w = hts_thread_get_specific(worker_key);
+
+  t->t_name = name;
+  t->t_func = func;
+  t->t_aux = aux;
+
+  hts_mutex_lock(&pool_mutex);
+
+  if(tc->tc_idle == 0 && tc->tc_pending >= tc->tc_starting &&
+     spawn_worker(c)) {
+    hts_mutex_unlock(&pool_mutex);
+    hts_thread_create_detached(name, overflow_thread, t, tc->tc_prio);
+    return;
+  }
+
+  if(w != NULL && w->w_class == c) {
+    hts_mutex_lock(&w->w_mutex);
+    TAILQ_INSERT_TAIL(&w->w_queue, t, t_link);
+    hts_mutex_unlock(&w->w_mutex);
+  } else {
+    TAILQ_INSERT_TAIL(&tc->tc_queue, t, t_link);
+  }
+
+  tc->tc_pending++;
+
+  if(tc->tc_idle > 0)
+    hts_cond_signal(&tc->tc_cond);
+
+  hts_mutex_unlock(&pool_mutex);
+}
+
+
+/**
+ *
+ */
+void
+hts_task_init(void)
+{
+  int i, c;
+
+  hts_thread_key_create(&worker_key, NULL);
+  hts_mutex_init(&pool_mutex);
+
+  for(c = 0; c < TASK_CLASSES; c++) {
+    TAILQ_INIT(&classes[c].tc_queue);
+    hts_cond_init(&classes[c].tc_cond, &pool_mutex);
+  }
+
+  classes[0].tc_prio = THREAD_PRIO_MODEL;
+  classes[1].tc_prio = THREAD_PRIO_UI_WORKER_LOW;
+  classes[2].tc_prio = THREAD_PRIO_BGTASK;
+
+  classes[0].tc_core = MAX(gconf.concurrency, 2);
+
+  for(i = 0; i < TASK_MAX_WORKERS; i++) {
+    hts_mutex_init(&workers[i].w_mutex);
+    TAILQ_INIT(&workers[i].w_queue);
+  }
+
+  hts_mutex_lock(&pool_mutex);
+  for(i = 0; i < classes[0].tc_core; i++)
+    spawn_worker(0);
+  hts_mutex_unlock(&pool_mutex);
+}
@@ -37,3 +37,12 @@ extern int hts_thread_set_specific(unsigned int k, void *p);
 extern void *hts_thread_get_specific(unsigned int k);
 extern void hts_thread_exit_specific(void);
 #endif
+
+
+/**
+ * Pool of worker threads for short lived tasks, see threadpool.c
+ */
+extern void hts_task_init(void);
+
+extern void hts_task_run(const char *name, void *(*func)(void *), void *aux,
+                         int prio);
@@ -30,6 +30,7 @@
 #include "event.h"
 #include "notifications.h"
 #include "misc/pixmap.h"
+#include "misc/pixmap_cache.h"
 #include "htsmsg/htsmsg_json.h"
 #include "media.h"
 
@@ -185,6 +186,16 @@ backend_imageloader(rstr_t *url0, const image_meta_t *im0,
     return NULL;
   }
 
+  const int use_pixmap_cache = !im0->im_no_decoding &&
+    cache_control != BYPASS_CACHE && cache_control != DISABLE_CACHE;
+
+  if(use_pixmap_cache) {
+    // Stale entries are only useful if the caller will refresh them
+    pixmap_t *pm = pixmap_cache_get(url, im0, vpaths, cache_control);
+    if(pm != NULL)
+      return pm;
+  }
+
   image_meta_t im = *im0;
 
   if(!strncmp(url, "thumb://", 8)) {
@@ -277,6 +288,11 @@ backend_imageloader(rstr_t *url0, const image_meta_t *im0,
       if(pm != NULL && pm->pm_type == PIXMAP_VECTOR)
         pm = pixmap_rasterize_ft(pm);
 
+      // Backends that resolve to another image (tmdb) may hand us a
+      // pixmap that is shared with the cache, don't draw on that one
+      if(pm != NULL && (im.im_shadow || im.im_corner_radius))
+        pm = pixmap_make_writable(pm);
+
       if(pm != NULL && im.im_shadow)
         pixmap_drop_shadow(pm, im.im_shadow, im.im_shadow);
 
@@ -284,8 +300,13 @@ backend_imageloader(rstr_t *url0, const image_meta_t *im0,
 	pm = pixmap_rounded_corners(pm, im.im_corner_radius,
 				    im.im_corner_selection);
 
-      if(pm != NULL)
+      if(pm != NULL && pm->pm_original_type != original_type)
         pm->pm_original_type = original_type;
+
+      // Don't cache data we've been told is stale, it will be refreshed
+      if(pm != NULL && cache_control != DISABLE_CACHE &&
+         !(ONLY_CACHED(cache_control) && *cache_control))
+        pixmap_cache_put(rstr_get(url0), im0, vpaths, pm, url);
     }
   }
   if(m)
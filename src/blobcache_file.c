@@ -16,6 +16,23 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/**
+ * Items are appended to segment files (bc3/seg-XXXXXXXX.dat) by the
+ * flush thread. An index of all items (key, segment, offset, ...) is
+ * kept in memory and periodically written to bc3/index.dat.
+ *
+ * Segments with a lot of dead space (replaced or evicted items) are
+ * compacted by copying the remaining live records to the current
+ * segment and then removing the old file. Dead space counts against
+ * the size budget: live items are pruned down to 3/4 of it, and once
+ * dead space exceeds the last quarter the segment with the most dead
+ * space is compacted.
+ *
+ * The in-memory index is split into lock stripes so loaders running
+ * in parallel don't contend on a single lock. cache_lock protects the
+ * flush queue and the segment list. Lock order is stripe -> cache_lock.
+ */
+
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -27,63 +44,99 @@
 #include <dirent.h>
 #include <limits.h>
 #include <errno.h>
+#include <zlib.h>
 
 #include "showtime.h"
 #include "blobcache.h"
 #include "misc/pool.h"
 #include "misc/callout.h"
 #include "misc/sha.h"
-#include "misc/md5.h"
 #include "arch/arch.h"
 #include "arch/threads.h"
 #include "arch/atomic.h"
 #include "settings.h"
 #include "notifications.h"
 
-#define BC2_MAGIC_current 0x62630206
-#define BC2_MAGIC_05      0x62630205
+#define BC3_MAGIC_INDEX   0x62630301
+#define BC3_MAGIC_RECORD  0x62637264
 
 typedef struct blobcache_item {
   struct blobcache_item *bi_link;
   char *bi_etag;
+  buf_t *bi_buf;            // Not yet written to a segment if != NULL
   uint64_t bi_key_hash;
-  uint64_t bi_content_hash;
+  uint32_t bi_content_hash;
   uint32_t bi_lastaccess;
   uint32_t bi_expiry;
   uint32_t bi_modtime;
   uint32_t bi_size;
+  uint32_t bi_segment;
+  uint32_t bi_offset;
   uint8_t bi_content_type_len;
 } blobcache_item_t;
 
 typedef struct blobcache_diskitem {
   uint64_t di_key_hash;
-  uint64_t di_content_hash;
+  uint32_t di_content_hash;
   uint32_t di_lastaccess;
   uint32_t di_expiry;
   uint32_t di_modtime;
   uint32_t di_size;
+  uint32_t di_segment;
+  uint32_t di_offset;
   uint8_t di_etaglen;
   uint8_t di_content_type_len;
   uint8_t di_etag[0];
 } __attribute__((packed)) blobcache_diskitem_t;
 
 
+/**
+ * Header in front of each item in a segment file, followed by
+ * content type and payload
+ */
+typedef struct blobcache_record {
+  uint32_t br_magic;
+  uint32_t br_size;
+  uint64_t br_key_hash;
+  uint32_t br_content_hash;
+  uint8_t br_content_type_len;
+} __attribute__((packed)) blobcache_record_t;
+
+#define RECORD_SIZE(size, ctlen) \
+  (sizeof(blobcache_record_t) + (ctlen) + (size))
+
+
 TAILQ_HEAD(blobcache_flush_queue, blobcache_flush);
 
 typedef struct blobcache_flush {
   TAILQ_ENTRY(blobcache_flush) bf_link;
   uint64_t bf_key_hash;
-  buf_t *bf_buf;
 } blobcache_flush_t;
 
 
+LIST_HEAD(blobcache_segment_list, blobcache_segment);
+
+typedef struct blobcache_segment {
+  LIST_ENTRY(blobcache_segment) bs_link;
+  uint32_t bs_id;
+  uint32_t bs_size;  // Bytes in file
+  uint32_t bs_live;  // Bytes referenced by items
+} blobcache_segment_t;
+
 
-#define ITEM_HASH_SIZE 256
+#define ITEM_HASH_SIZE 4096
 #define ITEM_HASH_MASK (ITEM_HASH_SIZE - 1)
 
+#define ITEM_LOCKS     16
+#define ITEM_LOCK_MASK (ITEM_LOCKS - 1)
+
 static blobcache_item_t *hashvector[ITEM_HASH_SIZE];
+static hts_mutex_t item_locks[ITEM_LOCKS];
+
+#define item_lock(dk) (&item_locks[(dk) & ITEM_LOCK_MASK])
 
 static struct blobcache_flush_queue flush_queue;
+static struct blobcache_segment_list segments;
 
 static pool_t *item_pool;
 static hts_mutex_t cache_lock;
@@ -92,19 +145,61 @@ static hts_thread_t bcthread;
 static int bcrun = 1;
 static int index_dirty;
 
+/**
+ * Current segment, only accessed by the flush thread
+ */
+static int cur_fd = -1;
+static blobcache_segment_t *cur_segment;
+static uint32_t next_segment_id;
+
 #define BLOB_CACHE_MINSIZE  (10 * 1000 * 1000)
 #define BLOB_CACHE_MAXSIZE (500 * 1000 * 1000)
 
+#define SEGMENT_MAXSIZE    (16 * 1024 * 1024)
+
+// Part of the size budget that may be dead space (1 / n)
+#define BLOB_CACHE_DEAD_SHARE 4
+
 static uint64_t current_cache_size;
 
 
 /**
+ * Bytes in segment files, both live and dead
  *
+ * Assume cache_lock is held
+ */
+static uint64_t
+segments_size(void)
+{
+  blobcache_segment_t *bs;
+  uint64_t r = 0;
+  LIST_FOREACH(bs, &segments, bs_link)
+    r += bs->bs_size;
+  return r;
+}
+
+
+/**
+ * Assume cache_lock is held
+ */
+static uint64_t
+segments_dead(void)
+{
+  blobcache_segment_t *bs;
+  uint64_t r = 0;
+  LIST_FOREACH(bs, &segments, bs_link)
+    r += bs->bs_size - bs->bs_live;
+  return r;
+}
+
+
+/**
+ * Assume cache_lock is held
  */
 static uint64_t
 blobcache_compute_maxsize(void)
 {
-  uint64_t avail = arch_cache_avail_bytes() + current_cache_size;
+  uint64_t avail = arch_cache_avail_bytes() + segments_size();
   avail = MAX(BLOB_CACHE_MINSIZE, MIN(avail / 10, BLOB_CACHE_MAXSIZE));
   return avail;
 }
@@ -130,124 +225,494 @@ digest_key(const char *key, const char *stash)
 
 
 /**
- *
+ * Used to detect if content changed on put and to catch corrupt or
+ * torn records on get, so crc32 is enough
  */
-static uint64_t
+static uint32_t
 digest_content(const void *data, size_t len)
 {
-  union {
-    uint8_t d[16];
-    uint64_t u64;
-  } u;
-  md5_decl(ctx);
-  md5_init(ctx);
-  md5_update(ctx, data, len);
-  md5_final(ctx, u.d);
-  return u.u64;
+  return crc32(0, data, len);
+}
+
+
+/**
+ *
+ */
+static void
+make_segment_filename(char *buf, size_t len, uint32_t id)
+{
+  snprintf(buf, len, "%s/bc3/seg-%08x.dat", gconf.cache_path, id);
+}
+
+
+/**
+ *
+ */
+static void
+lock_all(void)
+{
+  for(int i = 0; i < ITEM_LOCKS; i++)
+    hts_mutex_lock(&item_locks[i]);
+  hts_mutex_lock(&cache_lock);
+}
+
+
+/**
+ *
+ */
+static void
+unlock_all(void)
+{
+  hts_mutex_unlock(&cache_lock);
+  for(int i = ITEM_LOCKS - 1; i >= 0; i--)
+    hts_mutex_unlock(&item_locks[i]);
+}
+
+
+/**
+ * Assume stripe is locked
+ */
+static blobcache_item_t *
+lookup_item(uint64_t dk)
+{
+  blobcache_item_t *p;
+  for(p = hashvector[dk & ITEM_HASH_MASK]; p != NULL; p = p->bi_link)
+    if(p->bi_key_hash == dk)
+      return p;
+  return NULL;
 }
 
 
 /**
+ * Assume cache_lock is held
+ */
+static blobcache_segment_t *
+segment_find(uint32_t id)
+{
+  blobcache_segment_t *bs;
+  LIST_FOREACH(bs, &segments, bs_link)
+    if(bs->bs_id == id)
+      return bs;
+  return NULL;
+}
+
+
+/**
+ * Assume cache_lock is held
+ */
+static void
+segment_destroy(blobcache_segment_t *bs)
+{
+  char filename[PATH_MAX];
+  make_segment_filename(filename, sizeof(filename), bs->bs_id);
+  unlink(filename);
+  LIST_REMOVE(bs, bs_link);
+  free(bs);
+}
+
+
+/**
+ * Release the on-disk space held by an item
  *
+ * Assume cache_lock is held
  */
 static void
-make_filename(char *buf, size_t len, uint64_t hash, int for_write)
+item_release_space(blobcache_item_t *p)
 {
-  uint8_t dir = hash;
-  if(for_write) {
-    snprintf(buf, len, "%s/bc2/%02x", gconf.cache_path, dir);
-    mkdir(buf, 0777);
+  blobcache_segment_t *bs;
+
+  if(p->bi_buf != NULL) {
+    buf_release(p->bi_buf);
+    p->bi_buf = NULL;
+    return;
   }
-  snprintf(buf, len, "%s/bc2/%02x/%016"PRIx64, gconf.cache_path, dir, hash);
+
+  if((bs = segment_find(p->bi_segment)) != NULL)
+    bs->bs_live -= RECORD_SIZE(p->bi_size, p->bi_content_type_len);
 }
 
 
 /**
+ * Assume stripe and cache_lock is held
+ */
+static void
+item_destroy(blobcache_item_t *p)
+{
+  item_release_space(p);
+  current_cache_size -= p->bi_size;
+  free(p->bi_etag);
+  pool_put(item_pool, p);
+}
+
+
+/**
+ * Remove from hash and destroy
  *
+ * Assume stripe is locked
  */
 static void
-save_index(void)
+item_unlink(blobcache_item_t *p)
+{
+  blobcache_item_t **q;
+  for(q = &hashvector[p->bi_key_hash & ITEM_HASH_MASK]; *q != p;
+      q = &(*q)->bi_link) {}
+  *q = p->bi_link;
+
+  hts_mutex_lock(&cache_lock);
+  item_destroy(p);
+  index_dirty = 1;
+  hts_mutex_unlock(&cache_lock);
+}
+
+
+/**
+ * Append a record to the current segment
+ *
+ * Only called from the flush thread
+ */
+static int
+segment_append(const void *data, size_t len,
+               uint32_t *segmentp, uint32_t *offsetp)
 {
   char filename[PATH_MAX];
-  uint8_t *out, *base;
-  int i;
+
+  if(cur_fd != -1 && cur_segment->bs_size + len > SEGMENT_MAXSIZE) {
+    close(cur_fd);
+    cur_fd = -1;
+  }
+
+  if(cur_fd == -1) {
+    blobcache_segment_t *bs = calloc(1, sizeof(blobcache_segment_t));
+    hts_mutex_lock(&cache_lock);
+    bs->bs_id = next_segment_id++;
+    LIST_INSERT_HEAD(&segments, bs, bs_link);
+    cur_segment = bs;
+    hts_mutex_unlock(&cache_lock);
+
+    make_segment_filename(filename, sizeof(filename), bs->bs_id);
+    cur_fd = open(filename, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+    if(cur_fd == -1) {
+      TRACE(TRACE_INFO, "blobcache", "Unable to create segment %s -- %s",
+            filename, strerror(errno));
+      return -1;
+    }
+  }
+
+  uint32_t offset = cur_segment->bs_size;
+
+  if(pwrite(cur_fd, data, len, offset) != len) {
+    TRACE(TRACE_INFO, "blobcache", "Unable to write to segment %08x -- %s",
+          cur_segment->bs_id, strerror(errno));
+    close(cur_fd);
+    cur_fd = -1;
+    return -1;
+  }
+
+  hts_mutex_lock(&cache_lock);
+  cur_segment->bs_size += len;
+  hts_mutex_unlock(&cache_lock);
+
+  *segmentp = cur_segment->bs_id;
+  *offsetp = offset;
+  return 0;
+}
+
+
+/**
+ * Write a pending item to the current segment
+ */
+static void
+flush_item(uint64_t dk)
+{
+  hts_mutex_t *l = item_lock(dk);
   blobcache_item_t *p;
-  blobcache_diskitem_t *di;
-  size_t siz;
+  uint32_t segment, offset;
 
-  if(!index_dirty)
+  hts_mutex_lock(l);
+  p = lookup_item(dk);
+  if(p == NULL || p->bi_buf == NULL) {
+    // Removed or already flushed by an earlier entry in the queue
+    hts_mutex_unlock(l);
     return;
+  }
 
-  snprintf(filename, sizeof(filename), "%s/bc2/index.dat", gconf.cache_path);
-  
-  int fd = open(filename, O_CREAT | O_WRONLY | O_TRUNC, 0666);
-  if(fd == -1)
-    return;
-  
-  int items = 0;
-  siz = 12 + 20;
+  buf_t *b = buf_retain(p->bi_buf);
+  const int ctlen = p->bi_content_type_len;
+  const size_t reclen = RECORD_SIZE(b->b_size, ctlen);
+  uint8_t *rec = malloc(reclen);
+  blobcache_record_t *br = (blobcache_record_t *)rec;
+
+  br->br_magic = BC3_MAGIC_RECORD;
+  br->br_size = b->b_size;
+  br->br_key_hash = dk;
+  br->br_content_hash = p->bi_content_hash;
+  br->br_content_type_len = ctlen;
+  hts_mutex_unlock(l);
+
+  if(ctlen)
+    memcpy(rec + sizeof(blobcache_record_t),
+           rstr_get(b->b_content_type), ctlen);
+  memcpy(rec + sizeof(blobcache_record_t) + ctlen, b->b_ptr, b->b_size);
+
+  int err = segment_append(rec, reclen, &segment, &offset);
+  free(rec);
+
+  hts_mutex_lock(l);
+  p = lookup_item(dk);
+  if(p != NULL && p->bi_buf == b) {
+    if(err) {
+      item_unlink(p);
+    } else {
+      hts_mutex_lock(&cache_lock);
+      buf_release(p->bi_buf);
+      p->bi_buf = NULL;
+      p->bi_segment = segment;
+      p->bi_offset = offset;
+      blobcache_segment_t *bs = segment_find(segment);
+      if(bs != NULL)
+        bs->bs_live += reclen;
+      index_dirty = 1;
+      hts_mutex_unlock(&cache_lock);
+    }
+  }
+  hts_mutex_unlock(l);
+  buf_release(b);
+}
 
-  for(i = 0; i < ITEM_HASH_SIZE; i++) {
-    for(p = hashvector[i]; p != NULL; p = p->bi_link) {
-      siz += sizeof(blobcache_diskitem_t);
-      siz += p->bi_etag ? strlen(p->bi_etag) : 0;
-      items++;
+
+/**
+ * Move all live records from the given segment to the current one
+ * and remove it
+ *
+ * Only called from the flush thread
+ */
+static void
+compact_segment(uint32_t id)
+{
+  char filename[PATH_MAX];
+  blobcache_record_t br;
+  uint32_t off = 0, segment, offset;
+  int moved = 0;
+
+  make_segment_filename(filename, sizeof(filename), id);
+  int fd = open(filename, O_RDONLY, 0);
+
+  while(fd != -1) {
+    if(pread(fd, &br, sizeof(br), off) != sizeof(br) ||
+       br.br_magic != BC3_MAGIC_RECORD)
+      break;
+
+    const uint64_t dk = br.br_key_hash;
+    const size_t reclen = RECORD_SIZE(br.br_size, br.br_content_type_len);
+    hts_mutex_t *l = item_lock(dk);
+    blobcache_item_t *p;
+
+    hts_mutex_lock(l);
+    p = lookup_item(dk);
+    int live = p != NULL && p->bi_buf == NULL &&
+      p->bi_segment == id && p->bi_offset == off;
+    hts_mutex_unlock(l);
+
+    if(live) {
+      uint8_t *rec = malloc(reclen);
+      if(pread(fd, rec, reclen, off) != reclen ||
+         segment_append(rec, reclen, &segment, &offset)) {
+        free(rec);
+        break;
+      }
+      free(rec);
+
+      hts_mutex_lock(l);
+      p = lookup_item(dk);
+      if(p != NULL && p->bi_buf == NULL &&
+         p->bi_segment == id && p->bi_offset == off) {
+        hts_mutex_lock(&cache_lock);
+        item_release_space(p);
+        p->bi_segment = segment;
+        p->bi_offset = offset;
+        blobcache_segment_t *bs = segment_find(segment);
+        if(bs != NULL)
+          bs->bs_live += reclen;
+        index_dirty = 1;
+        hts_mutex_unlock(&cache_lock);
+        moved++;
+      }
+      hts_mutex_unlock(l);
     }
+    off += reclen;
   }
 
-  base = out = mymalloc(siz);
-  if(out == NULL) {
+  if(fd != -1)
     close(fd);
+
+  /**
+   * Items still referring to the segment at this point (if we failed
+   * to read or move them) are dropped on access or at next startup
+   */
+  hts_mutex_lock(&cache_lock);
+  blobcache_segment_t *bs = segment_find(id);
+  if(bs != NULL)
+    segment_destroy(bs);
+  hts_mutex_unlock(&cache_lock);
+
+  TRACE(TRACE_DEBUG, "blobcache", "Compacted segment %08x, %d items moved",
+        id, moved);
+}
+
+
+/**
+ * Compact one segment if it's mostly dead space, or the one with the
+ * most dead space if there is more of it than the budget allows
+ *
+ * Returns 1 if something was done
+ *
+ * Only called from the flush thread
+ */
+static int
+compact(void)
+{
+  blobcache_segment_t *bs, *victim = NULL;
+  uint32_t id = 0;
+  int found = 0;
+
+  hts_mutex_lock(&cache_lock);
+  const uint64_t maxdead =
+    blobcache_compute_maxsize() / BLOB_CACHE_DEAD_SHARE;
+  const int over = segments_dead() > maxdead;
+
+  LIST_FOREACH(bs, &segments, bs_link) {
+    if(bs == cur_segment)
+      continue;
+    if(bs->bs_live == 0) {
+      segment_destroy(bs);
+      hts_mutex_unlock(&cache_lock);
+      return 1;
+    }
+    if(victim == NULL ||
+       bs->bs_size - bs->bs_live > victim->bs_size - victim->bs_live)
+      victim = bs;
+  }
+
+  if(victim != NULL &&
+     (victim->bs_live < victim->bs_size / 2 ||
+      (over && victim->bs_live < victim->bs_size))) {
+    id = victim->bs_id;
+    found = 1;
+  }
+  hts_mutex_unlock(&cache_lock);
+
+  if(found)
+    compact_segment(id);
+  return found;
+}
+
+
+/**
+ *
+ */
+static void
+save_index(void)
+{
+  char filename[PATH_MAX];
+  uint8_t *out;
+  int i;
+  blobcache_item_t *p;
+  blobcache_diskitem_t *di;
+  size_t siz, cap;
+  int items = 0;
+
+  hts_mutex_lock(&cache_lock);
+  if(!index_dirty) {
+    hts_mutex_unlock(&cache_lock);
     return;
   }
-  *(uint32_t *)out = BC2_MAGIC_current;
-  out += 4;
-  *(uint32_t *)out = items;
-  out += 4;
-  *(uint32_t *)out = time(NULL);
-  out += 4;
+  index_dirty = 0;
+  hts_mutex_unlock(&cache_lock);
+
+  snprintf(filename, sizeof(filename), "%s/bc3/index.dat", gconf.cache_path);
+
+  cap = 65536;
+  out = mymalloc(cap);
+  if(out == NULL)
+    goto fail;
+  siz = 12;
+
   for(i = 0; i < ITEM_HASH_SIZE; i++) {
+    hts_mutex_t *l = &item_locks[i & ITEM_LOCK_MASK];
+    hts_mutex_lock(l);
+
     for(p = hashvector[i]; p != NULL; p = p->bi_link) {
+      if(p->bi_buf != NULL)
+        continue; // Not on disk yet, will be written with next save
+
       const int etaglen = p->bi_etag ? strlen(p->bi_etag) : 0;
-      di = (blobcache_diskitem_t *)out;
+
+      if(siz + sizeof(blobcache_diskitem_t) + etaglen + 20 > cap) {
+        cap *= 2;
+        uint8_t *n = realloc(out, cap);
+        if(n == NULL) {
+          hts_mutex_unlock(l);
+          free(out);
+          goto fail;
+        }
+        out = n;
+      }
+
+      di = (blobcache_diskitem_t *)(out + siz);
       di->di_key_hash     = p->bi_key_hash;
       di->di_content_hash = p->bi_content_hash;
       di->di_lastaccess   = p->bi_lastaccess;
       di->di_expiry       = p->bi_expiry;
       di->di_modtime      = p->bi_modtime;
       di->di_size         = p->bi_size;
+      di->di_segment      = p->bi_segment;
+      di->di_offset       = p->bi_offset;
       di->di_etaglen      = etaglen;
       di->di_content_type_len = p->bi_content_type_len;
-      out += sizeof(blobcache_diskitem_t);
+      siz += sizeof(blobcache_diskitem_t);
       if(etaglen) {
-	memcpy(out, p->bi_etag, etaglen);
-	out += etaglen;
+	memcpy(out + siz, p->bi_etag, etaglen);
+	siz += etaglen;
       }
-
+      items++;
     }
+    hts_mutex_unlock(l);
   }
 
+  *(uint32_t *)(out + 0) = BC3_MAGIC_INDEX;
+  *(uint32_t *)(out + 4) = items;
+  *(uint32_t *)(out + 8) = time(NULL);
+
   sha1_decl(shactx);
   sha1_init(shactx);
-  sha1_update(shactx, base, siz - 20);
-  sha1_final(shactx, out);
+  sha1_update(shactx, out, siz);
+  sha1_final(shactx, out + siz);
+  siz += 20;
 
-  if(write(fd, base, siz) != siz) {
+  int fd = open(filename, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+  if(fd == -1 || write(fd, out, siz) != siz) {
     TRACE(TRACE_INFO, "blobcache", "Unable to store index file %s -- %s",
 	  filename, strerror(errno));
-  } else {
-    index_dirty = 0;
+    if(fd != -1)
+      close(fd);
+    free(out);
+    goto fail;
   }
 
-  free(base);
+  free(out);
   close(fd);
+  return;
 
+ fail:
+  hts_mutex_lock(&cache_lock);
+  index_dirty = 1;
+  hts_mutex_unlock(&cache_lock);
 }
 
 
 
 /**
- *
+ * Called during init, no locking needed
  */
 static void
 load_index(void)
@@ -261,13 +726,13 @@ load_index(void)
   struct stat st;
   uint8_t digest[20];
 
-  snprintf(filename, sizeof(filename), "%s/bc2/index.dat", gconf.cache_path);
-  
+  snprintf(filename, sizeof(filename), "%s/bc3/index.dat", gconf.cache_path);
+
   int fd = open(filename, O_RDONLY, 0);
   if(fd == -1)
     return;
 
-  if(fstat(fd, &st) || st.st_size <= 20) {
+  if(fstat(fd, &st) || st.st_size <= 32) {
     close(fd);
     return;
   }
@@ -302,28 +767,19 @@ load_index(void)
   int items = *(uint32_t *)in;
   in += 4;
 
-  switch(magic) {
-  case BC2_MAGIC_current: {
-    if(*(uint32_t *)in > time(NULL)) {
-      TRACE(TRACE_INFO, "blobcache",
-	    "Clock going backwards, throwing away cache");
-      free(base);
-      return;
-    }
-    in += 4;
-    break;
-  }
-
-  case BC2_MAGIC_05:
-    TRACE(TRACE_INFO, "blobcache", "Upgrading from older format 0x%08x", magic);
-    break;
-
-  default:
+  if(magic != BC3_MAGIC_INDEX) {
     TRACE(TRACE_INFO, "blobcache", "Invalid magic 0x%08x", magic);
     free(base);
     return;
   }
 
+  if(*(uint32_t *)in > time(NULL)) {
+    TRACE(TRACE_INFO, "blobcache",
+          "Clock going backwards, throwing away cache");
+    free(base);
+    return;
+  }
+  in += 4;
 
   for(i = 0; i < items; i++) {
     di = (blobcache_diskitem_t *)in;
@@ -335,7 +791,10 @@ load_index(void)
     p->bi_expiry       = di->di_expiry;
     p->bi_modtime      = di->di_modtime;
     p->bi_size         = di->di_size;
+    p->bi_segment      = di->di_segment;
+    p->bi_offset       = di->di_offset;
     p->bi_content_type_len = di->di_content_type_len;
+    p->bi_buf          = NULL;
     int etaglen        = di->di_etaglen;
 
     in += sizeof(blobcache_diskitem_t);
@@ -355,6 +814,71 @@ load_index(void)
 }
 
 
+/**
+ * Find segment files on disk, account live bytes and drop items
+ * pointing to segments that have gone missing
+ *
+ * Called during init, no locking needed
+ */
+static void
+load_segments(void)
+{
+  char path[PATH_MAX];
+  struct dirent *de;
+  struct stat st;
+  uint32_t id;
+  DIR *d;
+  blobcache_item_t *p, **q;
+  blobcache_segment_t *bs, *n;
+
+  snprintf(path, sizeof(path), "%s/bc3", gconf.cache_path);
+
+  if((d = opendir(path)) != NULL) {
+    while((de = readdir(d)) != NULL) {
+      if(sscanf(de->d_name, "seg-%08x.dat", &id) != 1)
+        continue;
+
+      snprintf(path, sizeof(path), "%s/bc3/%s", gconf.cache_path, de->d_name);
+      if(stat(path, &st))
+        continue;
+
+      bs = calloc(1, sizeof(blobcache_segment_t));
+      bs->bs_id = id;
+      bs->bs_size = st.st_size;
+      LIST_INSERT_HEAD(&segments, bs, bs_link);
+      next_segment_id = MAX(next_segment_id, id + 1);
+    }
+    closedir(d);
+  }
+
+  for(int i = 0; i < ITEM_HASH_SIZE; i++) {
+    for(q = &hashvector[i]; (p = *q) != NULL; ) {
+      const size_t reclen = RECORD_SIZE(p->bi_size, p->bi_content_type_len);
+      bs = segment_find(p->bi_segment);
+      if(bs == NULL || (uint64_t)p->bi_offset + reclen > bs->bs_size) {
+        *q = p->bi_link;
+        current_cache_size -= p->bi_size;
+        free(p->bi_etag);
+        pool_put(item_pool, p);
+        index_dirty = 1;
+        continue;
+      }
+      bs->bs_live += reclen;
+      q = &p->bi_link;
+    }
+  }
+
+  for(bs = LIST_FIRST(&segments); bs != NULL; bs = n) {
+    n = LIST_NEXT(bs, bs_link);
+    if(bs->bs_live == 0) {
+      TRACE(TRACE_DEBUG, "blobcache", "Removed stale segment %08x",
+            bs->bs_id);
+      segment_destroy(bs);
+    }
+  }
+}
+
+
 
 /**
  *
@@ -364,41 +888,38 @@ blobcache_put(const char *key, const char *stash, buf_t *b,
               int maxage, const char *etag, time_t mtime)
 {
   uint64_t dk = digest_key(key, stash);
-  uint64_t dc = digest_content(b->b_ptr, b->b_size);
+  uint32_t dc = digest_content(b->b_ptr, b->b_size);
   uint32_t now = time(NULL);
+  hts_mutex_t *l = item_lock(dk);
   blobcache_item_t *p;
 
   if(etag != NULL && strlen(etag) > 255)
     etag = NULL;
 
-  hts_mutex_lock(&cache_lock);
+  hts_mutex_lock(l);
   if(!bcrun) {
-    hts_mutex_unlock(&cache_lock);
+    hts_mutex_unlock(l);
     return 0;
   }
 
-  for(p = hashvector[dk & ITEM_HASH_MASK]; p != NULL; p = p->bi_link)
-    if(p->bi_key_hash == dk)
-      break;
+  p = lookup_item(dk);
+  const int existing = p != NULL;
 
-  hts_cond_signal(&cache_cond);
-  index_dirty = 1;
+  int64_t expiry = (int64_t)maxage + now;
 
   if(p != NULL && p->bi_content_hash == dc && p->bi_size == b->b_size) {
     p->bi_modtime = mtime;
-    p->bi_expiry = now + maxage;
+    p->bi_expiry = MIN(INT32_MAX, expiry);
     p->bi_lastaccess = now;
     mystrset(&p->bi_etag, etag);
+    hts_mutex_lock(&cache_lock);
+    index_dirty = 1;
+    hts_cond_signal(&cache_cond);
     hts_mutex_unlock(&cache_lock);
+    hts_mutex_unlock(l);
     return 1;
   }
 
-  blobcache_flush_t *bf = pool_get(item_pool);
-  bf->bf_key_hash = dk;
-  bf->bf_buf = buf_retain(b);
-  TAILQ_INSERT_TAIL(&flush_queue, bf, bf_link);
-  hts_cond_signal(&cache_cond);
-
   if(p == NULL) {
     p = pool_get(item_pool);
     p->bi_key_hash = dk;
@@ -406,22 +927,37 @@ blobcache_put(const char *key, const char *stash, buf_t *b,
     p->bi_content_type_len = 0;
     p->bi_link = hashvector[dk & ITEM_HASH_MASK];
     p->bi_etag = NULL;
+    p->bi_buf = NULL;
+    p->bi_segment = 0;
+    p->bi_offset = 0;
     hashvector[dk & ITEM_HASH_MASK] = p;
   }
 
-  int64_t expiry = (int64_t)maxage + now;
-
   p->bi_modtime = mtime;
   mystrset(&p->bi_etag, etag);
   p->bi_expiry = MIN(INT32_MAX, expiry);
   p->bi_lastaccess = now;
   p->bi_content_hash = dc;
+
+  blobcache_flush_t *bf = pool_get(item_pool);
+  bf->bf_key_hash = dk;
+
+  hts_mutex_lock(&cache_lock);
+  if(existing)
+    item_release_space(p);
   current_cache_size -= p->bi_size;
   p->bi_size = b->b_size;
   current_cache_size += p->bi_size;
+  p->bi_buf = buf_retain(b);
   p->bi_content_type_len = b->b_content_type ?
-    strlen(rstr_get(b->b_content_type)) : 0;
+    MIN(255, strlen(rstr_get(b->b_content_type))) : 0;
+
+  TAILQ_INSERT_TAIL(&flush_queue, bf, bf_link);
+  index_dirty = 1;
+  hts_cond_signal(&cache_cond);
   hts_mutex_unlock(&cache_lock);
+
+  hts_mutex_unlock(l);
   return 0;
 }
 
@@ -434,23 +970,19 @@ blobcache_get(const char *key, const char *stash, int pad,
 	      int *ignore_expiry, char **etagp, time_t *mtimep)
 {
   uint64_t dk = digest_key(key, stash);
-  blobcache_item_t *p, **q;
+  hts_mutex_t *l = item_lock(dk);
+  blobcache_item_t *p;
   char filename[PATH_MAX];
-  struct stat st;
-  uint32_t now;
+  blobcache_record_t br;
+  uint32_t now, segment, offset, pos, size, hash;
+  int ctlen;
 
-  hts_mutex_lock(&cache_lock);
+  hts_mutex_lock(l);
 
-  if(!bcrun) {
-    p = NULL;
-  } else {
-    for(q = &hashvector[dk & ITEM_HASH_MASK]; (p = *q); q = &p->bi_link)
-      if(p->bi_key_hash == dk)
-	break;
-  }
+  p = bcrun ? lookup_item(dk) : NULL;
 
   if(p == NULL) {
-    hts_mutex_unlock(&cache_lock);
+    hts_mutex_unlock(l);
     return NULL;
   }
 
@@ -458,39 +990,14 @@ blobcache_get(const char *key, const char *stash, int pad,
 
   int expired = now > p->bi_expiry;
 
-  if(expired && ignore_expiry == NULL)
-    goto bad;
-
-  blobcache_flush_t *bf;
-  buf_t *b = NULL;
-  int fd = -1;
-  TAILQ_FOREACH_REVERSE(bf, &flush_queue, blobcache_flush_queue, bf_link) {
-    if(bf->bf_key_hash == p->bi_key_hash) {
-      // Item is not yet written to disk
-      b = buf_retain(bf->bf_buf);
-      break;
-    }
+  if(expired && ignore_expiry == NULL) {
+    item_unlink(p);
+    hts_mutex_unlock(l);
+    return NULL;
   }
 
-  if(b == NULL) {
-    make_filename(filename, sizeof(filename), p->bi_key_hash, 0);
-    fd = open(filename, O_RDONLY, 0);
-    if(fd == -1) {
-    bad:
-      *q = p->bi_link;
-      pool_put(item_pool, p);
-      hts_mutex_unlock(&cache_lock);
-      return NULL;
-    }
-
-    if(fstat(fd, &st))
-      goto bad;
-
-    if(st.st_size != p->bi_size + p->bi_content_type_len) {
-      unlink(filename);
-      goto bad;
-    }
-  }
+  // Item is not yet written to disk
+  buf_t *b = p->bi_buf ? buf_retain(p->bi_buf) : NULL;
 
   if(mtimep)
     *mtimep = p->bi_modtime;
@@ -499,40 +1006,81 @@ blobcache_get(const char *key, const char *stash, int pad,
     *etagp = p->bi_etag ? strdup(p->bi_etag) : NULL;
 
   p->bi_lastaccess = now;
-  index_dirty = 1; // We don't deem it important enough to wakeup on get
 
   if(ignore_expiry != NULL)
     *ignore_expiry = expired;
 
-  hts_mutex_unlock(&cache_lock);
+  segment = p->bi_segment;
+  offset  = p->bi_offset;
+  size    = p->bi_size;
+  hash    = p->bi_content_hash;
+  ctlen   = p->bi_content_type_len;
+  hts_mutex_unlock(l);
 
-  if(b == NULL) {
+  if(b != NULL)
+    return b;
 
-    b = buf_create(p->bi_size + pad);
-    if(b == NULL) {
-      close(fd);
-      return NULL;
-    }
+  make_segment_filename(filename, sizeof(filename), segment);
+  int fd = open(filename, O_RDONLY, 0);
+  if(fd == -1)
+    goto bad;
 
-    if(p->bi_content_type_len) {
-      b->b_content_type = rstr_allocl(NULL, p->bi_content_type_len);
-      if(read(fd, rstr_data(b->b_content_type), p->bi_content_type_len) !=
-	 p->bi_content_type_len) {
-	buf_release(b);
-	close(fd);
-	return NULL;
-      }
-    }
+  if(pread(fd, &br, sizeof(br), offset) != sizeof(br) ||
+     br.br_magic != BC3_MAGIC_RECORD || br.br_key_hash != dk ||
+     br.br_size != size || br.br_content_type_len != ctlen ||
+     br.br_content_hash != hash) {
+    close(fd);
+    goto bad;
+  }
+
+  pos = offset + sizeof(br);
 
-    if(read(fd, b->b_ptr, p->bi_size) != p->bi_size) {
+  b = buf_create(size + pad);
+  if(b == NULL) {
+    close(fd);
+    goto fail;
+  }
+
+  if(ctlen) {
+    b->b_content_type = rstr_allocl(NULL, ctlen);
+    if(pread(fd, rstr_data(b->b_content_type), ctlen, pos) != ctlen) {
       buf_release(b);
       close(fd);
-      return NULL;
+      goto bad;
     }
-    memset(b->b_ptr + p->bi_size, 0, pad);
+    pos += ctlen;
+  }
+
+  if(pread(fd, b->b_ptr, size, pos) != size) {
+    buf_release(b);
     close(fd);
+    goto bad;
+  }
+  close(fd);
+
+  if(digest_content(b->b_ptr, size) != hash) {
+    TRACE(TRACE_INFO, "blobcache", "Checksum mismatch in segment %08x, "
+          "dropping item", segment);
+    buf_release(b);
+    goto bad;
   }
+  memset(b->b_ptr + size, 0, pad);
   return b;
+
+ bad:
+  // Drop the item unless it has been moved or replaced while we read
+  hts_mutex_lock(l);
+  p = lookup_item(dk);
+  if(p != NULL && p->bi_buf == NULL &&
+     p->bi_segment == segment && p->bi_offset == offset)
+    item_unlink(p);
+  hts_mutex_unlock(l);
+ fail:
+  if(etagp != NULL) {
+    free(*etagp);
+    *etagp = NULL;
+  }
+  return NULL;
 }
 
 
@@ -543,20 +1091,16 @@ blobcache_get(const char *key, const char *stash, int pad,
  *
  */
 int
-blobcache_get_meta(const char *key, const char *stash, 
-		   char **etagp, time_t *mtimep)
+blobcache_get_meta(const char *key, const char *stash,
+		   char **etagp, time_t *mtimep, time_t *expiryp)
 {
   uint64_t dk = digest_key(key, stash);
+  hts_mutex_t *l = item_lock(dk);
   blobcache_item_t *p;
   int r;
-  hts_mutex_lock(&cache_lock);
-  if(!bcrun) {
-    p = NULL;
-  } else {
-    for(p = hashvector[dk & ITEM_HASH_MASK]; p != NULL; p = p->bi_link)
-      if(p->bi_key_hash == dk)
-	break;
-  }
+
+  hts_mutex_lock(l);
+  p = bcrun ? lookup_item(dk) : NULL;
 
   if(p != NULL) {
     r = 0;
@@ -567,90 +1111,18 @@ blobcache_get_meta(const char *key, const char *stash,
     if(etagp != NULL)
       *etagp = p->bi_etag ? strdup(p->bi_etag) : NULL;
 
+    if(expiryp != NULL)
+      *expiryp = p->bi_expiry;
+
   } else {
     r = -1;
   }
 
-  hts_mutex_unlock(&cache_lock);
+  hts_mutex_unlock(l);
   return r;
 }
 
 
-/**
- * Assume we're locked
- */
-static blobcache_item_t *
-lookup_item(uint64_t dk)
-{
-  blobcache_item_t *p;
-  for(p = hashvector[dk & ITEM_HASH_MASK]; p != NULL; p = p->bi_link)
-    if(p->bi_key_hash == dk)
-      return p;
-  return NULL;
-}
-
-/**
- *
- */
-static void
-prune_stale(void)
-{
-  DIR *d1, *d2;
-  struct dirent *de1, *de2;
-  char path[PATH_MAX];
-  char path2[PATH_MAX];
-  char path3[PATH_MAX];
-  uint64_t k;
-
-  snprintf(path, sizeof(path), "%s/bc2", gconf.cache_path);
-
-  if((d1 = opendir(path)) == NULL)
-    return;
-
-  while((de1 = readdir(d1)) != NULL) {
-    if(de1->d_name[0] != '.') {
-      snprintf(path2, sizeof(path2), "%s/bc2/%s",
-	       gconf.cache_path, de1->d_name);
-
-      if((d2 = opendir(path2)) != NULL) {
-	while((de2 = readdir(d2)) != NULL) {
-          if(de2->d_name[0] != '.') {
-
-	    snprintf(path3, sizeof(path3), "%s/bc2/%s/%s",
-		     gconf.cache_path, de1->d_name,
-		     de2->d_name);
-
-	    if(sscanf(de2->d_name, "%016"PRIx64, &k) != 1 ||
-	       lookup_item(k) == NULL) {
-	      TRACE(TRACE_DEBUG, "Blobcache", "Removed stale file %s", path3);
-	      unlink(path3);
-	    }
-	  }
-	}
-	closedir(d2);
-      }
-      rmdir(path2);
-    }
-  }
-  closedir(d1);
-}  
-
-
-
-
-/**
- *
- */
-static void
-prune_item(blobcache_item_t *p)
-{
-  char filename[PATH_MAX];
-  make_filename(filename, sizeof(filename), p->bi_key_hash, 0);
-  unlink(filename);
-  pool_put(item_pool, p);
-}
-
-
 /**
  *
  */
@@ -664,16 +1136,18 @@ accesstimecmp(const void *A, const void *B)
 
 
 /**
- *
+ * Assume everything is locked
  */
 static void
-prune_to_size(void)
+prune_to_size_locked(void)
 {
   int i, tot = 0, j = 0;
   blobcache_item_t *p, **sv;
 
   uint64_t maxsize = blobcache_compute_maxsize();
 
+  // Leave room for dead space waiting to be compacted
+  maxsize -= maxsize / BLOB_CACHE_DEAD_SHARE;
 
   for(i = 0; i < ITEM_HASH_SIZE; i++)
     for(p = hashvector[i]; p != NULL; p = p->bi_link)
@@ -696,8 +1170,7 @@ prune_to_size(void)
     p = sv[i];
     if(current_cache_size < maxsize)
       break;
-    current_cache_size -= p->bi_size;
-    prune_item(p);
+    item_destroy(p);
     index_dirty = 1;
   }
 
@@ -708,50 +1181,72 @@ prune_to_size(void)
   }
 
   free(sv);
-  save_index();
 }
 
 
-
 /**
  *
  */
 static void
-blobcache_prune_old(void)
+prune_to_size(void)
+{
+  lock_all();
+  prune_to_size_locked();
+  unlock_all();
+  save_index();
+}
+
+
+/**
+ * Remove a two level deep directory tree
+ */
+static void
+rmtree2(const char *path)
 {
   DIR *d1, *d2;
   struct dirent *de1, *de2;
-  char path[PATH_MAX];
   char path2[PATH_MAX];
   char path3[PATH_MAX];
 
-  snprintf(path, sizeof(path), "%s/blobcache", gconf.cache_path);
+  if((d1 = opendir(path)) == NULL)
+    return;
 
-  if((d1 = opendir(path)) != NULL) {
-
-    while((de1 = readdir(d1)) != NULL) {
-      if(de1->d_name[0] != '.') {
-	snprintf(path2, sizeof(path2), "%s/blobcache/%s",
-		 gconf.cache_path, de1->d_name);
-
-	if((d2 = opendir(path2)) != NULL) {
-	  while((de2 = readdir(d2)) != NULL) {
-	    if(de2->d_name[0] != '.') {
-
-	      snprintf(path3, sizeof(path3), "%s/blobcache/%s/%s",
-		       gconf.cache_path, de1->d_name,
-		       de2->d_name);
-	      unlink(path3);
-	    }
-	  }
-	  closedir(d2);
-	}
-	rmdir(path2);
+  while((de1 = readdir(d1)) != NULL) {
+    if(de1->d_name[0] != '.') {
+      snprintf(path2, sizeof(path2), "%s/%s", path, de1->d_name);
+
+      if((d2 = opendir(path2)) != NULL) {
+        while((de2 = readdir(d2)) != NULL) {
+          if(de2->d_name[0] != '.' &&
+             snprintf(path3, sizeof(path3), "%s/%s", path2,
+                      de2->d_name) < sizeof(path3))
+            unlink(path3);
+        }
+        closedir(d2);
+        rmdir(path2);
+      } else {
+        unlink(path2);
       }
     }
-    closedir(d1);
-    rmdir(path);
   }
+  closedir(d1);
+  rmdir(path);
+}
+
+
+/**
+ *
+ */
+static void
+blobcache_prune_old(void)
+{
+  char path[PATH_MAX];
+
+  snprintf(path, sizeof(path), "%s/blobcache", gconf.cache_path);
+  rmtree2(path);
+
+  snprintf(path, sizeof(path), "%s/bc2", gconf.cache_path);
+  rmtree2(path);
 
   snprintf(path, sizeof(path), "%s/cachedb/cache.db", gconf.cache_path);
   unlink(path);
@@ -759,27 +1254,39 @@ blobcache_prune_old(void)
   unlink(path);
   snprintf(path, sizeof(path), "%s/cachedb/cache.db-wal", gconf.cache_path);
   unlink(path);
-}  
+}
 
 static void
 cache_clear(void *opaque, prop_event_t event, ...)
 {
   int i;
   blobcache_item_t *p, *n;
+  blobcache_segment_t *bs, *bsn;
 
-  hts_mutex_lock(&cache_lock);
+  lock_all();
 
   for(i = 0; i < ITEM_HASH_SIZE; i++) {
     for(p = hashvector[i]; p != NULL; p = n) {
       n = p->bi_link;
-      prune_item(p);
-      index_dirty = 1;
+      item_destroy(p);
     }
     hashvector[i] = NULL;
   }
   current_cache_size = 0;
+  index_dirty = 1;
+
+  // The current segment is in use by the flush thread, it will be
+  // removed by compaction once it has been rotated
+  for(bs = LIST_FIRST(&segments); bs != NULL; bs = bsn) {
+    bsn = LIST_NEXT(bs, bs_link);
+    if(bs == cur_segment)
+      bs->bs_live = 0;
+    else
+      segment_destroy(bs);
+  }
+
+  unlock_all();
   save_index();
-  hts_mutex_unlock(&cache_lock);
   notify_add(NULL, NOTIFY_INFO, NULL, 3, _("Cache cleared"));
 }
 
@@ -800,47 +1307,52 @@ flushthread(void *aux)
     if((bf = TAILQ_FIRST(&flush_queue)) == NULL) {
 
       if(index_dirty) {
-        if(hts_cond_wait_timeout(&cache_cond, &cache_lock, 5000))
+        if(hts_cond_wait_timeout(&cache_cond, &cache_lock, 5000)) {
+          hts_mutex_unlock(&cache_lock);
           save_index();
+          compact();
+          hts_mutex_lock(&cache_lock);
+        }
       } else {
         hts_cond_wait(&cache_cond, &cache_lock);
       }
       continue;
     }
 
+    TAILQ_REMOVE(&flush_queue, bf, bf_link);
     hts_mutex_unlock(&cache_lock);
-    char filename[PATH_MAX];
-    make_filename(filename, sizeof(filename), bf->bf_key_hash, 1);
-    buf_t *b = bf->bf_buf;
-
-    int fd = open(filename, O_CREAT | O_WRONLY | O_TRUNC, 0666);
-    if(fd != -1) {
-
-      if(b->b_content_type != NULL) {
-	const char *str = rstr_get(b->b_content_type);
-	size_t len = strlen(str);
-	if(write(fd, str, len) != len)
-	  unlink(filename);
-      }
 
-      if(write(fd, b->b_ptr, b->b_size) != b->b_size)
-        unlink(filename);
+    flush_item(bf->bf_key_hash);
+    pool_put(item_pool, bf);
 
-      if(close(fd))
-        unlink(filename);
-    }
     hts_mutex_lock(&cache_lock);
+    const uint64_t maxsize = blobcache_compute_maxsize();
+    const uint64_t maxdead = maxsize / BLOB_CACHE_DEAD_SHARE;
+
+    if(maxsize - maxdead < current_cache_size) {
+      hts_mutex_unlock(&cache_lock);
+      prune_to_size();
+      hts_mutex_lock(&cache_lock);
+    } else if(segments_dead() > maxdead) {
+      hts_mutex_unlock(&cache_lock);
+      compact();
+      hts_mutex_lock(&cache_lock);
+    }
+  }
 
-    assert(TAILQ_FIRST(&flush_queue) == bf);
+  // Write whatever is left so nothing in the index refers to lost data
+  while((bf = TAILQ_FIRST(&flush_queue)) != NULL) {
     TAILQ_REMOVE(&flush_queue, bf, bf_link);
-    buf_release(bf->bf_buf);
+    hts_mutex_unlock(&cache_lock);
+    flush_item(bf->bf_key_hash);
     pool_put(item_pool, bf);
-
-    if(blobcache_compute_maxsize() < current_cache_size)
-      prune_to_size();
+    hts_mutex_lock(&cache_lock);
   }
-  save_index();
   hts_mutex_unlock(&cache_lock);
+
+  save_index();
+  if(cur_fd != -1)
+    close(cur_fd);
   return NULL;
 }
 
@@ -854,25 +1366,31 @@ void
 blobcache_init(void)
 {
   char buf[256];
+  int64_t ts = showtime_get_ts();
 
   TAILQ_INIT(&flush_queue);
+  LIST_INIT(&segments);
 
   blobcache_prune_old();
-  snprintf(buf, sizeof(buf), "%s/bc2", gconf.cache_path);
+  snprintf(buf, sizeof(buf), "%s/bc3", gconf.cache_path);
   if(mkdir(buf, 0777) && errno != EEXIST)
     TRACE(TRACE_ERROR, "blobcache", "Unable to create cache dir %s -- %s",
 	  buf, strerror(errno));
 
   hts_mutex_init(&cache_lock);
   hts_cond_init(&cache_cond, &cache_lock);
+  for(int i = 0; i < ITEM_LOCKS; i++)
+    hts_mutex_init(&item_locks[i]);
   item_pool = pool_create("blobcacheitems", sizeof(blobcache_item_t), 0);
 
   load_index();
-  prune_stale();
+  load_segments();
   prune_to_size();
   TRACE(TRACE_INFO, "blobcache",
-	"Initialized: %d items consuming %"PRId64" bytes on disk in %s",
-	pool_num(item_pool), current_cache_size, buf);
+	"Initialized: %d items consuming %"PRId64" bytes on disk in %s "
+        "(%d ms)",
+	pool_num(item_pool), current_cache_size, buf,
+        (int)((showtime_get_ts() - ts) / 1000));
 
   settings_create_action(gconf.settings_general, _p("Clear cached files"),
 			 cache_clear, NULL, 0, NULL);
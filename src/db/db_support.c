@@ -22,9 +22,178 @@
 
 #include "showtime.h"
 #include "fileaccess/fileaccess.h"
+#include "misc/queue.h"
 
 #include "db_support.h"
 
+#define DB_STMT_CACHE_SIZE      32
+#define DB_CONN_HASH_SIZE       64
+#define DB_SLOW_QUERY_THRESHOLD 50000  // µs
+#define DB_WAL_CHECKPOINT_PAGES 1000
+#define DB_BUSY_TIMEOUT         5000   // ms
+
+
+/**
+ * Each connection opened by a db_pool keeps a cache of prepared
+ * statements keyed on SQL text, in LRU order. db_finalize() resets a
+ * cached statement and makes it available again instead of destroying it.
+ *
+ * A connection is only ever used by one thread at a time (the one that
+ * got it from db_pool_get()) so the cache itself needs no locking, only
+ * the lookup from sqlite3 handle to db_conn does.
+ */
+LIST_HEAD(db_conn_list, db_conn);
+TAILQ_HEAD(db_stmt_queue, db_stmt);
+
+typedef struct db_stmt {
+  TAILQ_ENTRY(db_stmt) ds_link;
+  sqlite3_stmt *ds_stmt;
+  char *ds_sql;
+  unsigned int ds_hash;
+  int ds_inuse;
+} db_stmt_t;
+
+typedef struct db_conn {
+  LIST_ENTRY(db_conn) dc_link;
+  sqlite3 *dc_db;
+  struct db_stmt_queue dc_stmts;
+  int dc_nstmts;
+  int dc_wal_pages;
+} db_conn_t;
+
+static struct db_conn_list db_conns[DB_CONN_HASH_SIZE];
+static hts_mutex_t db_conn_mutex;
+
+
+/**
+ *
+ */
+static struct db_conn_list *
+db_conn_bucket(sqlite3 *db)
+{
+  return &db_conns[((uintptr_t)db >> 4) % DB_CONN_HASH_SIZE];
+}
+
+
+/**
+ *
+ */
+static db_conn_t *
+db_conn_find(sqlite3 *db)
+{
+  db_conn_t *dc;
+
+  hts_mutex_lock(&db_conn_mutex);
+  LIST_FOREACH(dc, db_conn_bucket(db), dc_link)
+    if(dc->dc_db == db)
+      break;
+  hts_mutex_unlock(&db_conn_mutex);
+  return dc;
+}
+
+
+/**
+ *
+ */
+static int
+db_wal_hook(void *opaque, sqlite3 *db, const char *name, int pages)
+{
+  db_conn_t *dc = opaque;
+  dc->dc_wal_pages = pages;
+  return SQLITE_OK;
+}
+
+
+/**
+ *
+ */
+static void
+db_conn_create(sqlite3 *db)
+{
+  db_conn_t *dc = calloc(1, sizeof(db_conn_t));
+  dc->dc_db = db;
+  TAILQ_INIT(&dc->dc_stmts);
+
+  /*
+   * We do checkpointing ourselves when a connection is returned to
+   * the pool so it does not happen in the middle of someone's commit
+   */
+  sqlite3_wal_autocheckpoint(db, 0);
+  sqlite3_wal_hook(db, db_wal_hook, dc);
+
+  hts_mutex_lock(&db_conn_mutex);
+  LIST_INSERT_HEAD(db_conn_bucket(db), dc, dc_link);
+  hts_mutex_unlock(&db_conn_mutex);
+}
+
+
+/**
+ *
+ */
+static void
+db_stmt_destroy(db_conn_t *dc, db_stmt_t *ds)
+{
+  TAILQ_REMOVE(&dc->dc_stmts, ds, ds_link);
+  dc->dc_nstmts--;
+  sqlite3_finalize(ds->ds_stmt);
+  free(ds->ds_sql);
+  free(ds);
+}
+
+
+/**
+ *
+ */
+static void
+db_stmt_insert(db_conn_t *dc, sqlite3_stmt *stmt, const char *sql,
+               unsigned int hash)
+{
+  db_stmt_t *ds;
+
+  if(dc->dc_nstmts >= DB_STMT_CACHE_SIZE) {
+    TAILQ_FOREACH_REVERSE(ds, &dc->dc_stmts, db_stmt_queue, ds_link)
+      if(!ds->ds_inuse)
+        break;
+    if(ds == NULL)
+      return; // Everything is in use, don't cache this one
+    db_stmt_destroy(dc, ds);
+  }
+
+  ds = malloc(sizeof(db_stmt_t));
+  ds->ds_stmt = stmt;
+  ds->ds_sql = strdup(sql);
+  ds->ds_hash = hash;
+  ds->ds_inuse = 1;
+  TAILQ_INSERT_HEAD(&dc->dc_stmts, ds, ds_link);
+  dc->dc_nstmts++;
+}
+
+
+/**
+ *
+ */
+static void
+db_close(sqlite3 *db)
+{
+  db_conn_t *dc = db_conn_find(db);
+  db_stmt_t *ds;
+
+  if(dc != NULL) {
+    hts_mutex_lock(&db_conn_mutex);
+    LIST_REMOVE(dc, dc_link);
+    hts_mutex_unlock(&db_conn_mutex);
+
+    while((ds = TAILQ_FIRST(&dc->dc_stmts)) != NULL) {
+      if(ds->ds_inuse)
+        TRACE(TRACE_ERROR, "DB", "Statement still in use at close: %s",
+              ds->ds_sql);
+      db_stmt_destroy(dc, ds);
+    }
+    free(dc);
+  }
+  sqlite3_close(db);
+}
+
 
 typedef struct unlock_notify {
   int fired;
@@ -74,13 +243,29 @@ int
 db_step(sqlite3_stmt *pStmt)
 {
   int rc;
+  int64_t ts = showtime_get_ts();
+
   while( SQLITE_LOCKED==(rc = sqlite3_step(pStmt)) ){
     rc = wait_for_unlock_notify(sqlite3_db_handle(pStmt));
     if( rc!=SQLITE_OK ) break;
     sqlite3_reset(pStmt);
   }
+  /*
+   * Pooled connections don't share cache, so a conflicting writer shows
+   * up as SQLITE_BUSY. If the busy handler gave up (or could not be used
+   * because we'd deadlock) report it as SQLITE_LOCKED so callers roll
+   * back and retry as they already do for lock conflicts
+   */
+  if(rc == SQLITE_BUSY)
+    rc = SQLITE_LOCKED;
+
   if(rc == SQLITE_LOCKED)
     TRACE(TRACE_DEBUG, "DB", "Deadlock detected");
+
+  ts = showtime_get_ts() - ts;
+  if(ts > DB_SLOW_QUERY_THRESHOLD)
+    TRACE(TRACE_DEBUG, "DB", "Slow query (%d ms): %s",
+          (int)(ts / 1000), sqlite3_sql(pStmt));
   return rc;
 }
 
@@ -89,6 +274,23 @@ db_preparex(sqlite3 *db, sqlite3_stmt **ppStmt, const char *zSql,
 	    const char *file, int line)
 {
   int rc;
+  db_conn_t *dc = db_conn_find(db);
+  unsigned int hash = 0;
+  db_stmt_t *ds;
+
+  if(dc != NULL) {
+    hash = mystrhash(zSql);
+
+    TAILQ_FOREACH(ds, &dc->dc_stmts, ds_link) {
+      if(!ds->ds_inuse && ds->ds_hash == hash && !strcmp(ds->ds_sql, zSql)) {
+        TAILQ_REMOVE(&dc->dc_stmts, ds, ds_link);
+        TAILQ_INSERT_HEAD(&dc->dc_stmts, ds, ds_link);
+        ds->ds_inuse = 1;
+        *ppStmt = ds->ds_stmt;
+        return SQLITE_OK;
+      }
+    }
+  }
 
   while(SQLITE_LOCKED==(rc = sqlite3_prepare_v2(db, zSql, -1, ppStmt, NULL))) {
     rc = wait_for_unlock_notify(db);
@@ -98,10 +300,38 @@ db_preparex(sqlite3 *db, sqlite3_stmt **ppStmt, const char *zSql,
   if(rc != SQLITE_OK) {
     TRACE(TRACE_ERROR, "SQLITE", "SQL Error %d at %s:%d",
 	  rc, file, line);
+  } else if(dc != NULL && *ppStmt != NULL) {
+    db_stmt_insert(dc, *ppStmt, zSql, hash);
   }
   return rc;
 }
 
+
+/**
+ * Release a statement obtained by db_prepare()
+ */
+void
+db_finalize(sqlite3_stmt *pStmt)
+{
+  db_conn_t *dc;
+  db_stmt_t *ds;
+
+  if(pStmt == NULL)
+    return;
+
+  if((dc = db_conn_find(sqlite3_db_handle(pStmt))) != NULL) {
+    TAILQ_FOREACH(ds, &dc->dc_stmts, ds_link) {
+      if(ds->ds_stmt == pStmt) {
+        sqlite3_reset(pStmt);
+        sqlite3_clear_bindings(pStmt);
+        ds->ds_inuse = 0;
+        return;
+      }
+    }
+  }
+  sqlite3_finalize(pStmt);
+}
+
 /**
  *
  */
@@ -139,9 +369,9 @@ db_get_int64_from_query(sqlite3 *db, const char *query, int64_t *v)
     return -1;
   }
 
-  rc = sqlite3_step(stmt);
+  rc = db_step(stmt);
   if(rc == SQLITE_LOCKED) {
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
     goto restart;
   }
 
@@ -152,7 +382,7 @@ db_get_int64_from_query(sqlite3 *db, const char *query, int64_t *v)
     rval = -1;
   }
 
-  sqlite3_finalize(stmt);
+  db_finalize(stmt);
   return rval;
 }
 
@@ -363,7 +593,7 @@ db_pool_get(db_pool_t *dp)
 
   rc = sqlite3_open_v2(dp->dp_path, &db,
 		       SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | 
-		       SQLITE_OPEN_NOMUTEX | SQLITE_OPEN_SHAREDCACHE,
+		       SQLITE_OPEN_NOMUTEX,
 		       NULL);
 
   if(rc) {
@@ -382,6 +612,10 @@ db_pool_get(db_pool_t *dp)
     sqlite3_close(db);
     return NULL;
   }
+
+  // WAL mode is persistent and set by db_upgrade_schema()
+  sqlite3_busy_timeout(db, DB_BUSY_TIMEOUT);
+  db_conn_create(db);
   return db;
 }
 
@@ -399,10 +633,21 @@ db_pool_put(db_pool_t *dp, sqlite3 *db)
     TRACE(TRACE_ERROR, "DB",
 	  "%s: db handle returned to pool while in transaction, closing handle",
 	  dp->dp_path);
-    sqlite3_close(db);
+    db_close(db);
     return;
   }
 
+  db_conn_t *dc = db_conn_find(db);
+  if(dc != NULL && dc->dc_wal_pages >= DB_WAL_CHECKPOINT_PAGES) {
+    int log, ckpt;
+    int rc = sqlite3_wal_checkpoint_v2(db, NULL, SQLITE_CHECKPOINT_PASSIVE,
+                                       &log, &ckpt);
+    TRACE(TRACE_DEBUG, "DB", "%s: Checkpoint %d of %d pages (rc=%d)",
+          dp->dp_path, ckpt, log, rc);
+    if(rc == SQLITE_OK && ckpt == log)
+      dc->dc_wal_pages = 0;
+  }
+
   hts_mutex_lock(&dp->dp_mutex);
   for(i = 0; i < dp->dp_size; i++) {
     if(dp->dp_pool[i] == NULL) {
@@ -413,7 +658,7 @@ db_pool_put(db_pool_t *dp, sqlite3 *db)
   }
 
   hts_mutex_unlock(&dp->dp_mutex);
-  sqlite3_close(db);
+  db_close(db);
 }
 
 
@@ -431,7 +676,7 @@ db_pool_close(db_pool_t *dp)
   dp->dp_closed = 1;
   for(i = 0; i < dp->dp_size; i++)
     if(dp->dp_pool[i] != NULL)
-      sqlite3_close(dp->dp_pool[i]);
+      db_close(dp->dp_pool[i]);
   hts_mutex_unlock(&dp->dp_mutex);
 }
 
@@ -574,6 +819,11 @@ static struct sqlite3_mutex_methods sqlite_mutexes = {
 void
 db_init(void)
 {
+  int i;
+  for(i = 0; i < DB_CONN_HASH_SIZE; i++)
+    LIST_INIT(&db_conns[i]);
+  hts_mutex_init(&db_conn_mutex);
+
 #if ENABLE_SQLITE_LOCKING
   sqlite3_config(SQLITE_CONFIG_MUTEX, &sqlite_mutexes);
 #endif
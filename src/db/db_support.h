@@ -25,6 +25,8 @@ int db_preparex(sqlite3 *db, sqlite3_stmt **ppStmt, const char *zSql,
 
 #define db_prepare(db, stmt, sql) db_preparex(db, stmt, sql, __FILE__, __LINE__)
 
+void db_finalize(sqlite3_stmt *pStmt);
+
 #define db_begin(db)    db_begin0(db, __FUNCTION__)
 #define db_commit(db)   db_commit0(db, __FUNCTION__)
 #define db_rollback(db) db_rollback0(db, __FUNCTION__)
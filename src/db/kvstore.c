@@ -35,12 +35,94 @@
 
 static db_pool_t *kvstore_pool;
 
+/**
+ * Writes are not done directly to the database. Instead they are put
+ * on a queue where updates to the same (url, domain, key) are coalesced
+ * and a background thread writes them out in a single transaction
+ * KVSTORE_WRITE_DELAY seconds after the oldest pending write was made
+ * (or earlier if too many writes are pending). Readers look at the
+ * pending writes first so they always see their own writes.
+ */
+#define KVSTORE_WRITE_DELAY   5     // Seconds
+#define KVSTORE_MAX_PENDING   256
+#define KVSTORE_HASH_SIZE     256
+#define KVSTORE_URL_CACHE_MAX 1024
+
+#define KV_NULL   0
+#define KV_INT    1
+#define KV_FLOAT  2
+#define KV_STRING 3
+#define KV_DELETE 4
+
+typedef struct kv_value {
+  int kv_type;
+  union {
+    int kv_int;
+    double kv_float;
+    rstr_t *kv_str;
+  };
+} kv_value_t;
+
+LIST_HEAD(kv_write_list, kv_write);
+TAILQ_HEAD(kv_write_queue, kv_write);
+
+typedef struct kv_write {
+  LIST_ENTRY(kv_write) kw_hash_link;
+  TAILQ_ENTRY(kv_write) kw_queue_link;
+  char *kw_url;
+  char *kw_key;
+  int kw_domain;
+  unsigned int kw_hash;
+  int kw_seq;
+  int64_t kw_created;
+  kv_value_t kw_value;
+} kv_write_t;
+
+static struct kv_write_list kv_write_hash[KVSTORE_HASH_SIZE];
+static struct kv_write_queue kv_writes;
+static int kv_num_writes;
+static int kv_seq;
+static int kv_running;
+static int kv_flush_now;
+static hts_mutex_t kv_mutex;
+static hts_mutex_t kv_flush_mutex;
+static hts_cond_t kv_cond;
+
+
+/**
+ * Cache of url -> id in the url table
+ */
+LIST_HEAD(kv_url_list, kv_url);
+TAILQ_HEAD(kv_url_queue, kv_url);
+
+typedef struct kv_url {
+  LIST_ENTRY(kv_url) ku_hash_link;
+  TAILQ_ENTRY(kv_url) ku_lru_link;
+  char *ku_url;
+  unsigned int ku_hash;
+  uint64_t ku_id;
+} kv_url_t;
+
+static struct kv_url_list kv_url_hash[KVSTORE_HASH_SIZE];
+static struct kv_url_queue kv_url_lru;
+static int kv_url_entries;
+static hts_mutex_t kv_url_mutex;
+
+static int kv_flush(void);
+
+
 /**
  *
  */
 void
 kvstore_fini(void)
 {
+  hts_mutex_lock(&kv_mutex);
+  kv_running = 0;
+  hts_cond_signal(&kv_cond);
+  hts_mutex_unlock(&kv_mutex);
+
+  kv_flush();
   db_pool_close(kvstore_pool);
 }
 
@@ -65,6 +147,51 @@ kvstore_close(void *db)
 }
 
 
+/**
+ *
+ */
+static void *
+kv_write_thread(void *aux)
+{
+  kv_write_t *kw;
+  int64_t now, deadline;
+
+  hts_mutex_lock(&kv_mutex);
+
+  while(kv_running) {
+
+    if((kw = TAILQ_FIRST(&kv_writes)) == NULL) {
+      hts_cond_wait(&kv_cond, &kv_mutex);
+      continue;
+    }
+
+    now = showtime_get_ts();
+    deadline = kw->kw_created + KVSTORE_WRITE_DELAY * 1000000LL;
+
+    if(!kv_flush_now && now < deadline) {
+      hts_cond_wait_timeout(&kv_cond, &kv_mutex, (deadline - now) / 1000 + 1);
+      continue;
+    }
+
+    kv_flush_now = 0;
+    hts_mutex_unlock(&kv_mutex);
+
+    if(kv_flush()) {
+      // Failed, don't retry immediately
+      hts_mutex_lock(&kv_mutex);
+      if(kv_running)
+        hts_cond_wait_timeout(&kv_cond, &kv_mutex,
+                              KVSTORE_WRITE_DELAY * 1000);
+      continue;
+    }
+    hts_mutex_lock(&kv_mutex);
+  }
+
+  hts_mutex_unlock(&kv_mutex);
+  return NULL;
+}
+
+
 /**
  *
  */
@@ -73,6 +200,18 @@ kvstore_init(void)
 {
   sqlite3 *db;
   char buf[256];
+  int i;
+
+  for(i = 0; i < KVSTORE_HASH_SIZE; i++) {
+    LIST_INIT(&kv_write_hash[i]);
+    LIST_INIT(&kv_url_hash[i]);
+  }
+  TAILQ_INIT(&kv_writes);
+  TAILQ_INIT(&kv_url_lru);
+  hts_mutex_init(&kv_mutex);
+  hts_mutex_init(&kv_flush_mutex);
+  hts_mutex_init(&kv_url_mutex);
+  hts_cond_init(&kv_cond, &kv_mutex);
 
   snprintf(buf, sizeof(buf), "%s/kvstore", gconf.persistent_path);
   mkdir(buf, 0770);
@@ -91,20 +230,102 @@ kvstore_init(void)
 
   kvstore_close(db);
 
-  if(r)
+  if(r) {
     kvstore_pool = NULL; // Disable
+    return;
+  }
+
+  kv_running = 1;
+  hts_thread_create_detached("kvstore", kv_write_thread, NULL,
+                             THREAD_PRIO_METADATA_BG);
 }
 
 
 
 typedef struct kv_prop_bind {
-  uint64_t kpb_id;  // ID of row in URL table
   prop_sub_t *kpb_sub;
-  int kpb_init;
   char *kpb_url;
 } kv_prop_bind_t;
 
 
+/**
+ *
+ */
+static int
+kv_url_cache_get(const char *url, uint64_t *id)
+{
+  kv_url_t *ku;
+  unsigned int hash = mystrhash(url);
+
+  hts_mutex_lock(&kv_url_mutex);
+  LIST_FOREACH(ku, &kv_url_hash[hash % KVSTORE_HASH_SIZE], ku_hash_link) {
+    if(ku->ku_hash == hash && !strcmp(ku->ku_url, url)) {
+      TAILQ_REMOVE(&kv_url_lru, ku, ku_lru_link);
+      TAILQ_INSERT_TAIL(&kv_url_lru, ku, ku_lru_link);
+      *id = ku->ku_id;
+      break;
+    }
+  }
+  hts_mutex_unlock(&kv_url_mutex);
+  return ku != NULL;
+}
+
+
+/**
+ *
+ */
+static void
+kv_url_destroy(kv_url_t *ku)
+{
+  LIST_REMOVE(ku, ku_hash_link);
+  TAILQ_REMOVE(&kv_url_lru, ku, ku_lru_link);
+  kv_url_entries--;
+  free(ku->ku_url);
+  free(ku);
+}
+
+
+/**
+ *
+ */
+static void
+kv_url_cache_put(const char *url, uint64_t id)
+{
+  kv_url_t *ku;
+
+  hts_mutex_lock(&kv_url_mutex);
+
+  if(kv_url_entries >= KVSTORE_URL_CACHE_MAX)
+    kv_url_destroy(TAILQ_FIRST(&kv_url_lru));
+
+  ku = malloc(sizeof(kv_url_t));
+  ku->ku_url = strdup(url);
+  ku->ku_hash = mystrhash(url);
+  ku->ku_id = id;
+  LIST_INSERT_HEAD(&kv_url_hash[ku->ku_hash % KVSTORE_HASH_SIZE], ku,
+                   ku_hash_link);
+  TAILQ_INSERT_TAIL(&kv_url_lru, ku, ku_lru_link);
+  kv_url_entries++;
+  hts_mutex_unlock(&kv_url_mutex);
+}
+
+
+/**
+ * Called when a transaction is rolled back since we might have
+ * cached ids of rows that no longer exists
+ */
+static void
+kv_url_cache_purge(void)
+{
+  kv_url_t *ku;
+
+  hts_mutex_lock(&kv_url_mutex);
+  while((ku = TAILQ_FIRST(&kv_url_lru)) != NULL)
+    kv_url_destroy(ku);
+  hts_mutex_unlock(&kv_url_mutex);
+}
+
+
 /**
  *
  */
@@ -114,6 +335,9 @@ get_url(void *db, const char *url, uint64_t *id)
   int rc;
   sqlite3_stmt *stmt;
 
+  if(kv_url_cache_get(url, id))
+    return SQLITE_OK;
+
   rc = db_prepare(db, &stmt,
 		  "SELECT id FROM url WHERE url=?1");
   
@@ -122,18 +346,19 @@ get_url(void *db, const char *url, uint64_t *id)
 
   sqlite3_bind_text(stmt, 1, url, -1, SQLITE_STATIC);
       
-  rc = sqlite3_step(stmt);
+  rc = db_step(stmt);
   if(rc == SQLITE_LOCKED) {
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
     return SQLITE_LOCKED;
   }
   if(rc == SQLITE_ROW) {
     *id = sqlite3_column_int64(stmt, 0);
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
+    kv_url_cache_put(url, *id);
     return SQLITE_OK;
 
   } else if(rc == SQLITE_DONE) {
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
 
     rc = db_prepare(db, &stmt,
 		    "INSERT INTO url ('url') VALUES (?1)");
@@ -147,10 +372,11 @@ get_url(void *db, const char *url, uint64_t *id)
     rc = db_step(stmt);
     if(rc == SQLITE_DONE) {
       *id = sqlite3_last_insert_rowid(db);
+      kv_url_cache_put(url, *id);
       rc = SQLITE_OK;
     }
   }
-  sqlite3_finalize(stmt);
+  db_finalize(stmt);
   return rc;
 }
 
@@ -159,16 +385,302 @@ get_url(void *db, const char *url, uint64_t *id)
  *
  */
 static void
-kv_value_cb(void *opaque, prop_event_t event, ...)
+kv_value_copy(kv_value_t *dst, const kv_value_t *src)
+{
+  *dst = *src;
+  if(dst->kv_type == KV_STRING)
+    dst->kv_str = rstr_dup(src->kv_str);
+}
+
+
+/**
+ *
+ */
+static void
+kv_value_release(kv_value_t *kv)
+{
+  if(kv->kv_type == KV_STRING)
+    rstr_release(kv->kv_str);
+}
+
+
+/**
+ * Must be called with kv_mutex held
+ */
+static kv_write_t *
+kv_write_find(const char *url, int domain, const char *key,
+              unsigned int hash)
+{
+  kv_write_t *kw;
+
+  LIST_FOREACH(kw, &kv_write_hash[hash % KVSTORE_HASH_SIZE], kw_hash_link)
+    if(kw->kw_hash == hash && kw->kw_domain == domain &&
+       !strcmp(kw->kw_key, key) && !strcmp(kw->kw_url, url))
+      return kw;
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static unsigned int
+kv_write_hashkey(const char *url, int domain, const char *key)
+{
+  return mystrhash(url) ^ (mystrhash(key) * 31) ^ domain;
+}
+
+
+/**
+ * Queue a write. Takes over the reference to any string in kv
+ */
+static void
+kv_write_enqueue(const char *url, int domain, const char *key,
+                 kv_value_t *kv)
+{
+  kv_write_t *kw;
+  unsigned int hash;
+
+  if(kvstore_pool == NULL) {
+    kv_value_release(kv);
+    return;
+  }
+
+  hash = kv_write_hashkey(url, domain, key);
+
+  hts_mutex_lock(&kv_mutex);
+
+  if((kw = kv_write_find(url, domain, key, hash)) != NULL) {
+    kv_value_release(&kw->kw_value);
+  } else {
+    kw = malloc(sizeof(kv_write_t));
+    kw->kw_url = strdup(url);
+    kw->kw_key = strdup(key);
+    kw->kw_domain = domain;
+    kw->kw_hash = hash;
+    kw->kw_created = showtime_get_ts();
+    LIST_INSERT_HEAD(&kv_write_hash[hash % KVSTORE_HASH_SIZE], kw,
+                     kw_hash_link);
+    TAILQ_INSERT_TAIL(&kv_writes, kw, kw_queue_link);
+    kv_num_writes++;
+
+    if(kv_num_writes == 1) {
+      hts_cond_signal(&kv_cond);
+    } else if(kv_num_writes == KVSTORE_MAX_PENDING) {
+      kv_flush_now = 1;
+      hts_cond_signal(&kv_cond);
+    }
+  }
+
+  kw->kw_value = *kv;
+  kw->kw_seq = ++kv_seq;
+  hts_mutex_unlock(&kv_mutex);
+}
+
+
+/**
+ * Get pending write (if any)
+ */
+static int
+kv_write_get(const char *url, int domain, const char *key, kv_value_t *kv)
+{
+  kv_write_t *kw;
+  unsigned int hash = kv_write_hashkey(url, domain, key);
+
+  hts_mutex_lock(&kv_mutex);
+  kw = kv_write_find(url, domain, key, hash);
+  if(kw != NULL)
+    kv_value_copy(kv, &kw->kw_value);
+  hts_mutex_unlock(&kv_mutex);
+  return kw != NULL;
+}
+
+
+/**
+ *
+ */
+static int
+kv_write_pending_for_url(const char *url)
+{
+  kv_write_t *kw;
+
+  hts_mutex_lock(&kv_mutex);
+  TAILQ_FOREACH(kw, &kv_writes, kw_queue_link)
+    if(!strcmp(kw->kw_url, url))
+      break;
+  hts_mutex_unlock(&kv_mutex);
+  return kw != NULL;
+}
+
+
+/**
+ *
+ */
+static int
+kv_write_one(void *db, const kv_write_t *kw, const kv_value_t *kv)
 {
-  kv_prop_bind_t *kpb = opaque;
-  va_list ap, apx;
-  //  prop_t *p;
-  //  rstr_t *key;
-  void *db;
   sqlite3_stmt *stmt;
+  uint64_t id = 0;
   int rc;
 
+  rc = get_url(db, kw->kw_url, &id);
+  if(rc != SQLITE_OK)
+    return rc;
+
+  if(kv->kv_type == KV_DELETE) {
+    rc = db_prepare(db, &stmt,
+		    "DELETE FROM url_kv "
+		    "WHERE url_id = ?1 "
+		    "AND domain = ?4 "
+		    "AND key = ?2");
+  } else {
+    rc = db_prepare(db, &stmt,
+		    "INSERT OR REPLACE INTO url_kv "
+		    "(url_id, domain, key, value) "
+		    "VALUES "
+		    "(?1, ?4, ?2, ?3)");
+  }
+
+  if(rc != SQLITE_OK)
+    return rc;
+
+  sqlite3_bind_int64(stmt, 1, id);
+  sqlite3_bind_text(stmt, 2, kw->kw_key, -1, SQLITE_STATIC);
+  sqlite3_bind_int(stmt, 4, kw->kw_domain);
+
+  switch(kv->kv_type) {
+  case KV_INT:
+    sqlite3_bind_int(stmt, 3, kv->kv_int);
+    break;
+  case KV_FLOAT:
+    sqlite3_bind_double(stmt, 3, kv->kv_float);
+    break;
+  case KV_STRING:
+    db_bind_rstr(stmt, 3, kv->kv_str);
+    break;
+  case KV_NULL:
+    sqlite3_bind_null(stmt, 3);
+    break;
+  }
+
+  rc = db_step(stmt);
+  db_finalize(stmt);
+  return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+
+/**
+ * Write all pending writes to the database in one transaction
+ */
+static int
+kv_flush(void)
+{
+  kv_write_t *kw, **kwv;
+  kv_value_t *kvv;
+  int *seqv;
+  int i, n, rc, r = -1;
+  void *db;
+
+  hts_mutex_lock(&kv_flush_mutex);
+  hts_mutex_lock(&kv_mutex);
+
+  n = kv_num_writes;
+  if(n == 0) {
+    hts_mutex_unlock(&kv_mutex);
+    hts_mutex_unlock(&kv_flush_mutex);
+    return 0;
+  }
+
+  /*
+   * Entries are only ever removed by us (and we hold kv_flush_mutex)
+   * so they stay valid, but the value might change under our feet
+   * so take a copy of it
+   */
+  kwv  = malloc(sizeof(kv_write_t *) * n);
+  kvv  = malloc(sizeof(kv_value_t) * n);
+  seqv = malloc(sizeof(int) * n);
+
+  i = 0;
+  TAILQ_FOREACH(kw, &kv_writes, kw_queue_link) {
+    kwv[i] = kw;
+    kv_value_copy(&kvv[i], &kw->kw_value);
+    seqv[i] = kw->kw_seq;
+    i++;
+  }
+  hts_mutex_unlock(&kv_mutex);
+
+  if((db = kvstore_get()) == NULL)
+    goto out;
+
+ again:
+  if(db_begin(db))
+    goto bad;
+
+  for(i = 0; i < n; i++) {
+    rc = kv_write_one(db, kwv[i], &kvv[i]);
+    if(rc == SQLITE_LOCKED) {
+      db_rollback_deadlock(db);
+      kv_url_cache_purge();
+      goto again;
+    }
+    if(rc != SQLITE_OK) {
+      db_rollback(db);
+      kv_url_cache_purge();
+      goto bad;
+    }
+  }
+
+  if(db_commit(db)) {
+    db_rollback(db);
+    kv_url_cache_purge();
+    goto bad;
+  }
+
+  r = 0;
+
+  // Remove everything that has not been updated while we were writing
+
+  hts_mutex_lock(&kv_mutex);
+  for(i = 0; i < n; i++) {
+    kw = kwv[i];
+    if(kw->kw_seq != seqv[i])
+      continue;
+    LIST_REMOVE(kw, kw_hash_link);
+    TAILQ_REMOVE(&kv_writes, kw, kw_queue_link);
+    kv_num_writes--;
+    kv_value_release(&kw->kw_value);
+    free(kw->kw_url);
+    free(kw->kw_key);
+    free(kw);
+  }
+  hts_mutex_unlock(&kv_mutex);
+
+ bad:
+  kvstore_close(db);
+ out:
+  for(i = 0; i < n; i++)
+    kv_value_release(&kvv[i]);
+  free(kwv);
+  free(kvv);
+  free(seqv);
+
+  if(r)
+    TRACE(TRACE_ERROR, "kvstore", "Unable to write %d pending values", n);
+  hts_mutex_unlock(&kv_flush_mutex);
+  return r;
+}
+
+
+/**
+ *
+ */
+static void
+kv_value_cb(void *opaque, prop_event_t event, ...)
+{
+  kv_prop_bind_t *kpb = opaque;
+  va_list ap;
+  kv_value_t kv;
+
   va_start(ap, event);
 
   switch(event) {
@@ -181,89 +693,36 @@ kv_value_cb(void *opaque, prop_event_t event, ...)
   case PROP_SET_CSTRING:
   case PROP_SET_INT:
   case PROP_SET_FLOAT:
-    
-    db = kvstore_get();
-    if(db == NULL)
-      break;
-    
-  again:
-    if(db_begin(db))
-      break;
-    
-    if(kpb->kpb_id == -1) {
-
-      rc = get_url(db, kpb->kpb_url, &kpb->kpb_id);
-      if(rc == SQLITE_LOCKED)
-	goto again;
-
-      if(rc != SQLITE_OK) {
-	db_rollback(db);
-	kvstore_close(db);
-	return;
-      }
-    }
-    
-    if(event == PROP_SET_VOID) {
-      rc = db_prepare(db, &stmt,
-		      "DELETE FROM url_kv "
-		      "WHERE url_id = ?1 "
-		      "AND domain = ?4 "
-		      "AND key = ?2");
-    } else {
-
-      rc = db_prepare(db, &stmt,
-		      "INSERT OR REPLACE INTO url_kv "
-		      "(url_id, domain, key, value) "
-		      "VALUES "
-		      "(?1, ?4, ?2, ?3)");
-    }
-
-    if(rc != SQLITE_OK) {
-      db_rollback(db);
-      kvstore_close(db);
-      return;
-    }
-
-    sqlite3_bind_int64(stmt, 1, kpb->kpb_id);
-    sqlite3_bind_int(stmt, 4, KVSTORE_DOMAIN_PROP);
-
-    va_copy(apx, ap);
 
     switch(event) {
     default:
-      break;
-
     case PROP_SET_VOID:
+      kv.kv_type = KV_DELETE;
       break;
     case PROP_SET_RSTRING:
-      db_bind_rstr(stmt, 3, va_arg(apx, rstr_t *));
+      kv.kv_type = KV_STRING;
+      kv.kv_str = rstr_dup(va_arg(ap, rstr_t *));
       break;
     case PROP_SET_CSTRING:
-      sqlite3_bind_text(stmt, 3, va_arg(apx, const char *), -1,
-			SQLITE_STATIC);
+      kv.kv_type = KV_STRING;
+      kv.kv_str = rstr_alloc(va_arg(ap, const char *));
       break;
     case PROP_SET_INT:
-      sqlite3_bind_int(stmt, 3, va_arg(apx, int));
+      kv.kv_type = KV_INT;
+      kv.kv_int = va_arg(ap, int);
       break;
     case PROP_SET_FLOAT:
-      sqlite3_bind_double(stmt, 3, va_arg(apx, double));
+      kv.kv_type = KV_FLOAT;
+      kv.kv_float = va_arg(ap, double);
       break;
     }
 
-    rstr_t *key = prop_get_name(va_arg(apx, prop_t *));
-    db_bind_rstr(stmt, 2, key);
-    
-    rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    rstr_t *key = prop_get_name(va_arg(ap, prop_t *));
+    if(key != NULL)
+      kv_write_enqueue(kpb->kpb_url, KVSTORE_DOMAIN_PROP, rstr_get(key), &kv);
+    else
+      kv_value_release(&kv);
     rstr_release(key);
-    
-    if(rc == SQLITE_LOCKED) {
-      db_rollback_deadlock(db);
-      goto again;
-    }
-    db_commit(db);
-    kvstore_close(db);
-      
     break;
 
   default:
@@ -345,10 +804,13 @@ void
 kv_prop_bind_create(prop_t *p, const char *url)
 {
   void *db;
-  int64_t id = -1;
   sqlite3_stmt *stmt;
   int rc;
 
+  // Make sure we see our own pending writes
+  if(kv_write_pending_for_url(url))
+    kv_flush();
+
   db = kvstore_get();
   if(db == NULL)
     return;
@@ -369,8 +831,6 @@ kv_prop_bind_create(prop_t *p, const char *url)
   sqlite3_bind_int(stmt, 2, KVSTORE_DOMAIN_PROP);
 
   while(db_step(stmt) == SQLITE_ROW) {
-    if(id == -1)
-      id = sqlite3_column_int64(stmt, 0);
     if(sqlite3_column_type(stmt, 1) != SQLITE_TEXT)
       continue;
 
@@ -392,11 +852,10 @@ kv_prop_bind_create(prop_t *p, const char *url)
     }
   }
 
-  sqlite3_finalize(stmt);
+  db_finalize(stmt);
   kvstore_close(db);
 
   kv_prop_bind_t *kpb = calloc(1, sizeof(kv_prop_bind_t));
-  kpb->kpb_id = id;
   kpb->kpb_url = strdup(url);
 
   kpb->kpb_sub = 
@@ -439,7 +898,7 @@ kv_url_opt_get(void *db, const char *url, int domain, const char *key)
 
   if(db_step(stmt) == SQLITE_ROW)
     return stmt;
-  sqlite3_finalize(stmt);
+  db_finalize(stmt);
   return NULL;
 }
 
@@ -449,12 +908,30 @@ kv_url_opt_get(void *db, const char *url, int domain, const char *key)
 rstr_t *
 kv_url_opt_get_rstr(const char *url, int domain, const char *key)
 {
+  kv_value_t kv;
+  char tmp[64];
+  rstr_t *r = NULL;
+
+  if(kv_write_get(url, domain, key, &kv)) {
+    switch(kv.kv_type) {
+    case KV_STRING:
+      return kv.kv_str;
+    case KV_INT:
+      snprintf(tmp, sizeof(tmp), "%d", kv.kv_int);
+      return rstr_alloc(tmp);
+    case KV_FLOAT:
+      snprintf(tmp, sizeof(tmp), "%.15g", kv.kv_float);
+      return rstr_alloc(tmp);
+    default:
+      return NULL;
+    }
+  }
+
   void *db = kvstore_get();
   sqlite3_stmt *stmt = kv_url_opt_get(db, url, domain, key);
-  rstr_t *r = NULL;
   if(stmt) {
     r = db_rstr(stmt, 0);
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
   }
   kvstore_close(db);
   return r;
@@ -467,20 +944,39 @@ kv_url_opt_get_rstr(const char *url, int domain, const char *key)
 int
 kv_url_opt_get_int(const char *url, int domain, const char *key, int def)
 {
+  kv_value_t kv;
+  int v = def;
+
+  if(kv_write_get(url, domain, key, &kv)) {
+    switch(kv.kv_type) {
+    case KV_STRING:
+      v = kv.kv_str ? atoi(rstr_get(kv.kv_str)) : 0;
+      rstr_release(kv.kv_str);
+      break;
+    case KV_INT:
+      v = kv.kv_int;
+      break;
+    case KV_FLOAT:
+      v = kv.kv_float;
+      break;
+    case KV_NULL:
+      v = 0;
+      break;
+    }
+    return v;
+  }
+
   void *db = kvstore_get();
   sqlite3_stmt *stmt = kv_url_opt_get(db, url, domain, key);
-  int v = def;
   if(stmt) {
     v = sqlite3_column_int(stmt, 0);
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
   }
   kvstore_close(db);
   return v;
 }
 
 
-
-
 /**
  *
  */
@@ -488,75 +984,30 @@ void
 kv_url_opt_set(const char *url, int domain, const char *key,
 	       int type, ...)
 {
-  void *db;
-  sqlite3_stmt *stmt;
-  int rc;
-  uint64_t id;
-  va_list ap, apx;
+  kv_value_t kv;
+  va_list ap;
   va_start(ap, type);
 
-  db = kvstore_get();
-  if(db == NULL)
-    return;
-  
- again:
-  if(db_begin(db)) {
-    kvstore_close(db);
-    return;
-  }
-
-  rc = get_url(db, url, &id);
-  if(rc == SQLITE_LOCKED)
-    goto again;
-
-  if(rc != SQLITE_OK) {
-    db_rollback(db);
-    kvstore_close(db);
-    return;
-  }
-
-  rc = db_prepare(db, &stmt,
-		  "INSERT OR REPLACE INTO url_kv "
-		  "(url_id, key, value, domain) "
-		  "VALUES "
-		  "(?1, ?2, ?3, ?4)"
-		  );
-
-
-  if(rc != SQLITE_OK) {
-    db_rollback(db);
-    kvstore_close(db);
-    return;
-  }
-
-  sqlite3_bind_int64(stmt, 1, id);
-  sqlite3_bind_text(stmt, 2, key, -1, SQLITE_STATIC);
-  sqlite3_bind_int(stmt, 4, domain);
-
-  va_copy(apx, ap);
-
   switch(type) {
   case KVSTORE_SET_INT:
-    sqlite3_bind_int(stmt, 3, va_arg(apx, int));
+    kv.kv_type = KV_INT;
+    kv.kv_int = va_arg(ap, int);
     break;
 
   case KVSTORE_SET_STRING:
-    sqlite3_bind_text(stmt, 3, va_arg(apx, const char *), -1, SQLITE_STATIC);
+    kv.kv_str = rstr_alloc(va_arg(ap, const char *));
+    kv.kv_type = kv.kv_str ? KV_STRING : KV_NULL;
     break;
 
   case KVSTORE_SET_VOID:
-    sqlite3_bind_null(stmt, 3);
+    kv.kv_type = KV_NULL;
     break;
 
   default:
-    break;
-  }
-  rc = sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-  if(rc == SQLITE_LOCKED) {
-    db_rollback_deadlock(db);
-    goto again;
+    va_end(ap);
+    return;
   }
-  db_commit(db);
-  kvstore_close(db);
+  va_end(ap);
+
+  kv_write_enqueue(url, domain, key, &kv);
 }
@@ -214,6 +214,8 @@ typedef struct http_file {
 
   char hf_fast_fail;
 
+  char hf_no_auth;
+
   char hf_req_compression;
   
   char hf_content_encoding;
@@ -1009,6 +1011,9 @@ http_headers_auth(struct http_header_list *headers, http_file_t *hf,
   const char *hostname = hf->hf_connection->hc_hostname;
   int port = hf->hf_connection->hc_port;
 
+  if(hf->hf_no_auth)
+    return;
+
 #if ENABLE_SPIDERMONKEY
   struct http_auth_req har;
 
@@ -1900,6 +1905,7 @@ http_open_ex(fa_protocol_t *fap, const char *url, char *errbuf, size_t errlen,
   hf->hf_debug = !!(flags & FA_DEBUG) || gconf.enable_http_debug;
   hf->hf_streaming = !!(flags & FA_STREAMING);
   hf->hf_fast_fail = !!(flags & FA_FAST_FAIL);
+  hf->hf_no_auth = !!(flags & FA_DISABLE_AUTH);
   if(stats != NULL) {
     hf->hf_stats_speed = prop_ref_inc(prop_create(stats, "bitrate"));
     prop_set_int(prop_create(stats, "bitrateValid"), 1);
@@ -19,14 +19,28 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <limits.h>
+#include <string.h>
+#include <errno.h>
 
 #include "showtime.h"
 #include "metadata/metadata.h"
 #include "db/db_support.h"
 #include "fa_indexer.h"
+#include "fa_nameindex.h"
+#include "misc/str.h"
 #include "fileaccess.h"
 #include "htsmsg/htsmsg_store.h"
 
+#if ENABLE_INOTIFY
+static void indexer_watch(const char *url);
+#endif
+
+/**
+ * How often (in seconds) indexed roots are fully rescanned when we
+ * are unable to get change notifications for them
+ */
+#define INDEXER_RESCAN_INTERVAL 600
+
 /**
  *
  */
@@ -52,9 +66,13 @@ index_path(const char *url)
     sqlite3_bind_text(stmt, 1, url, -1, SQLITE_STATIC);
     sqlite3_bind_int(stmt, 2, err ? INDEX_STATUS_ERROR : INDEX_STATUS_STATED);
     db_step(stmt);
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
   }
   metadb_close(db);
+#if ENABLE_INOTIFY
+  if(!err)
+    indexer_watch(url);
+#endif
   TRACE(TRACE_DEBUG, "Indexer", "Indexing %s done err=%d", url, err);
 }
 
@@ -108,7 +126,7 @@ get_items(void *db, struct item_queue *q, const char *pfx, const char *query)
     i->contenttype = sqlite3_column_int(stmt, 1);
     i->mtime =       sqlite3_column_int(stmt, 2);
   }
-  sqlite3_finalize(stmt);
+  db_finalize(stmt);
   return 0;
 }
 
@@ -154,9 +172,37 @@ do_round(const char *prefix)
 static hts_mutex_t indexer_mutex;
 static hts_cond_t indexer_cond;
 TAILQ_HEAD(indexer_root_queue, indexer_root);
+TAILQ_HEAD(indexer_dirty_queue, indexer_dirty);
 
 static struct indexer_root_queue roots;
 
+/**
+ * Directories reported as changed by the filesystem. Only these are
+ * rescanned, instead of walking the entire library
+ */
+static struct indexer_dirty_queue dirty_dirs;
+
+typedef struct indexer_dirty {
+  TAILQ_ENTRY(indexer_dirty) id_link;
+  char *id_url;
+} indexer_dirty_t;
+
+/**
+ * Set when change notification is not available for (parts of) the
+ * indexed roots. We fall back to periodic rescanning in that case
+ */
+static int indexer_need_polling;
+
+/**
+ * Set when we've lost track of changes and everything must be rescanned
+ */
+static int indexer_rescan_all;
+
+/**
+ * Set when items may have changed since the file name index was built
+ */
+static int indexer_nameindex_stale = 1;
+
 typedef struct indexer_root {
   TAILQ_ENTRY(indexer_root) ir_link;
   char *ir_url;
@@ -179,6 +225,113 @@ ir_release(indexer_root_t *ir)
 }
 
 
+/**
+ * Must be called with indexer_mutex held
+ */
+static void
+mark_dirty(const char *url)
+{
+  indexer_dirty_t *id;
+
+  TAILQ_FOREACH(id, &dirty_dirs, id_link)
+    if(!strcmp(id->id_url, url))
+      return;
+
+  id = malloc(sizeof(indexer_dirty_t));
+  id->id_url = strdup(url);
+  TAILQ_INSERT_TAIL(&dirty_dirs, id, id_link);
+  hts_cond_signal(&indexer_cond);
+}
+
+
+/**
+ * Rescan all directories that have been reported as changed
+ */
+static int
+do_dirty(void)
+{
+  indexer_dirty_t *id;
+  int r = 0;
+
+  while((id = TAILQ_FIRST(&dirty_dirs)) != NULL) {
+    TAILQ_REMOVE(&dirty_dirs, id, id_link);
+    hts_mutex_unlock(&indexer_mutex);
+    index_path(id->id_url);
+    free(id->id_url);
+    free(id);
+    r = 1;
+    hts_mutex_lock(&indexer_mutex);
+  }
+  return r;
+}
+
+
+/**
+ * Flag all directories below the roots for indexing again
+ *
+ * Must be called with indexer_mutex held
+ */
+static void
+reset_roots(void)
+{
+  indexer_root_t *ir;
+  char **urls = NULL;
+  char pfx[PATH_MAX];
+  sqlite3_stmt *stmt;
+  int i;
+
+  TAILQ_FOREACH(ir, &roots, ir_link) {
+    strvec_addp(&urls, ir->ir_url);
+    ir->ir_root_scanned = 0;
+  }
+
+  if(urls == NULL)
+    return;
+
+  hts_mutex_unlock(&indexer_mutex);
+
+  void *db = metadb_get();
+
+  for(i = 0; urls[i] != NULL; i++) {
+    db_escape_path_query(pfx, sizeof(pfx), urls[i]);
+
+    if(db_prepare(db, &stmt,
+                  "UPDATE item "
+                  "SET indexstatus = 0 "
+                  "WHERE url LIKE ?1 "
+                  "AND contenttype=1"))
+      continue;
+
+    sqlite3_bind_text(stmt, 1, pfx, -1, SQLITE_STATIC);
+    db_step(stmt);
+    db_finalize(stmt);
+  }
+  metadb_close(db);
+  strvec_free(urls);
+  hts_mutex_lock(&indexer_mutex);
+}
+
+
+/**
+ * Must be called with indexer_mutex held
+ */
+static void
+update_nameindex(void)
+{
+  indexer_root_t *ir;
+  char **urls = NULL;
+
+  TAILQ_FOREACH(ir, &roots, ir_link)
+    strvec_addp(&urls, ir->ir_url);
+
+  hts_mutex_unlock(&indexer_mutex);
+  fa_nameindex_rebuild((const char **)urls);
+  if(urls != NULL)
+    strvec_free(urls);
+  hts_mutex_lock(&indexer_mutex);
+}
+
+
 /**
  *
  */
@@ -216,6 +369,267 @@ save_state(void)
 
 
 
+#if ENABLE_INOTIFY
+#include <sys/inotify.h>
+#include <poll.h>
+
+#define INDEXER_WATCH_HASH_SIZE 256
+
+LIST_HEAD(indexer_watch_list, indexer_watch);
+
+typedef struct indexer_watch {
+  LIST_ENTRY(indexer_watch) iw_link;
+  int iw_wd;
+  char *iw_url;
+} indexer_watch_t;
+
+static struct indexer_watch_list watches[INDEXER_WATCH_HASH_SIZE];
+
+static int inotify_fd = -1;
+
+#define INDEXER_WATCH_MASK (IN_ONLYDIR | IN_CREATE | IN_CLOSE_WRITE |    \
+                            IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |     \
+                            IN_DELETE_SELF)
+
+
+/**
+ * Must be called with indexer_mutex held
+ */
+static indexer_watch_t *
+watch_find(int wd)
+{
+  indexer_watch_t *iw;
+  LIST_FOREACH(iw, &watches[wd & (INDEXER_WATCH_HASH_SIZE - 1)], iw_link)
+    if(iw->iw_wd == wd)
+      return iw;
+  return NULL;
+}
+
+
+/**
+ * Must be called with indexer_mutex held
+ */
+static void
+watch_destroy(indexer_watch_t *iw)
+{
+  LIST_REMOVE(iw, iw_link);
+  free(iw->iw_url);
+  free(iw);
+}
+
+
+/**
+ * Start watching a directory that has been indexed
+ */
+static void
+indexer_watch(const char *url)
+{
+  indexer_watch_t *iw;
+  int wd;
+
+  if(inotify_fd == -1)
+    return;
+
+  if(!strncmp(url, "file://", strlen("file://")))
+    url += strlen("file://");
+  else if(url[0] != '/')
+    return;
+
+  hts_mutex_lock(&indexer_mutex);
+
+  if((wd = inotify_add_watch(inotify_fd, url, INDEXER_WATCH_MASK)) == -1) {
+    if(errno == ENOSPC && !indexer_need_polling) {
+      TRACE(TRACE_INFO, "Indexer",
+            "inotify watch limit reached at %s, "
+            "falling back to periodic rescanning", url);
+      indexer_need_polling = 1;
+    }
+  } else if(watch_find(wd) == NULL) {
+    iw = malloc(sizeof(indexer_watch_t));
+    iw->iw_wd = wd;
+    iw->iw_url = malloc(strlen(url) + strlen("file://") + 1);
+    sprintf(iw->iw_url, "file://%s", url);
+    LIST_INSERT_HEAD(&watches[wd & (INDEXER_WATCH_HASH_SIZE - 1)],
+                     iw, iw_link);
+  }
+  hts_mutex_unlock(&indexer_mutex);
+}
+
+
+/**
+ * Watch all directories below the given root that were indexed during
+ * an earlier run. They are not indexed again unless they change, so
+ * index_path() won't add watches for them
+ */
+static void
+indexer_watch_stated(const char *url)
+{
+  char pfx[PATH_MAX];
+  struct item_queue q;
+  item_t *i;
+  sqlite3_stmt *stmt;
+  void *db;
+
+  if(inotify_fd == -1)
+    return;
+
+  db_escape_path_query(pfx, sizeof(pfx), url);
+  TAILQ_INIT(&q);
+
+  db = metadb_get();
+  int rc = db_prepare(db, &stmt,
+                      "SELECT url "
+                      "FROM item "
+                      "WHERE url LIKE ?1 "
+                      "AND contenttype=1 "
+                      "AND indexstatus = ?2");
+  if(!rc) {
+    sqlite3_bind_text(stmt, 1, pfx, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 2, INDEX_STATUS_STATED);
+
+    while(db_step(stmt) == SQLITE_ROW) {
+      i = calloc(1, sizeof(item_t));
+      i->url = strdup((const char *)sqlite3_column_text(stmt, 0));
+      TAILQ_INSERT_TAIL(&q, i, link);
+    }
+    db_finalize(stmt);
+  }
+  metadb_close(db);
+
+  TAILQ_FOREACH(i, &q, link)
+    indexer_watch(i->url);
+
+  free_items(&q);
+}
+
+
+/**
+ * Stop watching everything below the given url
+ *
+ * Must be called with indexer_mutex held
+ */
+static void
+indexer_unwatch_prefix(const char *url)
+{
+  indexer_watch_t *iw, *next;
+  size_t len = strlen(url);
+
+  for(int i = 0; i < INDEXER_WATCH_HASH_SIZE; i++) {
+    for(iw = LIST_FIRST(&watches[i]); iw != NULL; iw = next) {
+      next = LIST_NEXT(iw, iw_link);
+      if(strncmp(iw->iw_url, url, len))
+        continue;
+      inotify_rm_watch(inotify_fd, iw->iw_wd);
+      watch_destroy(iw);
+    }
+  }
+}
+
+
+/**
+ * Must be called with indexer_mutex held
+ */
+static void
+inotify_event(const struct inotify_event *e)
+{
+  indexer_watch_t *iw;
+
+  if(e->mask & IN_Q_OVERFLOW) {
+    TRACE(TRACE_DEBUG, "Indexer", "inotify queue overflow, rescanning");
+    indexer_rescan_all = 1;
+    hts_cond_signal(&indexer_cond);
+    return;
+  }
+
+  if((iw = watch_find(e->wd)) == NULL)
+    return;
+
+  if(e->mask & IN_IGNORED) {
+    watch_destroy(iw);
+    return;
+  }
+
+  if(e->len > 0 && e->name[0] == '.')
+    return; /* Skip all dot-filenames */
+
+  if(e->mask & IN_CREATE && !(e->mask & IN_ISDIR))
+    return; /* Wait for IN_CLOSE_WRITE */
+
+  TRACE(TRACE_DEBUG, "Indexer", "Change in %s (%s)",
+        iw->iw_url, e->len ? e->name : "");
+  mark_dirty(iw->iw_url);
+}
+
+
+/**
+ *
+ */
+static void *
+inotify_thread(void *aux)
+{
+  char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  const struct inotify_event *e;
+  struct pollfd fds;
+  int n;
+
+  fds.fd = inotify_fd;
+  fds.events = POLLIN;
+
+  while(1) {
+    if(poll(&fds, 1, -1) < 0) {
+      if(errno == EINTR)
+        continue;
+      break;
+    }
+
+    n = read(inotify_fd, buf, sizeof(buf));
+    if(n <= 0) {
+      if(n < 0 && errno == EINTR)
+        continue;
+      break;
+    }
+
+    hts_mutex_lock(&indexer_mutex);
+    for(char *p = buf; p < buf + n;
+        p += sizeof(struct inotify_event) + e->len) {
+      e = (const struct inotify_event *)p;
+      inotify_event(e);
+    }
+    hts_mutex_unlock(&indexer_mutex);
+  }
+
+  TRACE(TRACE_ERROR, "Indexer", "inotify failed -- %s", strerror(errno));
+  hts_mutex_lock(&indexer_mutex);
+  indexer_need_polling = 1;
+  hts_mutex_unlock(&indexer_mutex);
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static void
+indexer_notify_init(void)
+{
+  for(int i = 0; i < INDEXER_WATCH_HASH_SIZE; i++)
+    LIST_INIT(&watches[i]);
+
+  if((inotify_fd = inotify_init()) == -1) {
+    TRACE(TRACE_INFO, "Indexer",
+          "Unable to initialize inotify -- %s, "
+          "falling back to periodic rescanning", strerror(errno));
+    indexer_need_polling = 1;
+    return;
+  }
+
+  hts_thread_create_detached("indexer notify", inotify_thread, NULL,
+			     THREAD_PRIO_METADATA_BG);
+}
+
+#endif
+
+
 /**
  *
  */
@@ -239,8 +653,14 @@ fa_indexer_enable(const char *url, int on)
     }
   } else {
     if(ir != NULL) {
+#if ENABLE_INOTIFY
+      if(inotify_fd != -1)
+        indexer_unwatch_prefix(ir->ir_url);
+#endif
       TAILQ_REMOVE(&roots, ir, ir_link);
       ir_release(ir);
+      indexer_nameindex_stale = 1;
+      hts_cond_signal(&indexer_cond);
       TRACE(TRACE_DEBUG, "Indexer", "Removing indexed root at %s", url);
       save_state();
     }
@@ -261,7 +681,13 @@ indexer_thread(void *aux)
   hts_mutex_lock(&indexer_mutex);
   while(1) {
   restart:
-    did_something = 0;    
+    if(indexer_rescan_all) {
+      indexer_rescan_all = 0;
+      reset_roots();
+    }
+
+    did_something = do_dirty();
+
     TAILQ_FOREACH(ir, &roots, ir_link) {
       
       ir->ir_refcount++;
@@ -275,6 +701,9 @@ indexer_thread(void *aux)
       hts_mutex_unlock(&indexer_mutex);
 
       if(doroot) {
+#if ENABLE_INOTIFY
+        indexer_watch_stated(ir->ir_url);
+#endif
         index_path(ir->ir_url);
         did_something = 1;
       } else {
@@ -293,8 +722,25 @@ indexer_thread(void *aux)
         goto restart;
     }
 
-    if(!did_something)
+    if(did_something || !TAILQ_EMPTY(&dirty_dirs)) {
+      indexer_nameindex_stale = 1;
+      continue;
+    }
+
+    if(indexer_nameindex_stale) {
+      indexer_nameindex_stale = 0;
+      update_nameindex();
+      continue;
+    }
+
+    if(!indexer_need_polling) {
       hts_cond_wait(&indexer_cond, &indexer_mutex);
+      continue;
+    }
+
+    if(hts_cond_wait_timeout(&indexer_cond, &indexer_mutex,
+                             INDEXER_RESCAN_INTERVAL * 1000))
+      indexer_rescan_all = 1;
   }
   return NULL;
 }
@@ -307,8 +753,10 @@ void
 fa_indexer_init(void)
 {
   TAILQ_INIT(&roots);
+  TAILQ_INIT(&dirty_dirs);
   hts_mutex_init(&indexer_mutex);
   hts_cond_init(&indexer_cond, &indexer_mutex);
+  fa_nameindex_init();
 
   htsmsg_t *m = htsmsg_store_load("indexer");
   if(m != NULL) {
@@ -327,6 +775,12 @@ fa_indexer_init(void)
     htsmsg_destroy(m);
   }
 
+#if ENABLE_INOTIFY
+  indexer_notify_init();
+#else
+  indexer_need_polling = 1;
+#endif
+
   hts_thread_create_detached("indexer", indexer_thread, NULL,
 			     THREAD_PRIO_METADATA_BG);
 }
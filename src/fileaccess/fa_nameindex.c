@@ -0,0 +1,630 @@
+/*
+ *  Index of file names in indexed roots
+ *  Copyright (C) 2013 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+
+#include "showtime.h"
+#include "backend/backend.h"
+#include "backend/search.h"
+#include "metadata/metadata.h"
+#include "db/db_support.h"
+#include "misc/str.h"
+#include "settings.h"
+#include "htsmsg/htsmsg_store.h"
+#include "fileaccess.h"
+#include "fa_nameindex.h"
+
+/**
+ * In-memory index of the names of all audio and video files below the
+ * indexed roots, used for searching local files.
+ *
+ * The index is an immutable snapshot built from the item table in
+ * metadb. The indexer rebuilds it when it goes idle after finding
+ * changes, so searches never touch the filesystem. Files that the
+ * library search (browsemdb.c) already lists with their metadata are
+ * left out of the hits.
+ *
+ * Names are stored casefolded and without diacritics (utf8_fold()),
+ * sorted, in one string table. For each trigram (hashed into
+ * NAMEINDEX_TRIGRAM_SIZE buckets) there is a posting list of the
+ * entries containing it, stored as delta coded varints. A query picks
+ * the smallest posting list of any trigram in the query and verifies
+ * each candidate with strstr(). Hash collisions are thus harmless.
+ */
+
+#define NAMEINDEX_TRIGRAM_BITS 16
+#define NAMEINDEX_TRIGRAM_SIZE (1 << NAMEINDEX_TRIGRAM_BITS)
+#define NAMEINDEX_MAX_HITS     500
+
+typedef struct nameindex_entry {
+  uint32_t ne_url;           // Offset in ni_strings
+  uint32_t ne_name;          // Offset of folded name in ni_strings
+  uint8_t ne_contenttype;
+} nameindex_entry_t;
+
+
+typedef struct nameindex {
+  int ni_refcount;
+  int ni_num_entries;
+  nameindex_entry_t *ni_entries;
+  char *ni_strings;
+  uint32_t *ni_post_offset;  // NAMEINDEX_TRIGRAM_SIZE + 1 entries
+  uint32_t *ni_post_count;   // NAMEINDEX_TRIGRAM_SIZE entries
+  uint8_t *ni_postings;
+} nameindex_t;
+
+
+static hts_mutex_t nameindex_mutex;
+static nameindex_t *nameindex_current;
+static int nameindex_enabled;
+
+
+/**
+ *
+ */
+static inline unsigned int
+trigram(const char *s)
+{
+  const uint8_t *u = (const uint8_t *)s;
+  uint32_t x = (u[0] << 16) | (u[1] << 8) | u[2];
+  return (x * 2654435761U) >> (32 - NAMEINDEX_TRIGRAM_BITS);
+}
+
+
+/**
+ *
+ */
+static int
+varint_len(uint32_t v)
+{
+  int l = 1;
+  while(v >= 0x80) {
+    v >>= 7;
+    l++;
+  }
+  return l;
+}
+
+
+/**
+ *
+ */
+static uint8_t *
+varint_put(uint8_t *p, uint32_t v)
+{
+  while(v >= 0x80) {
+    *p++ = v | 0x80;
+    v >>= 7;
+  }
+  *p++ = v;
+  return p;
+}
+
+
+/**
+ *
+ */
+static const uint8_t *
+varint_get(const uint8_t *p, uint32_t *vp)
+{
+  uint32_t v = 0;
+  int shift = 0;
+  while(*p & 0x80) {
+    v |= (*p++ & 0x7f) << shift;
+    shift += 7;
+  }
+  *vp = v | (*p++ << shift);
+  return p;
+}
+
+
+/**
+ *
+ */
+static void
+nameindex_release(nameindex_t *ni)
+{
+  if(ni == NULL)
+    return;
+
+  hts_mutex_lock(&nameindex_mutex);
+  int r = --ni->ni_refcount;
+  hts_mutex_unlock(&nameindex_mutex);
+
+  if(r)
+    return;
+
+  free(ni->ni_entries);
+  free(ni->ni_strings);
+  free(ni->ni_post_offset);
+  free(ni->ni_post_count);
+  free(ni->ni_postings);
+  free(ni);
+}
+
+
+/**
+ *
+ */
+static nameindex_t *
+nameindex_get(void)
+{
+  nameindex_t *ni;
+  hts_mutex_lock(&nameindex_mutex);
+  ni = nameindex_current;
+  if(ni != NULL)
+    ni->ni_refcount++;
+  hts_mutex_unlock(&nameindex_mutex);
+  return ni;
+}
+
+
+/**
+ * Index building
+ */
+typedef struct nameindex_tmp {
+  char *url;
+  char *name;
+  int contenttype;
+} nameindex_tmp_t;
+
+
+/**
+ *
+ */
+static int
+tmp_cmp(const void *A, const void *B)
+{
+  const nameindex_tmp_t *a = A, *b = B;
+  return strcmp(a->name, b->name);
+}
+
+
+/**
+ *
+ */
+static void
+collect_root(void *db, const char *root, nameindex_tmp_t **vp, int *np,
+             int *capp)
+{
+  char pfx[PATH_MAX];
+  sqlite3_stmt *stmt;
+
+  int rc = db_prepare(db, &stmt,
+                      "SELECT url, contenttype "
+                      "FROM item "
+                      "WHERE url LIKE ?1 "
+                      "AND contenttype IN (4, 5, 7)"); // Audio, video, DVD
+  if(rc != SQLITE_OK)
+    return;
+
+  db_escape_path_query(pfx, sizeof(pfx), root);
+  sqlite3_bind_text(stmt, 1, pfx, -1, SQLITE_STATIC);
+
+  while(db_step(stmt) == SQLITE_ROW) {
+    const char *url = (const char *)sqlite3_column_text(stmt, 0);
+    const char *name;
+
+    if(url == NULL || strstr(url, "/.") != NULL)
+      continue;
+
+    name = strrchr(url, '/');
+    name = name ? name + 1 : url;
+    if(!*name)
+      continue;
+
+    if(*np == *capp) {
+      *capp = MAX(*capp * 2, 1024);
+      *vp = realloc(*vp, *capp * sizeof(nameindex_tmp_t));
+    }
+
+    nameindex_tmp_t *t = *vp + *np;
+    t->url = strdup(url);
+    t->name = utf8_fold(name);
+    t->contenttype = sqlite3_column_int(stmt, 1);
+    (*np)++;
+  }
+  db_finalize(stmt);
+}
+
+
+/**
+ * Add trigrams of entry 'idx' to the posting lists. If 'out' is NULL
+ * we just count the number of bytes needed
+ */
+static void
+add_postings(nameindex_t *ni, uint32_t *last, uint8_t **out,
+             const char *name, uint32_t idx)
+{
+  int len = strlen(name);
+  int i;
+
+  for(i = 0; i + 3 <= len; i++) {
+    unsigned int t = trigram(name + i);
+    if(last[t] == idx)
+      continue;
+
+    uint32_t delta = last[t] == UINT32_MAX ? idx : idx - last[t];
+    last[t] = idx;
+
+    if(out == NULL) {
+      ni->ni_post_offset[t + 1] += varint_len(delta);
+      ni->ni_post_count[t]++;
+    } else {
+      out[t] = varint_put(out[t], delta);
+    }
+  }
+}
+
+
+/**
+ * Build a new index from all items below the given roots and make it
+ * current. Called from the indexer thread
+ */
+void
+fa_nameindex_rebuild(const char **roots)
+{
+  nameindex_tmp_t *v = NULL;
+  int num = 0, cap = 0, i;
+  size_t strsize = 0;
+  int64_t ts = showtime_get_ts();
+  void *db = metadb_get();
+
+  if(db == NULL)
+    return;
+
+  for(; roots != NULL && *roots != NULL; roots++)
+    collect_root(db, *roots, &v, &num, &cap);
+  metadb_close(db);
+
+  qsort(v, num, sizeof(nameindex_tmp_t), tmp_cmp);
+
+  nameindex_t *ni = calloc(1, sizeof(nameindex_t));
+  ni->ni_refcount = 1;
+  ni->ni_num_entries = num;
+  ni->ni_entries = malloc(num * sizeof(nameindex_entry_t));
+
+  for(i = 0; i < num; i++)
+    strsize += strlen(v[i].url) + strlen(v[i].name) + 2;
+
+  ni->ni_strings = malloc(strsize);
+  char *s = ni->ni_strings;
+
+  for(i = 0; i < num; i++) {
+    nameindex_entry_t *ne = &ni->ni_entries[i];
+    ne->ne_contenttype = v[i].contenttype;
+    ne->ne_url = s - ni->ni_strings;
+    s = stpcpy(s, v[i].url) + 1;
+    ne->ne_name = s - ni->ni_strings;
+    s = stpcpy(s, v[i].name) + 1;
+    free(v[i].url);
+    free(v[i].name);
+  }
+  free(v);
+
+  // Posting lists, first pass counts and second pass fills in
+
+  uint32_t *last = malloc(NAMEINDEX_TRIGRAM_SIZE * sizeof(uint32_t));
+  uint8_t **out = malloc(NAMEINDEX_TRIGRAM_SIZE * sizeof(uint8_t *));
+  ni->ni_post_offset = calloc(NAMEINDEX_TRIGRAM_SIZE + 1, sizeof(uint32_t));
+  ni->ni_post_count  = calloc(NAMEINDEX_TRIGRAM_SIZE, sizeof(uint32_t));
+
+  memset(last, 0xff, NAMEINDEX_TRIGRAM_SIZE * sizeof(uint32_t));
+  for(i = 0; i < num; i++)
+    add_postings(ni, last, NULL,
+                 ni->ni_strings + ni->ni_entries[i].ne_name, i);
+
+  for(i = 0; i < NAMEINDEX_TRIGRAM_SIZE; i++)
+    ni->ni_post_offset[i + 1] += ni->ni_post_offset[i];
+
+  ni->ni_postings = malloc(ni->ni_post_offset[NAMEINDEX_TRIGRAM_SIZE] + 1);
+
+  for(i = 0; i < NAMEINDEX_TRIGRAM_SIZE; i++)
+    out[i] = ni->ni_postings + ni->ni_post_offset[i];
+
+  memset(last, 0xff, NAMEINDEX_TRIGRAM_SIZE * sizeof(uint32_t));
+  for(i = 0; i < num; i++)
+    add_postings(ni, last, out,
+                 ni->ni_strings + ni->ni_entries[i].ne_name, i);
+
+  free(last);
+  free(out);
+
+  TRACE(TRACE_DEBUG, "nameindex",
+        "Indexed %d files (%zd bytes names, %d bytes postings) in %dms",
+        num, strsize, ni->ni_post_offset[NAMEINDEX_TRIGRAM_SIZE],
+        (int)((showtime_get_ts() - ts) / 1000));
+
+  hts_mutex_lock(&nameindex_mutex);
+  nameindex_t *old = nameindex_current;
+  nameindex_current = ni;
+  hts_mutex_unlock(&nameindex_mutex);
+  nameindex_release(old);
+}
+
+
+/**
+ * Searching
+ */
+typedef struct nameindex_search {
+  char *nis_query;
+  char **nis_words;
+  prop_t *nis_nodes;
+  prop_sub_t *nis_sub;
+  prop_courier_t *nis_pc;
+  int nis_run;
+
+  prop_t *nis_classnodes[2];
+  prop_t *nis_entries[2];
+} nameindex_search_t;
+
+
+/**
+ *
+ */
+static void
+nis_destroy(nameindex_search_t *nis)
+{
+  int i;
+  for(i = 0; i < 2; i++) {
+    if(nis->nis_classnodes[i] != NULL)
+      prop_ref_dec(nis->nis_classnodes[i]);
+    if(nis->nis_entries[i] != NULL)
+      prop_ref_dec(nis->nis_entries[i]);
+  }
+  prop_unsubscribe(nis->nis_sub);
+  prop_courier_destroy(nis->nis_pc);
+  prop_ref_dec(nis->nis_nodes);
+  strvec_free(nis->nis_words);
+  free(nis->nis_query);
+  free(nis);
+}
+
+
+/**
+ *
+ */
+static void
+nis_nodesub(void *opaque, prop_event_t event, ...)
+{
+  nameindex_search_t *nis = opaque;
+
+  if(event == PROP_DESTROYED)
+    nis->nis_run = 0;
+}
+
+
+/**
+ *
+ */
+static int
+nis_match(nameindex_search_t *nis, const char *name)
+{
+  char **w;
+  for(w = nis->nis_words; *w != NULL; w++)
+    if(strstr(name, *w) == NULL)
+      return 0;
+  return 1;
+}
+
+
+/**
+ *
+ */
+static int
+nis_listed(char **urls, const char *url)
+{
+  for(; urls != NULL && *urls != NULL; urls++)
+    if(!strcmp(*urls, url))
+      return 1;
+  return 0;
+}
+
+
+/**
+ * Returns -1 if the search has been cancelled
+ */
+static int
+nis_add(nameindex_search_t *nis, const char *url, int ctype)
+{
+  const int t = ctype == CONTENT_AUDIO ? 0 : 1;
+  char fname[512];
+
+  if(nis->nis_classnodes[t] == NULL &&
+     search_class_create(nis->nis_nodes, &nis->nis_classnodes[t],
+                         &nis->nis_entries[t],
+                         t ? "Local video files" : "Local audio files",
+                         NULL))
+    return -1;
+
+  prop_add_int(nis->nis_entries[t], 1);
+
+  prop_t *p = prop_create_root(NULL);
+  prop_set(p, "url", PROP_SET_STRING, url);
+  prop_set(p, "type", PROP_SET_STRING, content2type(ctype));
+
+  fa_url_get_last_component(fname, sizeof(fname), url);
+  rstr_t *title = metadata_remove_postfix(fname);
+  prop_setv(p, "metadata", "title", NULL, PROP_SET_RSTRING, title);
+  rstr_release(title);
+
+  if(prop_set_parent(p, nis->nis_classnodes[t])) {
+    prop_destroy(p);
+    return -1;
+  }
+  return 0;
+}
+
+
+/**
+ *
+ */
+static void *
+nameindex_searcher(void *aux)
+{
+  nameindex_search_t *nis = aux;
+  nameindex_t *ni = nameindex_get();
+  const uint8_t *p = NULL, *end = NULL;
+  uint32_t idx = 0, delta;
+  int hits = 0, checked = 0;
+  int64_t ts = showtime_get_ts();
+  char **w;
+
+  if(ni == NULL) {
+    nis_destroy(nis);
+    return NULL;
+  }
+
+  // Files that the library search shows with their metadata
+  char **listed = library_search_urls(nis->nis_query);
+
+  // Find the rarest trigram in the query
+
+  uint32_t best = UINT32_MAX;
+
+  for(w = nis->nis_words; *w != NULL; w++) {
+    const int len = strlen(*w);
+    int i;
+    for(i = 0; i + 3 <= len; i++) {
+      unsigned int t = trigram(*w + i);
+      if(ni->ni_post_count[t] < best) {
+        best = ni->ni_post_count[t];
+        p   = ni->ni_postings + ni->ni_post_offset[t];
+        end = ni->ni_postings + ni->ni_post_offset[t + 1];
+      }
+    }
+  }
+
+  while(nis->nis_run && hits < NAMEINDEX_MAX_HITS) {
+
+    if(p != NULL) {
+      // Walk posting list
+      if(p >= end)
+        break;
+      p = varint_get(p, &delta);
+      idx += delta;
+    } else {
+      // No trigram in query, check all entries
+      if(checked == ni->ni_num_entries)
+        break;
+      idx = checked;
+    }
+
+    if((++checked & 0xff) == 0)
+      prop_courier_poll(nis->nis_pc);
+
+    const nameindex_entry_t *ne = &ni->ni_entries[idx];
+    if(!nis_match(nis, ni->ni_strings + ne->ne_name) ||
+       nis_listed(listed, ni->ni_strings + ne->ne_url))
+      continue;
+
+    if(nis_add(nis, ni->ni_strings + ne->ne_url, ne->ne_contenttype))
+      break;
+    hits++;
+  }
+
+  TRACE(TRACE_DEBUG, "nameindex", "Search %d hits, %d checked in %dµs",
+        hits, checked, (int)(showtime_get_ts() - ts));
+
+  if(listed != NULL)
+    strvec_free(listed);
+  nameindex_release(ni);
+  nis_destroy(nis);
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static void
+nameindex_search(prop_t *model, const char *query)
+{
+  char *q, *s, *tok;
+
+  if(!nameindex_enabled)
+    return;
+
+  nameindex_search_t *nis = calloc(1, sizeof(nameindex_search_t));
+
+  q = utf8_fold(query);
+  for(tok = strtok_r(q, " \t", &s); tok != NULL; tok = strtok_r(NULL, " \t", &s))
+    strvec_addp(&nis->nis_words, tok);
+  free(q);
+
+  if(nis->nis_words == NULL) {
+    free(nis);
+    return;
+  }
+
+  nis->nis_run = 1;
+  nis->nis_query = strdup(query);
+  nis->nis_nodes = prop_ref_inc(prop_create(model, "nodes"));
+  nis->nis_pc = prop_courier_create_passive();
+  nis->nis_sub =
+    prop_subscribe(PROP_SUB_TRACK_DESTROY,
+		   PROP_TAG_CALLBACK, nis_nodesub, nis,
+		   PROP_TAG_ROOT, nis->nis_nodes,
+		   PROP_TAG_COURIER, nis->nis_pc,
+		   NULL);
+
+  hts_task_run("nameindex search", nameindex_searcher, nis,
+               THREAD_PRIO_MODEL);
+}
+
+
+/**
+ * Called from fa_indexer_init() as the indexer may rebuild the index
+ * before backends are initialized
+ */
+void
+fa_nameindex_init(void)
+{
+  hts_mutex_init(&nameindex_mutex);
+}
+
+
+/**
+ *
+ */
+static int
+nameindex_init(void)
+{
+  htsmsg_t *store = htsmsg_store_load("nameindex") ?: htsmsg_create_map();
+  prop_t *s = search_get_settings();
+
+  settings_create_bool(s, "localfiles", _p("Search local media files"), 1,
+		       store, settings_generic_set_bool, &nameindex_enabled,
+		       SETTINGS_INITIAL_UPDATE, NULL,
+		       settings_generic_save_settings, (void *)"nameindex");
+  return 0;
+}
+
+
+/**
+ *
+ */
+backend_t be_nameindex = {
+  .be_init = nameindex_init,
+  .be_search = nameindex_search
+};
+
+BE_REGISTER(nameindex);
@@ -45,6 +45,7 @@
 #include "blobcache.h"
 #include "htsmsg/htsbuf.h"
 #include "htsmsg/htsmsg_store.h"
+#include "htsmsg/htsmsg_json.h"
 #include "fa_indexer.h"
 #include "settings.h"
 #include "notifications.h"
@@ -309,12 +310,23 @@ fa_fsize(void *fh_)
  */
 int
 fa_stat(const char *url, struct fa_stat *buf, char *errbuf, size_t errsize)
+{
+  return fa_stat_vpaths(url, NULL, buf, errbuf, errsize);
+}
+
+
+/**
+ *
+ */
+int
+fa_stat_vpaths(const char *url, const char **vpaths, struct fa_stat *buf,
+	       char *errbuf, size_t errsize)
 {
   fa_protocol_t *fap;
   char *filename;
   int r;
 
-  if((filename = fa_resolve_proto(url, &fap, NULL, errbuf, errsize)) == NULL)
+  if((filename = fa_resolve_proto(url, &fap, vpaths, errbuf, errsize)) == NULL)
     return -1;
 
   r = fap->fap_stat(fap, filename, buf, errbuf, errsize, 0);
@@ -1011,7 +1023,7 @@ fa_load(const char *url, const char **vpaths,
     }
 
     if(cache_control == BYPASS_CACHE)
-      blobcache_get_meta(url, "fa_load", &etag, &mtime);
+      blobcache_get_meta(url, "fa_load", &etag, &mtime, NULL);
     
     data2 = fap->fap_load(fap, filename, errbuf, errlen,
 			  &etag, &mtime, &max_age, flags, cb, opaque);
@@ -1275,6 +1287,43 @@ fa_load_query(const char *url0,
 }
 
 
+/**
+ * Load and parse a JSON document. Data is handed to the parser as it
+ * is read so the document itself is never kept in memory. If 'paths'
+ * is not NULL only those are kept, see htsmsg_json_parser_create()
+ */
+htsmsg_t *
+fa_load_json(const char *url, const char **paths,
+             char *errbuf, size_t errlen, int flags)
+{
+  char buf[4096];
+  int r;
+  htsmsg_json_parser_t *hjp;
+  htsmsg_t *m;
+  fa_handle_t *fh = fa_open_ex(url, errbuf, errlen, flags | FA_STREAMING,
+                               NULL);
+  if(fh == NULL)
+    return NULL;
+
+  hjp = htsmsg_json_parser_create(paths);
+
+  while((r = fa_read(fh, buf, sizeof(buf))) > 0)
+    if(htsmsg_json_parser_feed(hjp, buf, r))
+      break; // Error is reported by htsmsg_json_parser_finish()
+
+  fa_close(fh);
+
+  m = htsmsg_json_parser_finish(hjp, errbuf, errlen);
+  if(r < 0) {
+    snprintf(errbuf, errlen, "Read error");
+    if(m != NULL)
+      htsmsg_destroy(m);
+    return NULL;
+  }
+  return m;
+}
+
+
 /**
  *
  */
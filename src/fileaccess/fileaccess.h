@@ -164,6 +164,8 @@ int64_t fa_seek(void *fh, int64_t pos, int whence);
 int64_t fa_fsize(void *fh);
 int fa_seek_is_fast(void *fh);
 int fa_stat(const char *url, struct fa_stat *buf, char *errbuf, size_t errsize);
+int fa_stat_vpaths(const char *url, const char **vpaths, struct fa_stat *buf,
+		   char *errbuf, size_t errsize);
 int fa_findfile(const char *path, const char *file, 
 		char *fullpath, size_t fullpathlen);
 
@@ -201,6 +203,10 @@ buf_t *fa_load_query(const char *url,
                      char *errbuf, size_t errlen, int *cache_control,
                      const char **arguments, int flags);
 
+struct htsmsg;
+struct htsmsg *fa_load_json(const char *url, const char **paths,
+                            char *errbuf, size_t errlen, int flags);
+
 int fa_parent(char *dst, size_t dstlen, const char *url);
 
 struct backend;
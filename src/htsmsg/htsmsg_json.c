@@ -220,3 +220,279 @@ htsmsg_json_deserialize(const char *src)
 {
   return json_deserialize(src, &json_to_htsmsg, NULL, NULL, 0);
 }
+
+
+/**
+ * Incremental JSON -> htsmsg
+ *
+ * If paths are given only values at those paths (and everything below
+ * them) are added to the resulting message. Paths are '/' separated
+ * and a '*' component matches any key or any list element. So
+ * results, '*' and title joined with '/' gives a map with a "results"
+ * list containing maps that only have the "title" field.
+ */
+
+#define HJP_MAX_PATHS 64
+
+typedef struct hjp_frame {
+  htsmsg_t *msg;  // NULL if the container is not wanted
+  char *name;
+  int full;       // Everything below is wanted
+  uint64_t paths; // Paths that match so far (bit per path)
+} hjp_frame_t;
+
+struct htsmsg_json_parser {
+  json_parser_t *hjp_jp;
+  const char **hjp_paths;
+  int hjp_depth;
+  hjp_frame_t hjp_stack[JSON_MAX_DEPTH];
+  // What is left of each path below the container at each depth
+  const char *hjp_rest[JSON_MAX_DEPTH][HJP_MAX_PATHS];
+  htsmsg_t *hjp_result;
+};
+
+
+/**
+ * Returns pointer to next component of 'p' if the first one matches
+ * 'name', NULL otherwise
+ */
+static const char *
+hjp_match_component(const char *p, const char *name)
+{
+  const char *e = strchr(p, '/');
+  size_t len = e ? e - p : strlen(p);
+
+  if(!(len == 1 && *p == '*') &&
+     (name == NULL || strlen(name) != len || memcmp(name, p, len)))
+    return NULL;
+  return e ? e + 1 : p + len;
+}
+
+
+/**
+ * Returns 2 if the value 'name' in the innermost container is wanted in
+ * full, 1 if a wanted path is below it and 0 if not wanted at all.
+ *
+ * For containers ('pathsp' != NULL) the paths that continue below it
+ * are returned and what is left of them stored for the next depth
+ */
+static int
+hjp_want(htsmsg_json_parser_t *hjp, const char *name, uint64_t *pathsp)
+{
+  const hjp_frame_t *f;
+  const char **rest, **next;
+  uint64_t m = 0;
+  int i;
+
+  if(hjp->hjp_depth == 0) {
+    // The root is not part of the path
+    if(hjp->hjp_paths == NULL)
+      return 2;
+    for(i = 0; hjp->hjp_paths[i] != NULL; i++) {
+      hjp->hjp_rest[0][i] = hjp->hjp_paths[i];
+      m |= 1ULL << i;
+    }
+    *pathsp = m;
+    return 1;
+  }
+
+  f = &hjp->hjp_stack[hjp->hjp_depth - 1];
+  if(f->msg == NULL)
+    return 0;
+  if(f->full)
+    return 2;
+
+  rest = hjp->hjp_rest[hjp->hjp_depth - 1];
+  next = hjp->hjp_rest[hjp->hjp_depth];
+
+  for(i = 0; i < HJP_MAX_PATHS && f->paths >> i; i++) {
+    if(!(f->paths & (1ULL << i)))
+      continue;
+    const char *p = hjp_match_component(rest[i], name);
+    if(p == NULL)
+      continue;
+    if(*p == 0)
+      return 2;
+    m |= 1ULL << i;
+    if(pathsp != NULL)
+      next[i] = p;
+  }
+
+  if(pathsp == NULL)
+    return 0; // Only a container can lead to a wanted path
+  *pathsp = m;
+  return m ? 1 : 0;
+}
+
+
+/**
+ *
+ */
+static void
+hjp_begin(htsmsg_json_parser_t *hjp, const char *name, int islist)
+{
+  uint64_t paths = 0;
+  const int want = hjp_want(hjp, name, &paths);
+  hjp_frame_t *f = &hjp->hjp_stack[hjp->hjp_depth++];
+
+  if(want) {
+    f->msg = islist ? htsmsg_create_list() : htsmsg_create_map();
+    f->name = name ? strdup(name) : NULL;
+  } else {
+    f->msg = NULL;
+    f->name = NULL;
+  }
+  f->full = want == 2;
+  f->paths = paths;
+}
+
+static void
+hjp_begin_map(void *opaque, const char *name)
+{
+  hjp_begin(opaque, name, 0);
+}
+
+static void
+hjp_begin_list(void *opaque, const char *name)
+{
+  hjp_begin(opaque, name, 1);
+}
+
+static void
+hjp_end(void *opaque)
+{
+  htsmsg_json_parser_t *hjp = opaque;
+  hjp_frame_t *f = &hjp->hjp_stack[--hjp->hjp_depth];
+
+  if(f->msg != NULL) {
+    if(hjp->hjp_depth == 0)
+      hjp->hjp_result = f->msg;
+    else
+      htsmsg_add_msg(hjp->hjp_stack[hjp->hjp_depth - 1].msg, f->name, f->msg);
+  }
+  free(f->name);
+}
+
+static htsmsg_t *
+hjp_target(htsmsg_json_parser_t *hjp, const char *name)
+{
+  return hjp_want(hjp, name, NULL) ?
+    hjp->hjp_stack[hjp->hjp_depth - 1].msg : NULL;
+}
+
+static void
+hjp_string(void *opaque, const char *name, const char *str)
+{
+  htsmsg_t *m = hjp_target(opaque, name);
+  if(m != NULL)
+    htsmsg_add_str(m, name, str);
+}
+
+static void
+hjp_long(void *opaque, const char *name, int64_t v)
+{
+  htsmsg_t *m = hjp_target(opaque, name);
+  if(m != NULL)
+    htsmsg_add_s64(m, name, v);
+}
+
+static void
+hjp_double(void *opaque, const char *name, double v)
+{
+  htsmsg_t *m = hjp_target(opaque, name);
+  if(m != NULL)
+    htsmsg_add_dbl(m, name, v);
+}
+
+static void
+hjp_bool(void *opaque, const char *name, int v)
+{
+  htsmsg_t *m = hjp_target(opaque, name);
+  if(m != NULL)
+    htsmsg_add_u32(m, name, v);
+}
+
+static const json_sax_t json_sax_to_htsmsg = {
+  .js_begin_map  = hjp_begin_map,
+  .js_begin_list = hjp_begin_list,
+  .js_end        = hjp_end,
+  .js_string     = hjp_string,
+  .js_long       = hjp_long,
+  .js_double     = hjp_double,
+  .js_bool       = hjp_bool,
+};
+
+
+/**
+ * 'paths' is a NULL terminated array (or NULL for everything) of at
+ * most HJP_MAX_PATHS paths and must stay valid until
+ * htsmsg_json_parser_finish()
+ */
+htsmsg_json_parser_t *
+htsmsg_json_parser_create(const char **paths)
+{
+  int i;
+  for(i = 0; paths != NULL && paths[i] != NULL; i++)
+    assert(i < HJP_MAX_PATHS);
+
+  htsmsg_json_parser_t *hjp = calloc(1, sizeof(htsmsg_json_parser_t));
+  hjp->hjp_paths = paths;
+  hjp->hjp_jp = json_parser_create(&json_sax_to_htsmsg, hjp);
+  return hjp;
+}
+
+
+/**
+ *
+ */
+int
+htsmsg_json_parser_feed(htsmsg_json_parser_t *hjp, const void *data,
+			size_t len)
+{
+  return json_parser_feed(hjp->hjp_jp, data, len);
+}
+
+
+/**
+ * Returns the parsed message and frees the parser
+ */
+htsmsg_t *
+htsmsg_json_parser_finish(htsmsg_json_parser_t *hjp,
+			  char *errbuf, size_t errlen)
+{
+  htsmsg_t *r = hjp->hjp_result;
+  char errbuf0[128];
+
+  if(errbuf == NULL) {
+    errbuf = errbuf0;
+    errlen = sizeof(errbuf0);
+  }
+
+  if(json_parser_finish(hjp->hjp_jp, errbuf, errlen)) {
+    while(hjp->hjp_depth > 0) {
+      hjp_frame_t *f = &hjp->hjp_stack[--hjp->hjp_depth];
+      if(f->msg != NULL)
+	htsmsg_destroy(f->msg);
+      free(f->name);
+    }
+    if(r != NULL)
+      htsmsg_destroy(r);
+    r = NULL;
+  }
+
+  json_parser_destroy(hjp->hjp_jp);
+  free(hjp);
+  return r;
+}
+
+
+/**
+ *
+ */
+htsmsg_t *
+htsmsg_json_deserialize_paths(const char *src, const char **paths)
+{
+  htsmsg_json_parser_t *hjp = htsmsg_json_parser_create(paths);
+  htsmsg_json_parser_feed(hjp, src, strlen(src));
+  return htsmsg_json_parser_finish(hjp, NULL, 0);
+}
@@ -33,4 +33,16 @@ char *htsmsg_json_serialize_to_str(htsmsg_t *msg, int pretty);
 
 struct rstr *htsmsg_json_serialize_to_rstr(htsmsg_t *msg, const char *prefix);
 
+typedef struct htsmsg_json_parser htsmsg_json_parser_t;
+
+htsmsg_json_parser_t *htsmsg_json_parser_create(const char **paths);
+
+int htsmsg_json_parser_feed(htsmsg_json_parser_t *hjp, const void *data,
+			    size_t len);
+
+htsmsg_t *htsmsg_json_parser_finish(htsmsg_json_parser_t *hjp,
+				    char *errbuf, size_t errlen);
+
+htsmsg_t *htsmsg_json_deserialize_paths(const char *src, const char **paths);
+
 #endif /* HTSMSG_JSON_H_ */
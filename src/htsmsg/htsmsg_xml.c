@@ -82,6 +82,11 @@ typedef struct xmlparser {
 
   struct xmlns_list xp_namespaces;
 
+  int xp_depth;
+  int xp_emit_depth;
+  htsmsg_xml_emit_t *xp_emit;
+  void *xp_emit_opaque;
+
 } xmlparser_t;
 
 #define xmlerr(xp, fmt...) \
@@ -372,8 +377,11 @@ htsmsg_xml_parse_tag(xmlparser_t *xp, htsmsg_t *parent, char *src)
     htsmsg_destroy(attrs);
   }
 
+  xp->xp_depth++;
   if(!empty)
     src = htsmsg_xml_parse_cd(xp, m, src);
+  const int emit = xp->xp_emit != NULL && xp->xp_depth == xp->xp_emit_depth;
+  xp->xp_depth--;
 
   for(i = 0; i < taglen - 1; i++) {
     if(tagname[i] == ':') {
@@ -388,7 +396,12 @@ htsmsg_xml_parse_tag(xmlparser_t *xp, htsmsg_t *parent, char *src)
 	  n[ns->xmlns_norm_len + llen] = 0;
 	  memcpy(n, ns->xmlns_norm, ns->xmlns_norm_len);
 	  memcpy(n + ns->xmlns_norm_len, tagname + i + 1, llen);
-	  htsmsg_add_msg(parent, n, m);
+	  if(emit) {
+	    xp->xp_emit(xp->xp_emit_opaque, n, m);
+	    htsmsg_destroy(m);
+	  } else {
+	    htsmsg_add_msg(parent, n, m);
+	  }
 	  free(n);
 	  goto done;
 	}
@@ -396,9 +409,14 @@ htsmsg_xml_parse_tag(xmlparser_t *xp, htsmsg_t *parent, char *src)
     }
   }
 
-  xp->xp_srcdataused = 1;
   tagname[taglen] = 0;
-  htsmsg_add_msg_extname(parent, tagname, m);
+  if(emit) {
+    xp->xp_emit(xp->xp_emit_opaque, tagname, m);
+    htsmsg_destroy(m);
+  } else {
+    xp->xp_srcdataused = 1;
+    htsmsg_add_msg_extname(parent, tagname, m);
+  }
 
  done:
   while((ns = LIST_FIRST(&nslist)) != NULL)
@@ -821,7 +839,7 @@ htsmsg_xml_deserialize(char *src, char *errbuf, size_t errbufsize)
   char *src0 = src;
   int i;
 
-  xp.xp_errmsg[0] = 0;
+  memset(&xp, 0, sizeof(xp));
   xp.xp_encoding = XML_ENCODING_UTF8;
   LIST_INIT(&xp.xp_namespaces);
 
@@ -875,7 +893,7 @@ htsmsg_xml_deserialize_buf2(buf_t *buf, char *errbuf, size_t errbufsize)
 
   buf = buf_make_writable(buf);
 
-  xp.xp_errmsg[0] = 0;
+  memset(&xp, 0, sizeof(xp));
   xp.xp_encoding = XML_ENCODING_UTF8;
   LIST_INIT(&xp.xp_namespaces);
   src = buf->b_ptr;
@@ -912,3 +930,58 @@ htsmsg_xml_deserialize_buf2(buf_t *buf, char *errbuf, size_t errbufsize)
   buf_release(buf);
   return NULL;
 }
+
+
+/**
+ * Parse a document but instead of building the complete tree, each
+ * element at nesting level 'depth' (the root element is at level 1) is
+ * handed to 'emit' as soon as its end tag has been parsed. The message
+ * and the strings in it are only valid during the callback.
+ *
+ * This way at most one such element is materialized at any time, and
+ * consumers can act on the first elements before the rest is parsed.
+ *
+ * Takes ownership of 'src' (same as htsmsg_xml_deserialize())
+ */
+int
+htsmsg_xml_parse_elements(char *src, int depth, htsmsg_xml_emit_t *emit,
+			  void *opaque, char *errbuf, size_t errbufsize)
+{
+  htsmsg_t *m;
+  xmlparser_t xp;
+  char *src0 = src;
+  int i;
+
+  memset(&xp, 0, sizeof(xp));
+  xp.xp_encoding = XML_ENCODING_UTF8;
+  LIST_INIT(&xp.xp_namespaces);
+  xp.xp_emit = emit;
+  xp.xp_emit_opaque = opaque;
+  xp.xp_emit_depth = depth;
+
+  if((src = htsmsg_parse_prolog(&xp, src)) == NULL)
+    goto err;
+
+  m = htsmsg_create_map();
+  src = htsmsg_xml_parse_cd(&xp, m, src);
+  htsmsg_destroy(m);
+
+  if(src == NULL)
+    goto err;
+
+  free(src0);
+  return 0;
+
+ err:
+  free(src0);
+  snprintf(errbuf, errbufsize, "%s", xp.xp_errmsg);
+
+  /* Remove any odd chars inside of errmsg */
+  for(i = 0; i < errbufsize; i++) {
+    if(errbuf[i] < 32) {
+      errbuf[i] = 0;
+      break;
+    }
+  }
+  return -1;
+}
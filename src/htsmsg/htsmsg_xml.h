@@ -29,5 +29,10 @@ htsmsg_t *htsmsg_xml_deserialize(char *src, char *errbuf, size_t errsize);
 
 htsmsg_t *htsmsg_xml_deserialize_buf2(buf_t *b, char *errbuf, size_t errsize);
 
+typedef void (htsmsg_xml_emit_t)(void *opaque, const char *name, htsmsg_t *m);
+
+int htsmsg_xml_parse_elements(char *src, int depth, htsmsg_xml_emit_t *emit,
+			      void *opaque, char *errbuf, size_t errsize);
+
 
 #endif /* HTSMSG_XML_H_ */
@@ -27,6 +27,9 @@
 #include "navigator.h"
 #include "fileaccess/fileaccess.h"
 #include "fileaccess/fa_indexer.h"
+#include "backend/search.h"
+#include "misc/str.h"
+#include "library_search.h"
 
 /**
  *
@@ -59,10 +62,10 @@ count_items(void *db, const char *query, const char *url)
   db_escape_path_query(pfx, sizeof(pfx), url);
   sqlite3_bind_text(stmt, 1, pfx, -1, SQLITE_STATIC);
 
-  rc = sqlite3_step(stmt);
+  rc = db_step(stmt);
   if(rc == SQLITE_ROW)
     rval = sqlite3_column_int(stmt, 0);
-  sqlite3_finalize(stmt);
+  db_finalize(stmt);
   return rval;
 }
 
@@ -193,7 +196,7 @@ video_query(bmdb_t *b, void *db)
     add_item(b, url, parent, ct, NULL, 0, NULL, 0);
     rstr_release(ct);
   }
-  sqlite3_finalize(stmt);
+  db_finalize(stmt);
 }
 
 
@@ -233,7 +236,7 @@ albums_query(bmdb_t *b, void *db)
              (const char *)sqlite3_column_text(stmt, 2), 0);
   }
   rstr_release(ct);
-  sqlite3_finalize(stmt);
+  db_finalize(stmt);
 }
 
 
@@ -274,7 +277,7 @@ album_query(bmdb_t *b, void *db)
     rstr_release(artist);
   }
 
-  sqlite3_finalize(stmt);
+  db_finalize(stmt);
 
   rc = db_prepare(db, &stmt, 
                   "SELECT url, audioitem.title, track, duration, "
@@ -302,7 +305,7 @@ album_query(bmdb_t *b, void *db)
              
   }
   rstr_release(ct);
-  sqlite3_finalize(stmt);
+  db_finalize(stmt);
 }
 
 
@@ -338,7 +341,7 @@ artist_query(bmdb_t *b, void *db)
     rstr_release(artist);
   }
 
-  sqlite3_finalize(stmt);
+  db_finalize(stmt);
 
   rc = db_prepare(db, &stmt, 
                   "SELECT id,title "
@@ -362,7 +365,7 @@ artist_query(bmdb_t *b, void *db)
              (const char *)sqlite3_column_text(stmt, 1), 0, NULL, 0);
   }
   rstr_release(ct);
-  sqlite3_finalize(stmt);
+  db_finalize(stmt);
 }
 
 
@@ -400,7 +403,7 @@ artists_query(bmdb_t *b, void *db)
              (const char *)sqlite3_column_text(stmt, 1), 0, NULL, 0);
   }
   rstr_release(ct);
-  sqlite3_finalize(stmt);
+  db_finalize(stmt);
 }
 
 
@@ -558,12 +561,240 @@ library_canhandle(const char *url)
 }
 
 
+/**
+ * Library search
+ *
+ * Queries the FTS index maintained by metadb.c, see library_search.c
+ * for how queries are built and hits are ranked.
+ */
+
+#define LIBRARY_SEARCH_MAX_HITS 100
+
+typedef struct library_search_hit {
+  int64_t id;
+  double score;
+} library_search_hit_t;
+
+typedef struct library_search {
+  char *ls_query;
+  prop_t *ls_nodes;
+} library_search_t;
+
+
+/**
+ *
+ */
+static int
+hit_cmp(const void *A, const void *B)
+{
+  const library_search_hit_t *a = A, *b = B;
+  if(a->score > b->score)
+    return -1;
+  return a->score < b->score;
+}
+
+
+/**
+ *
+ */
+static void
+library_search_add_hit(void *db, int64_t id, prop_t **nodes, prop_t **entries,
+                       prop_t *parent)
+{
+  sqlite3_stmt *stmt;
+  int rc = db_prepare(db, &stmt,
+                      "SELECT item.url, item.contenttype, "
+                      "coalesce(item.usertitle, audioitem.title), "
+                      "artist.title, audioitem.duration "
+                      "FROM item "
+                      "LEFT OUTER JOIN audioitem ON audioitem.item_id = item.id "
+                      "LEFT OUTER JOIN artist ON artist.id = audioitem.artist_id "
+                      "WHERE item.id = ?1");
+  if(rc != SQLITE_OK)
+    return;
+
+  sqlite3_bind_int64(stmt, 1, id);
+
+  if(db_step(stmt) == SQLITE_ROW) {
+    const char *url = (const char *)sqlite3_column_text(stmt, 0);
+    const int ct = sqlite3_column_int(stmt, 1);
+    const char *title = (const char *)sqlite3_column_text(stmt, 2);
+    const char *artist = (const char *)sqlite3_column_text(stmt, 3);
+    const int duration = sqlite3_column_int(stmt, 4);
+    const int t = ct == CONTENT_AUDIO ? 0 : 1;
+
+    if(nodes[t] == NULL &&
+       search_class_create(parent, &nodes[t], &entries[t],
+                           t ? "Videos in library" : "Music in library",
+                           NULL)) {
+      db_finalize(stmt);
+      return;
+    }
+
+    prop_add_int(entries[t], 1);
+
+    prop_t *p = prop_create_root(NULL);
+    prop_t *metadata = prop_create(p, "metadata");
+
+    prop_set(p, "url", PROP_SET_STRING, url);
+    prop_set(p, "type", PROP_SET_STRING, content2type(ct));
+
+    if(artist != NULL)
+      prop_set(metadata, "artist", PROP_SET_STRING, artist);
+    if(duration > 0)
+      prop_set(metadata, "duration", PROP_SET_INT, duration / 1000);
+
+    if(title == NULL) {
+      char fname[512];
+      fa_url_get_last_component(fname, sizeof(fname), url);
+      rstr_t *ft = metadata_remove_postfix(fname);
+      prop_set(metadata, "title", PROP_SET_RSTRING, ft);
+      rstr_release(ft);
+    } else {
+      prop_set(metadata, "title", PROP_SET_STRING, title);
+    }
+
+    if(prop_set_parent(p, nodes[t]))
+      prop_destroy(p);
+  }
+  db_finalize(stmt);
+}
+
+
+/**
+ * Run the query against the index and return the hits, best first
+ */
+static int
+library_search_query(void *db, const char *query, library_search_hit_t **hitsp)
+{
+  library_search_hit_t *hits = NULL;
+  int num_hits = 0, max_hits = 0;
+  sqlite3_stmt *stmt;
+  char *q = library_search_make_query(query);
+
+  if(*q && db_prepare(db, &stmt,
+                      "SELECT docid, matchinfo(itemsearch) "
+                      "FROM itemsearch "
+                      "WHERE itemsearch MATCH ?1") == SQLITE_OK) {
+
+    sqlite3_bind_text(stmt, 1, q, -1, SQLITE_STATIC);
+
+    while(db_step(stmt) == SQLITE_ROW) {
+      if(num_hits == max_hits) {
+        max_hits = MAX(max_hits * 2, 64);
+        hits = realloc(hits, max_hits * sizeof(library_search_hit_t));
+      }
+      hits[num_hits].id = sqlite3_column_int64(stmt, 0);
+      hits[num_hits].score =
+        library_search_score(sqlite3_column_blob(stmt, 1),
+                             sqlite3_column_bytes(stmt, 1));
+      num_hits++;
+    }
+    db_finalize(stmt);
+  }
+
+  TRACE(TRACE_DEBUG, "library", "Search '%s' -> %d hits", q, num_hits);
+  free(q);
+
+  qsort(hits, num_hits, sizeof(library_search_hit_t), hit_cmp);
+  *hitsp = hits;
+  return MIN(num_hits, LIBRARY_SEARCH_MAX_HITS);
+}
+
+
+/**
+ *
+ */
+static void *
+library_search_thread(void *aux)
+{
+  library_search_t *ls = aux;
+  prop_t *nodes[2] = {}, *entries[2] = {};
+  library_search_hit_t *hits = NULL;
+  void *db;
+  int i, num_hits;
+
+  if((db = metadb_get()) == NULL)
+    goto out;
+
+  num_hits = library_search_query(db, ls->ls_query, &hits);
+
+  for(i = 0; i < num_hits; i++)
+    library_search_add_hit(db, hits[i].id, nodes, entries, ls->ls_nodes);
+
+  metadb_close(db);
+
+ out:
+  for(i = 0; i < 2; i++) {
+    if(nodes[i] != NULL)
+      prop_ref_dec(nodes[i]);
+    if(entries[i] != NULL)
+      prop_ref_dec(entries[i]);
+  }
+  free(hits);
+  free(ls->ls_query);
+  prop_ref_dec(ls->ls_nodes);
+  free(ls);
+  return NULL;
+}
+
+
+/**
+ * URLs of the items the library search lists for 'query'. Other
+ * search backends use this to not show the same file twice
+ */
+char **
+library_search_urls(const char *query)
+{
+  library_search_hit_t *hits = NULL;
+  sqlite3_stmt *stmt;
+  char **urls = NULL;
+  void *db;
+  int i, num_hits;
+
+  if((db = metadb_get()) == NULL)
+    return NULL;
+
+  num_hits = library_search_query(db, query, &hits);
+
+  if(num_hits > 0 &&
+     db_prepare(db, &stmt, "SELECT url FROM item WHERE id = ?1") == SQLITE_OK) {
+    for(i = 0; i < num_hits; i++) {
+      sqlite3_bind_int64(stmt, 1, hits[i].id);
+      if(db_step(stmt) == SQLITE_ROW)
+        strvec_addp(&urls, (const char *)sqlite3_column_text(stmt, 0));
+      sqlite3_reset(stmt);
+    }
+    db_finalize(stmt);
+  }
+
+  metadb_close(db);
+  free(hits);
+  return urls;
+}
+
+
+/**
+ *
+ */
+static void
+library_search(prop_t *model, const char *query)
+{
+  library_search_t *ls = malloc(sizeof(library_search_t));
+  ls->ls_query = strdup(query);
+  ls->ls_nodes = prop_create_r(model, "nodes");
+  hts_task_run("library search", library_search_thread, ls,
+               THREAD_PRIO_METADATA);
+}
+
+
 /**
  *
  */
 static backend_t be_library = {
   .be_canhandle = library_canhandle,
   .be_open = library_open,
+  .be_search = library_search,
 };
 
 BE_REGISTER(library);
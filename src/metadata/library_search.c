@@ -0,0 +1,92 @@
+/*
+ *  Showtime mediacenter
+ *  Copyright (C) 2007-2012 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Query building and ranking for the library search index (itemsearch)
+ *
+ * Each word in the query is a prefix match and all words must match.
+ * Hits are ranked by how rare the matching terms are (and in which
+ * column they match) using the matchinfo() data from sqlite.
+ *
+ * Kept apart from browsemdb.c so support/librarysearchbench can use it
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "misc/str.h"
+#include "library_search.h"
+
+
+/**
+ *
+ */
+char *
+library_search_make_query(const char *query)
+{
+  char *f = utf8_fold(query);
+  char *r = malloc(strlen(f) * 2 + 1);
+  const char *s = f;
+  char *d = r;
+  int inword = 0;
+
+  for(; *s; s++) {
+    const int tokenchar = (*s & 0x80) ||
+      (*s >= '0' && *s <= '9') || (*s >= 'a' && *s <= 'z');
+
+    if(tokenchar) {
+      if(!inword && d != r)
+        *d++ = ' ';
+      *d++ = *s;
+    } else if(inword) {
+      *d++ = '*';
+    }
+    inword = tokenchar;
+  }
+  if(inword)
+    *d++ = '*';
+  *d = 0;
+  free(f);
+  return r;
+}
+
+
+/**
+ * Score a hit given matchinfo() in the default 'pcx' format
+ */
+double
+library_search_score(const unsigned int *mi, int size)
+{
+  static const double weights[] = {1.0, 0.75, 0.5}; // title, artist, album
+  const int phrases = mi[0];
+  const int cols = mi[1];
+  double score = 0;
+  int p, c;
+
+  if(size < (2 + phrases * cols * 3) * sizeof(unsigned int) || cols > 3)
+    return 0;
+
+  for(p = 0; p < phrases; p++) {
+    for(c = 0; c < cols; c++) {
+      const unsigned int *x = mi + 2 + (p * cols + c) * 3;
+      if(x[0] && x[1])
+        score += weights[c] * x[0] / (double)x[1];
+    }
+  }
+  return score;
+}
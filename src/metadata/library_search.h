@@ -0,0 +1,26 @@
+/*
+ *  Showtime mediacenter
+ *  Copyright (C) 2007-2012 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRARY_SEARCH_H__
+#define LIBRARY_SEARCH_H__
+
+char *library_search_make_query(const char *query);
+
+double library_search_score(const unsigned int *matchinfo, int size);
+
+#endif // LIBRARY_SEARCH_H__
@@ -30,6 +30,7 @@
 #include "htsmsg/htsmsg_json.h"
 #include "misc/str.h"
 #include "misc/regex.h"
+#include "misc/callout.h"
 #include "api/lastfm.h"
 
 #include "metadata.h"
@@ -332,8 +333,24 @@ metadata_to_proptree(const metadata_t *md, prop_t *proproot,
 
 
 
+/**
+ * Lazy metadata props are loaded by a pool of METADATA_WORKERS threads.
+ *
+ * Items requested by something that is subscribing to the props (ie.
+ * a widget on screen) goes to the high priority queue, most recently
+ * requested first. Everything else goes to the low priority queue.
+ */
+#define METADATA_WORKERS              4
+#define METADATA_PROVIDER_CONCURRENCY 2
+
+#define MLP_PRIO_HIGH 0
+#define MLP_PRIO_LOW  1
+
+#define MLP_RETRY_MAX 60 // Max seconds between retries after temporary errors
+
 TAILQ_HEAD(metadata_lazy_prop_queue, metadata_lazy_prop);
-static struct metadata_lazy_prop_queue mlpqueue;
+static struct metadata_lazy_prop_queue mlpqueue[2];
+static hts_cond_t mlp_cond;
 struct metadata_lazy_prop;
 
 /**
@@ -344,6 +361,7 @@ typedef struct metadata_lazy_class {
   void (*mlc_kill)(struct metadata_lazy_prop *mlp);
   void (*mlc_dtor)(struct metadata_lazy_prop *mlp);
   size_t mlc_alloc_size;
+  int mlc_unlocked;  // mlc_load() is called without metadata_mutex held
 } metadata_lazy_class_t;
 
 
@@ -355,13 +373,31 @@ typedef struct metadata_lazy_prop {
   const metadata_lazy_class_t *mlp_class;
   uint64_t mlp_req_items;
   int16_t mlp_refcount;
+  int16_t mlp_retry_delay;
+  callout_t mlp_retry;
 
   unsigned char mlp_zombie : 1;
   unsigned char mlp_queued : 1;
+  unsigned char mlp_loading : 1;
+  unsigned char mlp_prio : 1;
 
 } metadata_lazy_prop_t;
 
 
+/**
+ * Queries to metadata providers currently in progress
+ */
+LIST_HEAD(metadata_query_list, metadata_query);
+
+typedef struct metadata_query {
+  LIST_ENTRY(metadata_query) mq_link;
+  char *mq_key;
+} metadata_query_t;
+
+static struct metadata_query_list metadata_queries;
+static hts_cond_t metadata_query_cond;
+
+
 /**
  *
  */
@@ -382,12 +418,24 @@ mlp_alloc(const metadata_lazy_class_t *class)
  *
  */
 static void
-mlp_enqueue(metadata_lazy_prop_t *mlp)
+mlp_enqueue(metadata_lazy_prop_t *mlp, int prio)
 {
-  if(mlp->mlp_zombie || mlp->mlp_queued)
+  if(mlp->mlp_zombie)
     return;
-  TAILQ_INSERT_TAIL(&mlpqueue, mlp, mlp_link);
+
+  if(mlp->mlp_queued) {
+    if(prio > mlp->mlp_prio)
+      return;
+    TAILQ_REMOVE(&mlpqueue[mlp->mlp_prio], mlp, mlp_link);
+  }
+
+  mlp->mlp_prio = prio;
+  if(prio == MLP_PRIO_HIGH)
+    TAILQ_INSERT_HEAD(&mlpqueue[prio], mlp, mlp_link);
+  else
+    TAILQ_INSERT_TAIL(&mlpqueue[prio], mlp, mlp_link);
   mlp->mlp_queued = 1;
+  hts_cond_signal(&mlp_cond);
 }
 
 
@@ -400,11 +448,28 @@ mlp_dequeue(metadata_lazy_prop_t *mlp)
   if(!mlp->mlp_queued)
     return;
 
-  TAILQ_REMOVE(&mlpqueue, mlp, mlp_link);
+  TAILQ_REMOVE(&mlpqueue[mlp->mlp_prio], mlp, mlp_link);
   mlp->mlp_queued = 0;
 }
 
 
+/**
+ *
+ */
+static void
+mlp_release(metadata_lazy_prop_t *mlp)
+{
+  mlp->mlp_refcount--;
+  if(mlp->mlp_refcount > 0)
+    return;
+
+  mlp_dequeue(mlp);
+
+  mlp->mlp_class->mlc_dtor(mlp);
+  free(mlp);
+}
+
+
 /**
  *
  */
@@ -416,15 +481,39 @@ mlp_destroy(metadata_lazy_prop_t *mlp)
     if(mlp->mlp_class->mlc_kill != NULL)
       mlp->mlp_class->mlc_kill(mlp);
   }
+  mlp_release(mlp);
+}
 
-  mlp->mlp_refcount--;
-  if(mlp->mlp_refcount > 0)
-    return;
 
-  mlp_dequeue(mlp);
+/**
+ *
+ */
+static void
+mlp_retry_cb(callout_t *c, void *aux)
+{
+  metadata_lazy_prop_t *mlp = aux;
 
-  mlp->mlp_class->mlc_dtor(mlp);
-  free(mlp);
+  hts_mutex_lock(&metadata_mutex);
+  mlp_enqueue(mlp, MLP_PRIO_LOW);
+  mlp_release(mlp);
+  hts_mutex_unlock(&metadata_mutex);
+}
+
+
+/**
+ * A provider could not be reached or is rate limiting us. Queue the
+ * item again later instead of leaving it without metadata, backing off
+ * up to MLP_RETRY_MAX seconds. The callout holds a reference
+ */
+static void
+mlp_retry_later(metadata_lazy_prop_t *mlp)
+{
+  if(mlp->mlp_zombie || callout_isarmed(&mlp->mlp_retry))
+    return;
+
+  mlp->mlp_retry_delay = MIN(MAX(mlp->mlp_retry_delay * 2, 1), MLP_RETRY_MAX);
+  mlp->mlp_refcount++;
+  callout_arm(&mlp->mlp_retry, mlp_retry_cb, mlp, mlp->mlp_retry_delay);
 }
 
 
@@ -446,7 +535,7 @@ mlp_sub_cb(void *opaque, prop_event_t event, ...)
     if(!(mlp->mlp_req_items & id)) {
 
       mlp->mlp_req_items |= id;
-      mlp_enqueue(mlp);
+      mlp_enqueue(mlp, MLP_PRIO_HIGH);
     }
     break;
   case PROP_DESTROYED:
@@ -525,6 +614,7 @@ const static metadata_lazy_class_t mlc_artist = {
   .mlc_load = mlp_artist_load,
   .mlc_dtor = mlp_artist_dtor,
   .mlc_alloc_size = sizeof(metadata_lazy_artist_t),
+  .mlc_unlocked = 1,
 };
 
 
@@ -604,6 +694,7 @@ const static metadata_lazy_class_t mlc_album = {
   .mlc_load = mlp_album_load,
   .mlc_dtor = mlp_album_dtor,
   .mlc_alloc_size = sizeof(metadata_lazy_album_t),
+  .mlc_unlocked = 1,
 };
 
 
@@ -715,6 +806,85 @@ get_ms(metadata_type_t type, int id)
 }
 
 
+/**
+ * Wait until the provider has room for another query and no identical
+ * query is running. metadata_mutex is dropped while waiting.
+ *
+ * *waited is set if we had to wait for an identical query, in which case
+ * the caller might find the answer in the database now.
+ */
+static metadata_query_t *
+metadata_query_begin(metadata_source_t *ms, const char *key, int *waited)
+{
+  metadata_query_t *mq;
+
+  *waited = 0;
+
+  while(1) {
+    LIST_FOREACH(mq, &metadata_queries, mq_link)
+      if(!strcmp(mq->mq_key, key))
+        break;
+
+    if(mq == NULL && ms->ms_inflight < ms->ms_max_inflight)
+      break;
+
+    if(mq != NULL)
+      *waited = 1;
+    hts_cond_wait(&metadata_query_cond, &metadata_mutex);
+  }
+
+  ms->ms_inflight++;
+  mq = malloc(sizeof(metadata_query_t));
+  mq->mq_key = strdup(key);
+  LIST_INSERT_HEAD(&metadata_queries, mq, mq_link);
+  return mq;
+}
+
+
+/**
+ *
+ */
+static void
+metadata_query_end(metadata_source_t *ms, metadata_query_t *mq)
+{
+  ms->ms_inflight--;
+  LIST_REMOVE(mq, mq_link);
+  free(mq->mq_key);
+  free(mq);
+  hts_cond_broadcast(&metadata_query_cond);
+}
+
+
+/**
+ *
+ */
+static void
+mlv_query_key(char *buf, size_t len, const metadata_lazy_video_t *mlv,
+              const metadata_source_t *ms, int qtype, const char *q)
+{
+  switch(qtype) {
+  case METADATA_QTYPE_IMDB:
+  case METADATA_QTYPE_CUSTOM_IMDB:
+    snprintf(buf, len, "%d:imdb:%s", ms->ms_id, q);
+    break;
+  case METADATA_QTYPE_MOVIE:
+    snprintf(buf, len, "%d:movie:%s:%d", ms->ms_id,
+             rstr_get(mlv->mlv_filename), mlv->mlv_year);
+    break;
+  case METADATA_QTYPE_TVSHOW:
+    snprintf(buf, len, "%d:tv:%s:%d:%d", ms->ms_id,
+             rstr_get(mlv->mlv_filename), mlv->mlv_season, mlv->mlv_episode);
+    break;
+  case METADATA_QTYPE_CUSTOM:
+    snprintf(buf, len, "%d:custom:%s", ms->ms_id, q);
+    break;
+  default:
+    snprintf(buf, len, "%d:url:%s", ms->ms_id, rstr_get(mlv->mlv_url));
+    break;
+  }
+}
+
+
 /**
  *
  */
@@ -957,8 +1127,18 @@ mlv_get_video_info0(void *db, metadata_lazy_video_t *mlv, int refresh)
   struct metadata_source_queue *msl = &metadata_sources[mlv->mlv_type];
   int r;
   int fixed_ds;
-  const char *sq = rstr_get(mlv->mlv_custom_query);
-  rstr_t *custom_title = mlv->mlv_custom_title;
+  int waited;
+  metadata_query_t *mq;
+  char key[512];
+
+  /*
+   * metadata_mutex is released while we query providers and these
+   * might be changed in the meantime so hold on to our own copies
+   */
+  rstr_t *custom_query = rstr_dup(mlv->mlv_custom_query);
+  rstr_t *custom_title = rstr_dup(mlv->mlv_custom_title);
+  rstr_t *imdb_id = rstr_dup(mlv->mlv_imdb_id);
+  const char *sq = rstr_get(custom_query);
 
   int sq_is_imdb_id = sq && sq[0] == 't' && sq[1] == 't' &&
     sq[2] >= '0' && sq[2] <= '9';
@@ -966,28 +1146,33 @@ mlv_get_video_info0(void *db, metadata_lazy_video_t *mlv, int refresh)
   if(sq && !*sq)
     sq = NULL;
 
-  if(custom_title && !*rstr_get(custom_title))
+  if(custom_title && !*rstr_get(custom_title)) {
+    rstr_release(custom_title);
     custom_title = NULL;
+  }
 
   // If duration is low skip this unless user have specified a custom query
   if(mlv->mlv_duration && mlv->mlv_duration < 300 && sq == NULL) {
     goto bad;
   }
 
-  TAILQ_FOREACH(ms, &metadata_sources[mlv->mlv_type], ms_link)
-    ms->ms_mark = 0;
-
  redo:
   if(md != NULL) {
     metadata_destroy(md);
     md = NULL;
   }
 
+  /*
+   * Marks are shared between all workers so clear them each time
+   * we're about to reload from the database
+   */
+  TAILQ_FOREACH(ms, &metadata_sources[mlv->mlv_type], ms_link)
+    ms->ms_mark = 0;
+
   if(!refresh) {
     r = metadb_get_videoinfo(db, rstr_get(mlv->mlv_url), msl, &fixed_ds, &md);
-    if(r) {
-      return r;
-    }
+    if(r)
+      goto out;
   } else {
     refresh = 0;
     fixed_ds = 0;
@@ -1021,12 +1206,12 @@ mlv_get_video_info0(void *db, metadata_lazy_video_t *mlv, int refresh)
       } else if(sq != NULL) {
 	qtype = METADATA_QTYPE_CUSTOM;
 	q = NULL;
-      } else if(msf->query_by_imdb_id != NULL && mlv->mlv_imdb_id != NULL) {
+      } else if(msf->query_by_imdb_id != NULL && imdb_id != NULL) {
 	if(mlv->mlv_passive)
 	  continue;
 
 	qtype = METADATA_QTYPE_IMDB;
-	q = rstr_get(mlv->mlv_imdb_id);
+	q = rstr_get(imdb_id);
 
       } else if(mlv->mlv_qtype == METADATA_QTYPE_MOVIE) {
 
@@ -1083,6 +1268,23 @@ mlv_get_video_info0(void *db, metadata_lazy_video_t *mlv, int refresh)
 
       if(rval == 0) {
 
+	if(qtype == METADATA_QTYPE_CUSTOM &&
+	   msf->query_by_title_and_year == NULL)
+	  continue;
+
+	mlv_query_key(key, sizeof(key), mlv, ms, qtype, q ?: sq);
+	mq = metadata_query_begin(ms, key, &waited);
+
+	if(waited) {
+	  // Someone else just did the same query, check the database again
+	  metadata_query_end(ms, mq);
+	  if(mlv->mlv_mlp.mlp_zombie)
+	    goto zombie;
+	  goto redo;
+	}
+
+	hts_mutex_unlock(&metadata_mutex);
+
 	switch(qtype) {
 	case METADATA_QTYPE_IMDB:
 	case METADATA_QTYPE_CUSTOM_IMDB:
@@ -1116,9 +1318,6 @@ mlv_get_video_info0(void *db, metadata_lazy_video_t *mlv, int refresh)
 	  break;
 
 	case METADATA_QTYPE_CUSTOM:
-	  if(msf->query_by_title_and_year == NULL)
-	    continue;
-
 	  TRACE(TRACE_DEBUG, "METADATA",
 		"Performing custom search lookup for %s using %s", sq,
 		ms->ms_name);
@@ -1127,8 +1326,15 @@ mlv_get_video_info0(void *db, metadata_lazy_video_t *mlv, int refresh)
 	  break;
 
 	default:
-	  continue;
+	  rval = METADATA_PERMANENT_ERROR;
+	  break;
 	}
+
+	hts_mutex_lock(&metadata_mutex);
+	metadata_query_end(ms, mq);
+
+	if(mlv->mlv_mlp.mlp_zombie)
+	  goto zombie;
       }
 
       if(rval == METADATA_DEADLOCK || rval == METADATA_TEMPORARY_ERROR) {
@@ -1137,9 +1343,8 @@ mlv_get_video_info0(void *db, metadata_lazy_video_t *mlv, int refresh)
 		rstr_get(mlv->mlv_url));
 
 	prop_set(mlv->mlv_m, "loading", PROP_SET_INT, 0);
-	if(md != NULL)
-	  metadata_destroy(md);
-	return rval;
+	r = rval;
+	goto out;
       }
 
       if(rval == METADATA_PERMANENT_ERROR)
@@ -1149,9 +1354,8 @@ mlv_get_video_info0(void *db, metadata_lazy_video_t *mlv, int refresh)
 
       if(rval < 0) {
 	prop_set(mlv->mlv_m, "loading", PROP_SET_INT, 0);
-	if(md != NULL)
-	  metadata_destroy(md);
-	return rval;
+	r = rval;
+	goto out;
       }
       goto redo;
     }
@@ -1168,28 +1372,46 @@ mlv_get_video_info0(void *db, metadata_lazy_video_t *mlv, int refresh)
 	  "Performing additional query for %s : %s", ms->ms_name,
 	  rstr_get(md->md_ext_id));
 
+    snprintf(key, sizeof(key), "%d:id:%s", ms->ms_id,
+             rstr_get(md->md_ext_id));
+    mq = metadata_query_begin(ms, key, &waited);
+    hts_mutex_unlock(&metadata_mutex);
+
     rval = ms->ms_funcs->query_by_id(db, rstr_get(mlv->mlv_url),
 				     rstr_get(md->md_ext_id));
-    
+
+    hts_mutex_lock(&metadata_mutex);
+    metadata_query_end(ms, mq);
+
     metadata_destroy(md);
+    md = NULL;
 
-    if(rval == METADATA_DEADLOCK)
-      return METADATA_DEADLOCK;
+    if(mlv->mlv_mlp.mlp_zombie)
+      goto zombie;
+
+    if(rval == METADATA_DEADLOCK) {
+      r = METADATA_DEADLOCK;
+      goto out;
+    }
 
     if(rval == METADATA_TEMPORARY_ERROR) {
       TRACE(TRACE_DEBUG, "METADATA", "Temporary error for %s",
 	    rstr_get(mlv->mlv_url));
-      return rval;
+      r = rval;
+      goto out;
     }
 
     if(rval == METADATA_PERMANENT_ERROR)
       TRACE(TRACE_DEBUG, "METADATA", "Permanent error for %s",
 	    rstr_get(mlv->mlv_url));
 
+    TAILQ_FOREACH(ms, &metadata_sources[mlv->mlv_type], ms_link)
+      ms->ms_mark = 0;
+
     r = metadb_get_videoinfo(db, rstr_get(mlv->mlv_url), msl, &fixed_ds, &md);
     if(r) {
       prop_set(mlv->mlv_m, "loading", PROP_SET_INT, 0);
-      return r;
+      goto out;
     }
   }
 
@@ -1275,6 +1497,7 @@ mlv_get_video_info0(void *db, metadata_lazy_video_t *mlv, int refresh)
 
       build_info_text(mlv, md);
       metadata_destroy(md);
+      md = NULL;
 
     } else {
 
@@ -1308,8 +1531,19 @@ mlv_get_video_info0(void *db, metadata_lazy_video_t *mlv, int refresh)
   rstr_release(title);
   TAILQ_FOREACH(ms, &metadata_sources[mlv->mlv_type], ms_link)
     ms->ms_mark = 0;
-
-  return 0;
+  r = 0;
+  goto out;
+
+ zombie:
+  // Unbound while we were waiting for a provider, nothing more to do
+  r = 0;
+ out:
+  if(md != NULL)
+    metadata_destroy(md);
+  rstr_release(custom_query);
+  rstr_release(custom_title);
+  rstr_release(imdb_id);
+  return r;
 }
 
 
@@ -1319,7 +1553,11 @@ mlv_get_video_info0(void *db, metadata_lazy_video_t *mlv, int refresh)
 static void
 mlv_load(void *db, metadata_lazy_prop_t *mlp)
 {
-  mlv_get_video_info0(db, (metadata_lazy_video_t *)mlp, 0);
+  if(mlv_get_video_info0(db, (metadata_lazy_video_t *)mlp, 0) ==
+     METADATA_TEMPORARY_ERROR)
+    mlp_retry_later(mlp);
+  else
+    mlp->mlp_retry_delay = 0;
 }
 
 
@@ -1460,7 +1698,8 @@ mlv_set_source(metadata_lazy_video_t *mlv, const char *name)
   metadb_item_set_preferred_ds(db, rstr_get(mlv->mlv_url), id);
   mlv_get_video_info0(db, mlv, 0);
   metadb_close(db);
-  load_alternatives(mlv);
+  if(!mlv->mlv_mlp.mlp_zombie)
+    load_alternatives(mlv);
 }
 
 
@@ -1511,7 +1750,8 @@ mlv_refresh_video_info(metadata_lazy_video_t *mlv)
   metadb_videoitem_set_preferred(db, rstr_get(mlv->mlv_url), 0);
   mlv_get_video_info0(db, mlv, 1);
   metadb_close(db);
-  load_alternatives(mlv);
+  if(!mlv->mlv_mlp.mlp_zombie)
+    load_alternatives(mlv);
 }
 
 
@@ -1539,6 +1779,8 @@ mlv_sub_actions(void *opaque, prop_event_t event, ...)
     if(event_is_type(e, EVENT_DYNAMIC_ACTION)) {
       if(!strcmp(e->e_payload, "refreshMetadata")) {
 	mlv_refresh_video_info(mlv);
+	if(mlv->mlv_mlp.mlp_zombie)
+	  break;
 	load_alternatives(mlv);
 	const char *s;
 
@@ -1987,8 +2229,7 @@ mlv_set_imdb_id(metadata_lazy_video_t *mlv, rstr_t *imdb_id)
 {
   hts_mutex_lock(&metadata_mutex);
   rstr_set(&mlv->mlv_imdb_id, imdb_id);
-  mlp_enqueue(&mlv->mlv_mlp);
-  prop_courier_wakeup(metadata_courier);
+  mlp_enqueue(&mlv->mlv_mlp, MLP_PRIO_LOW);
   hts_mutex_unlock(&metadata_mutex);
 }
 
@@ -2000,8 +2241,7 @@ mlv_set_duration(metadata_lazy_video_t *mlv, float duration)
 {
   hts_mutex_lock(&metadata_mutex);
   mlv->mlv_duration = duration;
-  mlp_enqueue(&mlv->mlv_mlp);
-  prop_courier_wakeup(metadata_courier);
+  mlp_enqueue(&mlv->mlv_mlp, MLP_PRIO_LOW);
   hts_mutex_unlock(&metadata_mutex);
 }
 
@@ -2015,8 +2255,7 @@ mlv_set_lonely(metadata_lazy_video_t *mlv, int lonely)
   hts_mutex_lock(&metadata_mutex);
   if(mlv->mlv_lonely != lonely) {
     mlv->mlv_lonely = lonely;
-    mlp_enqueue(&mlv->mlv_mlp);
-    prop_courier_wakeup(metadata_courier);
+    mlp_enqueue(&mlv->mlv_mlp, MLP_PRIO_LOW);
   }
   hts_mutex_unlock(&metadata_mutex);
 }
@@ -2430,7 +2669,7 @@ ms_set_enable(void *opaque, int value)
   sqlite3_bind_int(stmt, 2, ms->ms_enabled);
   
   rc = db_step(stmt);
-  sqlite3_finalize(stmt);
+  db_finalize(stmt);
   metadb_close(db);
 }
 
@@ -2466,7 +2705,7 @@ metadata_add_source(const char *name, const char *description,
 
   rc = db_step(stmt);
   if(rc == SQLITE_LOCKED) {
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
     db_rollback_deadlock(db);
     goto again;
   }
@@ -2478,11 +2717,11 @@ metadata_add_source(const char *name, const char *description,
     if(sqlite3_column_type(stmt, 1) == SQLITE_INTEGER)
       enabled = sqlite3_column_int(stmt, 2);
 
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
 
   } else {
 
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
 
     rc = db_prepare(db, &stmt,
 		    "INSERT INTO datasource "
@@ -2501,7 +2740,7 @@ metadata_add_source(const char *name, const char *description,
     sqlite3_bind_int(stmt, 4, enabled);
 
     rc = db_step(stmt);
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
     if(rc == SQLITE_LOCKED) {
       db_rollback_deadlock(db);
       goto again;
@@ -2521,6 +2760,7 @@ metadata_add_source(const char *name, const char *description,
   ms->ms_enabled = enabled;
   ms->ms_partial_props = partials;
   ms->ms_complete_props = complete;
+  ms->ms_max_inflight = METADATA_PROVIDER_CONCURRENCY;
 
   hts_mutex_lock(&metadata_mutex);
 
@@ -2591,7 +2831,7 @@ class_handle_move(metadata_source_t *ms, metadata_source_t *before)
       sqlite3_bind_int(stmt, 2, ms->ms_id);
       
       db_step(stmt);
-      sqlite3_finalize(stmt);
+      db_finalize(stmt);
     }
   }
   metadb_close(db);
@@ -2656,22 +2896,56 @@ add_provider_class(prop_concat_t *pc,
 /**
  *
  */
-static void
-mlp_dispatch(void)
+static metadata_lazy_prop_t *
+mlp_next(void)
 {
   metadata_lazy_prop_t *mlp;
-  void *db = metadb_get();
-  while((mlp = TAILQ_FIRST(&mlpqueue)) != NULL) {
-    TAILQ_REMOVE(&mlpqueue, mlp, mlp_link);
-    mlp->mlp_queued = 0;
+  int i;
+
+  for(i = 0; i < 2; i++)
+    TAILQ_FOREACH(mlp, &mlpqueue[i], mlp_link)
+      if(!mlp->mlp_loading)
+        return mlp;
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static void *
+mlp_worker(void *aux)
+{
+  metadata_lazy_prop_t *mlp;
+  void *db;
+
+  hts_mutex_lock(&metadata_mutex);
+  while(1) {
+
+    if((mlp = mlp_next()) == NULL) {
+      hts_cond_wait(&mlp_cond, &metadata_mutex);
+      continue;
+    }
+
+    mlp_dequeue(mlp);
+    mlp->mlp_loading = 1;
+    mlp->mlp_refcount++;
+
+    if(mlp->mlp_class->mlc_unlocked)
+      hts_mutex_unlock(&metadata_mutex);
+
+    db = metadb_get();
     if(!mlp->mlp_zombie)
       mlp->mlp_class->mlc_load(db, mlp);
+    metadb_close(db);
 
-    hts_mutex_unlock(&metadata_mutex);
-    usleep(1);
-    hts_mutex_lock(&metadata_mutex);
+    if(mlp->mlp_class->mlc_unlocked)
+      hts_mutex_lock(&metadata_mutex);
+
+    mlp->mlp_loading = 0;
+    mlp_release(mlp);
   }
-  metadb_close(db);
+  return NULL;
 }
 
 
@@ -2686,15 +2960,11 @@ metadata_thread(void *aux)
   while(1) {
     struct prop_notify_queue q;
 
-    int timo = TAILQ_FIRST(&mlpqueue) != NULL ? 50 : 0;
     hts_mutex_unlock(&metadata_mutex);
-    int r = prop_courier_wait(metadata_courier, &q, timo);
+    prop_courier_wait(metadata_courier, &q, 0);
     hts_mutex_lock(&metadata_mutex);
 
     prop_notify_dispatch(&q);
-
-    if(r)
-      mlp_dispatch();
   }
   return NULL;
 }
@@ -2712,13 +2982,23 @@ metadata_init(void)
   prop_t *s;
   prop_concat_t *pc;
 
+  int i;
+
   hts_mutex_init(&metadata_mutex);
+  hts_cond_init(&mlp_cond, &metadata_mutex);
+  hts_cond_init(&metadata_query_cond, &metadata_mutex);
 
   metadata_courier = prop_courier_create_waitable();
-  TAILQ_INIT(&mlpqueue);
+  TAILQ_INIT(&mlpqueue[MLP_PRIO_HIGH]);
+  TAILQ_INIT(&mlpqueue[MLP_PRIO_LOW]);
+  LIST_INIT(&metadata_queries);
 
   hts_thread_create_detached("metadata", metadata_thread, NULL, 
 			     THREAD_PRIO_METADATA);
+
+  for(i = 0; i < METADATA_WORKERS; i++)
+    hts_thread_create_detached("metadata worker", mlp_worker, NULL,
+                               THREAD_PRIO_METADATA);
   
   s = settings_add_dir(NULL, _p("Metadata"), "settings", NULL,
 		       _p("Metadata configuration and provider settings"),
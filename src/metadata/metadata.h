@@ -282,6 +282,9 @@ typedef struct metadata_source {
   int ms_status;
   int64_t ms_cfgid;
 
+  int ms_inflight;      // Queries currently running
+  int ms_max_inflight;
+
   uint64_t ms_partial_props;
   uint64_t ms_complete_props;
 } metadata_source_t;
@@ -485,3 +488,5 @@ void metadata_browse(void *db, const char *url,
                      struct prop *nodes, struct prop *model,
                      library_query_t qtype,
                      int (*checkstop)(void *opaque), void *opaque);
+
+char **library_search_urls(const char *query);
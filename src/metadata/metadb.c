@@ -17,6 +17,7 @@
 #include "htsmsg/htsmsg_json.h"
 #include "settings.h"
 #include "notifications.h"
+#include "misc/str.h"
 
 #define METADATA_VERSION_STR "1"
 
@@ -64,7 +65,7 @@ items_clear(void *opaque, prop_event_t event, ...)
 
   if(rc == SQLITE_OK) {
     rc = db_step(stmt);
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
   }
 
   if(rc == SQLITE_LOCKED) {
@@ -81,6 +82,163 @@ items_clear(void *opaque, prop_event_t event, ...)
 }
 
 
+/**
+ *
+ */
+static void
+bind_folded(sqlite3_stmt *stmt, int col, const char *str)
+{
+  if(str != NULL)
+    sqlite3_bind_text(stmt, col, utf8_fold(str), -1, free);
+}
+
+
+/**
+ * Update the full text search index for an item.
+ *
+ * The indexed text is casefolded and stripped of diacritical marks
+ * (using the same folding as for search queries) as the FTS tokenizer
+ * in sqlite only deals with ASCII
+ */
+static int
+metadb_search_update(sqlite3 *db, int64_t item_id)
+{
+  sqlite3_stmt *sel, *stmt;
+  int rc;
+
+  rc = db_prepare(db, &sel,
+                  "SELECT item.usertitle, audioitem.title, "
+                  "artist.title, album.title, "
+                  "(SELECT group_concat(title, ' ') FROM videoitem "
+                  " WHERE videoitem.item_id = item.id) "
+                  "FROM item "
+                  "LEFT OUTER JOIN audioitem ON audioitem.item_id = item.id "
+                  "LEFT OUTER JOIN artist ON artist.id = audioitem.artist_id "
+                  "LEFT OUTER JOIN album ON album.id = audioitem.album_id "
+                  "WHERE item.id = ?1");
+  if(rc != SQLITE_OK)
+    return METADATA_PERMANENT_ERROR;
+
+  sqlite3_bind_int64(sel, 1, item_id);
+  rc = db_step(sel);
+
+  if(rc != SQLITE_ROW) {
+    db_finalize(sel);
+    return rc == SQLITE_LOCKED ? METADATA_DEADLOCK : 0;
+  }
+
+  rc = db_prepare(db, &stmt, "DELETE FROM itemsearch WHERE docid = ?1");
+  if(rc != SQLITE_OK) {
+    db_finalize(sel);
+    return METADATA_PERMANENT_ERROR;
+  }
+  sqlite3_bind_int64(stmt, 1, item_id);
+  rc = db_step(stmt);
+  db_finalize(stmt);
+
+  if(rc == SQLITE_DONE) {
+    char title[1024];
+    const char *usertitle = (const char *)sqlite3_column_text(sel, 0);
+    const char *audiotitle = (const char *)sqlite3_column_text(sel, 1);
+    const char *videotitle = (const char *)sqlite3_column_text(sel, 4);
+
+    snprintf(title, sizeof(title), "%s %s %s",
+             usertitle ?: "", audiotitle ?: "", videotitle ?: "");
+
+    rc = db_prepare(db, &stmt,
+                    "INSERT INTO itemsearch (docid, title, artist, album) "
+                    "VALUES (?1, ?2, ?3, ?4)");
+    if(rc == SQLITE_OK) {
+      sqlite3_bind_int64(stmt, 1, item_id);
+      bind_folded(stmt, 2, title);
+      bind_folded(stmt, 3, (const char *)sqlite3_column_text(sel, 2));
+      bind_folded(stmt, 4, (const char *)sqlite3_column_text(sel, 3));
+      rc = db_step(stmt);
+      db_finalize(stmt);
+    }
+  }
+  db_finalize(sel);
+
+  if(rc == SQLITE_LOCKED)
+    return METADATA_DEADLOCK;
+  return rc == SQLITE_DONE ? 0 : METADATA_PERMANENT_ERROR;
+}
+
+
+#define SEARCH_REBUILD_BATCH 256
+
+/**
+ * Index all audio and video items that are missing from the search
+ * index. This fills the index after the schema upgrade that introduced
+ * it and picks up items whose rows were dropped by the delete triggers.
+ *
+ * Runs as a pool task so startup does not wait for it. Items are
+ * indexed in small transactions to not hold the database for long
+ */
+static void *
+metadb_search_rebuild(void *aux)
+{
+  sqlite3 *db;
+  sqlite3_stmt *stmt;
+  int64_t *ids = NULL;
+  int rc, num = 0, cap = 0, i, j;
+
+  if((db = metadb_get()) == NULL)
+    return NULL;
+
+  rc = db_prepare(db, &stmt,
+                  "SELECT item_id FROM audioitem "
+                  "WHERE item_id NOT IN (SELECT docid FROM itemsearch) "
+                  "UNION "
+                  "SELECT item_id FROM videoitem WHERE item_id NOT NULL "
+                  "AND item_id NOT IN (SELECT docid FROM itemsearch)");
+  if(rc != SQLITE_OK) {
+    metadb_close(db);
+    return NULL;
+  }
+
+  while(db_step(stmt) == SQLITE_ROW) {
+    if(num == cap) {
+      cap = cap ? cap * 2 : 1024;
+      ids = realloc(ids, cap * sizeof(int64_t));
+    }
+    ids[num++] = sqlite3_column_int64(stmt, 0);
+  }
+  db_finalize(stmt);
+
+  for(i = 0; i < num; i += SEARCH_REBUILD_BATCH) {
+  again:
+    if(db_begin(db))
+      break;
+
+    for(j = i; j < num && j < i + SEARCH_REBUILD_BATCH; j++) {
+      rc = metadb_search_update(db, ids[j]);
+      if(rc)
+        break;
+    }
+
+    if(rc == METADATA_DEADLOCK) {
+      db_rollback_deadlock(db);
+      goto again;
+    }
+
+    if(rc) {
+      db_rollback(db);
+      break;
+    }
+    db_commit(db);
+  }
+
+  metadb_close(db);
+  free(ids);
+
+  if(num)
+    TRACE(TRACE_INFO, "metadb", "Search index updated for %d of %d items",
+          MIN(i, num), num);
+  return NULL;
+}
+
+
 /**
  *
  */
@@ -109,11 +267,14 @@ metadb_init(void)
 
   metadb_close(db);
 
-  if(r)
+  if(r) {
     metadb_pool = NULL; // Disable
-  else
+  } else {
     settings_create_action(gconf.settings_general, _p("Clear all metadata"),
 			   items_clear, NULL, 0, NULL);
+    hts_task_run("metadb search index", metadb_search_rebuild, NULL,
+                 THREAD_PRIO_METADATA_BG);
+  }
 
 }
 
@@ -173,7 +334,7 @@ db_item_get(sqlite3 *db, const char *url, time_t *mtimep)
   } else if(rc == SQLITE_LOCKED)
     rval = METADATA_DEADLOCK;
 
-  sqlite3_finalize(stmt);
+  db_finalize(stmt);
   return rval;
 }
 
@@ -208,7 +369,7 @@ db_item_create(sqlite3 *db, const char *url, int contenttype, time_t mtime,
   sqlite3_bind_int(stmt, 5, indexstatus);
 
   rc = db_step(stmt);
-  sqlite3_finalize(stmt);
+  db_finalize(stmt);
 
   if(rc == SQLITE_LOCKED)
     return METADATA_DEADLOCK;
@@ -267,7 +428,7 @@ metadb_artist_get_by_title(void *db, const char *title, int ds_id,
       if(ext_id)
 	sqlite3_bind_text(ins, 3, ext_id, -1, SQLITE_STATIC);
       rc = db_step(ins);
-      sqlite3_finalize(ins);
+      db_finalize(ins);
       if(rc == SQLITE_LOCKED)
 	rval = METADATA_DEADLOCK;
       if(rc == SQLITE_DONE)
@@ -277,7 +438,7 @@ metadb_artist_get_by_title(void *db, const char *title, int ds_id,
     rval = METADATA_DEADLOCK;
   }
 
-  sqlite3_finalize(sel);
+  db_finalize(sel);
   return rval;
 }
 
@@ -335,7 +496,7 @@ metadb_album_get_by_title(void *db, const char *album, int64_t artist_id,
 	sqlite3_bind_text(ins, 4, ext_id, -1, SQLITE_STATIC);
 
       rc = db_step(ins);
-      sqlite3_finalize(ins);
+      db_finalize(ins);
       if(rc == SQLITE_DONE)
 	rval = sqlite3_last_insert_rowid(db);
       if(rc == SQLITE_LOCKED)
@@ -344,7 +505,7 @@ metadb_album_get_by_title(void *db, const char *album, int64_t artist_id,
   } else if(rc == SQLITE_LOCKED)
     rval = METADATA_DEADLOCK;
 
-  sqlite3_finalize(sel);
+  db_finalize(sel);
   return rval;
 }
 
@@ -374,7 +535,7 @@ metadb_insert_albumart(void *db, int64_t album_id, const char *url,
   if(width) sqlite3_bind_int64(ins, 3, width);
   if(height) sqlite3_bind_int64(ins, 4, height);
   db_step(ins);
-  sqlite3_finalize(ins);
+  db_finalize(ins);
 }
 
 
@@ -402,7 +563,7 @@ metadb_insert_artistpic(void *db, int64_t artist_id, const char *url,
   if(width) sqlite3_bind_int64(ins, 3, width);
   if(height) sqlite3_bind_int64(ins, 4, height);
   db_step(ins);
-  sqlite3_finalize(ins);
+  db_finalize(ins);
 }
 
 /**
@@ -436,7 +597,7 @@ metadb_insert_videoart(void *db, int64_t videoitem_id, const char *url,
   sqlite3_bind_int(ins, 8, titled);
 
   db_step(ins);
-  sqlite3_finalize(ins);
+  db_finalize(ins);
 }
 
 
@@ -457,7 +618,7 @@ metadb_delete_videoart(void *db, int64_t videoitem_id)
   
   sqlite3_bind_int64(ins, 1, videoitem_id);
   db_step(ins);
-  sqlite3_finalize(ins);
+  db_finalize(ins);
 }
 
 
@@ -501,7 +662,7 @@ metadb_insert_videocast(void *db, int64_t videoitem_id,
   if(height) sqlite3_bind_int(ins, 9, height);
   sqlite3_bind_text(ins, 10, ext_id, -1, SQLITE_STATIC);
   db_step(ins);
-  sqlite3_finalize(ins);
+  db_finalize(ins);
 }
 
 
@@ -522,7 +683,7 @@ metadb_delete_videocast(void *db, int64_t videoitem_id)
   
   sqlite3_bind_int64(ins, 1, videoitem_id);
   db_step(ins);
-  sqlite3_finalize(ins);
+  db_finalize(ins);
 }
 
 
@@ -547,7 +708,7 @@ metadb_insert_videogenre(void *db, int64_t videoitem_id, const char *title)
   sqlite3_bind_int64(ins, 1, videoitem_id);
   sqlite3_bind_text(ins, 2, title, -1, SQLITE_STATIC);
   db_step(ins);
-  sqlite3_finalize(ins);
+  db_finalize(ins);
 }
 
 
@@ -616,7 +777,7 @@ metadb_insert_audioitem(sqlite3 *db, int64_t item_id, const metadata_t *md,
     sqlite3_bind_int(stmt, 6, md->md_track);
 
     rc = db_step(stmt);
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
     if(rc == SQLITE_CONSTRAINT && i == 0)
       continue;
     break;
@@ -679,7 +840,7 @@ metadb_get_album_art(void *db, const char *album, const char *artist)
   sqlite3_bind_text(sel, 1, artist, -1, SQLITE_STATIC);
   sqlite3_bind_text(sel, 2, album, -1, SQLITE_STATIC);
   rstr_t *r = metadb_construct_imageset(sel, 0, 1, 2);
-  sqlite3_finalize(sel);
+  db_finalize(sel);
   return r;
 }
 
@@ -711,7 +872,7 @@ metadb_get_video_art(void *db, int64_t videoitem_id, int type)
   if(rc == SQLITE_ROW)
     r = db_rstr(sel, 0);
 
-  sqlite3_finalize(sel);
+  db_finalize(sel);
   return r;
 }
 
@@ -756,7 +917,7 @@ metadb_get_video_genre(sqlite3 *db, int64_t videoitem_id)
 
   sqlite3_bind_int64(sel, 1, videoitem_id);
   rstr_t *r = metadb_construct_list(sel, 0);
-  sqlite3_finalize(sel);
+  db_finalize(sel);
   return r;
 }
 
@@ -794,7 +955,7 @@ metadb_get_video_cast(sqlite3 *db, int64_t videoitem_id, metadata_t *md)
     else
       TAILQ_INSERT_TAIL(&md->md_crew, mp, mp_link);
   }
-  sqlite3_finalize(sel);
+  db_finalize(sel);
   return 0;
 }
 
@@ -830,7 +991,7 @@ metadb_get_artist_pics(void *db, const char *artist,
        sqlite3_column_int(sel, 2));
     rval = 0;
   }
-  sqlite3_finalize(sel);
+  db_finalize(sel);
   return rval;
 }
 
@@ -881,7 +1042,7 @@ metadb_insert_stream(sqlite3 *db, int64_t videoitem_id,
     sqlite3_bind_text(stmt, 8, rstr_get(ms->ms_title), -1, SQLITE_STATIC);
 
   rc = db_step(stmt);
-  sqlite3_finalize(stmt);
+  db_finalize(stmt);
   return rc2metadatacode(rc);
 }
 
@@ -905,7 +1066,7 @@ metadb_set_streams(sqlite3 *db, int64_t videoitem_id, const metadata_t *md)
   sqlite3_bind_int64(stmt, 1, videoitem_id);
 
   rc = db_step(stmt);
-  sqlite3_finalize(stmt);
+  db_finalize(stmt);
   if(rc == SQLITE_LOCKED)
     return METADATA_DEADLOCK;
   if(rc != SQLITE_DONE)
@@ -956,7 +1117,7 @@ metadb_insert_videoitem0(sqlite3 *db, int64_t item_id, int ds_id,
 
       rc = db_step(stmt);
       if(rc != SQLITE_ROW) {
-	sqlite3_finalize(stmt);
+	db_finalize(stmt);
 	if(rc == SQLITE_LOCKED)
 	  return METADATA_DEADLOCK;
 	TRACE(TRACE_ERROR, "SQLITE", "SQL Error 0x%x at %s:%d",
@@ -964,7 +1125,7 @@ metadb_insert_videoitem0(sqlite3 *db, int64_t item_id, int ds_id,
 	return METADATA_PERMANENT_ERROR;
       }
       id = sqlite3_column_int64(stmt, 0);
-      sqlite3_finalize(stmt);
+      db_finalize(stmt);
     }
 
 
@@ -1046,7 +1207,7 @@ metadb_insert_videoitem0(sqlite3 *db, int64_t item_id, int ds_id,
     sqlite3_bind_int64(stmt, 18, cfgid);
 
     rc = db_step(stmt);
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
     if(rc == SQLITE_CONSTRAINT && i == 0)
       continue;
     if(i == 0)
@@ -1092,8 +1253,11 @@ metadb_insert_videoitem(void *db, const char *url, int ds_id,
       return item_id;
   }
   
-  return metadb_insert_videoitem0(db, item_id, ds_id, ext_id, md, status,
-				  weight, qtype, cfgid);
+  int64_t id = metadb_insert_videoitem0(db, item_id, ds_id, ext_id, md,
+                                        status, weight, qtype, cfgid);
+  if(id >= 0 && metadb_search_update(db, item_id) == METADATA_DEADLOCK)
+    return METADATA_DEADLOCK;
+  return id;
 }
 
 /**
@@ -1136,7 +1300,7 @@ metadb_insert_imageitem(sqlite3 *db, int64_t item_id, const metadata_t *md)
 		      -1, SQLITE_STATIC);
     
     rc = db_step(stmt);
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
     if(rc == SQLITE_CONSTRAINT && i == 0)
       continue;
     break;
@@ -1215,7 +1379,7 @@ metadb_metadata_writex(void *db, const char *url, time_t mtime,
     sqlite3_bind_int(stmt,   5, indexstatus);
 
     rc = db_step(stmt);
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
     if(rc == METADATA_DEADLOCK)
       return METADATA_DEADLOCK;
   }
@@ -1239,6 +1403,9 @@ metadb_metadata_writex(void *db, const char *url, time_t mtime,
   default:
     return 0;
   }
+
+  if(!r && md->md_contenttype != CONTENT_IMAGE)
+    r = metadb_search_update(db, item_id);
   return r;
 }
 
@@ -1334,7 +1501,7 @@ metadb_metadata_get_artist(sqlite3 *db, get_cache_t *gc, int64_t id)
   rc = db_step(sel);
 
   if(rc != SQLITE_ROW) {
-    sqlite3_finalize(sel);
+    db_finalize(sel);
     return METADATA_PERMANENT_ERROR;
   }
 
@@ -1342,7 +1509,7 @@ metadb_metadata_get_artist(sqlite3 *db, get_cache_t *gc, int64_t id)
 
   rstr_release(gc->gc_artist_title);
   gc->gc_artist_title = rstr_alloc((void *)sqlite3_column_text(sel, 0));
-  sqlite3_finalize(sel);
+  db_finalize(sel);
   return 0;
 }
 
@@ -1375,14 +1542,14 @@ metadb_metadata_get_album(sqlite3 *db, get_cache_t *gc, int64_t id)
   rc = db_step(sel);
 
   if(rc != SQLITE_ROW) {
-    sqlite3_finalize(sel);
+    db_finalize(sel);
     return METADATA_PERMANENT_ERROR;
   }
 
   gc->gc_album_id = id;
   rstr_release(gc->gc_album_title);
   gc->gc_album_title = rstr_alloc((void *)sqlite3_column_text(sel, 0));
-  sqlite3_finalize(sel);
+  db_finalize(sel);
   return 0;
 }
 
@@ -1411,7 +1578,7 @@ metadb_metadata_get_audio(sqlite3 *db, metadata_t *md, int64_t item_id,
   rc = db_step(sel);
 
   if(rc != SQLITE_ROW) {
-    sqlite3_finalize(sel);
+    db_finalize(sel);
     return METADATA_PERMANENT_ERROR;
   }
 
@@ -1426,7 +1593,7 @@ metadb_metadata_get_audio(sqlite3 *db, metadata_t *md, int64_t item_id,
   md->md_duration = sqlite3_column_int(sel, 3) / 1000.0f;
   md->md_track = sqlite3_column_int(sel, 4);
 
-  sqlite3_finalize(sel);
+  db_finalize(sel);
   return 0;
 }
 
@@ -1457,7 +1624,7 @@ metadb_metadata_get_video(sqlite3 *db, metadata_t *md, int64_t item_id,
   rc = db_step(sel);
 
   if(rc != SQLITE_ROW) {
-    sqlite3_finalize(sel);
+    db_finalize(sel);
     return METADATA_PERMANENT_ERROR;
   }
 
@@ -1468,7 +1635,7 @@ metadb_metadata_get_video(sqlite3 *db, metadata_t *md, int64_t item_id,
   md->md_format = rstr_alloc((void *)sqlite3_column_text(sel, 3));
   md->md_year = sqlite3_column_int(sel, 4);
 
-  sqlite3_finalize(sel);
+  db_finalize(sel);
   return id;
 }
 
@@ -1496,7 +1663,7 @@ metadb_videoitem_set_preferred(void *db, const char *url, int64_t vid)
   sqlite3_bind_int64(stmt, 2, vid);
 
   rc = db_step(stmt);
-  sqlite3_finalize(stmt);
+  db_finalize(stmt);
   if(rc == SQLITE_LOCKED)
     return METADATA_DEADLOCK;
   return 0;
@@ -1525,9 +1692,19 @@ metadb_videoitem_delete_from_ds(void *db, const char *url, int ds)
   sqlite3_bind_int(stmt, 2, ds);
 
   rc = db_step(stmt);
-  sqlite3_finalize(stmt);
+  db_finalize(stmt);
   if(rc == SQLITE_LOCKED)
     return METADATA_DEADLOCK;
+
+  // The delete trigger dropped the item from the search index,
+  // put back what other sources know about it
+  if(rc == SQLITE_DONE && sqlite3_changes(db) > 0) {
+    int64_t item_id = db_item_get(db, url, NULL);
+    if(item_id == METADATA_DEADLOCK)
+      return METADATA_DEADLOCK;
+    if(item_id >= 0)
+      return metadb_search_update(db, item_id);
+  }
   return 0;
 }
 
@@ -1597,7 +1774,7 @@ metadb_videoitem_alternatives0(void *db, prop_t *p, const char *url, int dsid,
   prop_ref_dec(active);
 
   prop_vec_release(pv);
-  sqlite3_finalize(sel);
+  db_finalize(sel);
   return 0;
 }
 
@@ -1651,7 +1828,7 @@ metadb_item_set_preferred_ds(void *db, const char *url, int ds_id)
     sqlite3_bind_null(stmt, 2);
 
   rc = db_step(stmt);
-  sqlite3_finalize(stmt);
+  db_finalize(stmt);
   if(rc == SQLITE_LOCKED)
     return METADATA_DEADLOCK;
   return 0;
@@ -1687,7 +1864,7 @@ metadb_item_get_preferred_ds(const char *url)
   rc = db_step(stmt);
   if(rc == SQLITE_ROW)
     id = sqlite3_column_int(stmt, 0);
-  sqlite3_finalize(stmt);
+  db_finalize(stmt);
   metadb_close(db);
   return id;
 }
@@ -1724,7 +1901,7 @@ metadb_item_get_user_title(const char *url)
   if(rc == SQLITE_ROW)
     ret = db_rstr(stmt, 0);
 
-  sqlite3_finalize(stmt);
+  db_finalize(stmt);
   metadb_close(db);
   return ret;
 }
@@ -1761,7 +1938,11 @@ metadb_item_set_user_title(const char *url, const char *str)
   sqlite3_bind_text(stmt, 2, str, -1, SQLITE_STATIC);
 
   db_step(stmt);
-  sqlite3_finalize(stmt);
+  db_finalize(stmt);
+
+  int64_t item_id = db_item_get(db, url, NULL);
+  if(item_id >= 0)
+    metadb_search_update(db, item_id);
   metadb_close(db);
 }
 
@@ -1791,7 +1972,7 @@ metadb_get_videoinfo2(void *db, int64_t id, metadata_t **mdp)
   rc = db_step(sel);
 
   if(rc == SQLITE_LOCKED) {
-    sqlite3_finalize(sel);
+    db_finalize(sel);
     return METADATA_DEADLOCK;
   }
 
@@ -1825,7 +2006,7 @@ metadb_get_videoinfo2(void *db, int64_t id, metadata_t **mdp)
       metadb_get_videoinfo2(db, md->md_parent_id, &md->md_parent);
     *mdp = md;
   }
-  sqlite3_finalize(sel);
+  db_finalize(sel);
   return 0;
 }
 
@@ -1856,7 +2037,7 @@ metadb_get_videoitem(void *db, const char *url)
     rval = sqlite3_column_int64(stmt, 0);
   } else if(rc == SQLITE_LOCKED)
     rval = METADATA_DEADLOCK;
-  sqlite3_finalize(stmt);
+  db_finalize(stmt);
   return rval;
 }
 
@@ -1887,19 +2068,19 @@ metadb_get_videoinfo(void *db, const char *url,
 
   rc = db_step(sel);
   if(rc == SQLITE_LOCKED) {
-    sqlite3_finalize(sel);
+    db_finalize(sel);
     return METADATA_DEADLOCK;
   }
 
   if(rc != SQLITE_ROW) {
-    sqlite3_finalize(sel);
+    db_finalize(sel);
     return 0;
   }
 
   int64_t item_id = sqlite3_column_int64(sel, 0);
   int ds_id = sqlite3_column_int(sel, 1);
 
-  sqlite3_finalize(sel);
+  db_finalize(sel);
 
   if(fixed_ds)
     *fixed_ds = ds_id;
@@ -1998,7 +2179,7 @@ metadb_get_videoinfo(void *db, const char *url,
       metadb_get_videoinfo2(db, md->md_parent_id, &md->md_parent);
   }
 
-  sqlite3_finalize(sel);
+  db_finalize(sel);
   *mdp = md;
   return 0;
 }
@@ -2055,7 +2236,7 @@ metadb_metadata_get_streams(sqlite3 *db, metadata_t *md, int64_t videoitem_id)
 			sqlite3_column_int(sel, 5),
 			tn);
   }
-  sqlite3_finalize(sel);
+  db_finalize(sel);
   return 0;
 }
 
@@ -2083,14 +2264,14 @@ metadb_metadata_get_image(sqlite3 *db, metadata_t *md, int64_t item_id)
   rc = db_step(sel);
 
   if(rc != SQLITE_ROW) {
-    sqlite3_finalize(sel);
+    db_finalize(sel);
     return METADATA_PERMANENT_ERROR;
   }
 
   md->md_time = sqlite3_column_int(sel, 0);
   md->md_manufacturer = rstr_alloc((void *)sqlite3_column_text(sel, 1));
   md->md_equipment = rstr_alloc((void *)sqlite3_column_text(sel, 2));
-  sqlite3_finalize(sel);
+  db_finalize(sel);
   return 0;
 }
 
@@ -2172,7 +2353,7 @@ metadb_metadata_get(void *db, const char *url, time_t mtime)
   rc = db_step(sel);
 
   if(rc != SQLITE_ROW) {
-    sqlite3_finalize(sel);
+    db_finalize(sel);
     db_rollback(db);
     return NULL;
   }
@@ -2191,7 +2372,7 @@ metadb_metadata_get(void *db, const char *url, time_t mtime)
       METADATA_CACHE_STATUS_FULL :
       METADATA_CACHE_STATUS_UNPARENTED;
 
-  sqlite3_finalize(sel);
+  db_finalize(sel);
   db_rollback(db);
   return md;
 }
@@ -2264,7 +2445,7 @@ metadb_metadata_scandir(void *db, const char *url, time_t *mtime)
     }
   }
 
-  sqlite3_finalize(sel);
+  db_finalize(sel);
 
   get_cache_release(&gc);
 
@@ -2311,7 +2492,7 @@ metadb_unparent_item(void *db, const char *url)
     goto again;
   }
 
-  sqlite3_finalize(stmt);
+  db_finalize(stmt);
   db_commit(db);
 }
 
@@ -2351,7 +2532,7 @@ metadb_parent_item(void *db, const char *url, const char *parent_url)
     goto again;
   }
 
-  sqlite3_finalize(stmt);
+  db_finalize(stmt);
   db_commit(db);
 }
 
@@ -2404,7 +2585,7 @@ metadb_register_play(const char *url, int inc, int content_type)
     sqlite3_bind_int(stmt, 3, inc);
     sqlite3_bind_int(stmt, 4, content_type);
     rc = db_step(stmt);
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
     if(rc == SQLITE_LOCKED) {
       db_rollback_deadlock(db);
       goto again;
@@ -2467,7 +2648,7 @@ metadb_set_video_restartpos(const char *url, int64_t pos_ms)
       sqlite3_bind_int64(stmt, 2, pos_ms);
     sqlite3_bind_int(stmt, 3, CONTENT_VIDEO);
     rc = db_step(stmt);
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
     if(rc == SQLITE_LOCKED) {
       db_rollback_deadlock(db);
       goto again;
@@ -2507,7 +2688,7 @@ video_get_restartpos(const char *url)
 
     if(rc == SQLITE_ROW)
       rval = sqlite3_column_int64(stmt, 0);
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
   }
   metadb_close(db);
   return rval;
@@ -2572,7 +2753,7 @@ mip_get(sqlite3 *db, const char *url, metadb_item_info_t *mii)
     rc = 0;
   }
 
-  sqlite3_finalize(stmt);
+  db_finalize(stmt);
   return rc;
 }
 
@@ -2702,7 +2883,7 @@ metadb_set_playcount(void *opaque, prop_event_t event, ...)
     sqlite3_bind_text(stmt, 1, mip->mip_url, -1, SQLITE_STATIC);
     sqlite3_bind_int64(stmt, 2, v);
     rc = db_step(stmt);
-    sqlite3_finalize(stmt);
+    db_finalize(stmt);
     if(rc == SQLITE_LOCKED) {
       db_rollback_deadlock(db);
       goto again;
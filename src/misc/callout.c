@@ -22,22 +22,113 @@
 #include "callout.h"
 #include "arch/arch.h"
 
-static LIST_HEAD(, callout) callouts;
+/**
+ * Armed callouts are kept in a 4-ary min-heap on deadline, so arming
+ * and disarming is O(log n) regardless of the number of timers.
+ * c_heap_idx is the position of the callout in the heap.
+ */
+static callout_t **callout_heap;
+static int callout_heap_size;
+static int callout_heap_capacity;
 
 static hts_mutex_t callout_mutex;
 static hts_cond_t callout_cond;
 
+#define HEAP_PARENT(i) (((i) - 1) >> 2)
+#define HEAP_CHILD(i)  (((i) << 2) + 1)
+
+
 /**
- *htsmsg_t *props
+ *
  */
-static int
-calloutcmp(callout_t *a, callout_t *b)
+static inline void
+heap_set(int i, callout_t *c)
 {
-  if(a->c_deadline < b->c_deadline)
-    return -1;
-  else if(a->c_deadline > b->c_deadline)
-    return 1;
- return 0;
+  callout_heap[i] = c;
+  c->c_heap_idx = i;
+}
+
+
+/**
+ *
+ */
+static void
+heap_sift_up(int i)
+{
+  callout_t *c = callout_heap[i];
+
+  while(i > 0) {
+    int p = HEAP_PARENT(i);
+    if(callout_heap[p]->c_deadline <= c->c_deadline)
+      break;
+    heap_set(i, callout_heap[p]);
+    i = p;
+  }
+  heap_set(i, c);
+}
+
+
+/**
+ *
+ */
+static void
+heap_sift_down(int i)
+{
+  callout_t *c = callout_heap[i];
+
+  while(1) {
+    const int first = HEAP_CHILD(i);
+    const int last = MIN(first + 4, callout_heap_size);
+    uint64_t deadline = c->c_deadline;
+    int j, best = -1;
+
+    for(j = first; j < last; j++) {
+      if(callout_heap[j]->c_deadline < deadline) {
+        deadline = callout_heap[j]->c_deadline;
+        best = j;
+      }
+    }
+    if(best == -1)
+      break;
+    heap_set(i, callout_heap[best]);
+    i = best;
+  }
+  heap_set(i, c);
+}
+
+
+/**
+ *
+ */
+static void
+heap_insert(callout_t *c)
+{
+  if(callout_heap_size == callout_heap_capacity) {
+    callout_heap_capacity = MAX(callout_heap_capacity * 2, 64);
+    callout_heap = realloc(callout_heap,
+                           callout_heap_capacity * sizeof(callout_t *));
+  }
+  heap_set(callout_heap_size, c);
+  callout_heap_size++;
+  heap_sift_up(c->c_heap_idx);
+}
+
+
+/**
+ *
+ */
+static void
+heap_remove(callout_t *c)
+{
+  const int i = c->c_heap_idx;
+  callout_t *last = callout_heap[--callout_heap_size];
+
+  if(last == c)
+    return;
+
+  heap_set(i, last);
+  heap_sift_up(i);
+  heap_sift_down(last->c_heap_idx);
 }
 
 
@@ -50,17 +141,22 @@ callout_arm_abs(callout_t *d, callout_callback_t *callback, void *opaque,
 {
   hts_mutex_lock(&callout_mutex);
 
+  callout_t *first = callout_heap_size ? callout_heap[0] : NULL;
+
   if(d == NULL)
     d = malloc(sizeof(callout_t));
   else if(d->c_callback != NULL)
-    LIST_REMOVE(d, c_link);
-    
+    heap_remove(d);
+
   d->c_callback = callback;
   d->c_opaque = opaque;
   d->c_deadline = deadline;
 
-  LIST_INSERT_SORTED(&callouts, d, c_link, calloutcmp);
-  hts_cond_signal(&callout_cond);
+  heap_insert(d);
+
+  // Only need to wake up the callout thread if the next deadline changed
+  if(callout_heap[0] != first || first == d)
+    hts_cond_signal(&callout_cond);
   hts_mutex_unlock(&callout_mutex);
 }
 
@@ -94,7 +190,7 @@ callout_disarm(callout_t *d)
 {
   hts_mutex_lock(&callout_mutex);
   if(d->c_callback) {
-    LIST_REMOVE(d, c_link);
+    heap_remove(d);
     d->c_callback = NULL;
   }
   hts_mutex_unlock(&callout_mutex);
@@ -117,17 +213,18 @@ callout_loop(void *aux)
 
     now = showtime_get_ts();
   
-    while((c = LIST_FIRST(&callouts)) != NULL && c->c_deadline <= now) {
+    while(callout_heap_size > 0 &&
+          (c = callout_heap[0])->c_deadline <= now) {
       cc = c->c_callback;
-      LIST_REMOVE(c, c_link);
+      heap_remove(c);
       c->c_callback = NULL;
       hts_mutex_unlock(&callout_mutex);
       cc(c, c->c_opaque);
       hts_mutex_lock(&callout_mutex);
     }
 
-    if((c = LIST_FIRST(&callouts)) != NULL) {
-
+    if(callout_heap_size > 0) {
+      c = callout_heap[0];
       int timeout = (c->c_deadline - now + 999) / 1000;
       hts_cond_wait_timeout(&callout_cond, &callout_mutex, timeout);
     } else {
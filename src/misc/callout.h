@@ -26,7 +26,7 @@ struct callout;
 typedef void (callout_callback_t)(struct callout *c, void *opaque);
 
 typedef struct callout {
-  LIST_ENTRY(callout) c_link;
+  int c_heap_idx;
   callout_callback_t *c_callback;
   void *c_opaque;
   uint64_t c_deadline;
@@ -20,6 +20,8 @@
 #include <string.h>
 #include <limits.h>
 #include <stdio.h>
+#include <errno.h>
+#include <inttypes.h>
 #include "json.h"
 #include "str.h"
 #include "dbl.h"
@@ -32,8 +34,48 @@ static const char *json_parse_value(const char *s, void *parent,
 				    void *opaque,
 				    const char **failp, const char **failmsg);
 
+/**
+ * Returns value of the four hex digits at 's' or -1
+ */
+static int
+json_parse_hex4(const char *s)
+{
+  int i, v = 0;
+
+  for(i = 0; i < 4; i++) {
+    v = v << 4;
+    switch(s[i]) {
+    case '0' ... '9':
+      v |= s[i] - '0';
+      break;
+    case 'a' ... 'f':
+      v |= s[i] - 'a' + 10;
+      break;
+    case 'A' ... 'F':
+      v |= s[i] - 'A' + 10;
+      break;
+    default:
+      return -1;
+    }
+  }
+  return v;
+}
+
+
+/**
+ * Combine an UTF-16 surrogate pair into a code point
+ */
+#define json_is_high_surrogate(c) ((c) >= 0xd800 && (c) < 0xdc00)
+#define json_is_low_surrogate(c)  ((c) >= 0xdc00 && (c) < 0xe000)
+#define json_surrogate_pair(hi, lo) \
+  (0x10000 + (((hi) - 0xd800) << 10) + ((lo) - 0xdc00))
+
+
 /**
  * Returns a newly allocated string
+ *
+ * \u0000 is rejected as it can't be represented in a C string.
+ * Unpaired surrogates are dropped.
  */
 static char *
 json_parse_string(const char *s, const char **endp,
@@ -91,29 +133,24 @@ json_parse_string(const char *s, const char **endp,
 	      *b++ = '\t';
 	    else if(*a == 'u') {
 	      // Unicode character
-	      int i, v = 0;
+	      int v, lo;
 
 	      a++;
-	      for(i = 0; i < 4; i++) {
-		v = v << 4;
-		switch(a[i]) {
-		case '0' ... '9':
-		  v |= a[i] - '0';
-		  break;
-		case 'a' ... 'f':
-		  v |= a[i] - 'a' + 10;
-		  break;
-		case 'A' ... 'F':
-		  v |= a[i] - 'F' + 10;
-		  break;
-		default:
-		  free(r);
-		  *failmsg = "Incorrect escape sequence";
-		  *failp = (a - r) + start;
-		  return NULL;
-		}
+	      if((v = json_parse_hex4(a)) <= 0) {
+		*failmsg = v ? "Incorrect escape sequence" :
+		  "Invalid \\u0000 in string";
+		*failp = (a - r) + start;
+		free(r);
+		return NULL;
+	      }
+	      a += 3;
+
+	      if(json_is_high_surrogate(v) && a[1] == '\\' && a[2] == 'u' &&
+		 (lo = json_parse_hex4(a + 3)) != -1 &&
+		 json_is_low_surrogate(lo)) {
+		v = json_surrogate_pair(v, lo);
+		a += 6;
 	      }
-	      a+=3;
 	      b += utf8_put(b, v);
 	    } else {
 	      *b++ = *a;
@@ -429,3 +466,483 @@ json_deserialize(const char *src, const json_deserializer_t *jd, void *opaque,
   }
   return c;
 }
+
+
+/**
+ * Incremental parser
+ *
+ * Unlike json_deserialize() this never sees the whole document. The
+ * lexer state (jp_lex) is kept across calls to json_parser_feed() so
+ * tokens may be split at any byte. The grammar state is a stack of
+ * open containers plus what we expect next (jp_expect).
+ */
+
+typedef enum {
+  JP_EXPECT_VALUE,
+  JP_EXPECT_VALUE_OR_END,  // Right after '['
+  JP_EXPECT_KEY,
+  JP_EXPECT_KEY_OR_END,    // Right after '{'
+  JP_EXPECT_COLON,
+  JP_EXPECT_COMMA_OR_END,
+  JP_EXPECT_NOTHING,       // Document complete, rest of input is ignored
+} jp_expect_t;
+
+typedef enum {
+  JP_LEX_NONE,
+  JP_LEX_STRING,
+  JP_LEX_STRING_ESC,
+  JP_LEX_STRING_UNICODE,
+  JP_LEX_NUMBER,
+  JP_LEX_LITERAL,
+} jp_lex_t;
+
+struct json_parser {
+  const json_sax_t *jp_sax;
+  void *jp_opaque;
+
+  jp_expect_t jp_expect;
+  jp_lex_t jp_lex;
+
+  int jp_depth;
+  char jp_stack[JSON_MAX_DEPTH]; // '{' or '['
+
+  char *jp_tok;
+  size_t jp_toklen;
+  size_t jp_tokcap;
+
+  char *jp_key;
+  size_t jp_keycap;
+
+  int jp_unicode;
+  int jp_unicode_digits;
+  int jp_surrogate; // High surrogate waiting for its low half
+
+  int64_t jp_offset;
+  int64_t jp_erroffset;
+  const char *jp_errmsg;
+};
+
+#define JP_CB(jp, cb, ...) do {                             \
+    if((jp)->jp_sax->cb != NULL)                              \
+      (jp)->jp_sax->cb((jp)->jp_opaque, ##__VA_ARGS__);       \
+  } while(0)
+
+
+/**
+ *
+ */
+json_parser_t *
+json_parser_create(const json_sax_t *js, void *opaque)
+{
+  json_parser_t *jp = calloc(1, sizeof(json_parser_t));
+  jp->jp_sax = js;
+  jp->jp_opaque = opaque;
+  jp->jp_expect = JP_EXPECT_VALUE;
+  jp->jp_tokcap = 256;
+  jp->jp_tok = malloc(jp->jp_tokcap);
+  jp->jp_keycap = 64;
+  jp->jp_key = malloc(jp->jp_keycap);
+  return jp;
+}
+
+
+/**
+ *
+ */
+void
+json_parser_destroy(json_parser_t *jp)
+{
+  free(jp->jp_tok);
+  free(jp->jp_key);
+  free(jp);
+}
+
+
+/**
+ * Always leaves room for a terminating zero
+ */
+static void
+jp_tok_append(json_parser_t *jp, const char *s, size_t len)
+{
+  if(jp->jp_toklen + len + 1 > jp->jp_tokcap) {
+    while(jp->jp_toklen + len + 1 > jp->jp_tokcap)
+      jp->jp_tokcap *= 2;
+    jp->jp_tok = realloc(jp->jp_tok, jp->jp_tokcap);
+  }
+  memcpy(jp->jp_tok + jp->jp_toklen, s, len);
+  jp->jp_toklen += len;
+}
+
+
+/**
+ *
+ */
+static const char *
+jp_name(const json_parser_t *jp)
+{
+  if(jp->jp_depth > 0 && jp->jp_stack[jp->jp_depth - 1] == '{')
+    return jp->jp_key;
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static void
+jp_value_done(json_parser_t *jp)
+{
+  jp->jp_expect = jp->jp_depth ? JP_EXPECT_COMMA_OR_END : JP_EXPECT_NOTHING;
+}
+
+
+/**
+ *
+ */
+static void
+jp_string_done(json_parser_t *jp)
+{
+  jp->jp_tok[jp->jp_toklen] = 0;
+  jp->jp_lex = JP_LEX_NONE;
+
+  if(jp->jp_expect == JP_EXPECT_KEY || jp->jp_expect == JP_EXPECT_KEY_OR_END) {
+    if(jp->jp_toklen + 1 > jp->jp_keycap) {
+      jp->jp_keycap = jp->jp_toklen + 1;
+      jp->jp_key = realloc(jp->jp_key, jp->jp_keycap);
+    }
+    memcpy(jp->jp_key, jp->jp_tok, jp->jp_toklen + 1);
+    jp->jp_expect = JP_EXPECT_COLON;
+    return;
+  }
+
+  JP_CB(jp, js_string, jp_name(jp), jp->jp_tok);
+  jp_value_done(jp);
+}
+
+
+/**
+ *
+ */
+static const char *
+jp_number_done(json_parser_t *jp)
+{
+  const char *tok = jp->jp_tok;
+  const char *ep;
+  char *ep2;
+
+  jp->jp_tok[jp->jp_toklen] = 0;
+  jp->jp_lex = JP_LEX_NONE;
+
+  if(strpbrk(tok, ".eE") == NULL) {
+    errno = 0;
+    long long v = strtoll(tok, &ep2, 10);
+    if(*ep2 != 0)
+      return "Malformed number";
+    if(errno != ERANGE) {
+      JP_CB(jp, js_long, jp_name(jp), v);
+      jp_value_done(jp);
+      return NULL;
+    }
+  }
+
+  double d = my_str2double(tok, &ep);
+  if(ep == tok || *ep != 0)
+    return "Malformed number";
+
+  JP_CB(jp, js_double, jp_name(jp), d);
+  jp_value_done(jp);
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static const char *
+jp_literal_done(json_parser_t *jp)
+{
+  const char *name = jp_name(jp);
+
+  jp->jp_tok[jp->jp_toklen] = 0;
+  jp->jp_lex = JP_LEX_NONE;
+
+  if(!strcmp(jp->jp_tok, "true"))
+    JP_CB(jp, js_bool, name, 1);
+  else if(!strcmp(jp->jp_tok, "false"))
+    JP_CB(jp, js_bool, name, 0);
+  else if(!strcmp(jp->jp_tok, "null"))
+    JP_CB(jp, js_null, name);
+  else
+    return "Unknown token";
+
+  jp_value_done(jp);
+  return NULL;
+}
+
+
+/**
+ * Returns -1 on error, the error is reported by json_parser_finish()
+ */
+int
+json_parser_feed(json_parser_t *jp, const void *data, size_t len)
+{
+  const char *start = data;
+  const char *s = start;
+  const char *end = s + len;
+  const char *errmsg, *p;
+  char tmp[8];
+  int c;
+
+  if(jp->jp_errmsg != NULL)
+    return -1;
+
+  while(s < end) {
+    c = *(const unsigned char *)s;
+
+    switch(jp->jp_lex) {
+    case JP_LEX_STRING:
+      for(p = s; p < end && *p != '"' && *p != '\\'; p++) {}
+      if(p != s || (p < end && *p == '"'))
+	jp->jp_surrogate = 0; // Not followed by another escape, drop it
+      jp_tok_append(jp, s, p - s);
+      s = p;
+      if(s == end)
+	continue;
+      if(*s == '"')
+	jp_string_done(jp);
+      else
+	jp->jp_lex = JP_LEX_STRING_ESC;
+      s++;
+      continue;
+
+    case JP_LEX_STRING_ESC:
+      jp->jp_lex = JP_LEX_STRING;
+      switch(c) {
+      case 'b': tmp[0] = '\b'; break;
+      case 'f': tmp[0] = '\f'; break;
+      case 'n': tmp[0] = '\n'; break;
+      case 'r': tmp[0] = '\r'; break;
+      case 't': tmp[0] = '\t'; break;
+      case 'u':
+	jp->jp_lex = JP_LEX_STRING_UNICODE;
+	jp->jp_unicode = 0;
+	jp->jp_unicode_digits = 0;
+	s++;
+	continue;
+      default:
+	tmp[0] = c;
+	break;
+      }
+      jp->jp_surrogate = 0;
+      jp_tok_append(jp, tmp, 1);
+      s++;
+      continue;
+
+    case JP_LEX_STRING_UNICODE:
+      switch(c) {
+      case '0' ... '9':
+	c = c - '0';
+	break;
+      case 'a' ... 'f':
+	c = c - 'a' + 10;
+	break;
+      case 'A' ... 'F':
+	c = c - 'A' + 10;
+	break;
+      default:
+	errmsg = "Incorrect escape sequence";
+	goto fail;
+      }
+      jp->jp_unicode = (jp->jp_unicode << 4) | c;
+      if(++jp->jp_unicode_digits == 4) {
+	c = jp->jp_unicode;
+	jp->jp_lex = JP_LEX_STRING;
+
+	if(c == 0) {
+	  errmsg = "Invalid \\u0000 in string";
+	  goto fail;
+	}
+
+	if(json_is_low_surrogate(c) && jp->jp_surrogate)
+	  c = json_surrogate_pair(jp->jp_surrogate, c);
+	jp->jp_surrogate = 0;
+
+	if(json_is_high_surrogate(c))
+	  jp->jp_surrogate = c;
+	else
+	  jp_tok_append(jp, tmp, utf8_put(tmp, c));
+      }
+      s++;
+      continue;
+
+    case JP_LEX_NUMBER:
+      if((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' ||
+	 c == 'e' || c == 'E') {
+	tmp[0] = c;
+	jp_tok_append(jp, tmp, 1);
+	s++;
+	continue;
+      }
+      if((errmsg = jp_number_done(jp)) != NULL)
+	goto fail;
+      continue; // Process terminating character
+
+    case JP_LEX_LITERAL:
+      if(c >= 'a' && c <= 'z' && jp->jp_toklen < 5) {
+	tmp[0] = c;
+	jp_tok_append(jp, tmp, 1);
+	s++;
+	continue;
+      }
+      if((errmsg = jp_literal_done(jp)) != NULL)
+	goto fail;
+      continue; // Process terminating character
+
+    case JP_LEX_NONE:
+      break;
+    }
+
+    if(c > 0 && c < 33) {
+      s++;
+      continue;
+    }
+
+    if(jp->jp_expect == JP_EXPECT_NOTHING)
+      break;
+
+    switch(c) {
+    case '{':
+    case '[':
+      if(jp->jp_expect != JP_EXPECT_VALUE &&
+	 jp->jp_expect != JP_EXPECT_VALUE_OR_END) {
+	errmsg = "Unexpected '{' or '['";
+	goto fail;
+      }
+      if(jp->jp_depth == JSON_MAX_DEPTH) {
+	errmsg = "Too deeply nested";
+	goto fail;
+      }
+
+      if(c == '{') {
+	JP_CB(jp, js_begin_map, jp_name(jp));
+	jp->jp_expect = JP_EXPECT_KEY_OR_END;
+      } else {
+	JP_CB(jp, js_begin_list, jp_name(jp));
+	jp->jp_expect = JP_EXPECT_VALUE_OR_END;
+      }
+      jp->jp_stack[jp->jp_depth++] = c;
+      break;
+
+    case '}':
+      if(jp->jp_depth == 0 || jp->jp_stack[jp->jp_depth - 1] != '{' ||
+	 (jp->jp_expect != JP_EXPECT_KEY_OR_END &&
+	  jp->jp_expect != JP_EXPECT_COMMA_OR_END)) {
+	errmsg = "Unexpected '}'";
+	goto fail;
+      }
+      jp->jp_depth--;
+      JP_CB(jp, js_end);
+      jp_value_done(jp);
+      break;
+
+    case ']':
+      if(jp->jp_depth == 0 || jp->jp_stack[jp->jp_depth - 1] != '[' ||
+	 (jp->jp_expect != JP_EXPECT_VALUE_OR_END &&
+	  jp->jp_expect != JP_EXPECT_COMMA_OR_END)) {
+	errmsg = "Unexpected ']'";
+	goto fail;
+      }
+      jp->jp_depth--;
+      JP_CB(jp, js_end);
+      jp_value_done(jp);
+      break;
+
+    case ',':
+      if(jp->jp_expect != JP_EXPECT_COMMA_OR_END) {
+	errmsg = "Unexpected ','";
+	goto fail;
+      }
+      jp->jp_expect = jp->jp_stack[jp->jp_depth - 1] == '{' ?
+	JP_EXPECT_KEY : JP_EXPECT_VALUE;
+      break;
+
+    case ':':
+      if(jp->jp_expect != JP_EXPECT_COLON) {
+	errmsg = "Unexpected ':'";
+	goto fail;
+      }
+      jp->jp_expect = JP_EXPECT_VALUE;
+      break;
+
+    default:
+      if(jp->jp_depth == 0) {
+	errmsg = "Invalid JSON, expected '{' or '['";
+	goto fail;
+      }
+
+      if(c == '"' && (jp->jp_expect == JP_EXPECT_KEY ||
+		      jp->jp_expect == JP_EXPECT_KEY_OR_END)) {
+	jp->jp_lex = JP_LEX_STRING;
+	jp->jp_toklen = 0;
+	break;
+      }
+
+      if(jp->jp_expect != JP_EXPECT_VALUE &&
+	 jp->jp_expect != JP_EXPECT_VALUE_OR_END) {
+	errmsg = jp->jp_expect == JP_EXPECT_COLON ? "Expected ':'" :
+	  jp->jp_expect == JP_EXPECT_COMMA_OR_END ? "Expected ','" :
+	  "Expected string";
+	goto fail;
+      }
+
+      jp->jp_toklen = 0;
+
+      if(c == '"') {
+	jp->jp_lex = JP_LEX_STRING;
+	break;
+      }
+
+      tmp[0] = c;
+      jp_tok_append(jp, tmp, 1);
+
+      if((c >= '0' && c <= '9') || c == '-') {
+	jp->jp_lex = JP_LEX_NUMBER;
+      } else if(c >= 'a' && c <= 'z') {
+	jp->jp_lex = JP_LEX_LITERAL;
+      } else {
+	errmsg = "Unknown token";
+	goto fail;
+      }
+      break;
+    }
+    s++;
+  }
+
+  jp->jp_offset += len;
+  return 0;
+
+ fail:
+  jp->jp_errmsg = errmsg;
+  jp->jp_erroffset = jp->jp_offset + (s - start);
+  return -1;
+}
+
+
+/**
+ * Returns 0 if a complete document has been parsed
+ */
+int
+json_parser_finish(json_parser_t *jp, char *errbuf, size_t errlen)
+{
+  if(jp->jp_errmsg == NULL && jp->jp_expect != JP_EXPECT_NOTHING) {
+    jp->jp_errmsg = "Unexpected end of JSON message";
+    jp->jp_erroffset = jp->jp_offset;
+  }
+
+  if(jp->jp_errmsg == NULL)
+    return 0;
+
+  snprintf(errbuf, errlen, "%s at offset %"PRId64,
+	   jp->jp_errmsg, jp->jp_erroffset);
+  return -1;
+}
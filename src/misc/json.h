@@ -1,5 +1,8 @@
 #pragma once
 
+#include <stdint.h>
+#include <stddef.h>
+
 typedef struct json_deserializer {
   void *(*jd_create_map)(void *jd_opaque);
   void *(*jd_create_list)(void *jd_opaque);
@@ -29,3 +32,34 @@ typedef struct json_deserializer {
 
 void *json_deserialize(const char *src, const json_deserializer_t *jd,
 		       void *opaque, char *errbuf, size_t errlen);
+
+
+/**
+ * Incremental (push) parser. Data can be fed in arbitrary fragments as
+ * it arrives and the callbacks are invoked as soon as each value is
+ * complete. 'name' is the key when inside a map and NULL inside a list.
+ * Any callback may be NULL. Strings are only valid during the callback.
+ */
+typedef struct json_sax {
+  void (*js_begin_map)(void *opaque, const char *name);
+  void (*js_begin_list)(void *opaque, const char *name);
+  void (*js_end)(void *opaque); // End of innermost map or list
+
+  void (*js_string)(void *opaque, const char *name, const char *str);
+  void (*js_long)(void *opaque, const char *name, int64_t v);
+  void (*js_double)(void *opaque, const char *name, double d);
+  void (*js_bool)(void *opaque, const char *name, int v);
+  void (*js_null)(void *opaque, const char *name);
+} json_sax_t;
+
+#define JSON_MAX_DEPTH 64
+
+typedef struct json_parser json_parser_t;
+
+json_parser_t *json_parser_create(const json_sax_t *js, void *opaque);
+
+int json_parser_feed(json_parser_t *jp, const void *data, size_t len);
+
+int json_parser_finish(json_parser_t *jp, char *errbuf, size_t errlen);
+
+void json_parser_destroy(json_parser_t *jp);
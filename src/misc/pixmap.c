@@ -69,6 +69,57 @@ pixmap_dup(pixmap_t *pm)
 }
 
 
+/**
+ * Return a pixmap that the caller can modify in place. If anyone else
+ * holds a reference (such as the pixmap cache) the pixels are copied
+ * and our reference to the shared one is released. Returns NULL (with
+ * the reference released) if out of memory.
+ *
+ * Only for decoded pixmaps
+ */
+pixmap_t *
+pixmap_make_writable(pixmap_t *pm)
+{
+  int y;
+
+  if(pm->pm_refcount == 1)
+    return pm;
+
+  assert(!pixmap_is_coded(pm) && pm->pm_type != PIXMAP_VECTOR &&
+         pm->pm_type != PIXMAP_GLYPHS);
+
+  pixmap_t *c = pixmap_create(pm->pm_width - pm->pm_margin * 2,
+                              pm->pm_height - pm->pm_margin * 2,
+                              pm->pm_type, pm->pm_margin);
+  if(c == NULL) {
+    pixmap_release(pm);
+    return NULL;
+  }
+
+  const int len = MIN(c->pm_linesize, pm->pm_linesize);
+  for(y = 0; y < pm->pm_height; y++)
+    memcpy(c->pm_pixels + y * c->pm_linesize,
+           pm->pm_pixels + y * pm->pm_linesize, len);
+
+  if(pm->pm_charpos != NULL) {
+    // Start and end position per character
+    c->pm_charpos = malloc(2 * pm->pm_charposlen * sizeof(int));
+    memcpy(c->pm_charpos, pm->pm_charpos,
+           2 * pm->pm_charposlen * sizeof(int));
+    c->pm_charposlen = pm->pm_charposlen;
+  }
+
+  c->pm_orientation   = pm->pm_orientation;
+  c->pm_original_type = pm->pm_original_type;
+  c->pm_lines         = pm->pm_lines;
+  c->pm_aspect        = pm->pm_aspect;
+  c->pm_flags         = pm->pm_flags;
+
+  pixmap_release(pm);
+  return c;
+}
+
+
 /**
  *
  */
@@ -133,6 +184,53 @@ pixmap_create(int width, int height, pixmap_type_t type, int margin)
 }
 
 
+/**
+ * Shrink by a factor of (1 << shift) in both directions by averaging
+ * each box of source pixels
+ */
+pixmap_t *
+pixmap_downscale(const pixmap_t *src, int shift)
+{
+  const int bpp = bytes_per_pixel(src->pm_type);
+  const int w = src->pm_width  >> shift;
+  const int h = src->pm_height >> shift;
+  const int n = 1 << shift;
+  int x, y, i, j, c;
+  pixmap_t *dst;
+
+  if(bpp == 0 || w < 1 || h < 1)
+    return NULL;
+
+  dst = pixmap_create(w, h, src->pm_type, 0);
+  if(dst == NULL)
+    return NULL;
+
+  dst->pm_margin        = src->pm_margin >> shift;
+  dst->pm_aspect        = src->pm_aspect;
+  dst->pm_orientation   = src->pm_orientation;
+  dst->pm_original_type = src->pm_original_type;
+
+  for(y = 0; y < h; y++) {
+    uint8_t *d = dst->pm_data + y * dst->pm_linesize;
+
+    for(x = 0; x < w; x++) {
+      for(c = 0; c < bpp; c++) {
+	unsigned int sum = 0;
+	const uint8_t *s = src->pm_data + (y << shift) * src->pm_linesize +
+	  (x << shift) * bpp + c;
+
+	for(j = 0; j < n; j++, s += src->pm_linesize)
+	  for(i = 0; i < n; i++)
+	    sum += s[i * bpp];
+
+	*d++ = sum >> (shift * 2);
+      }
+    }
+  }
+  return dst;
+}
+
+
 /**
  *
  */
@@ -256,7 +354,9 @@ pixmap_release(pixmap_t *pm)
   if(atomic_add(&pm->pm_refcount, -1) > 1)
     return;
 
-  if(!pixmap_is_coded(pm)) {
+  if(pm->pm_type == PIXMAP_GLYPHS) {
+    free(pm->pm_data);
+  } else if(!pixmap_is_coded(pm)) {
     free(pm->pm_pixels);
     free(pm->pm_charpos);
   } else {
@@ -1382,6 +1482,131 @@ pixmap_compute_rescale_dim(const image_meta_t *im,
   *dst_height = h;
 }
 
+/**
+ * Per-thread pool of opened image decoders
+ *
+ * Opening a codec costs more than decoding a small image, so each thread
+ * decoding images keeps one context per codec (and lowres setting for
+ * JPEG) around between calls
+ */
+#define PIXMAP_DECODER_NONE  -1
+#define PIXMAP_DECODER_PNG    0
+#define PIXMAP_DECODER_JPEG   1  // + lowres (0 - 2)
+#define PIXMAP_DECODER_SLOTS  4
+
+typedef struct pixmap_decoder {
+  AVCodecContext *pd_ctx[PIXMAP_DECODER_SLOTS];
+  AVFrame *pd_frame;
+} pixmap_decoder_t;
+
+static unsigned int pixmap_decoder_key;
+
+
+/**
+ *
+ */
+static void
+pixmap_decoder_close(AVCodecContext *ctx)
+{
+  avcodec_close(ctx);
+  av_free(ctx);
+}
+
+
+/**
+ * Called when a thread exits
+ */
+static void
+pixmap_decoder_destroy(void *aux)
+{
+  pixmap_decoder_t *pd = aux;
+  int i;
+
+  for(i = 0; i < PIXMAP_DECODER_SLOTS; i++)
+    if(pd->pd_ctx[i] != NULL)
+      pixmap_decoder_close(pd->pd_ctx[i]);
+  av_free(pd->pd_frame);
+  free(pd);
+}
+
+
+/**
+ *
+ */
+void
+pixmap_decoder_init(void)
+{
+  hts_thread_key_create(&pixmap_decoder_key, pixmap_decoder_destroy);
+}
+
+
+/**
+ *
+ */
+static pixmap_decoder_t *
+pixmap_decoder_get(void)
+{
+  pixmap_decoder_t *pd = hts_thread_get_specific(pixmap_decoder_key);
+
+  if(pd == NULL) {
+    pd = calloc(1, sizeof(pixmap_decoder_t));
+    pd->pd_frame = avcodec_alloc_frame();
+    hts_thread_set_specific(pixmap_decoder_key, pd);
+  }
+  return pd;
+}
+
+
+/**
+ * Return an opened codec context, reusing the one from the thread's
+ * pool if possible
+ */
+static AVCodecContext *
+pixmap_decoder_open(pixmap_decoder_t *pd, AVCodec *codec, int slot,
+                    int lowres)
+{
+  AVCodecContext *ctx;
+
+  if(slot != PIXMAP_DECODER_NONE && pd->pd_ctx[slot] != NULL) {
+    // Drop anything left behind by the previous image
+    avcodec_flush_buffers(pd->pd_ctx[slot]);
+    return pd->pd_ctx[slot];
+  }
+
+  ctx = avcodec_alloc_context3(codec);
+  ctx->lowres = lowres;
+
+  if(avcodec_open2(ctx, codec, NULL) < 0) {
+    av_free(ctx);
+    return NULL;
+  }
+
+  if(slot != PIXMAP_DECODER_NONE)
+    pd->pd_ctx[slot] = ctx;
+  return ctx;
+}
+
+
+/**
+ * Give back a context obtained by pixmap_decoder_open(). If decoding
+ * failed we don't trust its state and close it
+ */
+static void
+pixmap_decoder_release(pixmap_decoder_t *pd, AVCodecContext *ctx, int slot,
+                       int failed)
+{
+  if(slot == PIXMAP_DECODER_NONE) {
+    pixmap_decoder_close(ctx);
+    return;
+  }
+
+  if(failed) {
+    pd->pd_ctx[slot] = NULL;
+    pixmap_decoder_close(ctx);
+  }
+}
+
+
 /**
  *
  */
@@ -1389,9 +1614,11 @@ pixmap_t *
 pixmap_decode(pixmap_t *pm, const image_meta_t *im,
 	      char *errbuf, size_t errlen)
 {
+  pixmap_decoder_t *pd;
   AVCodecContext *ctx;
   AVCodec *codec;
   AVFrame *frame;
+  int slot = PIXMAP_DECODER_NONE;
   int got_pic, w, h;
   int orientation = pm->pm_orientation;
   jpeg_meminfo_t mi;
@@ -1414,6 +1641,7 @@ pixmap_decode(pixmap_t *pm, const image_meta_t *im,
     return svg_decode(pm, im, errbuf, errlen);
   case PIXMAP_PNG:
     codec = avcodec_find_decoder(CODEC_ID_PNG);
+    slot = PIXMAP_DECODER_PNG;
     break;
   case PIXMAP_JPEG:
 
@@ -1437,6 +1665,7 @@ pixmap_decode(pixmap_t *pm, const image_meta_t *im,
       lowres = 1; // swscale have problems with dimensions > 4096
 
     codec = avcodec_find_decoder(CODEC_ID_MJPEG);
+    slot = PIXMAP_DECODER_JPEG + lowres;
     break;
   case PIXMAP_GIF:
     codec = avcodec_find_decoder(CODEC_ID_GIF);
@@ -1452,17 +1681,16 @@ pixmap_decode(pixmap_t *pm, const image_meta_t *im,
     return NULL;
   }
 
-  ctx = avcodec_alloc_context3(codec);
-  ctx->lowres = lowres;
+  pd = pixmap_decoder_get();
 
-  if(avcodec_open2(ctx, codec, NULL) < 0) {
-    av_free(ctx);
+  if((ctx = pixmap_decoder_open(pd, codec, slot, lowres)) == NULL) {
     pixmap_release(pm);
     snprintf(errbuf, errlen, "Unable to open codec");
     return NULL;
   }
-  
-  frame = avcodec_alloc_frame();
+
+  frame = pd->pd_frame;
+  avcodec_get_frame_defaults(frame);
 
   AVPacket avpkt;
   av_init_packet(&avpkt);
@@ -1470,13 +1698,12 @@ pixmap_decode(pixmap_t *pm, const image_meta_t *im,
   avpkt.size = pm->pm_size;
   int r = avcodec_decode_video2(ctx, frame, &got_pic, &avpkt);
 
-  if(r < 0 || ctx->width == 0 || ctx->height == 0) {
+  // Without a picture the frame and dimensions may be from a previous image
+  if(r < 0 || !got_pic || ctx->width == 0 || ctx->height == 0) {
     pixmap_release(pm);
-    avcodec_close(ctx);
-    av_free(ctx);
-    av_free(frame);
     snprintf(errbuf, errlen, "Unable to decode image of size (%d x %d)",
              ctx->width, ctx->height);
+    pixmap_decoder_release(pd, ctx, slot, 1);
     return NULL;
   }
 
@@ -1507,10 +1734,8 @@ pixmap_decode(pixmap_t *pm, const image_meta_t *im,
   } else {
     snprintf(errbuf, errlen, "Out of memory");
   }
-  av_free(frame);
 
-  avcodec_close(ctx);
-  av_free(ctx);
+  pixmap_decoder_release(pd, ctx, slot, 0);
   return pm;
 }
 
@@ -44,6 +44,7 @@ typedef enum {
   PIXMAP_RGB24,
   PIXMAP_IA,
   PIXMAP_I,
+  PIXMAP_GLYPHS,   // Array of text_glyph_t, see text/text.h
 } pixmap_type_t;
 
 #define pixmap_type_is_coded(t) ((t) < PIXMAP_coded)
@@ -117,6 +118,10 @@ typedef struct pixmap {
       int capacity;
       int used;
     } vector;
+
+    struct {
+      int count;
+    } glyphs;
   };
 
 } pixmap_t;
@@ -130,6 +135,8 @@ typedef struct pixmap {
 #define pm_capacity   vector.capacity
 #define pm_used       vector.used
 
+#define pm_num_glyphs glyphs.count
+
 
 pixmap_t *pixmap_alloc_coded(const void *data, size_t size,
 			     pixmap_type_t type);
@@ -138,6 +145,8 @@ pixmap_t *pixmap_create_vector(int width, int height);
 
 pixmap_t *pixmap_dup(pixmap_t *pm);
 
+pixmap_t *pixmap_make_writable(pixmap_t *pm);
+
 void pixmap_release(pixmap_t *pm);
 
 void pixmap_composite(pixmap_t *dst, const pixmap_t *src,
@@ -146,11 +155,15 @@ void pixmap_composite(pixmap_t *dst, const pixmap_t *src,
 pixmap_t *pixmap_create(int width, int height, pixmap_type_t type,
 			int margin);
 
+pixmap_t *pixmap_downscale(const pixmap_t *src, int shift);
+
 void pixmap_box_blur(pixmap_t *pm, int boxw, int boxh);
 
 pixmap_t *pixmap_decode(pixmap_t *pm, const image_meta_t *im,
 			char *errbuf, size_t errlen);
 
+void pixmap_decoder_init(void);
+
 extern pixmap_t *(*accel_pixmap_decode)(pixmap_t *pm, const image_meta_t *im,
 					char *errbuf, size_t errlen);
 
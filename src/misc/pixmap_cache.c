@@ -0,0 +1,429 @@
+/*
+ *  Cache of decoded pixmaps
+ *  Copyright (C) 2013 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "showtime.h"
+#include "pixmap.h"
+#include "pixmap_cache.h"
+#include "misc/queue.h"
+#include "blobcache.h"
+#include "settings.h"
+#include "htsmsg/htsmsg_store.h"
+
+/**
+ * Decoded (and post-processed) images are kept in memory in LRU order
+ * up to PIXMAP_CACHE_MAXSIZE bytes. Entries are keyed on URL and all
+ * parameters in image_meta that affect the result.
+ *
+ * Small images (thumbnails, posters) can also be stored as raw pixels
+ * in the blobcache so they don't need to be decoded again once they
+ * have been evicted from memory.
+ *
+ * If the source was loaded through the fa_load cache its expiry, ETag
+ * and modification time are copied to our entries. Entries expire when
+ * the source does and an expired entry is only handed out to callers
+ * that can refresh stale data. The fixed max ages are used when the
+ * origin did not tell us anything.
+ *
+ * Cached pixmaps are shared by reference with everyone that loads the
+ * same image and must be treated as read only. Code that wants to
+ * modify a loaded pixmap in place must call pixmap_make_writable() on
+ * it first.
+ */
+
+#define PIXMAP_CACHE_MAXSIZE     (16 * 1024 * 1024)
+#define PIXMAP_CACHE_HASH_SIZE   256
+#define PIXMAP_CACHE_MAXAGE      600     // Max seconds in memory
+#define PIXMAP_CACHE_DISK_MAXAGE 86400   // Seconds on disk without origin info
+#define PIXMAP_CACHE_DISK_MAXSIZE (256 * 1024)
+
+#define PIXMAP_CACHE_DISK_MAGIC  0x706d6331
+
+
+LIST_HEAD(pixmap_cache_entry_list, pixmap_cache_entry);
+TAILQ_HEAD(pixmap_cache_entry_queue, pixmap_cache_entry);
+
+typedef struct pixmap_cache_entry {
+  LIST_ENTRY(pixmap_cache_entry) pce_hash_link;
+  TAILQ_ENTRY(pixmap_cache_entry) pce_lru_link;
+  char *pce_key;
+  unsigned int pce_hash;
+  pixmap_t *pce_pm;
+  size_t pce_size;
+  time_t pce_expire;
+} pixmap_cache_entry_t;
+
+
+/**
+ * Cache validators of the source image
+ */
+typedef struct pixmap_cache_src {
+  char *pcs_etag;
+  time_t pcs_mtime;
+  time_t pcs_expire;  // 0 if the origin did not supply anything
+} pixmap_cache_src_t;
+
+
+/**
+ * Header for pixmaps stored in the blobcache
+ */
+typedef struct pixmap_cache_diskhdr {
+  uint32_t pcd_magic;
+  uint32_t pcd_linesize;
+  uint16_t pcd_width;
+  uint16_t pcd_height;
+  uint16_t pcd_margin;
+  uint8_t pcd_type;
+  uint8_t pcd_orientation;
+  uint8_t pcd_original_type;
+  uint8_t pcd_pad[3];
+  int32_t pcd_flags;
+  float pcd_aspect;
+} pixmap_cache_diskhdr_t;
+
+
+static struct pixmap_cache_entry_list pc_hash[PIXMAP_CACHE_HASH_SIZE];
+static struct pixmap_cache_entry_queue pc_lru;
+static hts_mutex_t pc_mutex;
+static size_t pc_size;
+static int pc_use_disk;
+
+
+/**
+ *
+ */
+static void
+make_key(char *buf, size_t len, const char *url, const image_meta_t *im,
+         const char **vpaths)
+{
+  int l = snprintf(buf, len, "%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:",
+                   im->im_req_width, im->im_req_height,
+                   im->im_max_width, im->im_max_height,
+                   im->im_can_mono, im->im_32bit_swizzle, im->im_no_rgb24,
+                   im->im_want_thumb, im->im_corner_selection,
+                   im->im_corner_radius, im->im_shadow, im->im_margin);
+
+  if(vpaths != NULL) {
+    for(; vpaths[0] != NULL && l < len; vpaths += 2)
+      l += snprintf(buf + l, len - l, "%s=%s:", vpaths[0], vpaths[1]);
+  }
+
+  if(l < len)
+    snprintf(buf + l, len - l, "%s", url);
+}
+
+
+/**
+ *
+ */
+static int
+pixmap_cacheable(const pixmap_t *pm)
+{
+  return pm != NULL && pm != NOT_MODIFIED &&
+    bytes_per_pixel(pm->pm_type) != 0 && pm->pm_charpos == NULL;
+}
+
+
+/**
+ *
+ */
+static size_t
+pixmap_bytes(const pixmap_t *pm)
+{
+  return pm->pm_linesize * pm->pm_height;
+}
+
+
+/**
+ * Must be called with pc_mutex held
+ */
+static void
+pce_destroy(pixmap_cache_entry_t *pce)
+{
+  LIST_REMOVE(pce, pce_hash_link);
+  TAILQ_REMOVE(&pc_lru, pce, pce_lru_link);
+  pc_size -= pce->pce_size;
+  pixmap_release(pce->pce_pm);
+  free(pce->pce_key);
+  free(pce);
+}
+
+
+/**
+ * Must be called with pc_mutex held
+ */
+static pixmap_cache_entry_t *
+pce_find(const char *key, unsigned int hash)
+{
+  pixmap_cache_entry_t *pce;
+  LIST_FOREACH(pce, &pc_hash[hash % PIXMAP_CACHE_HASH_SIZE], pce_hash_link)
+    if(pce->pce_hash == hash && !strcmp(pce->pce_key, key))
+      return pce;
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static void
+mem_insert(const char *key, unsigned int hash, pixmap_t *pm, time_t expire)
+{
+  pixmap_cache_entry_t *pce;
+  size_t size = pixmap_bytes(pm);
+
+  if(size > PIXMAP_CACHE_MAXSIZE / 4)
+    return;
+
+  hts_mutex_lock(&pc_mutex);
+
+  if((pce = pce_find(key, hash)) != NULL)
+    pce_destroy(pce);
+
+  while(pc_size + size > PIXMAP_CACHE_MAXSIZE &&
+        (pce = TAILQ_FIRST(&pc_lru)) != NULL)
+    pce_destroy(pce);
+
+  pce = malloc(sizeof(pixmap_cache_entry_t));
+  pce->pce_key = strdup(key);
+  pce->pce_hash = hash;
+  pce->pce_pm = pixmap_dup(pm);
+  pce->pce_size = size;
+  pce->pce_expire = MIN(time(NULL) + PIXMAP_CACHE_MAXAGE, expire);
+  LIST_INSERT_HEAD(&pc_hash[hash % PIXMAP_CACHE_HASH_SIZE], pce,
+                   pce_hash_link);
+  TAILQ_INSERT_TAIL(&pc_lru, pce, pce_lru_link);
+  pc_size += size;
+
+  hts_mutex_unlock(&pc_mutex);
+}
+
+
+/**
+ *
+ */
+static pixmap_t *
+disk_get(const char *key, int *is_expired)
+{
+  pixmap_cache_diskhdr_t pcd;
+  buf_t *b = blobcache_get(key, "pixmapcache", 0, is_expired, NULL, NULL);
+  pixmap_t *pm;
+
+  if(b == NULL)
+    return NULL;
+
+  if(b->b_size < sizeof(pcd)) {
+    buf_release(b);
+    return NULL;
+  }
+
+  memcpy(&pcd, b->b_ptr, sizeof(pcd));
+
+  if(pcd.pcd_magic != PIXMAP_CACHE_DISK_MAGIC ||
+     bytes_per_pixel(pcd.pcd_type) == 0 ||
+     b->b_size != sizeof(pcd) + pcd.pcd_linesize * pcd.pcd_height) {
+    buf_release(b);
+    return NULL;
+  }
+
+  pm = pixmap_create(pcd.pcd_width  - pcd.pcd_margin * 2,
+                     pcd.pcd_height - pcd.pcd_margin * 2,
+                     pcd.pcd_type, pcd.pcd_margin);
+
+  if(pm == NULL || pm->pm_linesize != pcd.pcd_linesize) {
+    if(pm != NULL)
+      pixmap_release(pm);
+    buf_release(b);
+    return NULL;
+  }
+
+  memcpy(pm->pm_pixels, b->b_ptr + sizeof(pcd),
+         pcd.pcd_linesize * pcd.pcd_height);
+  pm->pm_orientation   = pcd.pcd_orientation;
+  pm->pm_original_type = pcd.pcd_original_type;
+  pm->pm_flags         = pcd.pcd_flags;
+  pm->pm_aspect        = pcd.pcd_aspect;
+  buf_release(b);
+  return pm;
+}
+
+
+/**
+ *
+ */
+static void
+disk_put(const char *key, const pixmap_t *pm, const pixmap_cache_src_t *pcs)
+{
+  pixmap_cache_diskhdr_t pcd = {0};
+  const size_t size = pixmap_bytes(pm);
+
+  if(size > PIXMAP_CACHE_DISK_MAXSIZE)
+    return;
+
+  buf_t *b = buf_create(sizeof(pcd) + size);
+  if(b == NULL)
+    return;
+
+  pcd.pcd_magic         = PIXMAP_CACHE_DISK_MAGIC;
+  pcd.pcd_linesize      = pm->pm_linesize;
+  pcd.pcd_width         = pm->pm_width;
+  pcd.pcd_height        = pm->pm_height;
+  pcd.pcd_margin        = pm->pm_margin;
+  pcd.pcd_type          = pm->pm_type;
+  pcd.pcd_orientation   = pm->pm_orientation;
+  pcd.pcd_original_type = pm->pm_original_type;
+  pcd.pcd_flags         = pm->pm_flags;
+  pcd.pcd_aspect        = pm->pm_aspect;
+
+  memcpy(b->b_ptr, &pcd, sizeof(pcd));
+  memcpy(b->b_ptr + sizeof(pcd), pm->pm_pixels, size);
+  int maxage = PIXMAP_CACHE_DISK_MAXAGE;
+  if(pcs->pcs_expire)
+    maxage = MAX(pcs->pcs_expire - time(NULL), 0);
+
+  blobcache_put(key, "pixmapcache", b, maxage, pcs->pcs_etag,
+                pcs->pcs_mtime);
+  buf_release(b);
+}
+
+
+/**
+ * Get the validators the fa_load cache got from the origin of 'src_url'
+ */
+static void
+src_get(pixmap_cache_src_t *pcs, const char *src_url)
+{
+  memset(pcs, 0, sizeof(pixmap_cache_src_t));
+
+  if(src_url == NULL ||
+     blobcache_get_meta(src_url, "fa_load", &pcs->pcs_etag, &pcs->pcs_mtime,
+                        &pcs->pcs_expire))
+    return;
+
+  // Can't be zero as that means 'nothing supplied'
+  pcs->pcs_expire = MAX(pcs->pcs_expire, 1);
+}
+
+
+/**
+ * If 'is_expired' is NULL expired entries are not returned, otherwise
+ * they are and *is_expired is set accordingly
+ */
+pixmap_t *
+pixmap_cache_get(const char *url, const image_meta_t *im, const char **vpaths,
+                 int *is_expired)
+{
+  char key[1024];
+  pixmap_cache_entry_t *pce;
+  pixmap_t *pm = NULL;
+  int expired = 0;
+  time_t expire;
+
+  make_key(key, sizeof(key), url, im, vpaths);
+  const unsigned int hash = mystrhash(key);
+
+  if(is_expired != NULL)
+    *is_expired = 0;
+
+  hts_mutex_lock(&pc_mutex);
+  if((pce = pce_find(key, hash)) != NULL) {
+    if(pce->pce_expire < time(NULL)) {
+      pce_destroy(pce);
+    } else {
+      TAILQ_REMOVE(&pc_lru, pce, pce_lru_link);
+      TAILQ_INSERT_TAIL(&pc_lru, pce, pce_lru_link);
+      pm = pixmap_dup(pce->pce_pm);
+    }
+  }
+  hts_mutex_unlock(&pc_mutex);
+
+  if(pm != NULL || !pc_use_disk)
+    return pm;
+
+  if((pm = disk_get(key, is_expired ? &expired : NULL)) == NULL)
+    return NULL;
+
+  if(expired) {
+    *is_expired = 1;
+  } else if(!blobcache_get_meta(key, "pixmapcache", NULL, NULL, &expire)) {
+    mem_insert(key, hash, pm, expire);
+  }
+  return pm;
+}
+
+
+/**
+ * 'src_url' is the URL the image was actually loaded from
+ */
+void
+pixmap_cache_put(const char *url, const image_meta_t *im, const char **vpaths,
+                 pixmap_t *pm, const char *src_url)
+{
+  char key[1024];
+  pixmap_cache_src_t pcs;
+
+  if(!pixmap_cacheable(pm))
+    return;
+
+  src_get(&pcs, src_url);
+
+  make_key(key, sizeof(key), url, im, vpaths);
+  mem_insert(key, mystrhash(key), pm,
+             pcs.pcs_expire ?: time(NULL) + PIXMAP_CACHE_MAXAGE);
+
+  if(pc_use_disk)
+    disk_put(key, pm, &pcs);
+
+  free(pcs.pcs_etag);
+}
+
+
+/**
+ *
+ */
+static void
+pixmap_cache_save_settings(void *opaque, htsmsg_t *msg)
+{
+  htsmsg_store_save(msg, "pixmapcache");
+}
+
+
+/**
+ *
+ */
+void
+pixmap_cache_init(void)
+{
+  for(int i = 0; i < PIXMAP_CACHE_HASH_SIZE; i++)
+    LIST_INIT(&pc_hash[i]);
+  TAILQ_INIT(&pc_lru);
+  hts_mutex_init(&pc_mutex);
+
+  htsmsg_t *store = htsmsg_store_load("pixmapcache");
+  if(store == NULL)
+    store = htsmsg_create_map();
+
+  settings_create_bool(gconf.settings_general, "diskcache",
+                       _p("Store decoded thumbnails in cache"), 1, store,
+                       settings_generic_set_bool, &pc_use_disk,
+                       SETTINGS_INITIAL_UPDATE, NULL,
+                       pixmap_cache_save_settings, NULL);
+}
@@ -0,0 +1,31 @@
+/*
+ *  Cache of decoded pixmaps
+ *  Copyright (C) 2013 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+struct pixmap;
+struct image_meta;
+
+void pixmap_cache_init(void);
+
+struct pixmap *pixmap_cache_get(const char *url, const struct image_meta *im,
+                                const char **vpaths, int *is_expired);
+
+void pixmap_cache_put(const char *url, const struct image_meta *im,
+                      const char **vpaths, struct pixmap *pm,
+                      const char *src_url);
@@ -27,6 +27,7 @@
 #include "sha.h"
 
 #include "unicode_casefolding.h"
+#include "unicode_composition.h"
 
 /**
  * De-escape HTTP URL
@@ -760,6 +761,9 @@ utf8_from_bytes(const char *str, int len, const uint16_t *cp)
 static uint16_t *casefoldtable;
 static int casefoldtablelen;
 
+#define BASETABLE_LEN 0x2000 // Covers latin, greek and cyrillic
+static uint16_t *basetable;
+
 /**
  *
  */
@@ -900,6 +904,40 @@ unicode_init(void)
     to   = unicode_casefolding[i * 2 + 1];
     casefoldtable[from] = to;
   }
+
+  basetable = calloc(1, sizeof(uint16_t) * BASETABLE_LEN);
+  unicode_base_table(basetable, BASETABLE_LEN);
+
+  // Characters with multiple marks (such as U+01D5) decompose in steps
+  for(i = 0; i < BASETABLE_LEN; i++)
+    while(basetable[i] && basetable[i] < BASETABLE_LEN &&
+          basetable[basetable[i]])
+      basetable[i] = basetable[basetable[i]];
+}
+
+
+/**
+ * Return a copy of str that is casefolded and stripped of diacritical
+ * marks. Used for matching search queries
+ */
+char *
+utf8_fold(const char *str)
+{
+  char *r = malloc(strlen(str) * 3 + 1); // Folding never grows a char more
+  char *d = r;
+  int c;
+
+  while((c = utf8_get(&str)) != 0) {
+    if(c >= 0x300 && c < 0x370)
+      continue; // Combining diacritical mark
+
+    if(c < BASETABLE_LEN && basetable[c])
+      c = basetable[c];
+    c = unicode_casefold(c);
+    d += utf8_put(d, c);
+  }
+  *d = 0;
+  return r;
 }
 
 
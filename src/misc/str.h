@@ -53,6 +53,8 @@ void bin2hex(char *dst, size_t dstlen, const uint8_t *src, size_t srclen);
 
 void unicode_init(void);
 
+char *utf8_fold(const char *str);
+
 char *url_resolve_relative(const char *proto, const char *hostname, int port,
 			   const char *path, const char *ref);
 
@@ -1023,3 +1023,17 @@ unicode_compose(int a, int b)
   r = bsearch(&key, &kvs, sizeof(kvs) / sizeof(kvs[0]), sizeof(struct kv), cmp);
   return r != NULL ? r->d : -1;
 }
+
+
+/**
+ * Fill in table with the base character for each precomposed character
+ * that is a base character combined with a diacritical mark
+ */
+void
+unicode_base_table(uint16_t *table, int len)
+{
+  int i;
+  for(i = 0; i < sizeof(kvs) / sizeof(kvs[0]); i++)
+    if(kvs[i].c2 >= 0x300 && kvs[i].c2 < 0x370 && kvs[i].d < len)
+      table[kvs[i].d] = kvs[i].c1;
+}
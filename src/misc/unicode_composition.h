@@ -18,3 +18,5 @@
 
 int unicode_compose(int a, int b);
 
+
+void unicode_base_table(uint16_t *table, int len);
@@ -20,10 +20,18 @@
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <poll.h>
 #include <errno.h>
+#include <inttypes.h>
+
+#if defined(linux)
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#define HTTP_USE_EPOLL
+#endif
 
 #include <netinet/in.h>
 
@@ -71,6 +79,11 @@ struct http_connection {
   LIST_ENTRY(http_connection) hc_link;
   int hc_fd;
   int hc_events;
+#ifdef HTTP_USE_EPOLL
+  int hc_epoll_events;  // Events currently registered with epoll
+#else
+  int hc_pollidx;
+#endif
 
   int hc_state;
 #define HCS_COMMAND   0
@@ -110,6 +123,23 @@ struct http_connection {
   void *hc_opaque;
 
   struct http_server *hc_server;
+
+  /**
+   * Request handlers run on the task pool. While hc_busy is set the
+   * worker owns the connection and the server thread does not touch it
+   */
+  int hc_busy;
+  const http_path_t *hc_exec_path;
+  char *hc_exec_remain;
+  http_cmd_t hc_exec_method;
+  LIST_ENTRY(http_connection) hc_done_link;
+
+  /**
+   * File sent after hc_output has been drained, see http_send_file()
+   */
+  int hc_file_fd;
+  int64_t hc_file_offset;
+  int64_t hc_file_left;
 };
 
 
@@ -143,16 +173,25 @@ typedef struct http_server {
   int hs_fd;
   int hs_pipe[2];
 
+#ifdef HTTP_USE_EPOLL
+  int hs_epfd;
+#else
   int hs_fds_size;
   struct pollfd *hs_fds;
+#endif
 
   struct http_connection_list hs_connections;
   prop_courier_t *hs_courier;
 
+  hts_mutex_t hs_done_mutex;
+  struct http_connection_list hs_done; // Connections whose handler returned
+
 } http_server_t;
 
 static int http_write(http_connection_t *hc);
 
+static void http_server_wakeup(http_server_t *hs);
+
 /**
  *
  */
@@ -287,6 +326,8 @@ http_rc2str(int code)
   case HTTP_STATUS_METHOD_NOT_ALLOWED: return "Method not allowed";
   case HTTP_STATUS_PRECONDITION_FAILED: return "Precondition failed";
   case HTTP_STATUS_UNSUPPORTED_MEDIA_TYPE: return "Unsupported media type";
+  case HTTP_STATUS_PARTIAL_CONTENT: return "Partial content";
+  case HTTP_STATUS_RANGE_NOT_SATISFIABLE: return "Range not satisfiable";
   case HTTP_NOT_IMPLEMENTED: return "Not implemented";
   case 500: return "Internal Server Error";
   default:
@@ -300,7 +341,7 @@ http_rc2str(int code)
  */
 static void
 http_send_header(http_connection_t *hc, int rc, const char *content, 
-		 int contentlen, const char *encoding, const char *location, 
+		 int64_t contentlen, const char *encoding, const char *location,
 		 int maxage, const char *range)
 {
   htsbuf_queue_t hdrs;
@@ -348,7 +389,10 @@ http_send_header(http_connection_t *hc, int rc, const char *content,
   if(content != NULL)
     htsbuf_qprintf(&hdrs, "Content-Type: %s\r\n", content);
 
-  htsbuf_qprintf(&hdrs, "Content-Length: %d\r\n", contentlen);
+  if(range != NULL)
+    htsbuf_qprintf(&hdrs, "Content-Range: %s\r\n", range);
+
+  htsbuf_qprintf(&hdrs, "Content-Length: %"PRId64"\r\n", contentlen);
 
   LIST_FOREACH(hh, &hc->hc_response_headers, hh_link)
     htsbuf_qprintf(&hdrs, "%s: %s\r\n", hh->hh_key, hh->hh_value);
@@ -420,6 +464,123 @@ http_send_reply(http_connection_t *hc, int rc, const char *content,
 }
 
 
+/**
+ * Parse a Range: header. Only a single byte range is supported.
+ *
+ * Returns 0 if [*startp, *endp] should be sent, -1 if the header should
+ * be ignored and 1 if the range can't be satisfied
+ */
+static int
+http_parse_range(const char *r, int64_t size, int64_t *startp, int64_t *endp)
+{
+  char *e;
+  int64_t start, end;
+
+  if(strncmp(r, "bytes=", 6) || strchr(r, ',') != NULL)
+    return -1;
+  r += 6;
+
+  if(*r == '-') {
+    end = strtoll(r + 1, &e, 10);
+    if(e == r + 1 || *e)
+      return -1;
+    if(end == 0 || size == 0)
+      return 1;
+    *startp = MAX(size - end, 0);
+    *endp = size - 1;
+    return 0;
+  }
+
+  start = strtoll(r, &e, 10);
+  if(e == r || *e != '-')
+    return -1;
+  r = e + 1;
+
+  if(*r == 0) {
+    end = size - 1;
+  } else {
+    end = strtoll(r, &e, 10);
+    if(*e)
+      return -1;
+    if(end >= size)
+      end = size - 1;
+  }
+
+  if(start >= size || end < start)
+    return 1;
+
+  *startp = start;
+  *endp = end;
+  return 0;
+}
+
+
+/**
+ * Send a local file as reply. The file is transmitted by the server
+ * thread directly from the page cache (using sendfile() where available)
+ * once any preceding output has been written. Honours Range: requests.
+ *
+ * Returns -1 if 'path' can't be opened as a local file, the caller may
+ * then want to load it via fa_load() instead
+ */
+int
+http_send_file(http_connection_t *hc, const char *path, const char *content,
+	       int maxage)
+{
+  struct stat st;
+  int64_t start = 0, end;
+  char range[80];
+  const char *r;
+  int fd, rc = HTTP_STATUS_OK;
+
+  if(!strncmp(path, "file://", 7))
+    path += 7;
+
+  if((fd = open(path, O_RDONLY)) == -1)
+    return -1;
+
+  if(fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return -1;
+  }
+
+  end = st.st_size - 1;
+  http_set_response_hdr(hc, "Accept-Ranges", "bytes");
+
+  r = http_header_get(&hc->hc_request_headers, "Range");
+  if(r != NULL) {
+    switch(http_parse_range(r, st.st_size, &start, &end)) {
+    case 0:
+      rc = HTTP_STATUS_PARTIAL_CONTENT;
+      snprintf(range, sizeof(range), "bytes %"PRId64"-%"PRId64"/%"PRId64,
+	       start, end, (int64_t)st.st_size);
+      break;
+
+    case 1:
+      close(fd);
+      snprintf(range, sizeof(range), "bytes */%"PRId64, (int64_t)st.st_size);
+      http_set_response_hdr(hc, "Content-Range", range);
+      http_send_header(hc, HTTP_STATUS_RANGE_NOT_SATISFIABLE, NULL, 0,
+		       NULL, NULL, 0, NULL);
+      return 0;
+    }
+  }
+
+  http_send_header(hc, rc, content, end - start + 1, NULL, NULL, maxage,
+		   rc == HTTP_STATUS_PARTIAL_CONTENT ? range : NULL);
+
+  if(hc->hc_no_output || end < start) {
+    close(fd);
+    return 0;
+  }
+
+  hc->hc_file_fd = fd;
+  hc->hc_file_offset = start;
+  hc->hc_file_left = end - start + 1;
+  return 0;
+}
+
+
 /**
  * Send HTTP error back
  */
@@ -485,15 +646,19 @@ http_redirect(http_connection_t *hc, const char *location)
 
 
 /**
- *
+ * Runs on the task pool
  */
-static void
-http_exec(http_connection_t *hc, const http_path_t *hp, char *remain,
-	  http_cmd_t method)
+static void *
+http_exec_task(void *aux)
 {
+  http_connection_t *hc = aux;
+  http_server_t *hs = hc->hc_server;
+  const http_path_t *hp = hc->hc_exec_path;
+
   hsprintf("%p: Dispatching [%s] on thread 0x%lx\n",
 	 hc, hp->hp_path, pthread_self());
-  int err = hp->hp_callback(hc, remain, hp->hp_opaque, method);
+  int err = hp->hp_callback(hc, hc->hc_exec_remain, hp->hp_opaque,
+			    hc->hc_exec_method);
   hsprintf("%p: Returned from fn, err = %d\n", hc, err);
 
   if(err == HTTP_STATUS_OK) {
@@ -501,13 +666,32 @@ http_exec(http_connection_t *hc, const http_path_t *hp, char *remain,
     htsbuf_queue_init(&out, 0);
     htsbuf_append(&out, "OK\n", 3);
     http_send_reply(hc, 0, "text/ascii", NULL, NULL, 0, &out);
-    return;
   } else if(err > 0)
     http_error(hc, err, NULL);
-  else if(err == 0)
-    return;
-  else
+  else if(err < 0)
     abort();
+
+  // Hand the connection back to the server thread
+  hts_mutex_lock(&hs->hs_done_mutex);
+  LIST_INSERT_HEAD(&hs->hs_done, hc, hc_done_link);
+  hts_mutex_unlock(&hs->hs_done_mutex);
+  http_server_wakeup(hs);
+  return NULL;
+}
+
+
+/**
+ * The handler is dispatched to the task pool by http_process() once
+ * input parsing has stopped
+ */
+static void
+http_exec(http_connection_t *hc, const http_path_t *hp, char *remain,
+	  http_cmd_t method)
+{
+  hc->hc_exec_path = hp;
+  hc->hc_exec_remain = remain;
+  hc->hc_exec_method = method;
+  hc->hc_busy = 1;
 }
 
 
@@ -1108,6 +1292,9 @@ http_handle_input(http_connection_t *hc)
 	if(http_handle_request(hc))
 	  return 1;
 
+	if(hc->hc_busy)
+	  return 0; // Don't parse further requests until handler is done
+
 	if(TAILQ_FIRST(&hc->hc_output.hq_q) == NULL && !hc->hc_keep_alive)
 	  return 1;
 
@@ -1136,6 +1323,63 @@ http_handle_input(http_connection_t *hc)
 }
 
 
+/**
+ *
+ */
+static void
+http_update_events(http_connection_t *hc)
+{
+#ifdef HTTP_USE_EPOLL
+  struct epoll_event e = {0};
+  const int events = hc->hc_busy ? 0 : hc->hc_events;
+  int op;
+
+  if(events == hc->hc_epoll_events)
+    return;
+
+  if(events == 0)
+    op = EPOLL_CTL_DEL;
+  else if(hc->hc_epoll_events == 0)
+    op = EPOLL_CTL_ADD;
+  else
+    op = EPOLL_CTL_MOD;
+
+  e.events = EPOLLIN | (events & POLLOUT ? EPOLLOUT : 0);
+  e.data.ptr = hc;
+  if(epoll_ctl(hc->hc_server->hs_epfd, op, hc->hc_fd, &e))
+    TRACE(TRACE_ERROR, "HTTPSRV", "epoll_ctl failed: %s", strerror(errno));
+  hc->hc_epoll_events = events;
+#endif
+}
+
+
+/**
+ * Returns number of bytes written or -1 on error
+ */
+static ssize_t
+http_write_file(http_connection_t *hc)
+{
+  ssize_t r;
+#if defined(linux)
+  off_t off = hc->hc_file_offset;
+  r = sendfile(hc->hc_fd, hc->hc_file_fd, &off,
+	       MIN(hc->hc_file_left, 1024 * 1024));
+#else
+  char buf[16384];
+  r = pread(hc->hc_file_fd, buf, MIN(hc->hc_file_left, sizeof(buf)),
+	    hc->hc_file_offset);
+  if(r > 0)
+    r = write(hc->hc_fd, buf, r);
+#endif
+  if(r == 0) {
+    // File was truncated under our feet
+    errno = EIO;
+    return -1;
+  }
+  return r;
+}
+
+
 /**
  *
  */
@@ -1164,6 +1408,7 @@ http_write(http_connection_t *hc)
       // Failed to write it all
       hd->hd_data_off += r;
       hc->hc_events |= POLLOUT;
+      http_update_events(hc);
       return 0;
     }
 
@@ -1171,7 +1416,58 @@ http_write(http_connection_t *hc)
     free(hd->hd_data);
     free(hd);
   }
+
+  while(hc->hc_file_fd != -1) {
+    ssize_t s = http_write_file(hc);
+
+    if(s == -1) {
+      if(errno == EWOULDBLOCK || errno == EAGAIN) {
+	hc->hc_events |= POLLOUT;
+	http_update_events(hc);
+	return 0;
+      }
+      return -1;
+    }
+
+    hc->hc_file_offset += s;
+    hc->hc_file_left -= s;
+    if(hc->hc_file_left == 0) {
+      close(hc->hc_file_fd);
+      hc->hc_file_fd = -1;
+    }
+  }
+
   hc->hc_events &= ~POLLOUT;
+  http_update_events(hc);
+  return 0;
+}
+
+
+/**
+ * Parse buffered input and write as much output as possible.
+ * Returns non-zero if the connection should be closed
+ */
+static int
+http_process(http_connection_t *hc)
+{
+  int blocked;
+
+  do {
+    // Requests are not parsed while a file reply is still being sent
+    blocked = hc->hc_file_fd != -1;
+
+    if(!blocked && http_handle_input(hc))
+      return 1;
+
+    if(http_write(hc))
+      return 1;
+
+  } while(blocked && hc->hc_file_fd == -1);
+
+  if(hc->hc_busy) {
+    http_update_events(hc);
+    hts_task_run("httpreq", http_exec_task, hc, THREAD_PRIO_MODEL);
+  }
   return 0;
 }
 
@@ -1193,15 +1489,12 @@ http_io(http_connection_t *hc, int revents)
     r = read(hc->hc_fd, mem, rlen);
     if(r > 0) {
       htsbuf_append_prealloc(&hc->hc_input, mem, r);
-      if(http_handle_input(hc))
-	return 1;
     } else {
       free(mem);
       return 1;
     }
   }
-  r = http_write(hc);
-  return r;
+  return http_process(hc);
 }
 
 
@@ -1220,6 +1513,8 @@ http_close(http_server_t *hs, http_connection_t *hc)
   LIST_REMOVE(hc, hc_link);
   hs->hs_numcon--;
   close(hc->hc_fd);
+  if(hc->hc_file_fd != -1)
+    close(hc->hc_file_fd);
   free(hc->hc_url);
   free(hc->hc_url_orig);
   free(hc->hc_post_data);
@@ -1230,6 +1525,31 @@ http_close(http_server_t *hs, http_connection_t *hc)
 }
 
 
+/**
+ * Pick up connections handed back from the task pool
+ */
+static void
+http_handlers_done(http_server_t *hs)
+{
+  http_connection_t *hc;
+
+  hts_mutex_lock(&hs->hs_done_mutex);
+  while((hc = LIST_FIRST(&hs->hs_done)) != NULL) {
+    LIST_REMOVE(hc, hc_done_link);
+    hts_mutex_unlock(&hs->hs_done_mutex);
+
+    hc->hc_busy = 0;
+
+    if((TAILQ_FIRST(&hc->hc_output.hq_q) == NULL && hc->hc_file_fd == -1 &&
+	!hc->hc_keep_alive) || http_process(hc))
+      http_close(hs, hc);
+
+    hts_mutex_lock(&hs->hs_done_mutex);
+  }
+  hts_mutex_unlock(&hs->hs_done_mutex);
+}
+
+
 /**
  *
  */
@@ -1270,6 +1590,7 @@ http_accept(http_server_t *hs)
   hc = calloc(1, sizeof(http_connection_t));
   hc->hc_server = hs;
   hc->hc_fd = fd;
+  hc->hc_file_fd = -1;
   hc->hc_events = POLLIN | POLLHUP | POLLERR;
   LIST_INSERT_HEAD(&hs->hs_connections, hc, hc_link);
   hs->hs_numcon++;
@@ -1314,8 +1635,78 @@ http_accept(http_server_t *hs)
     hc->hc_myaddr[0] = 0;
   }
   hsprintf("%p: ----------------- NEW CONNECTION\n", hc);
+  http_update_events(hc);
+}
+
+
+/**
+ *
+ */
+static void
+http_server_wakeup(http_server_t *hs)
+{
+  if(write(hs->hs_pipe[1], "x", 1) != 1)
+    TRACE(TRACE_ERROR, "HTTP", "Pipe problems");
+}
+
+
+/**
+ *
+ */
+static void
+http_server_pipe_input(http_server_t *hs)
+{
+  char dump[64];
+  if(read(hs->hs_pipe[0], dump, sizeof(dump)) <= 0)
+    return;
+  http_handlers_done(hs);
+  prop_courier_poll(hs->hs_courier);
+}
+
+
+#ifdef HTTP_USE_EPOLL
+
+/**
+ *
+ */
+static void *
+http_server(void *aux)
+{
+  http_server_t *hs = aux;
+  struct epoll_event ev[64];
+  http_connection_t *hc;
+  int i, n, revents;
+
+  while(1) {
+    n = epoll_wait(hs->hs_epfd, ev, 64, -1);
+
+    if(n == -1)
+      continue;
+
+    for(i = 0; i < n; i++) {
+      if(ev[i].data.ptr == &hs->hs_fd) {
+	http_accept(hs);
+      } else if(ev[i].data.ptr == hs->hs_pipe) {
+	http_server_pipe_input(hs);
+      } else {
+	// Connections handed to a worker are not in the epoll set, so
+	// closing 'hc' here can't invalidate a later entry in ev[]
+	hc = ev[i].data.ptr;
+	revents =
+	  (ev[i].events & EPOLLIN  ? POLLIN  : 0) |
+	  (ev[i].events & EPOLLOUT ? POLLOUT : 0) |
+	  (ev[i].events & EPOLLHUP ? POLLHUP : 0) |
+	  (ev[i].events & EPOLLERR ? POLLERR : 0);
+
+	if(http_io(hc, revents))
+	  http_close(hs, hc);
+      }
+    }
+  }
+  return NULL;
 }
 
+#else
 
 /**
  *
@@ -1337,6 +1728,11 @@ http_server(void *aux)
 
     n = 0;
     LIST_FOREACH(hc, &hs->hs_connections, hc_link) {
+      if(hc->hc_busy) {
+	hc->hc_pollidx = -1;
+	continue;
+      }
+      hc->hc_pollidx = n;
       hs->hs_fds[n].fd = hc->hc_fd;
       hs->hs_fds[n].events = hc->hc_events;
       n++;
@@ -1353,26 +1749,26 @@ http_server(void *aux)
     if(r == -1)
       continue;
 
-    n = 0;
     for(hc = LIST_FIRST(&hs->hs_connections); hc != NULL; hc = nxt) {
       nxt = LIST_NEXT(hc, hc_link);
 
-      if(http_io(hc, hs->hs_fds[n].revents)) {
+      if(hc->hc_pollidx == -1)
+	continue;
+
+      if(http_io(hc, hs->hs_fds[hc->hc_pollidx].revents)) {
 	http_close(hs, hc);
       }
-      n++;
     }
-    if(hs->hs_fds[n].revents & POLLIN)
+    if(hs->hs_fds[n-2].revents & POLLIN)
       http_accept(hs);
-    if(hs->hs_fds[n+1].revents & POLLIN) {
-      char dump;
-      if(read(hs->hs_pipe[0], &dump, 1) == 1)
-	prop_courier_poll(hs->hs_courier);
-    }
+    if(hs->hs_fds[n-1].revents & POLLIN)
+      http_server_pipe_input(hs);
   }
   return NULL;
 }
 
+#endif
+
 
 /**
  *
@@ -1380,9 +1776,7 @@ http_server(void *aux)
 static void
 http_courier_notify(void *opaque)
 {
-  http_server_t *hs = opaque;
-  if(write(hs->hs_pipe[1], "x", 1) != 1)
-    TRACE(TRACE_ERROR, "HTTP", "Pipe problems");
+  http_server_wakeup(opaque);
 }
 
 
@@ -1431,11 +1825,24 @@ http_server_init(void)
 
   TRACE(TRACE_INFO, "HTTPSRV", "Listening on port %d", http_server_port);
 
-  listen(fd, 1);
+  listen(fd, 16);
   hs = calloc(1, sizeof(http_server_t));
 
   arch_pipe(hs->hs_pipe);
   hs->hs_fd = fd;  
+  hts_mutex_init(&hs->hs_done_mutex);
+
+#ifdef HTTP_USE_EPOLL
+  struct epoll_event e = {0};
+
+  hs->hs_epfd = epoll_create(64);
+  e.events = EPOLLIN;
+  e.data.ptr = &hs->hs_fd;
+  epoll_ctl(hs->hs_epfd, EPOLL_CTL_ADD, hs->hs_fd, &e);
+  e.data.ptr = hs->hs_pipe;
+  epoll_ctl(hs->hs_epfd, EPOLL_CTL_ADD, hs->hs_pipe[0], &e);
+#endif
+
   hs->hs_courier = prop_courier_create_notify(http_courier_notify, hs);
   hts_thread_create_detached("httpsrv", http_server, hs,
 			     THREAD_PRIO_MODEL);
@@ -868,6 +868,9 @@ init_dev_settings(void)
   add_dev_bool("Debug FTP",
 	       "ftpdebug", &gconf.enable_ftp_debug);
 
+  add_dev_bool("Log GLW view expression evaluation stats",
+	       "glwevalstats", &gconf.enable_glw_eval_stats);
+
   add_dev_bool("Upgrade using patches",
 	       "patchupgrade", &gconf.enable_patched_upgrade);
 
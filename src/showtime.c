@@ -46,6 +46,7 @@
 #include "i18n.h"
 #include "misc/str.h"
 #include "misc/pixmap.h"
+#include "misc/pixmap_cache.h"
 #include "text/text.h"
 #include "video/video_settings.h"
 #include "metadata/metadata.h"
@@ -212,6 +213,9 @@ showtime_init(void)
   /* Callout framework */
   callout_init();
 
+  /* Pool of worker threads */
+  hts_task_init();
+
   /* Initialize htsmsg_store() */
   htsmsg_store_init();
 
@@ -246,6 +250,9 @@ showtime_init(void)
     gconf.persistent_path = NULL;
   }
 
+  /* Decoded image cache */
+  pixmap_cache_init();
+
   /* Metadata init */
   metadata_init();
   metadb_init();
@@ -263,6 +270,7 @@ showtime_init(void)
   av_lockmgr_register(fflockmgr);
   av_log_set_callback(fflog);
   av_register_all();
+  pixmap_decoder_init();
 
   TRACE(TRACE_INFO, "libav", LIBAVFORMAT_IDENT", "LIBAVCODEC_IDENT", "LIBAVUTIL_IDENT);
 #endif
@@ -382,6 +390,9 @@ parse_opts(int argc, char **argv)
 	     "   -j <path>           Load javascript file\n"
 	     "   --ui <ui>           Select user interface\n"
 	     "   --skin <skin>     Select skin (for GLW ui)\n"
+	     "   --test-glw-viewcache\n"
+	     "                     Run all views in the skin through the view\n"
+	     "                     cache, report and exit\n"
 	     "\n"
 	     "  URL is any URL-type supported by Showtime, "
 	     "e.g., \"file:///...\"\n"
@@ -429,6 +440,10 @@ parse_opts(int argc, char **argv)
       argc -= 1; argv += 1;
       continue;
 #endif
+    } else if(!strcmp(argv[0], "--test-glw-viewcache")) {
+      gconf.enable_glw_viewcache_test = 1;
+      argc -= 1; argv += 1;
+      continue;
     } else if(!strcmp(argv[0], "--disable-sd")) {
       gconf.disable_sd = 1;
       argc -= 1; argv += 1;
@@ -243,6 +243,8 @@ typedef struct gconf {
   int enable_detailed_avdiff;
   int enable_hls_debug;
   int enable_ftp_debug;
+  int enable_glw_eval_stats;
+  int enable_glw_viewcache_test;
   int enable_patched_upgrade;
 
   const char *devplugin;
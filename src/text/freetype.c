@@ -24,6 +24,8 @@
 #include "misc/pixmap.h"
 #include "text.h"
 #include "arch/arch.h"
+#include "arch/threads.h"
+#include "misc/buf.h"
 
 #include "fileaccess/fileaccess.h"
 
@@ -43,8 +45,7 @@
 
 #define ftver ver(FREETYPE_MAJOR, FREETYPE_MINOR, FREETYPE_PATCH)
 
-static FT_Library text_library;
-static FT_Stroker text_stroker;
+static FT_Library text_library;  // Only used with text_mutex held
 static hts_mutex_t text_mutex;
 static int font_domain_tally = 10;
 
@@ -52,7 +53,9 @@ static int font_domain_tally = 10;
 #define GLYPH_HASH_MASK (GLYPH_HASH_SIZE-1)
 TAILQ_HEAD(glyph_queue, glyph);
 LIST_HEAD(glyph_list, glyph);
-TAILQ_HEAD(face_queue, face);
+TAILQ_HEAD(font_queue, font);
+LIST_HEAD(face_list, face);
+LIST_HEAD(text_ctx_list, text_ctx);
 LIST_HEAD(idmap_list, idmap);
 
 //----------------- generica name <-> id map --------------
@@ -67,25 +70,79 @@ typedef struct idmap {
 static int idmap_id_tally;
 static struct  idmap_list idmaps;
 
-//------------------------- Faces -----------------------
+//------------------------- Fonts -----------------------
 
-typedef struct face {
-  TAILQ_ENTRY(face) link;
+/**
+ * A loaded font file, shared by all render contexts and protected by
+ * text_mutex. The file is kept in memory so each render context can
+ * open its own FT_Face from it. 'face' is only used for finding out
+ * which font to use for a character. Only 'linked', 'persistent' and
+ * 'refcount' change after loading, the rest can be read by anyone
+ * holding a reference.
+ */
+typedef struct font {
+  TAILQ_ENTRY(font) link;
 
+  buf_t *data;
   FT_Face face;
   char *url;
-  int current_size;
   char *family;
   char *fullname;
   uint8_t style;
+  uint8_t linked;   // On 'fonts' list, ie. can be found by lookups
   int persistent;
+  int refcount;     // Number of faces (in render contexts) using it
   int font_domain;
+  int id;   // Identifies the font in text_glyph_t ids
+} font_t;
+
+static struct font_queue fonts;
+static font_t *default_font;
+static int font_id_tally;
+
+
+//------------------------- Render contexts -----------------------
+
+/**
+ * FreeType objects can't be used by more than one thread at a time.
+ * A render context has its own library, faces and glyph cache so
+ * several threads can render text in parallel. A thread gets the same
+ * context back as long as it's free to keep its caches warm.
+ */
+typedef struct text_ctx {
+  LIST_ENTRY(text_ctx) link;
+
+  FT_Library library;
+  FT_Stroker stroker;
+  struct face_list faces;
+  struct glyph_list glyph_hash[GLYPH_HASH_SIZE];
+  struct glyph_queue glyphs;  // In LRU order
+  int num_glyphs;
+  int in_use;
+} text_ctx_t;
+
+static struct text_ctx_list text_ctxs_free;
+static int text_ctxs_num;
+static hts_cond_t text_ctx_cond;
+static unsigned int text_ctx_key;
+
+#define TEXT_CTX_MAX_GLYPHS 512
+
+
+//------------------------- Faces -----------------------
+
+/**
+ * A font opened in a render context
+ */
+typedef struct face {
+  LIST_ENTRY(face) link;
+
+  font_t *font;
+  FT_Face face;
+  int current_size;
   struct glyph_list glyphs;
 } face_t;
 
-static struct face_queue faces;
-static face_t *default_font;
-
 
 //------------------------- Glyph cache -----------------------
 
@@ -111,9 +168,27 @@ typedef struct glyph {
 
 } glyph_t;
 
-static struct glyph_list glyph_hash[GLYPH_HASH_SIZE];
-static struct glyph_queue allglyphs;
-static int num_glyphs;
+
+/**
+ * Glyph ids handed out in text_glyph_t:
+ *
+ *  bits 34-53  Font id
+ *  bits 23-33  Size in pixels
+ *  bits 21-22  Style
+ *  bits  0-20  Unicode code point
+ */
+#define GLYPH_ID_FONT_MASK 0xfffff
+#define GLYPH_ID_SIZE_MAX  0x7ff
+
+#define GLYPH_ID(g) (((uint64_t)(g)->face->font->id << 34) |	\
+		     ((uint64_t)(g)->size << 23) |		\
+		     ((uint64_t)(g)->style << 21) |		\
+		     ((g)->uc & 0x1fffff))
+
+#define GLYPH_ID_FONT(id)  (((id) >> 34) & GLYPH_ID_FONT_MASK)
+#define GLYPH_ID_SIZE(id)  (((id) >> 23) & GLYPH_ID_SIZE_MAX)
+#define GLYPH_ID_STYLE(id) (((id) >> 21) & 3)
+#define GLYPH_ID_UC(id)    ((id) & 0x1fffff)
 
 /**
  *
@@ -141,10 +216,12 @@ static idmap_t *
 idmap_find(int id)
 {
   idmap_t *im;
+  hts_mutex_lock(&text_mutex);
   LIST_FOREACH(im, &idmaps, link)
     if(id == im->id)
-      return im;
-  return NULL;
+      break;
+  hts_mutex_unlock(&text_mutex);
+  return im;
 }
 
 
@@ -154,10 +231,10 @@ idmap_find(int id)
  *
  */
 static void
-glyph_destroy(glyph_t *g)
+glyph_destroy(text_ctx_t *tc, glyph_t *g)
 {
   LIST_REMOVE(g, face_link);
-  TAILQ_REMOVE(&allglyphs, g, lru_link);
+  TAILQ_REMOVE(&tc->glyphs, g, lru_link);
   LIST_REMOVE(g, hash_link);
   FT_Done_Glyph(g->orig_glyph);
   if(g->bmp)
@@ -165,78 +242,151 @@ glyph_destroy(glyph_t *g)
   if(g->outline)
     FT_Done_Glyph(g->outline);
   free(g);
-  num_glyphs--;
+  tc->num_glyphs--;
 }
 
 
 /**
- *
+ * Must be called with text_mutex held
  */
 static void
-face_destroy(face_t *f)
+font_destroy(font_t *f)
 {
-  glyph_t *g;
-  while((g = LIST_FIRST(&f->glyphs)) != NULL)
-    glyph_destroy(g);
-
   TRACE(TRACE_DEBUG, "Freetype", "Unloading '%s' [%s] originally from %s",
 	f->face->family_name, f->face->style_name, f->url ?: "memory");
-  TAILQ_REMOVE(&faces, f, link);
+  if(f->linked)
+    TAILQ_REMOVE(&fonts, f, link);
   free(f->url);
   free(f->family);
   free(f->fullname);
   FT_Done_Face(f->face);
+  buf_release(f->data);
   free(f);
 }
 
 
 /**
- *
+ * Must be called with text_mutex held
  */
 static void
-faces_purge(void)
+font_release(font_t *f)
 {
-  face_t *f, *n;
-  for(f = TAILQ_FIRST(&faces); f != NULL; f = n) {
-    n = TAILQ_NEXT(f, link);
+  if(--f->refcount == 0 && f->persistent == 0)
+    font_destroy(f);
+}
+
+
+/**
+ * Drop a persistent reference. Must be called with text_mutex held
+ */
+static void
+font_unload(font_t *f)
+{
+  if(--f->persistent)
+    return;
 
-    if(LIST_FIRST(&f->glyphs) == NULL && f->persistent == 0)
-      face_destroy(f);
+  if(f->refcount == 0) {
+    font_destroy(f);
+  } else {
+    // Render contexts still have it open, but it must not be used anymore
+    TAILQ_REMOVE(&fonts, f, link);
+    f->linked = 0;
   }
 }
 
 
 /**
- *
+ * Must be called with text_mutex held
  */
-static unsigned long
-face_read(FT_Stream stream, unsigned long offset, unsigned char *buffer,
-	  unsigned long count)
+static void
+face_destroy(text_ctx_t *tc, face_t *f)
 {
-  if(count == 0)
-    return fa_seek(stream->descriptor.pointer, offset, SEEK_SET) < 0;
-  return fa_read(stream->descriptor.pointer, buffer, count);
+  glyph_t *g;
+  while((g = LIST_FIRST(&f->glyphs)) != NULL)
+    glyph_destroy(tc, g);
+
+  LIST_REMOVE(f, link);
+  FT_Done_Face(f->face);
+  font_release(f->font);
+  free(f);
 }
 
 
 /**
- *
+ * Close faces without glyphs, except for fonts that are loaded for
+ * good. Must be called with text_mutex held
  */
 static void
-face_close(FT_Stream stream)
+faces_purge(text_ctx_t *tc)
 {
-  fa_close(stream->descriptor.pointer);
+  face_t *f, *n;
+  for(f = LIST_FIRST(&tc->faces); f != NULL; f = n) {
+    n = LIST_NEXT(f, link);
+
+    if(LIST_FIRST(&f->glyphs) == NULL &&
+       (f->font->persistent == 0 || !f->font->linked))
+      face_destroy(tc, f);
+  }
 }
 
 
 /**
+ * Close faces (and their glyphs) of fonts that have been unloaded.
+ * Done when a context is acquired so glyph lookups, which run without
+ * text_mutex, never need to look at 'linked'. Must be called with
+ * text_mutex held
+ */
+static void
+faces_drop_unlinked(text_ctx_t *tc)
+{
+  face_t *f, *n;
+  for(f = LIST_FIRST(&tc->faces); f != NULL; f = n) {
+    n = LIST_NEXT(f, link);
+
+    if(!f->font->linked)
+      face_destroy(tc, f);
+  }
+}
+
+
+/**
+ * Get (or open) the face for 'font' in a render context
  *
+ * Must be called with text_mutex held
  */
 static face_t *
-face_create_epilogue(face_t *face, int font_domain)
+face_get(text_ctx_t *tc, font_t *font)
 {
-  const char *family = face->face->family_name;
-  const char *style = face->face->style_name;
+  face_t *f;
+
+  LIST_FOREACH(f, &tc->faces, link)
+    if(f->font == font)
+      return f;
+
+  f = calloc(1, sizeof(face_t));
+
+  if(FT_New_Memory_Face(tc->library, font->data->b_ptr, font->data->b_size,
+			0, &f->face)) {
+    free(f);
+    return NULL;
+  }
+
+  FT_Select_Charmap(f->face, FT_ENCODING_UNICODE);
+  f->font = font;
+  font->refcount++;
+  LIST_INSERT_HEAD(&tc->faces, f, link);
+  return f;
+}
+
+
+/**
+ *
+ */
+static font_t *
+font_create_epilogue(font_t *font, int font_domain)
+{
+  const char *family = font->face->family_name;
+  const char *style = font->face->style_name;
   char buf[256];
 
   TRACE(TRACE_DEBUG, "Freetype", "Loaded '%s' [%s] domain:%d",
@@ -248,77 +398,76 @@ face_create_epilogue(face_t *face, int font_domain)
     while((tok = strtok_r(f, " ", &tmp)) != NULL) {
       f = NULL;
       if(!strcasecmp(tok, "bold"))
-	face->style = TR_STYLE_BOLD;
+	font->style = TR_STYLE_BOLD;
       if(!strcasecmp(tok, "italic"))
-	face->style = TR_STYLE_ITALIC;
+	font->style = TR_STYLE_ITALIC;
     }
   }
-  face->font_domain = font_domain;
-  face->family = strdup(family);
+  font->font_domain = font_domain;
+  font_id_tally = (font_id_tally + 1) & GLYPH_ID_FONT_MASK;
+  font->id = font_id_tally;
+  font->family = strdup(family);
   snprintf(buf, sizeof(buf), "%s %s", family, style);
-  face->fullname = strdup(buf);
+  font->fullname = strdup(buf);
 
-  FT_Select_Charmap(face->face, FT_ENCODING_UNICODE);
+  FT_Select_Charmap(font->face, FT_ENCODING_UNICODE);
 
-  TAILQ_INSERT_TAIL(&faces, face, link);
-  return face;
+  TAILQ_INSERT_TAIL(&fonts, font, link);
+  font->linked = 1;
+  return font;
 }
 
 
 /**
  *
  */
-static face_t *
-face_create_from_fh(fa_handle_t *fh, int font_domain, 
+static font_t *
+font_create_from_fh(fa_handle_t *fh, int font_domain,
 		    char *errbuf, size_t errlen)
 {
-  FT_Open_Args oa = {0};
   FT_Error err;
-  int64_t s;
-  face_t *face;
+  font_t *font;
+  buf_t *b;
 
-  s = fa_fsize(fh);
-  if(s < 0) {
+  if(fa_fsize(fh) < 0) {
     snprintf(errbuf, errlen, "Not a seekable file");
     fa_close(fh);
     return NULL;
   }
 
-  face = calloc(1, sizeof(face_t));
+  if((b = fa_load_and_close(fh)) == NULL) {
+    snprintf(errbuf, errlen, "Unable to read file");
+    return NULL;
+  }
 
-  FT_Stream srec = calloc(1, sizeof(FT_StreamRec));
-  srec->size = fa_fsize(fh);
-  srec->descriptor.pointer = fh;
-  srec->read = face_read;
-  srec->close = face_close;
+  font = calloc(1, sizeof(font_t));
 
-  oa.stream = srec;
-  oa.flags = FT_OPEN_STREAM;
-  
-  if((err = FT_Open_Face(text_library, &oa, 0, &face->face)) != 0) {
+  if((err = FT_New_Memory_Face(text_library, b->b_ptr, b->b_size, 0,
+			       &font->face)) != 0) {
     snprintf(errbuf, errlen, "Unable to open face: %d", err);
-    free(face);
-    free(srec);
+    buf_release(b);
+    free(font);
     return NULL;
   }
 
-  return face_create_epilogue(face, font_domain);
+  font->data = b;
+  return font_create_epilogue(font, font_domain);
 }
 
 
 /**
  *
  */
-static face_t *
-face_create_from_uri(const char *path, int font_domain, const char **vpaths)
+static font_t *
+font_create_from_uri(const char *path, int font_domain, const char **vpaths)
 {
   char errbuf[256];
-  face_t *face;
+  font_t *font;
 
-  TAILQ_FOREACH(face, &faces, link)
-    if(face->url != NULL && !strcmp(face->url, path) &&
-       face->font_domain == font_domain)
-      return face;
+  TAILQ_FOREACH(font, &fonts, link)
+    if(font->url != NULL && !strcmp(font->url, path) &&
+       font->font_domain == font_domain)
+      return font;
   fa_handle_t *fh = fa_open_vpaths(path, vpaths, errbuf, sizeof(errbuf), 0);
   if(fh == NULL) {
     TRACE(TRACE_ERROR, "Freetype", "Unable to load font: %s -- %s",
@@ -326,14 +475,14 @@ face_create_from_uri(const char *path, int font_domain, const char **vpaths)
     return NULL;
   }
 
-  face = face_create_from_fh(fh, font_domain, errbuf, sizeof(errbuf));
-  if(face == NULL) {
+  font = font_create_from_fh(fh, font_domain, errbuf, sizeof(errbuf));
+  if(font == NULL) {
     TRACE(TRACE_ERROR, "Freetype", "Unable to load font: %s -- %s",
 	  path, errbuf);
     return NULL;
   }
-  face->url = strdup(path);
-  return face;
+  font->url = strdup(path);
+  return font;
 }
 
 
@@ -358,7 +507,7 @@ striptrail(char *x2)
  *
  */
 static int
-face_is_family(face_t *f, const char *family, int domain, int fuzzyness)
+font_is_family(font_t *f, const char *family, int domain, int fuzzyness)
 {
   char *a, *b;
   if(domain != f->font_domain)
@@ -381,34 +530,34 @@ face_is_family(face_t *f, const char *family, int domain, int fuzzyness)
 }
 
 /**
- *
+ * Must be called with text_mutex held
  */
-static face_t *
-face_resolve(int uc, uint8_t style, const char *font, int font_domain,
+static font_t *
+font_resolve(int uc, uint8_t style, const char *font, int font_domain,
 	     const char **vpaths)
 {
-  face_t *f = NULL;
+  font_t *f = NULL;
   if(font != NULL) {
     int i;
-    // Try already loaded faces
+    // Try already loaded fonts
     for(i = 0; i < 3; i++) {
-      TAILQ_FOREACH(f, &faces, link)
-	if(face_is_family(f, font, font_domain, i) &&
+      TAILQ_FOREACH(f, &fonts, link)
+	if(font_is_family(f, font, font_domain, i) &&
 	   f->style == style &&
 	   FT_Get_Char_Index(f->face, uc))
 	  return f;
     }
 
     for(i = 0; i < 3; i++) {
-      TAILQ_FOREACH(f, &faces, link)
-	if(face_is_family(f, font, font_domain, i) &&
+      TAILQ_FOREACH(f, &fonts, link)
+	if(font_is_family(f, font, font_domain, i) &&
 	   f->style == 0 &&
 	   FT_Get_Char_Index(f->face, uc))
 	  return f;
     }
 
     if(fa_can_handle(font, NULL, 0)) {
-      f = face_create_from_uri(font, font_domain, vpaths);
+      f = font_create_from_uri(font, font_domain, vpaths);
       if(f == NULL || !FT_Get_Char_Index(f->face, uc))
 	f = NULL;
     }
@@ -416,13 +565,13 @@ face_resolve(int uc, uint8_t style, const char *font, int font_domain,
 #if 0
   // Try anything from the exact domain
   if(f == NULL) {
-    TAILQ_FOREACH(f, &faces, link) {
+    TAILQ_FOREACH(f, &fonts, link) {
       if(f->font_domain == font_domain &&
          f->style == style &&
          FT_Get_Char_Index(f->face, uc))
       return f;
     }
-    TAILQ_FOREACH(f, &faces, link) {
+    TAILQ_FOREACH(f, &fonts, link) {
       if(f->font_domain == font_domain &&
          FT_Get_Char_Index(f->face, uc))
       return f;
@@ -437,7 +586,7 @@ face_resolve(int uc, uint8_t style, const char *font, int font_domain,
       f = default_font;
 
   if(f == NULL)
-    TAILQ_FOREACH(f, &faces, link)
+    TAILQ_FOREACH(f, &fonts, link)
       if(f->font_domain == FONT_DOMAIN_FALLBACK &&
 	 FT_Get_Char_Index(f->face, uc))
 	break;
@@ -446,14 +595,14 @@ face_resolve(int uc, uint8_t style, const char *font, int font_domain,
   if(f == NULL) {
     char url[URL_MAX];
     if(!fontconfig_resolve(uc, style, font, url, sizeof(url)))
-      f = face_create_from_uri(url, FONT_DOMAIN_FALLBACK, NULL);
+      f = font_create_from_uri(url, FONT_DOMAIN_FALLBACK, NULL);
   }
 #endif
 
   
   // Last resort, anything that has the glyph
   if(f == NULL)
-    TAILQ_FOREACH(f, &faces, link)
+    TAILQ_FOREACH(f, &fonts, link)
       if(FT_Get_Char_Index(f->face, uc))
 	break;
   return f;
@@ -461,13 +610,13 @@ face_resolve(int uc, uint8_t style, const char *font, int font_domain,
 
 
 /**
- *
+ * Must be called with text_mutex held
  */
-static face_t *
-face_find(int uc, uint8_t style, const char *family, int font_domain,
+static font_t *
+font_find(int uc, uint8_t style, const char *family, int font_domain,
 	  const char **vpaths)
 {
-  face_t *f = face_resolve(uc, style, family, font_domain, vpaths);
+  font_t *f = font_resolve(uc, style, family, font_domain, vpaths);
 
 #if 0
   printf("Resolv %c (0x%x) [style=0x%x, font: %s] -> %s\n",
@@ -502,102 +651,238 @@ face_set_size(face_t *f, int size)
  *
  */
 static glyph_t *
-glyph_get(int uc, int size, uint8_t style, const char *font,
+glyph_create(text_ctx_t *tc, face_t *f, int uc, int size, uint8_t style)
+{
+  int hash = (uc ^ size ^ style) & GLYPH_HASH_MASK;
+  FT_GlyphSlot gs;
+  FT_UInt gi;
+  glyph_t *g;
+
+  gi = FT_Get_Char_Index(f->face, uc);
+
+  face_set_size(f, size);
+
+  if(FT_Load_Glyph(f->face, gi, FT_LOAD_FORCE_AUTOHINT) != 0)
+    return NULL;
+
+  gs = f->face->glyph;
+
+  if(style & TR_STYLE_ITALIC && !(f->font->style & TR_STYLE_ITALIC))
+    FT_GlyphSlot_Oblique(gs);
+
+  if(style & TR_STYLE_BOLD && !(f->font->style & TR_STYLE_BOLD) && 
+     gs->format == FT_GLYPH_FORMAT_OUTLINE) {
+    int v = FT_MulFix(gs->face->units_per_EM,
+		      gs->face->size->metrics.y_scale) / 64;
+    FT_Outline_Embolden(&gs->outline, v);
+  }
+
+  g = calloc(1, sizeof(glyph_t));
+
+  if(FT_Get_Glyph(gs, &g->orig_glyph) != 0) {
+    free(g);
+    return NULL;
+  }
+
+  FT_Glyph_Get_CBox(g->orig_glyph, FT_GLYPH_BBOX_GRIDFIT, &g->bbox);
+
+  g->gi = gi;
+  LIST_INSERT_HEAD(&f->glyphs, g, face_link);
+  g->face = f;
+  g->uc = uc;
+  g->style = style;
+  g->size = size;
+
+  g->adv_x = gs->advance.x;
+  LIST_INSERT_HEAD(&tc->glyph_hash[hash], g, hash_link);
+  tc->num_glyphs++;
+  return g;
+}
+
+
+/**
+ *
+ */
+static glyph_t *
+glyph_get(text_ctx_t *tc, int uc, int size, uint8_t style, const char *font,
 	  int font_domain, const char **vpaths)
 {
-  int err, hash = (uc ^ size ^ style) & GLYPH_HASH_MASK;
+  int hash = (uc ^ size ^ style) & GLYPH_HASH_MASK;
   glyph_t *g;
-  FT_GlyphSlot gs;
 
-  LIST_FOREACH(g, &glyph_hash[hash], hash_link) {
+  LIST_FOREACH(g, &tc->glyph_hash[hash], hash_link) {
+    const font_t *fo = g->face->font;
+
     if(g->uc != uc || g->size != size || g->style != style)
       continue;
     
     if(font == NULL) {
-      if(g->face->font_domain <= FONT_DOMAIN_DEFAULT)
+      if(fo->font_domain <= FONT_DOMAIN_DEFAULT)
 	break;
       else
 	continue;
     }
 
-    if(!strcmp(g->face->family, font) && g->face->font_domain == font_domain)
+    if(!strcmp(fo->family, font) && fo->font_domain == font_domain)
       break;
 
-    if(g->face->url && !strcmp(g->face->url, font))
+    if(fo->url && !strcmp(fo->url, font))
       break;
   }
 
   if(g == NULL) {
-    face_t *f;
-    FT_UInt gi = 0;
+    face_t *f = NULL;
+    font_t *fo;
 
-    f = face_find(uc, style, font, font_domain, vpaths);
+    hts_mutex_lock(&text_mutex);
 
-    if(f == NULL) {
-      f = face_find(uc, 0, font, font_domain, vpaths);
-      if(f == NULL)
-	return NULL;
-    }
+    fo = font_find(uc, style, font, font_domain, vpaths);
 
-    gi = FT_Get_Char_Index(f->face, uc);
+    if(fo == NULL)
+      fo = font_find(uc, 0, font, font_domain, vpaths);
 
-    face_set_size(f, size);
+    if(fo != NULL)
+      f = face_get(tc, fo);
 
-    if((err = FT_Load_Glyph(f->face, gi, FT_LOAD_FORCE_AUTOHINT)) != 0)
+    hts_mutex_unlock(&text_mutex);
+
+    if(f == NULL)
       return NULL;
-    
-    gs = f->face->glyph;
 
-    if(style & TR_STYLE_ITALIC && !(f->style & TR_STYLE_ITALIC))
-      FT_GlyphSlot_Oblique(gs);
+    if((g = glyph_create(tc, f, uc, size, style)) == NULL)
+      return NULL;
+  } else {
+    TAILQ_REMOVE(&tc->glyphs, g, lru_link);
+  }
+  TAILQ_INSERT_TAIL(&tc->glyphs, g, lru_link);
 
-    if(style & TR_STYLE_BOLD && !(f->style & TR_STYLE_BOLD) && 
-       gs->format == FT_GLYPH_FORMAT_OUTLINE) {
-      int v = FT_MulFix(gs->face->units_per_EM,
-			gs->face->size->metrics.y_scale) / 64;
-      FT_Outline_Embolden(&gs->outline, v);
-    }
+  return g;
+}
 
-    g = calloc(1, sizeof(glyph_t));
 
-    if((err = FT_Get_Glyph(gs, &g->orig_glyph)) != 0) {
-      free(g);
-      return NULL;
-    }
+/**
+ * Get glyph for 'uc' from a given face
+ */
+static glyph_t *
+glyph_get_from_face(text_ctx_t *tc, face_t *f, int uc, int size,
+		    uint8_t style)
+{
+  int hash = (uc ^ size ^ style) & GLYPH_HASH_MASK;
+  glyph_t *g;
 
-    FT_Glyph_Get_CBox(g->orig_glyph, FT_GLYPH_BBOX_GRIDFIT, &g->bbox);
-
-    g->gi = gi;
-    LIST_INSERT_HEAD(&f->glyphs, g, face_link);
-    g->face = f;
-    g->uc = uc;
-    g->style = style;
-    g->size = size;
-	 
-    g->adv_x = gs->advance.x;
-    LIST_INSERT_HEAD(&glyph_hash[hash], g, hash_link);
-    num_glyphs++;
+  LIST_FOREACH(g, &tc->glyph_hash[hash], hash_link)
+    if(g->face == f && g->uc == uc && g->size == size && g->style == style)
+      break;
+
+  if(g == NULL) {
+    if((g = glyph_create(tc, f, uc, size, style)) == NULL)
+      return NULL;
   } else {
-    TAILQ_REMOVE(&allglyphs, g, lru_link);
+    TAILQ_REMOVE(&tc->glyphs, g, lru_link);
   }
-  TAILQ_INSERT_TAIL(&allglyphs, g, lru_link);
-
+  TAILQ_INSERT_TAIL(&tc->glyphs, g, lru_link);
   return g;
 }
 
 
+/**
+ * Rasterize glyph if not already done
+ */
+static FT_BitmapGlyph
+glyph_get_bitmap(glyph_t *g)
+{
+  if(g->bmp == NULL) {
+    g->bmp = g->orig_glyph;
+    if(FT_Glyph_To_Bitmap(&g->bmp, FT_RENDER_MODE_NORMAL, NULL, 0))
+      g->bmp = NULL;
+  }
+  return (FT_BitmapGlyph)g->bmp;
+}
+
+
 /**
  *
  */
 static void
-glyph_flush_one(void)
+glyph_flush_one(text_ctx_t *tc)
 {
-  glyph_t *g = TAILQ_FIRST(&allglyphs);
+  glyph_t *g = TAILQ_FIRST(&tc->glyphs);
   assert(g != NULL);
-  glyph_destroy(g);
+  glyph_destroy(tc, g);
+}
+
+
+/**
+ *
+ */
+static text_ctx_t *
+text_ctx_create(void)
+{
+  text_ctx_t *tc = calloc(1, sizeof(text_ctx_t));
+
+  if(FT_Init_FreeType(&tc->library)) {
+    free(tc);
+    return NULL;
+  }
+  FT_Stroker_New(tc->library, &tc->stroker);
+  TAILQ_INIT(&tc->glyphs);
+  return tc;
+}
+
+
+/**
+ * Get a render context for the calling thread. Waits if all of them
+ * are busy. Must be called with text_mutex held
+ */
+static text_ctx_t *
+text_ctx_acquire(void)
+{
+  text_ctx_t *tc;
+
+  while(1) {
+    tc = hts_thread_get_specific(text_ctx_key);
+    if(tc == NULL || tc->in_use)
+      tc = LIST_FIRST(&text_ctxs_free);
+
+    if(tc != NULL) {
+      LIST_REMOVE(tc, link);
+      break;
+    }
+
+    if(text_ctxs_num < MAX(gconf.concurrency, 2)) {
+      if((tc = text_ctx_create()) != NULL) {
+	text_ctxs_num++;
+	break;
+      }
+      if(text_ctxs_num == 0)
+	return NULL;
+    }
+    hts_cond_wait(&text_ctx_cond, &text_mutex);
+  }
+  tc->in_use = 1;
+  hts_thread_set_specific(text_ctx_key, tc);
+  faces_drop_unlinked(tc);
+  return tc;
 }
 
 
+/**
+ * Trim caches and hand back the context. Must be called with
+ * text_mutex held
+ */
+static void
+text_ctx_release(text_ctx_t *tc)
+{
+  while(tc->num_glyphs > TEXT_CTX_MAX_GLYPHS)
+    glyph_flush_one(tc);
+
+  faces_purge(tc);
+
+  tc->in_use = 0;
+  LIST_INSERT_HEAD(&text_ctxs_free, tc, link);
+  hts_cond_signal(&text_ctx_cond);
+}
+
 /**
  *
  */
@@ -671,9 +956,9 @@ static const float legacy_size_mult[16] = {
  *
  */
 static void
-draw_glyphs(pixmap_t *pm, struct line_queue *lq, int target_height,
-	    int siz_x, item_t *items, int start_x, int start_y,
-	    int origin_y, int margin, int pass)
+draw_glyphs(text_ctx_t *tc, pixmap_t *pm, struct line_queue *lq,
+	    int target_height, int siz_x, item_t *items, int start_x,
+	    int start_y, int origin_y, int margin, int pass)
 {
   FT_Vector pen;
   line_t *li;
@@ -785,23 +1070,20 @@ draw_glyphs(pixmap_t *pm, struct line_queue *lq, int target_height,
 	  FT_Done_Glyph(g->outline);
 	
 	g->outline = g->orig_glyph;
-	FT_Stroker_Set(text_stroker,
+	FT_Stroker_Set(tc->stroker,
 		       items[i].outline,
 		       FT_STROKER_LINECAP_ROUND,
 		       FT_STROKER_LINEJOIN_ROUND,
 		       0);
 	g->outline_amt = items[i].outline;
-	if(FT_Glyph_StrokeBorder(&g->outline, text_stroker, 0, 0))
+	if(FT_Glyph_StrokeBorder(&g->outline, tc->stroker, 0, 0))
 	  g->outline = NULL;
 	else if(FT_Glyph_To_Bitmap(&g->outline, FT_RENDER_MODE_NORMAL, NULL, 1))
 	  g->outline = NULL;
       }
       
-      if(g->bmp == NULL) {
-	g->bmp = g->orig_glyph;
-	if(FT_Glyph_To_Bitmap(&g->bmp, FT_RENDER_MODE_NORMAL, NULL, 0))
-	  g->bmp = NULL;
-      }
+      glyph_get_bitmap(g);
+
       if(pass == 0 && items[i].shadow && (g->outline != NULL || g->bmp != NULL)) {
 	FT_BitmapGlyph bmp = (FT_BitmapGlyph)(g->outline ?: g->bmp);
 	draw_glyph(pm,
@@ -847,11 +1129,116 @@ draw_glyphs(pixmap_t *pm, struct line_queue *lq, int target_height,
   }
 }
 
+/**
+ * Check if the text can be output as a glyph run (TR_RENDER_GLYPHS)
+ * Rules and glyphs too big for a glyph atlas must be drawn into a
+ * pixmap.
+ */
+static int
+glyphs_can_run(struct line_queue *lq, const item_t *items)
+{
+  const line_t *li;
+  int i;
+
+  TAILQ_FOREACH(li, lq, link) {
+    if(li->type == LINE_TYPE_HR)
+      return 0;
+
+    for(i = li->start; i < li->start + li->count; i++) {
+      const glyph_t *g = items[i].g;
+      if(g == NULL)
+	continue;
+      if(g->size > GLYPH_ID_SIZE_MAX ||
+	 g->bbox.xMax - g->bbox.xMin > TR_GLYPHS_MAX_SIZE * 64 ||
+	 g->bbox.yMax - g->bbox.yMin > TR_GLYPHS_MAX_SIZE * 64)
+	return 0;
+    }
+  }
+  return 1;
+}
+
+
+/**
+ * Same pen positioning as draw_glyphs() but instead of drawing we store
+ * the glyph id and the position of its origin in the pixmap
+ */
+static void
+layout_glyphs(pixmap_t *pm, struct line_queue *lq, int target_height,
+	      int siz_x, item_t *items, int start_x, int start_y,
+	      int origin_y, int margin)
+{
+  FT_Vector pen;
+  line_t *li;
+  int i, n = 0;
+  int pen_y = 0;
+  int pen_x = 0;
+  glyph_t *g;
+  text_glyph_t *tg;
+
+  TAILQ_FOREACH(li, lq, link)
+    n += li->count;
+
+  pm->pm_type = PIXMAP_GLYPHS;
+  pm->pm_data = tg = malloc(sizeof(text_glyph_t) * MAX(n, 1));
+  n = 0;
+
+  TAILQ_FOREACH(li, lq, link) {
+
+    pen_y -= li->height * 64;
+    pen_x = li->xoffset;
+
+    switch(li->alignment) {
+    case TR_ALIGN_LEFT:
+    case TR_ALIGN_JUSTIFIED:
+      break;
+    case TR_ALIGN_CENTER:
+      pen_x += (siz_x - li->width) / 2;
+      break;
+    case TR_ALIGN_RIGHT:
+      pen_x += li->width - siz_x;
+      break;
+    }
+
+    for(i = li->start; i < li->start + li->count; i++) {
+
+      g = items[i].g;
+      if(g == NULL)
+	continue;
+
+      pen_x += items[i].kerning;
+
+      pen.x = start_x + pen_x + 31;
+      pen.y = start_y + pen_y + origin_y + 31 - li->descender;
+
+      pen.x &= ~63;
+      pen.y &= ~63;
+
+      pen.x >>= 6;
+      pen.y >>= 6;
+
+      if(items[i].code != ' ') {
+	tg->tg_id    = GLYPH_ID(g);
+	tg->tg_x     = margin + pen.x;
+	tg->tg_y     = target_height + margin - pen.y;
+	tg->tg_color = items[i].color;
+	tg++;
+	n++;
+      }
+
+      pen_x += items[i].adv_x;
+      if(items[i].code == ' ')
+	pen_x += li->xspace;
+    }
+  }
+  pm->pm_num_glyphs = n;
+}
+
+
 /**
  *
  */
 static struct pixmap *
-text_render0(const uint32_t *uc, const int len,
+text_render0(text_ctx_t *tc, const uint32_t *uc, const int len,
 	     int flags, int default_size, float scale,
 	     int global_alignment, int max_width, int max_lines,
 	     const char *default_font, int default_domain,
@@ -1089,8 +1476,8 @@ text_render0(const uint32_t *uc, const int len,
     if(li->start == -1)
       li->start = out;
 
-    if((g = glyph_get(uc[i], current_size, style, current_font, current_domain,
-		      vpaths)) == NULL)
+    if((g = glyph_get(tc, uc[i], current_size, style, current_font,
+		      current_domain, vpaths)) == NULL)
       continue;
 
     if(FT_HAS_KERNING(g->face->face) && g->gi && prev) {
@@ -1197,9 +1584,9 @@ text_render0(const uint32_t *uc, const int len,
       if(lines == max_lines - 1 && g != NULL && max_width) {
 	
 	if(flags & TR_RENDER_ELLIPSIZE) {
-	  glyph_t *eg = glyph_get(HORIZONTAL_ELLIPSIS_UNICODE, g->size, 0,
-				  g->face->url, g->face->font_domain,
-				  vpaths);
+	  glyph_t *eg = glyph_get(tc, HORIZONTAL_ELLIPSIS_UNICODE, g->size, 0,
+				  g->face->font->url,
+				  g->face->font->font_domain, vpaths);
 	  if(w + d > max_width - eg->adv_x ) {
 
 	    while(j > 0 && items[li->start + j - 1].code == ' ') {
@@ -1308,6 +1695,22 @@ text_render0(const uint32_t *uc, const int len,
 
   margin = (margin + 63) / 64;
 
+  if(flags & TR_RENDER_GLYPHS && !need_shadow_pass && !need_outline_pass &&
+     !(flags & (TR_RENDER_DEBUG | TR_RENDER_CHARACTER_POS |
+		TR_RENDER_NO_OUTPUT)) &&
+     glyphs_can_run(&lq, items)) {
+
+    pm = pixmap_create(target_width, target_height, PIXMAP_NULL, margin);
+    if(pm != NULL) {
+      pm->pm_lines = lines;
+      pm->pm_flags = pmflags;
+      layout_glyphs(pm, &lq, target_height, siz_x, items, start_x, start_y,
+		    origin_y, margin);
+    }
+    free(items);
+    return pm;
+  }
+
   // --- allocate and init pixmap
 
   pm = pixmap_create(target_width, target_height,
@@ -1338,17 +1741,17 @@ text_render0(const uint32_t *uc, const int len,
       }
 
       if(need_shadow_pass) {
-	draw_glyphs(pm, &lq, target_height, siz_x, items, start_x, start_y,
+	draw_glyphs(tc, pm, &lq, target_height, siz_x, items, start_x, start_y,
 		    origin_y, margin, 0);
 	pixmap_box_blur(pm, 4, 4);
       }
 
       if(need_outline_pass)
-	draw_glyphs(pm, &lq, target_height, siz_x, items, start_x, start_y,
+	draw_glyphs(tc, pm, &lq, target_height, siz_x, items, start_x, start_y,
 		    origin_y, margin, 1);
 
 
-      draw_glyphs(pm, &lq, target_height, siz_x, items, start_x, start_y,
+      draw_glyphs(tc, pm, &lq, target_height, siz_x, items, start_x, start_y,
 		  origin_y, margin, 2);
     }
   }
@@ -1371,36 +1774,105 @@ text_render(const uint32_t *uc, const int len, int flags, int default_size,
 	    const char **vpaths)
 {
   struct pixmap *pm;
+  text_ctx_t *tc;
 
   hts_mutex_lock(&text_mutex);
+  tc = text_ctx_acquire();
+  hts_mutex_unlock(&text_mutex);
 
-  pm = text_render0(uc, len, flags, default_size, scale, alignment, 
+  if(tc == NULL)
+    return NULL;
+
+  pm = text_render0(tc, uc, len, flags, default_size, scale, alignment, 
 		    max_width, max_lines, family, context, min_size,
 		    vpaths);
-  while(num_glyphs > 512)
-    glyph_flush_one();
-
-  faces_purge();
 
+  hts_mutex_lock(&text_mutex);
+  text_ctx_release(tc);
   hts_mutex_unlock(&text_mutex);
 
   return pm;
 }
 
 /**
+ * Rasterize a glyph returned in a glyph run from text_render()
+ *
+ * On success '*pmp' is set to a PIXMAP_I with the coverage of the glyph
+ * (or NULL if the glyph has no pixels, such as a space) and 'left',
+ * 'top' to the offset of the bitmap from the glyph origin.
  *
+ * Returns -1 if the glyph can no longer be rendered (its font has been
+ * unloaded).
+ */
+int
+text_glyph_render(uint64_t id, struct pixmap **pmp, int *left, int *top)
+{
+  const int font_id = GLYPH_ID_FONT(id);
+  FT_BitmapGlyph bmp;
+  text_ctx_t *tc = NULL;
+  pixmap_t *pm = NULL;
+  face_t *f = NULL;
+  font_t *fo;
+  glyph_t *g;
+  int y, r = -1;
+
+  hts_mutex_lock(&text_mutex);
+
+  TAILQ_FOREACH(fo, &fonts, link)
+    if(fo->id == font_id)
+      break;
+
+  if(fo != NULL) {
+    fo->refcount++; // Might have to wait for a context
+    if((tc = text_ctx_acquire()) != NULL)
+      f = face_get(tc, fo);
+    font_release(fo);
+  }
+
+  hts_mutex_unlock(&text_mutex);
+
+  if(f != NULL &&
+     (g = glyph_get_from_face(tc, f, GLYPH_ID_UC(id), GLYPH_ID_SIZE(id),
+			      GLYPH_ID_STYLE(id))) != NULL &&
+     (bmp = glyph_get_bitmap(g)) != NULL) {
+
+    const FT_Bitmap *b = &bmp->bitmap;
+
+    if(b->width > 0 && b->rows > 0 &&
+       (pm = pixmap_create(b->width, b->rows, PIXMAP_I, 0)) != NULL) {
+      for(y = 0; y < b->rows; y++)
+	memcpy(pm->pm_pixels + y * pm->pm_linesize,
+	       b->buffer + y * b->pitch, b->width);
+    }
+    *left = bmp->left;
+    *top  = bmp->top;
+    r = 0;
+  }
+
+  if(tc != NULL) {
+    hts_mutex_lock(&text_mutex);
+    text_ctx_release(tc);
+    hts_mutex_unlock(&text_mutex);
+  }
+
+  *pmp = pm;
+  return r;
+}
+
+
+/**
+ * Must be called with text_mutex held
  */
 static void
-freetype_set_fontptr(face_t **ptr, const char *url)
+freetype_set_fontptr(font_t **ptr, const char *url)
 {
   if(*ptr) {
-    if(--(*ptr)->persistent == 0)
-      face_destroy(*ptr);
+    font_unload(*ptr);
     *ptr = NULL;
   }
 
   if(url) {
-    *ptr = face_create_from_uri(url, FONT_DOMAIN_DEFAULT, NULL);
+    *ptr = font_create_from_uri(url, FONT_DOMAIN_DEFAULT, NULL);
     if(*ptr != NULL)
       (*ptr)->persistent++;
   }
@@ -1433,10 +1905,10 @@ freetype_init(void)
     TRACE(TRACE_ERROR, "Freetype", "Freetype init error\n");
     return -1;
   }
-  FT_Stroker_New(text_library, &text_stroker);
-  TAILQ_INIT(&faces);
-  TAILQ_INIT(&allglyphs);
+  TAILQ_INIT(&fonts);
   hts_mutex_init(&text_mutex);
+  hts_cond_init(&text_ctx_cond, &text_mutex);
+  hts_thread_key_create(&text_ctx_key, NULL);
   //  arch_preload_fonts();
 
   snprintf(url, sizeof(url),
@@ -1455,10 +1927,10 @@ freetype_init(void)
 void *
 freetype_load_font(const char *url, int context, const char **vpaths)
 {
-  face_t *f;
+  font_t *f;
   hts_mutex_lock(&text_mutex);
   
-  f = face_create_from_uri(url, context, vpaths);
+  f = font_create_from_uri(url, context, vpaths);
   if(f != NULL)
     f->persistent++;
   
@@ -1474,10 +1946,10 @@ void *
 freetype_load_font_from_fh(fa_handle_t *fh, int font_domain,
 			   char *errbuf, size_t errlen)
 {
-  face_t *f;
+  font_t *f;
   hts_mutex_lock(&text_mutex);
 
-  f = face_create_from_fh(fh, font_domain, errbuf, errlen);
+  f = font_create_from_fh(fh, font_domain, errbuf, errlen);
   if(f != NULL)
     f->persistent++;
 
@@ -1492,10 +1964,9 @@ freetype_load_font_from_fh(fa_handle_t *fh, int font_domain,
 void
 freetype_unload_font(void *ref)
 {
-  face_t *f = ref;
+  font_t *f = ref;
   hts_mutex_lock(&text_mutex);
-  if(--f->persistent == 0)
-    face_destroy(f);
+  font_unload(f);
   hts_mutex_unlock(&text_mutex);
 }
 
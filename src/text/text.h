@@ -73,6 +73,7 @@ struct prop;
 #define TR_RENDER_OUTLINE       0x40
 #define TR_RENDER_NO_OUTPUT     0x80
 #define TR_RENDER_SUBS          0x100  // Render for subtitles
+#define TR_RENDER_GLYPHS        0x200  // Output a glyph run if possible
 
 #define TR_ALIGN_AUTO      0
 #define TR_ALIGN_LEFT      1
@@ -86,6 +87,24 @@ text_render(const uint32_t *uc, int len, int flags, int default_size,
 	    int max_width, int max_lines, const char *font_family,
 	    int font_domain, int min_size, const char **vpaths);
 
+/**
+ * With TR_RENDER_GLYPHS text_render() returns a PIXMAP_GLYPHS pixmap
+ * holding the positioned glyphs instead of drawing them, unless the
+ * text needs effects (shadow, outline, rules) only done in pixmaps.
+ * Dimensions, margin and flags of the pixmap are the same as if it
+ * had been drawn.
+ */
+typedef struct text_glyph {
+  uint64_t tg_id;     // Pass to text_glyph_render() to get the bitmap
+  int16_t tg_x;       // Glyph origin in pixels from top left of pixmap
+  int16_t tg_y;
+  uint32_t tg_color;  // Same as TR_CODE_COLOR | TR_CODE_ALPHA << 24
+} text_glyph_t;
+
+#define TR_GLYPHS_MAX_SIZE 120 // Larger glyphs are always drawn in pixmaps
+
+int text_glyph_render(uint64_t id, struct pixmap **pmp, int *left, int *top);
+
 
 #if ENABLE_LIBFREETYPE
 
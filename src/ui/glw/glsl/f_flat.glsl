@@ -2,11 +2,21 @@
 precision highp float;
 #endif
 
+#ifdef CLIP
+varying vec3 f_clip0;
+varying vec3 f_clip1;
+#endif
+
 varying vec4 f_col_mul;
 varying vec4 f_col_mul2;
 varying vec4 f_col_off;
 
 void main()
 {
+#ifdef CLIP
+  if(any(lessThan(f_clip0, vec3(0.0))) || any(lessThan(f_clip1, vec3(0.0))))
+    discard;
+#endif
+
   gl_FragColor = clamp(f_col_mul, 0.0, 1.0) * f_col_mul2 + f_col_off;
 }
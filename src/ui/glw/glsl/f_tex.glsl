@@ -4,6 +4,11 @@ precision highp float;
 
 uniform sampler2D u_t0;
 
+#ifdef CLIP
+varying vec3 f_clip0;
+varying vec3 f_clip1;
+#endif
+
 varying vec4 f_col_mul;
 varying vec4 f_col_mul2;
 varying vec4 f_col_off;
@@ -11,5 +16,10 @@ varying vec4 f_tex;
 
 void main()
 {
+#ifdef CLIP
+  if(any(lessThan(f_clip0, vec3(0.0))) || any(lessThan(f_clip1, vec3(0.0))))
+    discard;
+#endif
+
   gl_FragColor = clamp(f_col_mul, 0.0, 1.0) * f_col_mul2 * (texture2D(u_t0, f_tex.xy) + f_col_off);
 }
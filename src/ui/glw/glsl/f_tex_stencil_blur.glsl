@@ -5,6 +5,11 @@ precision highp float;
 uniform sampler2D u_t0;
 uniform sampler2D u_t1;
 
+#ifdef CLIP
+varying vec3 f_clip0;
+varying vec3 f_clip1;
+#endif
+
 varying vec4 f_col_mul;
 varying vec4 f_col_mul2;
 varying vec4 f_col_off;
@@ -13,6 +18,11 @@ varying vec3 f_blur;
 
 void main()
 {
+#ifdef CLIP
+  if(any(lessThan(f_clip0, vec3(0.0))) || any(lessThan(f_clip1, vec3(0.0))))
+    discard;
+#endif
+
   
   vec2 t = clamp(f_blur.x, 0.0, 1.0) * f_blur.yz;
   
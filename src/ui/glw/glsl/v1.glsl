@@ -7,6 +7,13 @@ uniform vec4 u_color_offset;
 uniform mat4 u_modelview;
 uniform vec3 u_blur;
 
+#ifdef CLIP
+// Eye space clip and fader planes, see GLW_RENDER_CLIP_PLANES
+uniform vec4 u_clip[6];
+uniform vec4 u_fader[6];
+uniform vec2 u_fader_ab[6]; // Alpha and blur falloff
+#endif
+
 
 const mat4 projection = mat4(2.414213,0.000000,0.000000,0.000000,
 			     0.000000,2.414213,0.000000,0.000000,
@@ -15,6 +22,10 @@ const mat4 projection = mat4(2.414213,0.000000,0.000000,0.000000,
 
 // The ordering of these are important to match the varying variables
 // in the fragment shaders.
+#ifdef CLIP
+varying vec3 f_clip0;
+varying vec3 f_clip1;
+#endif
 varying vec4 f_col_mul;
 varying vec4 f_col_mul2;
 varying vec4 f_col_off;
@@ -23,10 +34,27 @@ varying vec3 f_blur;
 
 void main()
 {
-  gl_Position = projection * u_modelview * vec4(a_position.xyz, 1);
-  f_col_mul = a_color;
+  vec4 eye = u_modelview * vec4(a_position.xyz, 1);
+  vec4 col = a_color;
+  float sharpness = a_position.w;
+
+#ifdef CLIP
+  f_clip0 = vec3(dot(eye, u_clip[0]), dot(eye, u_clip[1]), dot(eye, u_clip[2]));
+  f_clip1 = vec3(dot(eye, u_clip[3]), dot(eye, u_clip[4]), dot(eye, u_clip[5]));
+
+  for(int i = 0; i < 6; i++) {
+    float d = dot(eye, u_fader[i]);
+    if(u_fader_ab[i].x > 0.0)
+      col.a *= 1.0 + d / u_fader_ab[i].x;
+    if(u_fader_ab[i].y > 0.0)
+      sharpness *= min(1.0 + d / u_fader_ab[i].y, 1.0);
+  }
+#endif
+
+  gl_Position = projection * eye;
+  f_col_mul = col;
   f_col_off = u_color_offset;
   f_col_mul2 =  clamp(u_color, 0.0, 1.0);
   f_tex = a_texcoord;
-  f_blur = vec3(u_blur.x + (1.0 - a_position.w), u_blur.yz);
+  f_blur = vec3(u_blur.x + (1.0 - sharpness), u_blur.yz);
 }
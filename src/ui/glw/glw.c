@@ -32,6 +32,7 @@
 #include "glw_text_bitmap.h"
 #include "glw_texture.h"
 #include "glw_view.h"
+#include "glw_glyph_atlas.h"
 #include "glw_event.h"
 
 static void glw_focus_init_widget(glw_t *w, float weight);
@@ -233,6 +234,7 @@ glw_fini(glw_root_t *gr)
 
   glw_text_bitmap_fini(gr);
   rstr_release(gr->gr_default_font);
+  glw_view_eval_stats_report(gr, 0);
   glw_tex_fini(gr);
   free(gr->gr_skin);
   prop_unsubscribe(gr->gr_evsub);
@@ -266,6 +268,11 @@ glw_load_universe(glw_root_t *gr)
   prop_t *page = prop_create(gr->gr_prop_ui, "root");
   glw_unload_universe(gr);
 
+  if(gconf.enable_glw_viewcache_test) {
+    gconf.enable_glw_viewcache_test = 0;
+    showtime_shutdown(glw_view_bincache_test(gr) ? 2 : 0);
+  }
+
   rstr_t *universe = rstr_alloc("skin://universe.view");
 
   gr->gr_universe = glw_view_create(gr,
@@ -471,6 +478,10 @@ glw_prepare_frame(glw_root_t *gr, int flags)
       gr->gr_hz_sample = gr->gr_frame_start;
     }
   }
+
+  if((gr->gr_frames & 0x7f) == 0)
+    glw_view_eval_stats_report(gr, gconf.enable_glw_eval_stats ? 128 : 0);
+
   gr->gr_frames++;
 
   gr->gr_screensaver_counter++;
@@ -478,6 +489,10 @@ glw_prepare_frame(glw_root_t *gr, int flags)
   if(gr->gr_be_prepare != NULL)
     gr->gr_be_prepare(gr);
 
+  glw_glyph_atlas_frame(gr);
+
+  glw_tex_frame(gr);
+
   prop_set_int(gr->gr_screensaver_active, glw_screensaver_is_active(gr));
   prop_set_int(gr->gr_prop_width, gr->gr_width);
   prop_set_int(gr->gr_prop_height, gr->gr_height);
@@ -49,6 +49,8 @@ LIST_HEAD(glw_prop_sub_list, glw_prop_sub);
 LIST_HEAD(glw_loadable_texture_list, glw_loadable_texture);
 TAILQ_HEAD(glw_loadable_texture_queue, glw_loadable_texture);
 LIST_HEAD(glw_video_list, glw_video);
+LIST_HEAD(glw_renderer_cache_list, glw_renderer_cache);
+TAILQ_HEAD(glw_renderer_cache_queue, glw_renderer_cache);
 
 // ------------------- Backends -----------------
 
@@ -64,19 +66,31 @@ LIST_HEAD(glw_video_list, glw_video);
 
 // ------------------- Math mode -----------------
 
-// all supported apple devices should support SSE
-#if (defined(__x86_64) || defined(__APPLE__)) && !defined(__llvm__)
+// Selected by the target flags of the compiler. x86_64 always has SSE2
+#if defined(__SSE2__)
 #define ENABLE_GLW_MATH_SSE 1
 #else
 #define ENABLE_GLW_MATH_SSE 0
 #endif
 
+#if (defined(__ARM_NEON__) || defined(__ARM_NEON)) && !ENABLE_GLW_MATH_SSE
+#define ENABLE_GLW_MATH_NEON 1
+#else
+#define ENABLE_GLW_MATH_NEON 0
+#endif
+
 #if ENABLE_GLW_MATH_SSE
 #include <xmmintrin.h>
 typedef __m128 Mtx[4];
 typedef __m128 Vec4;
 typedef __m128 Vec3;
 typedef __m128 Vec2;
+#elif ENABLE_GLW_MATH_NEON
+#include <arm_neon.h>
+typedef float32x4_t Mtx[4];
+typedef float32x4_t Vec4;
+typedef float32x4_t Vec3;
+typedef float32x4_t Vec2;
 #else
 typedef float Mtx[16];
 typedef float Vec4[4];
@@ -294,6 +308,12 @@ typedef enum {
    */
   GLW_SIGNAL_MOVE,
 
+  /**
+   * Sent to a GLW_PLACEHOLDER widget to have it instantiated right away
+   * instead of when its parent first lays it out
+   */
+  GLW_SIGNAL_INSTANTIATE,
+
 } glw_signal_t;
 
 
@@ -334,6 +354,10 @@ typedef struct glw_class {
 #define GLW_CAN_HIDE_CHILDS            0x2
 #define GLW_TRANSFORM_LR_TO_UD         0x8
 #define GLW_UNCONSTRAINED              0x10
+#define GLW_VIRTUAL_CHILDS             0x20 /* Only childs near the viewport
+                                               are laid out, instantiation
+                                               of cloned childs is deferred
+                                               until they get there */
 
   /**
    * If the widget arranges its childer in horizontal or vertical order
@@ -669,6 +693,8 @@ typedef struct glw_root {
   struct glw *gr_universe;
 
   LIST_HEAD(, glw_cached_view) gr_views;
+  struct glw_view_deps *gr_view_deps; // Files loaded by view being compiled
+  LIST_HEAD(, glw_view_eval_stat) gr_eval_stats; // Dynamic evals per expr
 
   const char *gr_vpaths[5];
   char *gr_skin;
@@ -718,10 +744,13 @@ typedef struct glw_root {
    * Font renderer
    */
   LIST_HEAD(,  glw_text_bitmap) gr_gtbs;
+  struct glw_glyph_atlas *gr_glyph_atlas;
   TAILQ_HEAD(, glw_text_bitmap) gr_gtb_render_queue;
   TAILQ_HEAD(, glw_text_bitmap) gr_gtb_dim_queue;
   hts_cond_t gr_gtb_work_cond;
-  hts_thread_t gr_font_thread;
+#define GLW_MAX_FONT_THREADS 4
+  hts_thread_t gr_font_threads[GLW_MAX_FONT_THREADS];
+  int gr_num_font_threads;
   int gr_font_thread_running;
 
   rstr_t *gr_default_font;
@@ -756,7 +785,26 @@ typedef struct glw_root {
     int limit;
   } gr_tex_stash[2];
 
-  struct glw_loadable_texture_list gr_tex_list;
+  // Inactive textures still holding backend memory, oldest first
+  struct glw_loadable_texture_queue gr_tex_parked;
+
+#define GLW_TEX_HASH_SIZE 256
+  struct glw_loadable_texture_list gr_tex_hash[GLW_TEX_HASH_SIZE];
+
+  // Backend uploads done by glw_tex_layout() this frame
+  int gr_tex_upload_bytes;
+  int gr_tex_upload_time;
+
+  // Upload statistics, published every 128 frames
+  int gr_tex_stat_uploads;
+  int gr_tex_stat_deferred;
+  int gr_tex_stat_maxtime;
+  int64_t gr_tex_stat_bytes;
+  int64_t gr_tex_stat_time;
+
+  // Backend memory held by loadable textures, see glw_tex_evict()
+  int64_t gr_tex_resident;
+  int gr_tex_evictions;
 
   int gr_normalized_texture_coords;
 
@@ -816,6 +864,23 @@ typedef struct glw_root {
   char gr_need_sw_clip;          /* Set if software clipping is needed
 				    at the moment */
 
+  char gr_shader_clipping;       /* Backend can clip and fade in shaders,
+				    see GLW_RENDER_CLIP_PLANES */
+
+  /**
+   * Clippers and faders that apply to the current gr_render() call
+   * when GLW_RENDER_CLIP_PLANES is set
+   */
+  int gr_render_clippers;
+  int gr_render_faders;
+
+  /**
+   * Cache of tessellated (clipped, stenciled and faded) geometry
+   */
+  struct glw_renderer_cache_list *gr_tess_hash;
+  struct glw_renderer_cache_queue gr_tess_lru;
+  int gr_tess_bytes;
+
 
   void (*gr_set_hw_clipper)(const struct glw_rctx *rc, int which,
 			    const Vec4 vec);
@@ -842,6 +907,11 @@ typedef struct glw_root {
 					 * ie, the triangle should be blurred
 					 */
 
+#define GLW_RENDER_CLIP_PLANES      0x4 /* Clip and fade using the planes
+					 * in gr_render_clippers and
+					 * gr_render_faders
+					 */
+
 
   float *gr_vtmp_buffer;  // temporary buffer for emitting vertices
   int gr_vtmp_cur;
@@ -890,6 +960,8 @@ typedef struct glw_rctx {
 
 #if ENABLE_GLW_MATH_SSE
 #include "glw_math_sse.h"
+#elif ENABLE_GLW_MATH_NEON
+#include "glw_math_neon.h"
 #else
 #include "glw_math_c.h"
 #endif
@@ -976,6 +1048,8 @@ typedef struct glw {
 #define GLW_HIDDEN               0x1000
 #define GLW_RETIRED              0x2000
 #define GLW_CAN_SCROLL           0x4000
+#define GLW_PLACEHOLDER          0x8000 /* Clone that has not been
+                                           instantiated yet */
 
 
 
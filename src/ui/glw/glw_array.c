@@ -28,6 +28,8 @@ typedef struct glw_array {
   int page_size;
 
   glw_t *scroll_to_me;
+  glw_t *anchor;  // First child in the layout window
+  int relayout;   // Childs or geometry changed
 
   glw_slider_metrics_t metrics;
   
@@ -63,6 +65,8 @@ typedef struct glw_array {
 
   int num_visible_childs;
 
+  int saved_geometry[8];
+
   float alpha_falloff;
   float blur_falloff;
 
@@ -122,15 +126,149 @@ glw_array_update_metrics(glw_array_t *a)
 
 
 /**
- *
+ * Place all childs in the grid. This is only done when childs are
+ * added, removed, moved or when the geometry of the array changes.
+ * Layout and rendering then only visit the rows around the current
+ * scroll position, starting at a->anchor
  */
 static void
-glw_array_layout(glw_array_t *a, glw_rctx_t *rc)
+glw_array_relayout(glw_array_t *a, int xpos, int ypos,
+		   float xspacing, float yspacing, int width, int window_start)
 {
   glw_t *c, *w = &a->w, *prev = NULL;
-  glw_rctx_t rc0 = *rc;
   int column = 0;
   int topedge = 1;
+
+  a->relayout = 0;
+  a->anchor = NULL;
+
+  TAILQ_FOREACH(c, &w->glw_childs, glw_parent_link) {
+    c->glw_flags |= GLW_CLIPPED;
+
+    if(c->glw_flags & GLW_HIDDEN)
+      continue;
+
+    if(c->glw_flags & GLW_CONSTRAINT_D) {
+      if(column != 0) {
+	ypos += a->child_height_px + yspacing;
+	column = 0;
+	topedge = 0;
+      }
+
+      if(c->glw_flags & GLW_CONSTRAINT_Y) {
+	c->glw_parent_height = c->glw_req_size_y;
+      } else {
+	c->glw_parent_height = a->child_height_px;
+      }
+      c->glw_parent_col = -1;
+
+    } else {
+      c->glw_parent_height = a->child_height_px;
+      c->glw_parent_col = column;
+    }
+
+    c->glw_parent_pos_y = ypos;
+    c->glw_parent_pos_x = column * (xspacing + a->child_width_px) + xpos;
+
+    if(a->anchor == NULL && ypos + c->glw_parent_height > window_start)
+      a->anchor = c;
+
+    if(column == 0) {
+      c->glw_flags2 |= GLW2_LEFT_EDGE;
+    } else {
+      c->glw_flags2 &= ~GLW2_LEFT_EDGE;
+
+      if(prev != NULL) {
+	prev->glw_flags2 |= GLW2_RIGHT_EDGE;
+      } else {
+	prev->glw_flags2 &= ~GLW2_RIGHT_EDGE;
+      }
+    }
+
+    if(topedge) {
+      c->glw_flags2 |= GLW2_TOP_EDGE;
+    } else {
+      c->glw_flags2 &= ~GLW2_TOP_EDGE;
+    }
+
+    c->glw_flags2 &= ~GLW2_BOTTOM_EDGE; // Will be set later
+
+    if(c->glw_flags & GLW_CONSTRAINT_D) {
+      ypos += c->glw_parent_height + yspacing;
+      column = 0;
+      topedge = 0;
+      
+    } else {
+      column++;
+      if(column == a->xentries) {
+	ypos += a->child_height_px + yspacing;
+	column = 0;
+	topedge = 0;
+      }
+    }
+    prev = c;
+  }
+
+  if(column != 0)
+    ypos += a->child_height_px;
+
+
+  glw_t *last = TAILQ_LAST(&w->glw_childs, glw_queue);
+  if(last != NULL) {
+    last->glw_flags2 |= GLW2_BOTTOM_EDGE | GLW2_RIGHT_EDGE;
+    c = last;
+    while((c = TAILQ_PREV(c, glw_queue, glw_parent_link)) != NULL) {
+      if(c->glw_parent_pos_y == last->glw_parent_pos_y)
+	c->glw_flags2 |= GLW2_BOTTOM_EDGE;
+      else
+	break;
+    }
+  }
+
+  if(a->anchor == NULL)
+    a->anchor = glw_last_widget(w);
+
+  if(a->total_size != ypos) {
+    a->total_size = ypos;
+    a->w.glw_flags |= GLW_UPDATE_METRICS;
+  }
+}
+
+
+/**
+ * Move the anchor to the first child that ends after 'start'
+ */
+static glw_t *
+glw_array_find_anchor(glw_array_t *a, int start)
+{
+  glw_t *c = a->anchor, *d;
+
+  if(c == NULL)
+    return NULL;
+
+  while((d = glw_prev_widget(c)) != NULL &&
+	d->glw_parent_pos_y + d->glw_parent_height > start)
+    c = d;
+
+  while(c->glw_parent_pos_y + c->glw_parent_height <= start &&
+	(d = glw_next_widget(c)) != NULL) {
+    c->glw_flags |= GLW_CLIPPED;
+    c = d;
+  }
+
+  a->anchor = c;
+  return c;
+}
+
+
+/**
+ *
+ */
+static void
+glw_array_layout(glw_array_t *a, glw_rctx_t *rc)
+{
+  glw_t *c, *w = &a->w;
+  glw_rctx_t rc0 = *rc;
   float xspacing = 0, yspacing = 0;
   int height, width, rows;
   int xpos = 0, ypos = 0;
@@ -230,37 +368,34 @@ glw_array_layout(glw_array_t *a, glw_rctx_t *rc)
 
   glw_lp(&a->filtered_pos, w->glw_root, a->current_pos, 0.25);
 
+  const int geometry[8] = {
+    a->xentries, a->child_width_px, a->child_height_px,
+    xspacing, yspacing, xpos, ypos, width
+  };
 
-  TAILQ_FOREACH(c, &w->glw_childs, glw_parent_link) {
-    if(c->glw_flags & GLW_HIDDEN)
-      continue;
+  if(memcmp(geometry, a->saved_geometry, sizeof(geometry))) {
+    memcpy(a->saved_geometry, geometry, sizeof(geometry));
+    a->relayout = 1;
+  }
 
-    if(c->glw_flags & GLW_CONSTRAINT_D) {
-      if(column != 0) {
-	ypos += rc0.rc_height + yspacing;
-	column = 0;
-	topedge = 0;
-      }
+  if(a->relayout)
+    glw_array_relayout(a, xpos, ypos, xspacing, yspacing, width,
+		       a->filtered_pos - height);
 
-      rc0.rc_width  = width;
+  for(c = glw_array_find_anchor(a, a->filtered_pos - height); c != NULL;
+      c = glw_next_widget(c)) {
 
-      if(c->glw_flags & GLW_CONSTRAINT_Y) {
-	rc0.rc_height = c->glw_req_size_y;
-      } else {
-	rc0.rc_height = a->child_height_px;
-      }
-      c->glw_parent_col = -1;
+    if(c->glw_parent_pos_y - a->filtered_pos >= height * 2)
+      break;
 
+    if(c->glw_parent_col == -1) {
+      rc0.rc_width  = width;
+      rc0.rc_height = c->glw_parent_height;
     } else {
       rc0.rc_width  = a->child_width_px;
       rc0.rc_height = a->child_height_px;
-      c->glw_parent_col = column;
     }
 
-    c->glw_parent_pos_y = ypos;
-    c->glw_parent_pos_x = column * (xspacing + a->child_width_px) + xpos;
-    c->glw_parent_height = rc0.rc_height;
-
     if(c->glw_parent_inst) {
       c->glw_parent_pos_fy = c->glw_parent_pos_y;
       c->glw_parent_pos_fx = c->glw_parent_pos_x;
@@ -270,79 +405,23 @@ glw_array_layout(glw_array_t *a, glw_rctx_t *rc)
       glw_lp(&c->glw_parent_pos_fx, w->glw_root, c->glw_parent_pos_x, 0.25);
     }
 
-    if(ypos - a->filtered_pos > -height &&
-       ypos - a->filtered_pos <  height * 2)
-      glw_layout0(c, &rc0);
-
-    if(c == a->scroll_to_me) {
-      a->scroll_to_me = NULL;
-     
-      if(ypos - a->filtered_pos < 0) {
-	a->current_pos = ypos;
-	a->w.glw_flags |= GLW_UPDATE_METRICS;
-      } else if(ypos - a->filtered_pos + rc0.rc_height > height) {
-	a->current_pos = ypos + rc0.rc_height - height;
-	a->w.glw_flags |= GLW_UPDATE_METRICS;
-      }
-    }
-
-    if(column == 0) {
-      c->glw_flags2 |= GLW2_LEFT_EDGE;
-    } else {
-      c->glw_flags2 &= ~GLW2_LEFT_EDGE;
-
-      if(prev != NULL) {
-	prev->glw_flags2 |= GLW2_RIGHT_EDGE;
-      } else {
-	prev->glw_flags2 &= ~GLW2_RIGHT_EDGE;
-      }
-    }
-
-    if(topedge) {
-      c->glw_flags2 |= GLW2_TOP_EDGE;
-    } else {
-      c->glw_flags2 &= ~GLW2_TOP_EDGE;
-    }
-
-    c->glw_flags2 &= ~GLW2_BOTTOM_EDGE; // Will be set later
-
-    if(c->glw_flags & GLW_CONSTRAINT_D) {
-      ypos += rc0.rc_height + yspacing;
-      column = 0;
-      topedge = 0;
-      
-    } else {
-      column++;
-      if(column == a->xentries) {
-	ypos += a->child_height_px + yspacing;
-	column = 0;
-	topedge = 0;
-      }
-    }
-    prev = c;
+    glw_layout0(c, &rc0);
   }
 
-  if(column != 0)
-    ypos += a->child_height_px;
-
+  if((c = a->scroll_to_me) != NULL && !a->relayout &&
+     !(c->glw_flags & GLW_HIDDEN)) {
+    const int ypos = c->glw_parent_pos_y;
+    a->scroll_to_me = NULL;
 
-  glw_t *last = TAILQ_LAST(&w->glw_childs, glw_queue);
-  if(last != NULL) {
-    last->glw_flags2 |= GLW2_BOTTOM_EDGE | GLW2_RIGHT_EDGE;
-    c = last;
-    while((c = TAILQ_PREV(c, glw_queue, glw_parent_link)) != NULL) {
-      if(c->glw_parent_pos_y == last->glw_parent_pos_y)
-	c->glw_flags2 |= GLW2_BOTTOM_EDGE;
-      else
-	break;
+    if(ypos - a->filtered_pos < 0) {
+      a->current_pos = ypos;
+      a->w.glw_flags |= GLW_UPDATE_METRICS;
+    } else if(ypos - a->filtered_pos + c->glw_parent_height > height) {
+      a->current_pos = ypos + c->glw_parent_height - height;
+      a->w.glw_flags |= GLW_UPDATE_METRICS;
     }
   }
 
- if(a->total_size != ypos) {
-    a->total_size = ypos;
-    a->w.glw_flags |= GLW_UPDATE_METRICS;
-  }
-
   if(a->w.glw_flags & GLW_UPDATE_METRICS)
     glw_array_update_metrics(a);
 }
@@ -447,12 +526,16 @@ glw_array_render(glw_t *w, const glw_rctx_t *rc)
   
   glw_Translatef(&rc2, 0, 2.0f * a->filtered_pos / height, 0);
 
-  TAILQ_FOREACH(c, &w->glw_childs, glw_parent_link) {
-    if(c->glw_flags & GLW_HIDDEN)
-      continue;
+  for(c = a->anchor; c != NULL; c = glw_next_widget(c)) {
+    if(c->glw_parent_pos_y - a->filtered_pos >= height * 2)
+      break;
     if(w->glw_focused != c)
       glw_array_render_one(a, c, width, height, &rc0, &rc2);
   }
+
+  // Childs that just left the window are not visited anymore
+  for(; c != NULL && !(c->glw_flags & GLW_CLIPPED); c = glw_next_widget(c))
+    c->glw_flags |= GLW_CLIPPED;
   
   // Render the focused widget last so it stays on top
   // until we have decent Z ordering
@@ -533,14 +616,32 @@ glw_array_callback(glw_t *w, void *opaque, glw_signal_t signal, void *extra)
     c = extra;
     a->num_visible_childs++;
     c->glw_parent_inst = 1;
+    a->relayout = 1;
     break;
 
 
   case GLW_SIGNAL_CHILD_DESTROYED:
+    if(a->anchor == extra)
+      a->anchor = glw_next_widget(extra) ?: glw_prev_widget(extra);
     if(a->scroll_to_me == extra)
       a->scroll_to_me = NULL;
   case GLW_SIGNAL_CHILD_HIDDEN:
     a->num_visible_childs--;
+    a->relayout = 1;
+    break;
+
+  case GLW_SIGNAL_CHILD_CONSTRAINTS_CHANGED:
+    c = extra;
+    if(c->glw_flags & GLW_HIDDEN)
+      break;
+    if(c->glw_flags & GLW_CONSTRAINT_D) {
+      if(c->glw_parent_col != -1 ||
+	 c->glw_parent_height != (c->glw_flags & GLW_CONSTRAINT_Y ?
+				  c->glw_req_size_y : a->child_height_px))
+	a->relayout = 1;
+    } else if(c->glw_parent_col == -1) {
+      a->relayout = 1;
+    }
     break;
 
   case GLW_SIGNAL_POINTER_EVENT:
@@ -561,6 +662,7 @@ glw_array_callback(glw_t *w, void *opaque, glw_signal_t signal, void *extra)
     break;
 
   case GLW_SIGNAL_CHILD_MOVED:
+    a->relayout = 1;
     scroll_to_me(a, w->glw_focused);
     break;
 
@@ -575,6 +677,8 @@ glw_array_callback(glw_t *w, void *opaque, glw_signal_t signal, void *extra)
 static void
 glw_array_ctor(glw_t *w)
 {
+  glw_array_t *a = (glw_array_t *)w;
+  a->relayout = 1;
   w->glw_flags |= GLW_FLOATING_FOCUS;
 }
 
@@ -689,7 +793,8 @@ set_border(glw_t *w, const int16_t *v)
 static glw_class_t glw_array = {
   .gc_name = "array",
   .gc_instance_size = sizeof(glw_array_t),
-  .gc_flags = GLW_NAVIGATION_SEARCH_BOUNDARY | GLW_CAN_HIDE_CHILDS,
+  .gc_flags = GLW_NAVIGATION_SEARCH_BOUNDARY | GLW_CAN_HIDE_CHILDS |
+  GLW_VIRTUAL_CHILDS,
   .gc_nav_descend_mode = GLW_NAV_DESCEND_FOCUSED,
   .gc_nav_search_mode = GLW_NAV_SEARCH_ARRAY,
   .gc_render = glw_array_render,
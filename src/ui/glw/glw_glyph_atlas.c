@@ -0,0 +1,462 @@
+/*
+ *  GL Widgets, Shared glyph atlas for text
+ *  Copyright (C) 2013 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "arch/threads.h"
+#include "glw.h"
+#include "glw_texture.h"
+#include "glw_glyph_atlas.h"
+#include "misc/pixmap.h"
+#include "text/text.h"
+
+/**
+ * Labels that are laid out as glyph runs (see TR_RENDER_GLYPHS) are
+ * drawn as one quad per glyph from a single atlas texture shared by
+ * all labels, so changing the text of a label does not allocate or
+ * upload any texture unless new glyphs are needed.
+ *
+ * The atlas is split into horizontal bands. Glyphs are packed into
+ * shelves within a band and when no band has room the least recently
+ * drawn band is evicted as a whole. Labels notice the eviction and
+ * look up their glyphs again. Glyphs without pixels (spaces) take no
+ * room but are put in the most recently used band so they are evicted
+ * like the others instead of piling up in the hash.
+ *
+ * Missing glyphs are queued and rasterized in batches on the task pool.
+ * The rows that changed are uploaded at the start of next frame.
+ */
+
+#define GLW_ATLAS_HASH_SIZE 512
+#define GLW_ATLAS_BATCH     32  // Glyphs per rasterization task
+#define GLW_ATLAS_TASKS     4   // Max concurrent rasterization tasks
+
+LIST_HEAD(glw_atlas_glyph_list, glw_atlas_glyph);
+TAILQ_HEAD(glw_atlas_glyph_queue, glw_atlas_glyph);
+
+typedef struct glw_atlas_band {
+  struct glw_atlas_glyph_list gab_glyphs;
+  int gab_last_used;    // gr_frames when last drawn
+  int16_t gab_shelf_x;
+  int16_t gab_shelf_y;
+  int16_t gab_shelf_height;
+  int16_t gab_dirty_top;     // Rows to upload, relative to band
+  int16_t gab_dirty_bottom;  // Nothing to upload if equal to top
+} glw_atlas_band_t;
+
+
+typedef struct glw_glyph_atlas {
+  struct glw_atlas_glyph_list gga_hash[GLW_ATLAS_HASH_SIZE];
+  struct glw_atlas_glyph_queue gga_pending;
+
+  glw_atlas_band_t gga_bands[GLW_ATLAS_BANDS];
+
+  pixmap_t *gga_pixmap;
+  glw_backend_texture_t gga_texture;
+
+  int gga_evictions;
+  int gga_ready;        // Bumped when glyphs become ready
+
+  int gga_tasks;        // Rasterization tasks running
+  hts_cond_t gga_tasks_cond;
+
+} glw_glyph_atlas_t;
+
+
+/**
+ * Glyphs rasterized by one task
+ */
+typedef struct glw_atlas_job {
+  glw_root_t *gaj_root;
+  int gaj_num;
+  struct {
+    uint64_t id;
+    pixmap_t *pm;
+    int left, top;
+    int err;
+  } gaj_glyphs[GLW_ATLAS_BATCH];
+} glw_atlas_job_t;
+
+
+/**
+ *
+ */
+static glw_atlas_glyph_t *
+atlas_find(glw_glyph_atlas_t *gga, uint64_t id)
+{
+  glw_atlas_glyph_t *gag;
+  const unsigned int h = (id ^ (id >> 23) ^ (id >> 34)) % GLW_ATLAS_HASH_SIZE;
+
+  LIST_FOREACH(gag, &gga->gga_hash[h], gag_hash_link)
+    if(gag->gag_id == id)
+      return gag;
+
+  gag = calloc(1, sizeof(glw_atlas_glyph_t));
+  gag->gag_id = id;
+  gag->gag_band = -1;
+  gag->gag_state = GAG_PENDING;
+  LIST_INSERT_HEAD(&gga->gga_hash[h], gag, gag_hash_link);
+  TAILQ_INSERT_TAIL(&gga->gga_pending, gag, gag_pending_link);
+  return gag;
+}
+
+
+/**
+ * Mark rows y to y + h of band as changed
+ */
+static void
+atlas_band_dirty(glw_atlas_band_t *gab, int y, int h)
+{
+  if(gab->gab_dirty_top == gab->gab_dirty_bottom) {
+    gab->gab_dirty_top = y;
+    gab->gab_dirty_bottom = y + h;
+  } else {
+    gab->gab_dirty_top = MIN(gab->gab_dirty_top, y);
+    gab->gab_dirty_bottom = MAX(gab->gab_dirty_bottom, y + h);
+  }
+}
+
+
+/**
+ *
+ */
+static void
+atlas_band_evict(glw_glyph_atlas_t *gga, int band)
+{
+  glw_atlas_band_t *gab = &gga->gga_bands[band];
+  glw_atlas_glyph_t *gag;
+  pixmap_t *pm = gga->gga_pixmap;
+
+  while((gag = LIST_FIRST(&gab->gab_glyphs)) != NULL) {
+    LIST_REMOVE(gag, gag_band_link);
+    LIST_REMOVE(gag, gag_hash_link);
+    free(gag);
+  }
+
+  memset(pm->pm_pixels + band * GLW_ATLAS_BAND_HEIGHT * pm->pm_linesize, 0,
+	 GLW_ATLAS_BAND_HEIGHT * pm->pm_linesize);
+
+  gab->gab_shelf_x = 0;
+  gab->gab_shelf_y = 0;
+  gab->gab_shelf_height = 0;
+  gga->gga_evictions++;
+  atlas_band_dirty(gab, 0, GLW_ATLAS_BAND_HEIGHT);
+}
+
+
+/**
+ * Find room for a w * h bitmap in band, returns 0 on success
+ */
+static int
+atlas_band_alloc(glw_atlas_band_t *gab, int w, int h, int *xp, int *yp)
+{
+  if(gab->gab_shelf_x + w > GLW_ATLAS_SIZE || h > gab->gab_shelf_height) {
+    // Open a new shelf below current one
+    int y = gab->gab_shelf_y + gab->gab_shelf_height;
+    if(y + h > GLW_ATLAS_BAND_HEIGHT)
+      return -1;
+
+    gab->gab_shelf_x = 0;
+    gab->gab_shelf_y = y;
+    gab->gab_shelf_height = h;
+  }
+
+  *xp = gab->gab_shelf_x;
+  *yp = gab->gab_shelf_y;
+  gab->gab_shelf_x += w;
+  return 0;
+}
+
+
+/**
+ *
+ */
+static void
+atlas_insert(glw_root_t *gr, glw_glyph_atlas_t *gga, glw_atlas_glyph_t *gag,
+	     const pixmap_t *src, int left, int top)
+{
+  pixmap_t *pm = gga->gga_pixmap;
+  int band, x, y, i, j;
+
+  gag->gag_state = GAG_READY;
+  gga->gga_ready++;
+
+  if(src == NULL || src->pm_width == 0 || src->pm_height == 0) {
+    band = 0;
+    for(i = 1; i < GLW_ATLAS_BANDS; i++)
+      if(gga->gga_bands[i].gab_last_used > gga->gga_bands[band].gab_last_used)
+	band = i;
+
+    gag->gag_band = band;
+    LIST_INSERT_HEAD(&gga->gga_bands[band].gab_glyphs, gag, gag_band_link);
+    return;
+  }
+
+  // One pixel of padding to avoid bleeding between glyphs
+  const int w = src->pm_width + 1;
+  const int h = src->pm_height + 1;
+
+  for(band = 0; band < GLW_ATLAS_BANDS; band++)
+    if(!atlas_band_alloc(&gga->gga_bands[band], w, h, &x, &y))
+      break;
+
+  if(band == GLW_ATLAS_BANDS) {
+    // Evict least recently drawn band
+    band = 0;
+    for(i = 1; i < GLW_ATLAS_BANDS; i++)
+      if(gga->gga_bands[i].gab_last_used < gga->gga_bands[band].gab_last_used)
+	band = i;
+
+    atlas_band_evict(gga, band);
+    if(atlas_band_alloc(&gga->gga_bands[band], w, h, &x, &y))
+      return; // Can't happen for glyphs <= TR_GLYPHS_MAX_SIZE
+  }
+
+  gga->gga_bands[band].gab_last_used = gr->gr_frames;
+  atlas_band_dirty(&gga->gga_bands[band], y, h);
+
+  y += band * GLW_ATLAS_BAND_HEIGHT;
+
+  for(j = 0; j < src->pm_height; j++) {
+    const uint8_t *s = src->pm_pixels + j * src->pm_linesize;
+    uint8_t *d = pm->pm_pixels + (y + j) * pm->pm_linesize + x * 2;
+    for(i = 0; i < src->pm_width; i++) {
+      *d++ = 0xff;
+      *d++ = *s++;
+    }
+  }
+
+  gag->gag_band   = band;
+  gag->gag_left   = left;
+  gag->gag_top    = top;
+  gag->gag_width  = src->pm_width;
+  gag->gag_height = src->pm_height;
+  gag->gag_x      = x;
+  gag->gag_y      = y;
+  LIST_INSERT_HEAD(&gga->gga_bands[band].gab_glyphs, gag, gag_band_link);
+}
+
+
+/**
+ * Rasterize a batch of glyphs on the task pool. text_glyph_render()
+ * does not need the glw lock so we only take it to insert the results
+ */
+static void *
+atlas_rasterize_task(void *aux)
+{
+  glw_atlas_job_t *gaj = aux;
+  glw_root_t *gr = gaj->gaj_root;
+  glw_glyph_atlas_t *gga = gr->gr_glyph_atlas;
+  glw_atlas_glyph_t *gag;
+  int i;
+
+  for(i = 0; i < gaj->gaj_num; i++)
+    gaj->gaj_glyphs[i].err =
+      text_glyph_render(gaj->gaj_glyphs[i].id, &gaj->gaj_glyphs[i].pm,
+			&gaj->gaj_glyphs[i].left, &gaj->gaj_glyphs[i].top);
+
+  glw_lock(gr);
+
+  for(i = 0; i < gaj->gaj_num; i++) {
+    gag = atlas_find(gga, gaj->gaj_glyphs[i].id);
+    if(gag->gag_state != GAG_RASTERIZING)
+      continue;
+
+    // If the face is gone the glyph is stored empty, it will not be
+    // asked for again as reloading the face gives it a new id
+    atlas_insert(gr, gga, gag,
+		 gaj->gaj_glyphs[i].err ? NULL : gaj->gaj_glyphs[i].pm,
+		 gaj->gaj_glyphs[i].left, gaj->gaj_glyphs[i].top);
+  }
+
+  gga->gga_tasks--;
+  if(gga->gga_tasks == 0)
+    hts_cond_signal(&gga->gga_tasks_cond);
+
+  glw_unlock(gr);
+
+  for(i = 0; i < gaj->gaj_num; i++)
+    if(gaj->gaj_glyphs[i].pm != NULL)
+      pixmap_release(gaj->gaj_glyphs[i].pm);
+  free(gaj);
+  return NULL;
+}
+
+
+/**
+ * Look up a glyph. Returns NULL if it is not in the atlas yet, in which
+ * case it is queued for rasterization
+ */
+const glw_atlas_glyph_t *
+glw_glyph_atlas_get(glw_root_t *gr, uint64_t id)
+{
+  glw_atlas_glyph_t *gag = atlas_find(gr->gr_glyph_atlas, id);
+  return gag->gag_state == GAG_READY ? gag : NULL;
+}
+
+
+/**
+ * Remember current state of the atlas after having looked up glyphs
+ */
+void
+glw_glyph_atlas_ref(glw_root_t *gr, glw_atlas_ref_t *gar)
+{
+  glw_glyph_atlas_t *gga = gr->gr_glyph_atlas;
+  gar->gar_evictions = gga->gga_evictions;
+  gar->gar_ready     = gga->gga_ready;
+}
+
+
+/**
+ * Returns true if glyphs should be looked up again
+ */
+int
+glw_glyph_atlas_stale(glw_root_t *gr, const glw_atlas_ref_t *gar)
+{
+  glw_glyph_atlas_t *gga = gr->gr_glyph_atlas;
+
+  if(gar->gar_evictions != gga->gga_evictions)
+    return 1;
+  return gar->gar_missing && gar->gar_ready != gga->gga_ready;
+}
+
+
+/**
+ * Called when drawing from the atlas. Returns the texture to use
+ */
+const glw_backend_texture_t *
+glw_glyph_atlas_touch(glw_root_t *gr, const glw_atlas_ref_t *gar)
+{
+  glw_glyph_atlas_t *gga = gr->gr_glyph_atlas;
+  int i;
+
+  for(i = 0; i < GLW_ATLAS_BANDS; i++)
+    if(gar->gar_bands & (1 << i))
+      gga->gga_bands[i].gab_last_used = gr->gr_frames;
+
+  return glw_is_tex_inited(&gga->gga_texture) ? &gga->gga_texture : NULL;
+}
+
+
+/**
+ * Upload the rows that have changed since last frame
+ */
+static void
+atlas_upload(glw_root_t *gr, glw_glyph_atlas_t *gga)
+{
+  glw_atlas_band_t *gab;
+  int i;
+
+  if(!glw_is_tex_inited(&gga->gga_texture)) {
+    glw_tex_upload(gr, &gga->gga_texture, gga->gga_pixmap, 0);
+    for(i = 0; i < GLW_ATLAS_BANDS; i++)
+      gga->gga_bands[i].gab_dirty_bottom = gga->gga_bands[i].gab_dirty_top;
+    return;
+  }
+
+  for(i = 0; i < GLW_ATLAS_BANDS; i++) {
+    gab = &gga->gga_bands[i];
+    if(gab->gab_dirty_top == gab->gab_dirty_bottom)
+      continue;
+
+    glw_tex_upload_rows(gr, &gga->gga_texture, gga->gga_pixmap,
+			i * GLW_ATLAS_BAND_HEIGHT + gab->gab_dirty_top,
+			gab->gab_dirty_bottom - gab->gab_dirty_top);
+    gab->gab_dirty_bottom = gab->gab_dirty_top;
+  }
+}
+
+
+/**
+ * Called at start of each frame. Upload the atlas if it has changed and
+ * start rasterization of glyphs asked for during last frame
+ */
+void
+glw_glyph_atlas_frame(glw_root_t *gr)
+{
+  glw_glyph_atlas_t *gga = gr->gr_glyph_atlas;
+  glw_atlas_glyph_t *gag;
+  glw_atlas_job_t *gaj;
+
+  atlas_upload(gr, gga);
+
+  while(gga->gga_tasks < GLW_ATLAS_TASKS &&
+	(gag = TAILQ_FIRST(&gga->gga_pending)) != NULL) {
+
+    gaj = calloc(1, sizeof(glw_atlas_job_t));
+    gaj->gaj_root = gr;
+
+    while(gaj->gaj_num < GLW_ATLAS_BATCH &&
+	  (gag = TAILQ_FIRST(&gga->gga_pending)) != NULL) {
+      TAILQ_REMOVE(&gga->gga_pending, gag, gag_pending_link);
+      gag->gag_state = GAG_RASTERIZING;
+      gaj->gaj_glyphs[gaj->gaj_num++].id = gag->gag_id;
+    }
+
+    gga->gga_tasks++;
+    hts_task_run("glyphs", atlas_rasterize_task, gaj,
+		 THREAD_PRIO_UI_WORKER_HIGH);
+  }
+}
+
+
+/**
+ *
+ */
+void
+glw_glyph_atlas_init(glw_root_t *gr)
+{
+  glw_glyph_atlas_t *gga = calloc(1, sizeof(glw_glyph_atlas_t));
+
+  TAILQ_INIT(&gga->gga_pending);
+  hts_cond_init(&gga->gga_tasks_cond, &gr->gr_mutex);
+  gga->gga_pixmap = pixmap_create(GLW_ATLAS_SIZE, GLW_ATLAS_SIZE,
+				  PIXMAP_IA, 0);
+  gr->gr_glyph_atlas = gga;
+}
+
+
+/**
+ *
+ */
+void
+glw_glyph_atlas_fini(glw_root_t *gr)
+{
+  glw_glyph_atlas_t *gga = gr->gr_glyph_atlas;
+  glw_atlas_glyph_t *gag;
+  int i;
+
+  glw_lock(gr);
+  while(gga->gga_tasks > 0)
+    glw_cond_wait(gr, &gga->gga_tasks_cond);
+  glw_unlock(gr);
+
+  for(i = 0; i < GLW_ATLAS_HASH_SIZE; i++) {
+    while((gag = LIST_FIRST(&gga->gga_hash[i])) != NULL) {
+      LIST_REMOVE(gag, gag_hash_link);
+      free(gag);
+    }
+  }
+
+  glw_tex_destroy(gr, &gga->gga_texture);
+  pixmap_release(gga->gga_pixmap);
+  hts_cond_destroy(&gga->gga_tasks_cond);
+  free(gga);
+  gr->gr_glyph_atlas = NULL;
+}
@@ -0,0 +1,80 @@
+/*
+ *  GL Widgets, Shared glyph atlas for text
+ *  Copyright (C) 2013 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GLW_GLYPH_ATLAS_H
+#define GLW_GLYPH_ATLAS_H
+
+#define GLW_ATLAS_SIZE        1024  // Width and height of atlas texture
+#define GLW_ATLAS_BANDS       8     // Evicted as a unit
+#define GLW_ATLAS_BAND_HEIGHT (GLW_ATLAS_SIZE / GLW_ATLAS_BANDS)
+
+/**
+ * A glyph stored in the atlas
+ */
+typedef struct glw_atlas_glyph {
+  LIST_ENTRY(glw_atlas_glyph) gag_hash_link;
+  LIST_ENTRY(glw_atlas_glyph) gag_band_link;
+  TAILQ_ENTRY(glw_atlas_glyph) gag_pending_link;
+
+  uint64_t gag_id;
+
+  uint8_t gag_state;
+#define GAG_PENDING     0  // Waiting for rasterization
+#define GAG_RASTERIZING 1
+#define GAG_READY       2
+
+  int8_t gag_band;      // -1 if not in the atlas
+
+  int16_t gag_left;     // Bitmap offset from glyph origin
+  int16_t gag_top;
+  uint16_t gag_width;   // 0 if glyph has no pixels
+  uint16_t gag_height;
+  uint16_t gag_x;       // Position in atlas
+  uint16_t gag_y;
+
+} glw_atlas_glyph_t;
+
+
+/**
+ * What a user of the atlas has seen. Used to know when to look up
+ * glyphs again
+ */
+typedef struct glw_atlas_ref {
+  int gar_evictions;
+  int gar_ready;
+  uint8_t gar_missing;  // Some glyphs were not ready
+  uint8_t gar_bands;    // Bitmask of bands used
+} glw_atlas_ref_t;
+
+
+void glw_glyph_atlas_init(glw_root_t *gr);
+
+void glw_glyph_atlas_fini(glw_root_t *gr);
+
+void glw_glyph_atlas_frame(glw_root_t *gr);
+
+const glw_atlas_glyph_t *glw_glyph_atlas_get(glw_root_t *gr, uint64_t id);
+
+void glw_glyph_atlas_ref(glw_root_t *gr, glw_atlas_ref_t *gar);
+
+int glw_glyph_atlas_stale(glw_root_t *gr, const glw_atlas_ref_t *gar);
+
+const glw_backend_texture_t *glw_glyph_atlas_touch(glw_root_t *gr,
+						   const glw_atlas_ref_t *gar);
+
+#endif /* GLW_GLYPH_ATLAS_H */
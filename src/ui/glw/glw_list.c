@@ -35,6 +35,8 @@ typedef struct glw_list {
   int velocity;
 
   glw_t *scroll_to_me;
+  glw_t *anchor;  // First child in the layout window
+  int relayout;   // Child sizes or order changed
 
   glw_t *suggested;
   int suggest_cnt;
@@ -49,6 +51,7 @@ typedef struct glw_list {
   int16_t padding_right;
   int16_t padding_top;
   int16_t padding_bottom;
+  int16_t default_size;
 
   float alpha_falloff;
   float blur_falloff;
@@ -59,6 +62,7 @@ typedef struct glw_list {
 #define glw_parent_width  glw_parent_val[1].i32
 #define glw_parent_pos    glw_parent_val[2].f
 #define glw_parent_inst   glw_parent_val[3].i32
+#define glw_parent_lpos   glw_parent_val[4].i32
 
 
 const static float top_plane[4] = {0,-1,0,1};
@@ -108,6 +112,134 @@ glw_list_update_metrics(glw_list_t *l)
 }
 
 
+/**
+ *
+ */
+static int
+glw_list_child_size(const glw_list_t *l, glw_t *c, int estimate)
+{
+  const int f = glw_filter_constraints(c);
+
+  if(l->w.glw_class->gc_child_orientation == GLW_ORIENTATION_VERTICAL) {
+    if(f & GLW_CONSTRAINT_Y)
+      return c->glw_req_size_y;
+  } else {
+    if(f & GLW_CONSTRAINT_X)
+      return c->glw_req_size_x;
+  }
+  return c->glw_flags & GLW_PLACEHOLDER ? estimate : l->default_size;
+}
+
+
+/**
+ *
+ */
+static int
+glw_list_child_extent(const glw_list_t *l, const glw_t *c)
+{
+  if(l->w.glw_class->gc_child_orientation == GLW_ORIENTATION_VERTICAL)
+    return c->glw_parent_lpos + c->glw_parent_height;
+  else
+    return c->glw_parent_lpos + c->glw_parent_width;
+}
+
+
+/**
+ * Compute the position of every child from their sizes. This is only
+ * done when childs are added, removed, moved or change size. Layout
+ * and rendering then only visit the childs in the window around the
+ * current scroll position, starting at l->anchor
+ *
+ * Childs that have not been instantiated by the cloner yet are assumed
+ * to be as large as the closest preceding child that has been.
+ */
+static int
+glw_list_relayout(glw_list_t *l, int pos, int window_start)
+{
+  glw_t *c;
+  const int vertical =
+    l->w.glw_class->gc_child_orientation == GLW_ORIENTATION_VERTICAL;
+  int size, estimate = l->default_size;
+
+  l->relayout = 0;
+  l->anchor = NULL;
+
+  TAILQ_FOREACH(c, &l->w.glw_childs, glw_parent_link) {
+    c->glw_flags |= GLW_CLIPPED;
+
+    if(c->glw_flags & GLW_HIDDEN)
+      continue;
+
+    size = glw_list_child_size(l, c, estimate);
+    if(!(c->glw_flags & GLW_PLACEHOLDER))
+      estimate = size;
+
+    if(vertical)
+      c->glw_parent_height = size;
+    else
+      c->glw_parent_width = size;
+
+    c->glw_parent_lpos = pos;
+
+    if(l->anchor == NULL && pos + size > window_start)
+      l->anchor = c;
+
+    pos += size + l->spacing;
+  }
+
+  if(l->anchor == NULL)
+    l->anchor = glw_last_widget(&l->w);
+  return pos;
+}
+
+
+/**
+ * Move the anchor to the first child that ends after 'start'
+ */
+static glw_t *
+glw_list_find_anchor(glw_list_t *l, int start)
+{
+  glw_t *c = l->anchor, *d;
+
+  if(c == NULL)
+    return NULL;
+
+  while((d = glw_prev_widget(c)) != NULL &&
+        glw_list_child_extent(l, d) > start)
+    c = d;
+
+  while(glw_list_child_extent(l, c) <= start &&
+        (d = glw_next_widget(c)) != NULL) {
+    c->glw_flags |= GLW_CLIPPED;
+    c = d;
+  }
+
+  l->anchor = c;
+  return c;
+}
+
+
+/**
+ *
+ */
+static void
+glw_list_child_constraints_changed(glw_list_t *l, glw_t *c)
+{
+  int size;
+
+  if(c->glw_flags & GLW_HIDDEN)
+    return;
+
+  if(l->w.glw_class->gc_child_orientation == GLW_ORIENTATION_VERTICAL)
+    size = c->glw_parent_height;
+  else
+    size = c->glw_parent_width;
+
+  if(glw_list_child_size(l, c, size) != size)
+    l->relayout = 1;
+}
+
+
 /**
  *
  */
@@ -115,7 +247,6 @@ static int
 glw_list_layout_y(glw_list_t *l, glw_rctx_t *rc)
 {
   glw_t *c, *w = &l->w;
-  int ypos = 0;
   glw_rctx_t rc0 = *rc;
 
   glw_reposition(&rc0, l->padding_left, rc->rc_height - l->padding_top,
@@ -133,6 +264,11 @@ glw_list_layout_y(glw_list_t *l, glw_rctx_t *rc)
       l->scroll_to_me = w->glw_focused;
   }
 
+  if(l->saved_width != rc0.rc_width) {
+    l->saved_width = rc0.rc_width;
+    l->default_size = rc0.rc_width / 10;
+    l->relayout = 1;
+  }
   
   if(l->touched) {
 
@@ -153,17 +289,23 @@ glw_list_layout_y(glw_list_t *l, glw_rctx_t *rc)
     }
   }
 
-  TAILQ_FOREACH(c, &w->glw_childs, glw_parent_link) {
-    if(c->glw_flags & GLW_HIDDEN)
-      continue;
-
-    int f = glw_filter_constraints(c);
+  if(l->relayout) {
+    int ypos = glw_list_relayout(l, 0, l->filtered_pos - height);
 
-    if(f & GLW_CONSTRAINT_Y) {
-      rc0.rc_height = c->glw_req_size_y;
-    } else {
-      rc0.rc_height = rc0.rc_width / 10;
+    if(l->total_size != ypos) {
+      l->total_size = ypos;
+      l->w.glw_flags |= GLW_UPDATE_METRICS;
     }
+  }
+
+  for(c = glw_list_find_anchor(l, l->filtered_pos - height); c != NULL;
+      c = glw_next_widget(c)) {
+    const int ypos = c->glw_parent_lpos;
+
+    if(ypos - l->filtered_pos >= height * 2)
+      break;
+
+    rc0.rc_height = c->glw_parent_height;
 
     if(c->glw_parent_inst) {
       c->glw_parent_pos = ypos;
@@ -172,33 +314,22 @@ glw_list_layout_y(glw_list_t *l, glw_rctx_t *rc)
       glw_lp(&c->glw_parent_pos, w->glw_root, ypos, 0.25);
     }
 
-    c->glw_parent_height = rc0.rc_height;
     c->glw_norm_weight = rc0.rc_height * IH;
-    
-
-    if(ypos - l->filtered_pos > -height &&
-       ypos - l->filtered_pos <  height * 2)
-      glw_layout0(c, &rc0);
-
-    if(c == l->scroll_to_me) {
-      l->scroll_to_me = NULL;
-     
-      if(ypos - l->filtered_pos < 0) {
-	l->current_pos = ypos;
-	l->w.glw_flags |= GLW_UPDATE_METRICS;
-      } else if(ypos - l->filtered_pos + rc0.rc_height > height) {
-	l->current_pos = ypos + rc0.rc_height - height;
-	l->w.glw_flags |= GLW_UPDATE_METRICS;
-      }
-    }
-
-    ypos += rc0.rc_height;
-    ypos += l->spacing;
+    glw_layout0(c, &rc0);
   }
 
-  if(l->total_size != ypos) {
-    l->total_size = ypos;
-    l->w.glw_flags |= GLW_UPDATE_METRICS;
+  if((c = l->scroll_to_me) != NULL && !l->relayout &&
+     !(c->glw_flags & GLW_HIDDEN)) {
+    const int ypos = c->glw_parent_lpos;
+    l->scroll_to_me = NULL;
+
+    if(ypos - l->filtered_pos < 0) {
+      l->current_pos = ypos;
+      l->w.glw_flags |= GLW_UPDATE_METRICS;
+    } else if(ypos - l->filtered_pos + c->glw_parent_height > height) {
+      l->current_pos = ypos + c->glw_parent_height - height;
+      l->w.glw_flags |= GLW_UPDATE_METRICS;
+    }
   }
 
   if(l->w.glw_flags & GLW_UPDATE_METRICS)
@@ -217,7 +348,6 @@ glw_list_layout_x(glw_list_t *l, glw_rctx_t *rc)
 {
   glw_t *c, *w = &l->w;
   const int bd = l->scroll_threshold;
-  int xpos = bd;
   glw_rctx_t rc0 = *rc;
 
   glw_reposition(&rc0, l->padding_left, rc->rc_height - l->padding_top,
@@ -235,6 +365,11 @@ glw_list_layout_x(glw_list_t *l, glw_rctx_t *rc)
       l->scroll_to_me = w->glw_focused;
   }
 
+  if(l->saved_height != rc0.rc_height) {
+    l->saved_height = rc0.rc_height;
+    l->default_size = rc0.rc_height;
+    l->relayout = 1;
+  }
   
   l->current_pos = GLW_MAX(0, GLW_MIN(l->current_pos,
 				      l->total_size - l->page_size));
@@ -245,48 +380,40 @@ glw_list_layout_x(glw_list_t *l, glw_rctx_t *rc)
     glw_lp(&l->filtered_pos, w->glw_root, l->current_pos, 0.25);
   }
 
-  TAILQ_FOREACH(c, &w->glw_childs, glw_parent_link) {
-    if(c->glw_flags & GLW_HIDDEN)
-      continue;
-
-    int f = glw_filter_constraints(c);
+  if(l->relayout) {
+    int xpos = glw_list_relayout(l, bd, l->filtered_pos - width0) + bd;
 
-    if(f & GLW_CONSTRAINT_X) {
-      rc0.rc_width = c->glw_req_size_x;
-    } else {
-      rc0.rc_width = rc0.rc_height;
+    if(l->total_size != xpos) {
+      l->total_size = xpos;
+      l->w.glw_flags |= GLW_UPDATE_METRICS;
     }
+  }
 
-    c->glw_parent_pos = xpos;
-    c->glw_parent_width = rc0.rc_width;
-    c->glw_norm_weight = rc0.rc_width * IW;
-    
-
-    if(xpos - l->filtered_pos > -width0 &&
-       xpos - l->filtered_pos <  width0 * 2) {
-      glw_layout0(c, &rc0);
-    }
+  for(c = glw_list_find_anchor(l, l->filtered_pos - width0); c != NULL;
+      c = glw_next_widget(c)) {
+    const int xpos = c->glw_parent_lpos;
 
-    if(c == l->scroll_to_me) {
-      l->scroll_to_me = NULL;
-      if(xpos - l->filtered_pos < bd) {
-	l->current_pos = xpos - bd;
-	l->w.glw_flags |= GLW_UPDATE_METRICS;
-      } else if(xpos - l->filtered_pos + rc0.rc_width > width0) {
-	l->current_pos = xpos + rc0.rc_width - width0 - bd;
-	l->w.glw_flags |= GLW_UPDATE_METRICS;
-      }
-    }
+    if(xpos - l->filtered_pos >= width0 * 2)
+      break;
 
-    xpos += rc0.rc_width;
-    xpos += l->spacing;
+    rc0.rc_width = c->glw_parent_width;
+    c->glw_parent_pos = xpos;
+    c->glw_norm_weight = rc0.rc_width * IW;
+    glw_layout0(c, &rc0);
   }
 
-  xpos += bd;
-
-  if(l->total_size != xpos) {
-    l->total_size = xpos;
-    l->w.glw_flags |= GLW_UPDATE_METRICS;
+  if((c = l->scroll_to_me) != NULL && !l->relayout &&
+     !(c->glw_flags & GLW_HIDDEN)) {
+    const int xpos = c->glw_parent_lpos;
+    l->scroll_to_me = NULL;
+
+    if(xpos - l->filtered_pos < bd) {
+      l->current_pos = xpos - bd;
+      l->w.glw_flags |= GLW_UPDATE_METRICS;
+    } else if(xpos - l->filtered_pos + c->glw_parent_width > width0) {
+      l->current_pos = xpos + c->glw_parent_width - width0 - bd;
+      l->w.glw_flags |= GLW_UPDATE_METRICS;
+    }
   }
 
   if(l->w.glw_flags & GLW_UPDATE_METRICS)
@@ -382,12 +509,17 @@ glw_list_render_y(glw_t *w, const glw_rctx_t *rc)
 
   glw_Translatef(&rc1, 0, 2.0f * l->filtered_pos / rc0.rc_height, 0);
   
-  TAILQ_FOREACH(c, &w->glw_childs, glw_parent_link) {
-    if(c->glw_flags & GLW_HIDDEN)
-      continue;
+  for(c = l->anchor; c != NULL; c = glw_next_widget(c)) {
+    if(c->glw_parent_lpos - l->filtered_pos >= rc0.rc_height * 2)
+      break;
     if(w->glw_focused != c)
       glw_list_y_render_one(l, c, rc0.rc_width, rc0.rc_height, &rc0, &rc1);
   }
+
+  // Childs that just left the window are not visited anymore
+  for(; c != NULL && !(c->glw_flags & GLW_CLIPPED); c = glw_next_widget(c))
+    c->glw_flags |= GLW_CLIPPED;
+
   if(w->glw_focused != NULL)
     glw_list_y_render_one(l, w->glw_focused, rc0.rc_width, rc0.rc_height,
                           &rc0, &rc1);
@@ -427,9 +559,9 @@ glw_list_render_x(glw_t *w, const glw_rctx_t *rc)
 
   glw_Translatef(&rc1, -2.0f * l->filtered_pos / width, 0, 0);
   
-  TAILQ_FOREACH(c, &w->glw_childs, glw_parent_link) {
-    if(c->glw_flags & GLW_HIDDEN)
-      continue;
+  for(c = l->anchor; c != NULL; c = glw_next_widget(c)) {
+    if(c->glw_parent_lpos - l->filtered_pos >= width * 2)
+      break;
 
     x = c->glw_parent_pos - l->filtered_pos;
     if(!l->noclip && (x + c->glw_parent_width < 0 || x > width)) {
@@ -476,6 +608,9 @@ glw_list_render_x(glw_t *w, const glw_rctx_t *rc)
     if(rf != -1)
       glw_fader_disable(w->glw_root, rf);
   }
+
+  for(; c != NULL && !(c->glw_flags & GLW_CLIPPED); c = glw_next_widget(c))
+    c->glw_flags |= GLW_CLIPPED;
 }
 
 
@@ -577,6 +712,9 @@ glw_list_callback(glw_t *w, void *opaque, glw_signal_t signal, void *extra)
     return 0;
 
   case GLW_SIGNAL_CHILD_DESTROYED:
+    l->relayout = 1;
+    if(l->anchor == extra)
+      l->anchor = glw_next_widget(extra) ?: glw_prev_widget(extra);
     if(l->scroll_to_me == extra)
       l->scroll_to_me = NULL;
     if(l->suggested == extra)
@@ -601,15 +739,21 @@ glw_list_callback(glw_t *w, void *opaque, glw_signal_t signal, void *extra)
     glw_list_scroll(l, extra);
     break;
 
+  case GLW_SIGNAL_CHILD_HIDDEN:
+    l->relayout = 1;
+    break;
+
   case GLW_SIGNAL_CHILD_CREATED:
   case GLW_SIGNAL_CHILD_UNHIDDEN:
     c = extra;
     c->glw_parent_inst = 1;
   case GLW_SIGNAL_CHILD_MOVED:
+    l->relayout = 1;
     scroll_to_me(l, w->glw_focused);
     break;
 
   case GLW_SIGNAL_CHILD_CONSTRAINTS_CHANGED:
+    glw_list_child_constraints_changed(l, extra);
     if(w->glw_focused == extra) {
       scroll_to_me(l, extra);
     }
@@ -671,6 +815,7 @@ glw_list_set(glw_t *w, va_list ap)
 
     case GLW_ATTRIB_SPACING:
       l->spacing = va_arg(ap, int);
+      l->relayout = 1;
       break;
 
     case GLW_ATTRIB_ALPHA_FALLOFF:
@@ -704,6 +849,7 @@ glw_list_y_ctor(glw_t *w)
   
   l->child_aspect = 20;
   l->suggest_cnt = 1;
+  l->relayout = 1;
   w->glw_flags |= GLW_FLOATING_FOCUS;
 }
 
@@ -718,6 +864,7 @@ glw_list_x_ctor(glw_t *w)
   
   l->child_aspect = 1;
   l->suggest_cnt = 1;
+  l->relayout = 1;
   w->glw_flags |= GLW_FLOATING_FOCUS;
 }
 
@@ -763,7 +910,7 @@ static glw_class_t glw_list_y = {
   .gc_name = "list_y",
   .gc_instance_size = sizeof(glw_list_t),
   .gc_flags = GLW_NAVIGATION_SEARCH_BOUNDARY | GLW_CAN_HIDE_CHILDS | 
-  GLW_TRANSFORM_LR_TO_UD,
+  GLW_TRANSFORM_LR_TO_UD | GLW_VIRTUAL_CHILDS,
   .gc_child_orientation = GLW_ORIENTATION_VERTICAL,
   .gc_nav_descend_mode = GLW_NAV_DESCEND_FOCUSED,
   .gc_nav_search_mode = GLW_NAV_SEARCH_BY_ORIENTATION_WITH_PAGING,
@@ -784,7 +931,8 @@ GLW_REGISTER_CLASS(glw_list_y);
 static glw_class_t glw_list_x = {
   .gc_name = "list_x",
   .gc_instance_size = sizeof(glw_list_t),
-  .gc_flags = GLW_NAVIGATION_SEARCH_BOUNDARY | GLW_CAN_HIDE_CHILDS,
+  .gc_flags = GLW_NAVIGATION_SEARCH_BOUNDARY | GLW_CAN_HIDE_CHILDS |
+  GLW_VIRTUAL_CHILDS,
   .gc_child_orientation = GLW_ORIENTATION_HORIZONTAL,
   .gc_nav_descend_mode = GLW_NAV_DESCEND_FOCUSED,
   .gc_nav_search_mode = GLW_NAV_SEARCH_BY_ORIENTATION_WITH_PAGING,
@@ -1,7 +1,7 @@
 #include "glw.h"
 
-#if ENABLE_GLW_MATH_SSE
-#include "glw_math_sse.c"
+#if ENABLE_GLW_MATH_SSE || ENABLE_GLW_MATH_NEON
+#include "glw_math_simd.c"
 #else
 #include "glw_math_c.c"
 #endif
@@ -0,0 +1,213 @@
+/*
+ *  GLW Math, NEON
+ *  Copyright (C) 2013 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Same layout as the SSE code: vectors in lane order x, y, z, w and
+ * matrices stored as four columns. Only ARMv7 intrinsics are used so
+ * this works on both 32 and 64 bit ARM.
+ */
+
+static inline void
+glw_Translatef(glw_rctx_t *rc, float x, float y, float z)
+{
+  float32x4_t r = vmlaq_n_f32(rc->rc_mtx[3], rc->rc_mtx[0], x);
+  r = vmlaq_n_f32(r, rc->rc_mtx[1], y);
+  rc->rc_mtx[3] = vmlaq_n_f32(r, rc->rc_mtx[2], z);
+}
+
+
+
+static inline void
+glw_Scalef(glw_rctx_t *rc, float x, float y, float z)
+{
+  rc->rc_mtx[0] = vmulq_n_f32(rc->rc_mtx[0], x);
+  rc->rc_mtx[1] = vmulq_n_f32(rc->rc_mtx[1], y);
+  rc->rc_mtx[2] = vmulq_n_f32(rc->rc_mtx[2], z);
+}
+
+void glw_Rotatef(glw_rctx_t *rc, float a, float x, float y, float z);
+void glw_LoadIdentity(glw_rctx_t *rc);
+
+static inline void
+glw_LoadMatrixf(glw_rctx_t *rc, float *src)
+{
+  memcpy(rc->rc_mtx, src, sizeof(float) * 16);
+}
+
+
+static inline void
+glw_LerpMatrix(Mtx out, float v, const Mtx a, const Mtx b)
+{
+  int i;
+
+  for(i = 0; i < 4; i++)
+    out[i] = vmlaq_n_f32(a[i], vsubq_f32(b[i], a[i]), v);
+}
+
+
+static inline void
+glw_vec4_store(float *p, const Vec4 v)
+{
+  vst1q_f32(p, v);
+}
+
+
+/**
+ * The columns are scaled by the vector components and summed, so the
+ * matrix can be used as is
+ */
+typedef const float32x4_t *PMtx;
+
+#define glw_pmtx_mul_prepare(dst, src) dst = &(src)[0]
+
+static inline float32x4_t
+glw_neon_mul_vec3(const float32x4_t *m, float32x4_t v)
+{
+  float32x2_t lo = vget_low_f32(v);
+  float32x4_t r = vmlaq_lane_f32(m[3], m[0], lo, 0);
+  r = vmlaq_lane_f32(r, m[1], lo, 1);
+  return vmlaq_lane_f32(r, m[2], vget_high_f32(v), 0);
+}
+
+static inline float32x4_t
+glw_neon_mul_vec4(const float32x4_t *m, float32x4_t v)
+{
+  float32x2_t lo = vget_low_f32(v);
+  float32x2_t hi = vget_high_f32(v);
+  float32x4_t r = vmulq_lane_f32(m[0], lo, 0);
+  r = vmlaq_lane_f32(r, m[1], lo, 1);
+  r = vmlaq_lane_f32(r, m[2], hi, 0);
+  return vmlaq_lane_f32(r, m[3], hi, 1);
+}
+
+#define glw_pmtx_mul_vec4(dst, pmt, v) (dst) = glw_neon_mul_vec4(pmt, v)
+
+#define glw_pmtx_mul_vec4_i glw_pmtx_mul_vec4
+
+#define glw_pmtx_mul_vec3(dst, pmt, v) (dst) = glw_neon_mul_vec3(pmt, v)
+
+
+#define glw_vec3_make(x,y,z) ((float32x4_t){x, y, z, 0})
+#define glw_vec4_make(x,y,z,w) ((float32x4_t){x, y, z, w})
+#define glw_vec4_make1(w) ((float32x4_t){w, 0, 0, 0})
+
+#define glw_vec3_copy(dst, src) (dst) = (src)
+#define glw_vec4_copy(dst, src) (dst) = (src)
+
+#define glw_vec3_addmul(dst, a, b, s) do { \
+    dst = vmlaq_n_f32((a), (b), (s)); } while(0)
+
+#define glw_vec3_sub(dst, a, b) do { \
+    dst = vsubq_f32((a), (b)); } while(0)
+
+
+static inline float32x4_t
+glw_neon_cross(float32x4_t a, float32x4_t b)
+{
+  float ax = vgetq_lane_f32(a, 0), ay = vgetq_lane_f32(a, 1);
+  float az = vgetq_lane_f32(a, 2);
+  float bx = vgetq_lane_f32(b, 0), by = vgetq_lane_f32(b, 1);
+  float bz = vgetq_lane_f32(b, 2);
+
+  return (float32x4_t){ay * bz - az * by,
+		       az * bx - ax * bz,
+		       ax * by - ay * bx, 0};
+}
+
+#define glw_vec3_cross(dst, a, b) (dst) = glw_neon_cross(a, b)
+
+#define glw_vec3_extract(a, pos) vgetq_lane_f32(a, pos)
+
+#define glw_vec4_extract(a, pos) vgetq_lane_f32(a, pos)
+
+
+/**
+ * Sum of all four lanes of a * b
+ */
+static inline float
+glw_neon_dot4(float32x4_t a, float32x4_t b)
+{
+  float32x4_t n = vmulq_f32(a, b);
+  float32x2_t s = vadd_f32(vget_low_f32(n), vget_high_f32(n));
+  return vget_lane_f32(vpadd_f32(s, s), 0);
+}
+
+static inline float glw_vec3_dot(const Vec3 a, const Vec3 b)
+{
+  return glw_neon_dot4(vsetq_lane_f32(0, a, 3), b);
+}
+
+static inline float glw_vec34_dot(const Vec3 a, const Vec4 b)
+{
+  return glw_neon_dot4(vsetq_lane_f32(1, a, 3), b);
+}
+
+static inline void
+glw_mtx_copy(Mtx dst, const Mtx src)
+{
+  dst[0] = src[0];
+  dst[1] = src[1];
+  dst[2] = src[2];
+  dst[3] = src[3];
+}
+
+extern int glw_mtx_invert(Mtx dst, const Mtx src);
+
+#define glw_vec4_mul_c3(a, v) do { \
+    a = vsetq_lane_f32(vgetq_lane_f32(a, 3) * (v), a, 3);	\
+  } while(0)
+
+
+const static inline float *
+glw_mtx_get(const Mtx src)
+{
+  return (const float *)&src[0];
+}
+
+static inline Vec4 glw_vec4_get(const float *p)
+{
+  return vld1q_f32(p);
+}
+
+#define glw_vec4_lerp(dst, s, a, b) do { \
+    dst = vmlaq_n_f32((a), vsubq_f32(b, a), (s)); } \
+  while(0)
+
+
+/**
+ * Dot product of each column of mt with v
+ */
+static inline float32x4_t
+glw_neon_trans_mul_vec4(const float32x4_t *mt, float32x4_t v)
+{
+  float32x4_t a0 = vmulq_f32(mt[0], v);
+  float32x4_t a1 = vmulq_f32(mt[1], v);
+  float32x4_t a2 = vmulq_f32(mt[2], v);
+  float32x4_t a3 = vmulq_f32(mt[3], v);
+  float32x2_t s0 = vadd_f32(vget_low_f32(a0), vget_high_f32(a0));
+  float32x2_t s1 = vadd_f32(vget_low_f32(a1), vget_high_f32(a1));
+  float32x2_t s2 = vadd_f32(vget_low_f32(a2), vget_high_f32(a2));
+  float32x2_t s3 = vadd_f32(vget_low_f32(a3), vget_high_f32(a3));
+  return vcombine_f32(vpadd_f32(s0, s1), vpadd_f32(s2, s3));
+}
+
+#define glw_mtx_trans_mul_vec4(dst, mt, v) \
+  (dst) = glw_neon_trans_mul_vec4(mt, v)
+
+
+#define glw_vec4_set(v, i, s) (v) = vsetq_lane_f32(s, v, i)
@@ -1,5 +1,5 @@
 /*
- *  GLW Math
+ *  GLW Math, shared by the SSE and NEON code
  *  Copyright (C) 2008 Andreas Öman
  *
  *  This program is free software: you can redistribute it and/or modify
@@ -127,8 +127,8 @@ glw_Rotatef(glw_rctx_t *rc, float a, float x, float y, float z)
 void
 glw_LoadIdentity(glw_rctx_t *rc)
 {
-  rc->rc_mtx[0]  = (__m128){1, 0, 0, 0};
-  rc->rc_mtx[1]  = (__m128){0, 1, 0, 0};
-  rc->rc_mtx[2]  = (__m128){0, 0, 1, 0};
-  rc->rc_mtx[3]  = (__m128){0, 0, 0, 1};
+  rc->rc_mtx[0]  = glw_vec4_make(1, 0, 0, 0);
+  rc->rc_mtx[1]  = glw_vec4_make(0, 1, 0, 0);
+  rc->rc_mtx[2]  = glw_vec4_make(0, 0, 1, 0);
+  rc->rc_mtx[3]  = glw_vec4_make(0, 0, 0, 1);
 }
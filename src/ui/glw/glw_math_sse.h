@@ -1,15 +1,18 @@
+/**
+ * Only standard intrinsics are used so this builds with both gcc and
+ * clang. Vectors are kept in lane order x, y, z, w and matrices are
+ * stored as four columns, same as the scalar code.
+ */
+
+#define glw_sse_splat(v, i) _mm_shuffle_ps(v, v, _MM_SHUFFLE(i, i, i, i))
+
+
 static inline void
 glw_Translatef(glw_rctx_t *rc, float x, float y, float z)
 {
-  __m128 vec = (__m128){x, y, z, 0};
-
-  __m128 X =  _mm_shuffle_ps(vec, vec, _MM_SHUFFLE(3,0,0,0));
-  __m128 Y =  _mm_shuffle_ps(vec, vec, _MM_SHUFFLE(3,1,1,1));
-  __m128 Z =  _mm_shuffle_ps(vec, vec, _MM_SHUFFLE(3,2,2,2));
-
-  __m128 a = _mm_mul_ps(rc->rc_mtx[0], X);
-  __m128 b = _mm_mul_ps(rc->rc_mtx[1], Y);
-  __m128 c = _mm_mul_ps(rc->rc_mtx[2], Z);
+  __m128 a = _mm_mul_ps(rc->rc_mtx[0], _mm_set1_ps(x));
+  __m128 b = _mm_mul_ps(rc->rc_mtx[1], _mm_set1_ps(y));
+  __m128 c = _mm_mul_ps(rc->rc_mtx[2], _mm_set1_ps(z));
   
   rc->rc_mtx[3] = _mm_add_ps(_mm_add_ps(a, b), _mm_add_ps(c, rc->rc_mtx[3]));
 }
@@ -19,14 +22,9 @@ glw_Translatef(glw_rctx_t *rc, float x, float y, float z)
 static inline void
 glw_Scalef(glw_rctx_t *rc, float x, float y, float z)
 {
-  __m128 vec = (__m128){x, y, z, 0};
-
-  __m128 X =  _mm_shuffle_ps(vec, vec, _MM_SHUFFLE(3,0,0,0));
-  __m128 Y =  _mm_shuffle_ps(vec, vec, _MM_SHUFFLE(3,1,1,1));
-  __m128 Z =  _mm_shuffle_ps(vec, vec, _MM_SHUFFLE(3,2,2,2));
-  rc->rc_mtx[0] = _mm_mul_ps(rc->rc_mtx[0], X);
-  rc->rc_mtx[1] = _mm_mul_ps(rc->rc_mtx[1], Y);
-  rc->rc_mtx[2] = _mm_mul_ps(rc->rc_mtx[2], Z);
+  rc->rc_mtx[0] = _mm_mul_ps(rc->rc_mtx[0], _mm_set1_ps(x));
+  rc->rc_mtx[1] = _mm_mul_ps(rc->rc_mtx[1], _mm_set1_ps(y));
+  rc->rc_mtx[2] = _mm_mul_ps(rc->rc_mtx[2], _mm_set1_ps(z));
 }
 
 void glw_Rotatef(glw_rctx_t *rc, float a, float x, float y, float z);
@@ -57,44 +55,38 @@ glw_vec4_store(float *p, const Vec4 v)
 }
 
 
-typedef Mtx PMtx;
-
-#define glw_pmtx_mul_prepare(dst, src) do {				\
-    __v4sf __r0 = (src)[0], __r1 = (src)[1], __r2 = (src)[2], __r3 = (src)[3]; \
-    __v4sf __t0 = __builtin_ia32_unpcklps (__r0, __r1);			\
-    __v4sf __t1 = __builtin_ia32_unpcklps (__r2, __r3);			\
-    __v4sf __t2 = __builtin_ia32_unpckhps (__r0, __r1);			\
-    __v4sf __t3 = __builtin_ia32_unpckhps (__r2, __r3);			\
-    (dst)[0] = __builtin_ia32_movlhps (__t0, __t1);			\
-    (dst)[1] = __builtin_ia32_movhlps (__t1, __t0);			\
-    (dst)[2] = __builtin_ia32_movlhps (__t2, __t3);			\
-    (dst)[3] = __builtin_ia32_movhlps (__t3, __t2);			\
-  } while (0)
-
-
-#define glw_pmtx_mul_vec4(dst, pmt, v) do {	\
-    __v4sf a0 = _mm_mul_ps(pmt[0], v);		\
-    __v4sf a1 = _mm_mul_ps(pmt[1], v);		\
-    __v4sf a2 = _mm_mul_ps(pmt[2], v);		\
-    __v4sf a3 = _mm_mul_ps(pmt[3], v);		\
-    _MM_TRANSPOSE4_PS(a0, a1, a2, a3);			    \
-    dst = _mm_add_ps(_mm_add_ps(a0, a1), _mm_add_ps(a2, a3));	\
-  } while(0)
+/**
+ * The columns are scaled by the vector components and summed, so the
+ * matrix can be used as is
+ */
+typedef const __m128 *PMtx;
+
+#define glw_pmtx_mul_prepare(dst, src) dst = &(src)[0]
+
+static inline __m128
+glw_sse_mul_vec3(const __m128 *m, __m128 v)
+{
+  __m128 a = _mm_mul_ps(m[0], glw_sse_splat(v, 0));
+  __m128 b = _mm_mul_ps(m[1], glw_sse_splat(v, 1));
+  __m128 c = _mm_mul_ps(m[2], glw_sse_splat(v, 2));
+  return _mm_add_ps(_mm_add_ps(a, b), _mm_add_ps(c, m[3]));
+}
+
+static inline __m128
+glw_sse_mul_vec4(const __m128 *m, __m128 v)
+{
+  __m128 a = _mm_mul_ps(m[0], glw_sse_splat(v, 0));
+  __m128 b = _mm_mul_ps(m[1], glw_sse_splat(v, 1));
+  __m128 c = _mm_mul_ps(m[2], glw_sse_splat(v, 2));
+  __m128 d = _mm_mul_ps(m[3], glw_sse_splat(v, 3));
+  return _mm_add_ps(_mm_add_ps(a, b), _mm_add_ps(c, d));
+}
+
+#define glw_pmtx_mul_vec4(dst, pmt, v) (dst) = glw_sse_mul_vec4(pmt, v)
 
 #define glw_pmtx_mul_vec4_i glw_pmtx_mul_vec4
 
-#define glw_pmtx_mul_vec3(dst, pmt, V) do {			\
-    __v4sf v = _mm_set_ps(1,					\
-			  __builtin_ia32_vec_ext_v4sf(V, 2),	\
-			  __builtin_ia32_vec_ext_v4sf(V, 1),	\
-			  __builtin_ia32_vec_ext_v4sf(V, 0));	\
-    __v4sf a0 = _mm_mul_ps(pmt[0], v);				\
-    __v4sf a1 = _mm_mul_ps(pmt[1], v);				\
-    __v4sf a2 = _mm_mul_ps(pmt[2], v);				\
-    __v4sf a3 = _mm_mul_ps(pmt[3], v);				\
-    _MM_TRANSPOSE4_PS(a0, a1, a2, a3);				\
-    dst = _mm_add_ps(_mm_add_ps(a0, a1), _mm_add_ps(a2, a3));	\
-  } while(0)
+#define glw_pmtx_mul_vec3(dst, pmt, v) (dst) = glw_sse_mul_vec3(pmt, v)
 
 
 #define glw_vec3_make(x,y,z) _mm_set_ps(0, z, y, x)
@@ -110,33 +102,40 @@ typedef Mtx PMtx;
 #define glw_vec3_sub(dst, a, b) do { \
     dst = _mm_sub_ps((a), (b)); } while(0)
 
-#define glw_vec3_cross(dst, A, B) do {		\
-    const float *a = (const float *)&A;		\
-    const float *b = (const float *)&B;		\
-    dst = (__m128){				\
-      (a[1] * b[2]) - (a[2] * b[1]),		\
-      (a[2] * b[0]) - (a[0] * b[2]),		\
-      (a[0] * b[1]) - (a[1] * b[0]), 0};	\
-  } while(0)
+static inline __m128
+glw_sse_cross(__m128 a, __m128 b)
+{
+  __m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+  __m128 b_zxy = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 1, 0, 2));
+  __m128 a_zxy = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 1, 0, 2));
+  __m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+  return _mm_sub_ps(_mm_mul_ps(a_yzx, b_zxy), _mm_mul_ps(a_zxy, b_yzx));
+}
+
+#define glw_vec3_cross(dst, a, b) (dst) = glw_sse_cross(a, b)
+
+#define glw_vec3_extract(a, pos) _mm_cvtss_f32(glw_sse_splat(a, pos))
+
+#define glw_vec4_extract(a, pos) _mm_cvtss_f32(glw_sse_splat(a, pos))
 
 
 static inline float glw_vec3_dot(const Vec3 a, const Vec3 b)
 {
-  __v4sf n = _mm_mul_ps(a,b);
+  __m128 n = _mm_mul_ps(a,b);
   return 
-    __builtin_ia32_vec_ext_v4sf(n, 0) + 
-    __builtin_ia32_vec_ext_v4sf(n, 1) + 
-    __builtin_ia32_vec_ext_v4sf(n, 2);
+    glw_vec4_extract(n, 0) +
+    glw_vec4_extract(n, 1) +
+    glw_vec4_extract(n, 2);
 }
 
 static inline float glw_vec34_dot(const Vec3 a, const Vec4 b)
 {
-  __v4sf n = _mm_mul_ps(a,b);
+  __m128 n = _mm_mul_ps(a,b);
   return 
-    __builtin_ia32_vec_ext_v4sf(n, 0) + 
-    __builtin_ia32_vec_ext_v4sf(n, 1) + 
-    __builtin_ia32_vec_ext_v4sf(n, 2) + 
-    __builtin_ia32_vec_ext_v4sf(b, 3);
+    glw_vec4_extract(n, 0) +
+    glw_vec4_extract(n, 1) +
+    glw_vec4_extract(n, 2) +
+    glw_vec4_extract(b, 3);
 }
 
 static inline void
@@ -150,10 +149,6 @@ glw_mtx_copy(Mtx dst, const Mtx src)
 
 extern int glw_mtx_invert(Mtx dst, const Mtx src);
 
-#define glw_vec3_extract(a, pos) __builtin_ia32_vec_ext_v4sf(a, pos)
-
-#define glw_vec4_extract(a, pos) __builtin_ia32_vec_ext_v4sf(a, pos)
-
 #define glw_vec4_mul_c3(a, v) do { \
     a = _mm_mul_ps(a, _mm_set_ps(v, 1, 1, 1));	\
   } while(0)
@@ -165,7 +160,7 @@ glw_mtx_get(const Mtx src)
   return (const float *)&src[0];
 }
 
-static inline Vec2 glw_vec4_get(const float *p)
+static inline Vec4 glw_vec4_get(const float *p)
 {
   return _mm_loadu_ps(p);
 }
@@ -176,10 +171,10 @@ static inline Vec2 glw_vec4_get(const float *p)
 
 
 #define glw_mtx_trans_mul_vec4(dst, mt, v) do { \
-  __v4sf a0 = _mm_mul_ps(mt[0], v); \
-  __v4sf a1 = _mm_mul_ps(mt[1], v); \
-  __v4sf a2 = _mm_mul_ps(mt[2], v); \
-  __v4sf a3 = _mm_mul_ps(mt[3], v); \
+  __m128 a0 = _mm_mul_ps(mt[0], v); \
+  __m128 a1 = _mm_mul_ps(mt[1], v); \
+  __m128 a2 = _mm_mul_ps(mt[2], v); \
+  __m128 a3 = _mm_mul_ps(mt[3], v); \
   _MM_TRANSPOSE4_PS(a0, a1, a2, a3); \
   dst = _mm_add_ps(_mm_add_ps(a0, a1), _mm_add_ps(a2, a3)); \
   } while(0)
@@ -205,7 +200,7 @@ static inline Vec2 glw_vec4_get(const float *p)
 
 
 #define glw_vec4_set(v, i, s) do {			\
-	__v4sf tmp = _mm_set_ss(s);			\
+	__m128 tmp = _mm_set_ss(s);			\
 	switch(i) {					\
 	case 0:						       \
 	    v = _mm_move_ss(v, tmp);			       \
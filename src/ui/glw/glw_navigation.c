@@ -128,6 +128,19 @@ compute_position(glw_t *w, glw_orientation_t o, float n)
 }
 
 
+/**
+ * Widgets not yet instantiated by the cloner have no focusable childs,
+ * so ask for them to be created before we look at them
+ */
+static glw_t *
+nav_instantiate(glw_t *w)
+{
+  if(w != NULL && w->glw_flags & GLW_PLACEHOLDER)
+    glw_signal0(w, GLW_SIGNAL_INSTANTIATE, NULL);
+  return w;
+}
+
+
 /**
  *
  */
@@ -438,10 +451,10 @@ glw_navigate(glw_t *w, event_t *e, int local)
 
 	      while(pagecnt--) {
 		c = d;
-		d = glw_prev_widget(c);
+		d = nav_instantiate(glw_prev_widget(c));
 
 		while(d != NULL && !glw_is_child_focusable(d))
-		  d = glw_prev_widget(d);
+		  d = nav_instantiate(glw_prev_widget(d));
 
 		if(d == NULL) {
 		  loop = 0;
@@ -454,11 +467,11 @@ glw_navigate(glw_t *w, event_t *e, int local)
 
 	  } else if(pagemode == 2) {
 	    
-	    c = glw_first_widget(p);
+	    c = nav_instantiate(glw_first_widget(p));
 
 	    
 	    while(c != NULL && !glw_is_child_focusable(c))
-	      c = glw_next_widget(c);
+	      c = nav_instantiate(glw_next_widget(c));
 
 	    loop = 0;
 
@@ -470,6 +483,7 @@ glw_navigate(glw_t *w, event_t *e, int local)
 
 	if(c == NULL)
 	  break;
+	nav_instantiate(c);
 	find_candidate(c, &query, escape_score);
 	if(query.best)
 	  break;
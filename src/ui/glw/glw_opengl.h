@@ -82,6 +82,12 @@ struct glw_program {
 
   GLint  gp_uniform_t[6];
 
+  // Clip planes and faders (only in programs compiled with CLIP)
+  GLint  gp_uniform_clip;
+  GLint  gp_uniform_fader;
+  GLint  gp_uniform_fader_ab;
+
+  struct glw_program *gp_clipped; // Same program compiled with CLIP
 };
 
 
@@ -137,8 +143,22 @@ typedef struct glw_backend_root {
   int gbr_vertex_buffer_capacity;
   int gbr_vertex_offset;
 
+  struct render_batch *gbr_render_batches;
+  int gbr_render_batches_capacity;
+
+  float *gbr_batch_vertices;  // Vertices reordered per batch
+  int gbr_batch_vertices_capacity;
+
   GLuint gbr_vbo;
 
+  int gbr_use_pbo;     // Upload textures via a pixel buffer object
+  GLuint gbr_tex_pbo;
+
+  // Statistics from last frame
+  int gbr_stat_jobs;
+  int gbr_stat_drawcalls;
+  int gbr_stat_state_changes;
+
 } glw_backend_root_t;
 
 
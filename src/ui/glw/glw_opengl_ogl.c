@@ -263,6 +263,8 @@ glw_opengl_init_context(glw_root_t *gr)
 
   glEnable(gbr->gbr_primary_texture_mode);
 
+  gbr->gbr_use_pbo = check_gl_ext(s, "GL_ARB_pixel_buffer_object");
+
   glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &tu);
   if(tu < 6) {
     TRACE(TRACE_ERROR, "GLW", 
@@ -18,6 +18,7 @@
 
 #include <string.h>
 #include <limits.h>
+#include <float.h>
 
 #include "glw.h"
 #include "glw_renderer.h"
@@ -29,8 +30,28 @@
 // #define DEBUG_SHADERS
 
 /**
+ * In delayed mode every gr_render() call is recorded as a render job.
  *
+ * Jobs using the builtin programs have their geometry transformed to
+ * eye space and their color and blur folded into the vertex attributes
+ * when they are recorded. What is left as GL state is the textures,
+ * the program, the blend mode and the color offset, so jobs sharing
+ * those can be drawn with a single glDrawArrays().
+ *
+ * Before drawing, render_unlocked() groups the jobs into batches. A job
+ * is appended to an earlier batch with the same state if it does not
+ * overlap (on screen) any of the batches it would be moved in front of.
+ * Otherwise drawing order is kept as is.
+ *
+ * Jobs that are clipped or faded in the shader (GLW_RENDER_CLIP_PLANES)
+ * carry their planes and only batch with jobs using the same planes.
+ * Faders modify color and blur per vertex so those are not folded.
  */
+
+#define BATCH_LOOKBACK 16  // Number of batches to search for a match
+
+#define PROJECTION_XY 2.414213f // Must match the projection in v1.glsl
+
 typedef struct render_job {
   Mtx m;
   const struct glw_backend_texture *t0;
@@ -40,8 +61,13 @@ typedef struct render_job {
   struct glw_rgb rgb_off;
   float alpha;
   float blur;
+  float bbox[4];  // Screen space (x1, y1, x2, y2), normalized coordinates
+  float clip[NUM_CLIPPLANES * 4];
+  float fader[NUM_FADERS * 4];
+  float fader_ab[NUM_FADERS * 2];
   int vertex_offset;
-  int16_t num_vertices;
+  int num_vertices;
+  int next;       // Next job in the same batch
   int16_t width;
   int16_t height;
   char blendmode;
@@ -51,6 +77,18 @@ typedef struct render_job {
 } render_job_t;
 
 
+/**
+ *
+ */
+typedef struct render_batch {
+  int first;
+  int last;
+  int vertex_offset;
+  int num_vertices;
+  float bbox[4];
+} render_batch_t;
+
+
 /**
  *
  */
@@ -61,6 +99,95 @@ prepare_delayed(glw_root_t *gr)
 
   gbr->gbr_num_render_jobs = 0;
   gbr->gbr_vertex_offset = 0;
+
+  if((gr->gr_frames & 0x7f) == 0) {
+    prop_t *p = prop_create(gr->gr_prop_ui, "renderstats");
+    prop_set(p, "jobs",         PROP_SET_INT, gbr->gbr_stat_jobs);
+    prop_set(p, "drawcalls",    PROP_SET_INT, gbr->gbr_stat_drawcalls);
+    prop_set(p, "statechanges", PROP_SET_INT, gbr->gbr_stat_state_changes);
+  }
+}
+
+
+/**
+ *
+ */
+static glw_program_t *
+select_program(const glw_backend_root_t *gbr,
+	       const struct glw_backend_texture *t0,
+	       const struct glw_backend_texture *t1,
+	       float blur, int flags,
+	       glw_program_t *up)
+{
+  glw_program_t *gp;
+
+  if(up != NULL)
+    return up;
+
+  if(t0 == NULL) {
+    gp = t1 != NULL ? gbr->gbr_renderer_flat_stencil :
+      gbr->gbr_renderer_flat;
+  } else {
+    const int doblur = blur > 0.05 || flags & GLW_RENDER_BLUR_ATTRIBUTE;
+
+    if(t1 != NULL)
+      gp = doblur ? gbr->gbr_renderer_tex_stencil_blur :
+	gbr->gbr_renderer_tex_stencil;
+    else
+      gp = doblur ? gbr->gbr_renderer_tex_blur : gbr->gbr_renderer_tex;
+  }
+
+  if(gp != NULL && flags & GLW_RENDER_CLIP_PLANES)
+    gp = gp->gp_clipped;
+  return gp;
+}
+
+
+/**
+ * Collect eye space planes for GLW_RENDER_CLIP_PLANES. Unused clip
+ * planes are set to let everything through
+ */
+static void
+get_clip_planes(const glw_root_t *gr, float *clip, float *fader,
+		float *fader_ab)
+{
+  int i;
+
+  for(i = 0; i < NUM_CLIPPLANES; i++) {
+    if(gr->gr_render_clippers & (1 << i)) {
+      glw_vec4_store(clip + i * 4, gr->gr_clip[i]);
+    } else {
+      clip[i * 4 + 0] = 0;
+      clip[i * 4 + 1] = 0;
+      clip[i * 4 + 2] = 0;
+      clip[i * 4 + 3] = 1;
+    }
+  }
+
+  for(i = 0; i < NUM_FADERS; i++) {
+    if(gr->gr_render_faders & (1 << i)) {
+      glw_vec4_store(fader + i * 4, gr->gr_fader[i]);
+      fader_ab[i * 2 + 0] = gr->gr_fader_alpha[i];
+      fader_ab[i * 2 + 1] = gr->gr_fader_blur[i];
+    } else {
+      memset(fader + i * 4, 0, 4 * sizeof(float));
+      fader_ab[i * 2 + 0] = 0;
+      fader_ab[i * 2 + 1] = 0;
+    }
+  }
+}
+
+
+/**
+ *
+ */
+static void
+set_clip_uniforms(const glw_program_t *gp, const float *clip,
+		  const float *fader, const float *fader_ab)
+{
+  glUniform4fv(gp->gp_uniform_clip, NUM_CLIPPLANES, clip);
+  glUniform4fv(gp->gp_uniform_fader, NUM_FADERS, fader);
+  glUniform2fv(gp->gp_uniform_fader_ab, NUM_FADERS, fader_ab);
 }
 
 
@@ -74,47 +201,153 @@ get_program(const glw_backend_root_t *gbr,
 	    float blur, int flags,
 	    glw_program_t *up)
 {
-  glw_program_t *gp;
+  glw_program_t *gp = select_program(gbr, t0, t1, blur, flags, up);
 
   if(up != NULL) {
     if(t0 != NULL)
       glBindTexture(gbr->gbr_primary_texture_mode, t0->tex);
-    return up;
+    return gp;
   }
 
   if(t0 == NULL) {
-
-    if(t1 != NULL) {
-      gp = gbr->gbr_renderer_flat_stencil;
+    if(t1 != NULL)
       glBindTexture(gbr->gbr_primary_texture_mode, t1->tex);
+    return gp;
+  }
 
-    } else {
-      gp = gbr->gbr_renderer_flat;
-    }
-    
+  if(t1 != NULL) {
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(gbr->gbr_primary_texture_mode, t1->tex);
+    glActiveTexture(GL_TEXTURE0);
+  }
 
-  } else {
+  glBindTexture(gbr->gbr_primary_texture_mode, t0->tex);
+  return gp;
+}
 
-    const int doblur = blur > 0.05 || flags & GLW_RENDER_BLUR_ATTRIBUTE;
 
-    if(t1 != NULL) {
+/**
+ * Returns true if the jobs can be drawn with a single draw call
+ */
+static int
+job_can_batch(const render_job_t *a, const render_job_t *b)
+{
+  return a->up == NULL && b->up == NULL &&
+    a->t0 == b->t0 && a->t1 == b->t1 &&
+    a->flags == b->flags &&
+    a->blendmode == b->blendmode &&
+    a->frontface == b->frontface &&
+    a->rgb_off.r == b->rgb_off.r &&
+    a->rgb_off.g == b->rgb_off.g &&
+    a->rgb_off.b == b->rgb_off.b &&
+    a->rgb_mul.r == b->rgb_mul.r &&
+    a->rgb_mul.g == b->rgb_mul.g &&
+    a->rgb_mul.b == b->rgb_mul.b &&
+    a->alpha == b->alpha &&
+    a->blur == b->blur &&
+    (!(a->flags & GLW_RENDER_CLIP_PLANES) ||
+     (!memcmp(a->clip, b->clip, sizeof(a->clip)) &&
+      !memcmp(a->fader, b->fader, sizeof(a->fader)) &&
+      !memcmp(a->fader_ab, b->fader_ab, sizeof(a->fader_ab))));
+}
 
-      gp = doblur ? gbr->gbr_renderer_tex_stencil_blur :
-	gbr->gbr_renderer_tex_stencil;
 
-      glActiveTexture(GL_TEXTURE1);
-      glBindTexture(gbr->gbr_primary_texture_mode, t1->tex);
-      glActiveTexture(GL_TEXTURE0);
+/**
+ *
+ */
+static int
+bbox_overlap(const float *a, const float *b)
+{
+  return a[0] <= b[2] && b[0] <= a[2] && a[1] <= b[3] && b[1] <= a[3];
+}
 
+
+/**
+ * Group render jobs into batches, returns number of batches
+ */
+static int
+build_batches(glw_backend_root_t *gbr)
+{
+  render_job_t *jobs = gbr->gbr_render_jobs;
+  render_batch_t *rb;
+  int i, j, nb = 0;
+
+  if(gbr->gbr_num_render_jobs > gbr->gbr_render_batches_capacity) {
+    gbr->gbr_render_batches_capacity = gbr->gbr_render_jobs_capacity;
+    gbr->gbr_render_batches = realloc(gbr->gbr_render_batches,
+				      sizeof(render_batch_t) *
+				      gbr->gbr_render_batches_capacity);
+  }
+
+  render_batch_t *batches = gbr->gbr_render_batches;
+
+  for(i = 0; i < gbr->gbr_num_render_jobs; i++) {
+    render_job_t *rj = jobs + i;
+    rj->next = -1;
+    rb = NULL;
+
+    if(rj->up == NULL) {
+      for(j = nb - 1; j >= 0 && j >= nb - BATCH_LOOKBACK; j--) {
+	if(job_can_batch(jobs + batches[j].first, rj)) {
+	  rb = batches + j;
+	  break;
+	}
+	if(bbox_overlap(batches[j].bbox, rj->bbox))
+	  break; // Can't move in front of this one
+      }
+    }
+
+    if(rb == NULL) {
+      rb = batches + nb++;
+      rb->first = i;
+      rb->num_vertices = 0;
+      memcpy(rb->bbox, rj->bbox, sizeof(rb->bbox));
     } else {
-      gp = doblur ? gbr->gbr_renderer_tex_blur : gbr->gbr_renderer_tex;
+      jobs[rb->last].next = i;
+      rb->bbox[0] = GLW_MIN(rb->bbox[0], rj->bbox[0]);
+      rb->bbox[1] = GLW_MIN(rb->bbox[1], rj->bbox[1]);
+      rb->bbox[2] = GLW_MAX(rb->bbox[2], rj->bbox[2]);
+      rb->bbox[3] = GLW_MAX(rb->bbox[3], rj->bbox[3]);
     }
+    rb->last = i;
+    rb->num_vertices += rj->num_vertices;
+  }
+  return nb;
+}
+
 
-    glBindTexture(gbr->gbr_primary_texture_mode, t0->tex);
+/**
+ * Copy the vertices of all batches into one buffer, each batch
+ * contiguous
+ */
+static const float *
+pack_batches(glw_backend_root_t *gbr, int nb)
+{
+  const render_job_t *jobs = gbr->gbr_render_jobs;
+  const size_t vsize = sizeof(float) * VERTEX_SIZE;
+  int i, j, offset = 0;
+
+  if(gbr->gbr_vertex_offset > gbr->gbr_batch_vertices_capacity) {
+    gbr->gbr_batch_vertices_capacity = gbr->gbr_vertex_buffer_capacity;
+    gbr->gbr_batch_vertices = realloc(gbr->gbr_batch_vertices,
+				      vsize * gbr->gbr_batch_vertices_capacity);
   }
-  return gp;
+
+  for(i = 0; i < nb; i++) {
+    render_batch_t *rb = gbr->gbr_render_batches + i;
+    rb->vertex_offset = offset;
+
+    for(j = rb->first; j != -1; j = jobs[j].next) {
+      memcpy(gbr->gbr_batch_vertices + offset * VERTEX_SIZE,
+	     gbr->gbr_vertex_buffer + jobs[j].vertex_offset * VERTEX_SIZE,
+	     jobs[j].num_vertices * vsize);
+      offset += jobs[j].num_vertices;
+    }
+  }
+  return gbr->gbr_batch_vertices;
 }
 
+
 /**
  *
  */
@@ -122,18 +355,19 @@ static void
 render_unlocked(glw_root_t *gr)
 {
   glw_backend_root_t *gbr = &gr->gr_be;
+  const render_job_t *jobs = gbr->gbr_render_jobs;
   int i;
-  struct render_job *rj = gbr->gbr_render_jobs;
-
-  int64_t ts = showtime_get_ts();
+  GLuint bound[2] = {-1, -1};
 
   int current_blendmode = GLW_BLEND_NORMAL;
   glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA,
 		      GL_ONE, GL_ONE);
 
-  int program_switches = 0;
+  int drawcalls = 0;
+  int state_changes = 0;
 
-  const float *vertices = gbr->gbr_vertex_buffer;
+  const int nb = build_batches(gbr);
+  const float *vertices = pack_batches(gbr, nb);
 
   glBindBuffer(GL_ARRAY_BUFFER, gbr->gbr_vbo);
   glBufferData(GL_ARRAY_BUFFER,
@@ -150,19 +384,37 @@ render_unlocked(glw_root_t *gr)
   glVertexAttribPointer(2, 4, GL_FLOAT, 0, sizeof(float) * VERTEX_SIZE,
 			vertices + 8);
 
-  for(i = 0; i < gbr->gbr_num_render_jobs; i++, rj++) {
-
+  for(i = 0; i < nb; i++) {
+    const render_batch_t *rb = gbr->gbr_render_batches + i;
+    const render_job_t *rj = jobs + rb->first;
     const struct glw_backend_texture *t0 = rj->t0;
-    glw_program_t *gp = get_program(gbr, t0, rj->t1, rj->blur, rj->flags,
-				    rj->up);
+    const struct glw_backend_texture *t1 = rj->t1;
+    glw_program_t *gp = select_program(gbr, t0, t1, rj->blur, rj->flags,
+				       rj->up);
 
     if(gp == NULL)
       continue;
-    
-    if(glw_load_program(gbr, gp)) {
-      program_switches++;
+
+    // Texture unit 0 gets t0 (or the stencil if there is no t0)
+    const struct glw_backend_texture *u0 = rj->up ? t0 : t0 ?: t1;
+
+    if(u0 != NULL && u0->tex != bound[0]) {
+      glBindTexture(gbr->gbr_primary_texture_mode, u0->tex);
+      bound[0] = u0->tex;
+      state_changes++;
     }
 
+    if(t0 != NULL && t1 != NULL && rj->up == NULL && t1->tex != bound[1]) {
+      glActiveTexture(GL_TEXTURE1);
+      glBindTexture(gbr->gbr_primary_texture_mode, t1->tex);
+      glActiveTexture(GL_TEXTURE0);
+      bound[1] = t1->tex;
+      state_changes++;
+    }
+
+    if(glw_load_program(gbr, gp))
+      state_changes++;
+
     glUniform4f(gp->gp_uniform_color_offset,
 		rj->rgb_off.r, rj->rgb_off.g, rj->rgb_off.b, 0);
     
@@ -179,6 +431,9 @@ render_unlocked(glw_root_t *gr)
       glUniform3f(gp->gp_uniform_blur, rj->blur,
 		  1.5 / t0->width, 1.5 / t0->height);
 
+    if(rj->flags & GLW_RENDER_CLIP_PLANES)
+      set_clip_uniforms(gp, rj->clip, rj->fader, rj->fader_ab);
+
     if(rj->eyespace) {
       glUniformMatrix4fv(gp->gp_uniform_modelview, 1, 0, glw_identitymtx);
     } else {
@@ -187,6 +442,7 @@ render_unlocked(glw_root_t *gr)
 
     if(current_blendmode != rj->blendmode) {
       current_blendmode = rj->blendmode;
+      state_changes++;
       switch(current_blendmode) {
       case GLW_BLEND_NORMAL:
 	glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA,
@@ -200,26 +456,77 @@ render_unlocked(glw_root_t *gr)
       }
     }
       
-    glDrawArrays(GL_TRIANGLES, rj->vertex_offset, rj->num_vertices);
+    glDrawArrays(GL_TRIANGLES, rb->vertex_offset, rb->num_vertices);
+    drawcalls++;
   }
   if(current_blendmode != GLW_BLEND_NORMAL) {
     glBlendFuncSeparate(GL_SRC_COLOR, GL_ONE,
 			GL_ONE, GL_ONE);
   }
-  ts = showtime_get_ts() - ts;
-  static int hold;
-  
-  hold++;
-  if(hold < 20)
-    return;
 
-  static int cnt;
-  static int64_t tssum;
+  gbr->gbr_stat_jobs = gbr->gbr_num_render_jobs;
+  gbr->gbr_stat_drawcalls = drawcalls;
+  gbr->gbr_stat_state_changes = state_changes;
+}
 
-  tssum += ts;
-  cnt++;
 
-  // printf("%16d (%d) %d switches\n", (int)ts, (int)(tssum/cnt), program_switches);
+/**
+ * Copy vertices for a job using a builtin program.
+ *
+ * Positions are transformed to eye space, the color multiplier is
+ * folded into the color attribute and the blur into pos.w so none of
+ * it needs to be set as uniforms when drawing. The fragment shaders
+ * clamp both color factors to [0,1] so premultiplying the clamped
+ * values gives the same result.
+ *
+ * If 'col' is NULL color and blur are copied as is.
+ */
+static void
+copy_vertex_eyespace(float *dst, const float *src, const float *m,
+		     const float *col, float blur, float *bbox)
+{
+  float x, y, z;
+
+  if(m != NULL) {
+    x = m[0] * src[0] + m[4] * src[1] + m[ 8] * src[2] + m[12];
+    y = m[1] * src[0] + m[5] * src[1] + m[ 9] * src[2] + m[13];
+    z = m[2] * src[0] + m[6] * src[1] + m[10] * src[2] + m[14];
+  } else {
+    x = src[0];
+    y = src[1];
+    z = src[2];
+  }
+
+  dst[0] = x;
+  dst[1] = y;
+  dst[2] = z;
+
+  if(col != NULL) {
+    dst[3] = src[3] - blur;
+    dst[4] = GLW_CLAMP(src[4], 0, 1) * col[0];
+    dst[5] = GLW_CLAMP(src[5], 0, 1) * col[1];
+    dst[6] = GLW_CLAMP(src[6], 0, 1) * col[2];
+    dst[7] = GLW_CLAMP(src[7], 0, 1) * col[3];
+  } else {
+    memcpy(dst + 3, src + 3, 5 * sizeof(float));
+  }
+
+  memcpy(dst + 8, src + 8, 4 * sizeof(float));
+
+  if(z > -0.01f) {
+    // At or behind the eye, can't say where it ends up
+    bbox[0] = bbox[1] = -FLT_MAX;
+    bbox[2] = bbox[3] = FLT_MAX;
+    return;
+  }
+
+  x = PROJECTION_XY * x / -z;
+  y = PROJECTION_XY * y / -z;
+
+  bbox[0] = GLW_MIN(bbox[0], x);
+  bbox[1] = GLW_MIN(bbox[1], y);
+  bbox[2] = GLW_MAX(bbox[2], x);
+  bbox[3] = GLW_MAX(bbox[3], y);
 }
 
 
@@ -307,18 +614,70 @@ shader_render_delayed(struct glw_root *root,
 
   float *vdst = gbr->gbr_vertex_buffer + gbr->gbr_vertex_offset * VERTEX_SIZE;
 
-  if(indices != NULL) {
-    int i;
-    for(i = 0; i < num_triangles * 3; i++) {
-      const float *v = &vertices[indices[i] * VERTEX_SIZE];
-      memcpy(vdst, v, VERTEX_SIZE * sizeof(float));
-      vdst += VERTEX_SIZE;
+  if(p != NULL) {
+    // User supplied program, copy as is and never batch
+
+    if(indices != NULL) {
+      int i;
+      for(i = 0; i < num_triangles * 3; i++) {
+	const float *v = &vertices[indices[i] * VERTEX_SIZE];
+	memcpy(vdst, v, VERTEX_SIZE * sizeof(float));
+	vdst += VERTEX_SIZE;
+      }
+    } else {
+      memcpy(vdst, vertices, num_vertices * VERTEX_SIZE * sizeof(float));
     }
+
+    rj->bbox[0] = rj->bbox[1] = -FLT_MAX;
+    rj->bbox[2] = rj->bbox[3] = FLT_MAX;
+    rj->flags = flags;
+
   } else {
-    memcpy(vdst, vertices, num_vertices * VERTEX_SIZE * sizeof(float));
+
+    const float col[4] = {
+      GLW_CLAMP(rj->rgb_mul.r, 0, 1),
+      GLW_CLAMP(rj->rgb_mul.g, 0, 1),
+      GLW_CLAMP(rj->rgb_mul.b, 0, 1),
+      GLW_CLAMP(rj->alpha, 0, 1),
+    };
+    const float *mtx = m != NULL ? glw_mtx_get(m) : NULL;
+    const int fold = !(flags & GLW_RENDER_CLIP_PLANES) ||
+      root->gr_render_faders == 0;
+
+    if(flags & GLW_RENDER_CLIP_PLANES)
+      get_clip_planes(root, rj->clip, rj->fader, rj->fader_ab);
+
+    rj->bbox[0] = rj->bbox[1] = FLT_MAX;
+    rj->bbox[2] = rj->bbox[3] = -FLT_MAX;
+
+    if(indices != NULL) {
+      int i;
+      for(i = 0; i < num_triangles * 3; i++) {
+	copy_vertex_eyespace(vdst, &vertices[indices[i] * VERTEX_SIZE],
+			     mtx, fold ? col : NULL, blur, rj->bbox);
+	vdst += VERTEX_SIZE;
+      }
+    } else {
+      int i;
+      for(i = 0; i < num_vertices; i++) {
+	copy_vertex_eyespace(vdst, &vertices[i * VERTEX_SIZE],
+			     mtx, fold ? col : NULL, blur, rj->bbox);
+	vdst += VERTEX_SIZE;
+      }
+    }
+
+    rj->flags = flags & GLW_RENDER_CLIP_PLANES;
+    if(blur > 0.05 || flags & GLW_RENDER_BLUR_ATTRIBUTE)
+      rj->flags |= GLW_RENDER_BLUR_ATTRIBUTE;
+    rj->eyespace = 1;
+
+    if(fold) {
+      rj->rgb_mul.r = rj->rgb_mul.g = rj->rgb_mul.b = 1;
+      rj->alpha = 1;
+      rj->blur = 0;
+    }
   }
 
-  rj->flags = flags;
   rj->vertex_offset = gbr->gbr_vertex_offset;
   rj->num_vertices = vnum;
   gbr->gbr_vertex_offset += vnum;
@@ -386,6 +745,15 @@ shader_render(struct glw_root *root,
   glUniformMatrix4fv(gp->gp_uniform_modelview, 1, 0,
 		     glw_mtx_get(m) ?: glw_identitymtx);
 
+  if(flags & GLW_RENDER_CLIP_PLANES) {
+    float clip[NUM_CLIPPLANES * 4];
+    float fader[NUM_FADERS * 4];
+    float fader_ab[NUM_FADERS * 2];
+
+    get_clip_planes(root, clip, fader, fader_ab);
+    set_clip_uniforms(gp, clip, fader, fader_ab);
+  }
+
   glVertexAttribPointer(gp->gp_attribute_position,
 			4, GL_FLOAT, 0, sizeof(float) * VERTEX_SIZE,
 			vertices);
@@ -408,10 +776,11 @@ shader_render(struct glw_root *root,
 
 
 /**
- *
+ * 'defines' (if not NULL) is prepended to the shader source
  */
 static GLuint
-glw_compile_shader(const char *path, int type, glw_root_t *gr)
+glw_compile_shader(const char *path, int type, glw_root_t *gr,
+		   const char *defines)
 {
   GLint v, len;
   GLuint s;
@@ -426,9 +795,9 @@ glw_compile_shader(const char *path, int type, glw_root_t *gr)
   }
 
   b = buf_make_writable(b);
-  char *src = buf_str(b);
+  const char *src[2] = {defines ?: "", buf_str(b)};
   s = glCreateShader(type);
-  glShaderSource(s, 1, (const char **)&src, NULL);
+  glShaderSource(s, 2, src, NULL);
 
   glCompileShader(s);
   glGetShaderInfoLog(s, sizeof(log), &len, log);
@@ -499,6 +868,9 @@ glw_link_program(glw_backend_root_t *gbr, const char *title,
   gp->gp_uniform_blur        = glGetUniformLocation(p, "u_blur");
   gp->gp_uniform_time        = glGetUniformLocation(p, "time");
   gp->gp_uniform_resolution  = glGetUniformLocation(p, "resolution");
+  gp->gp_uniform_clip        = glGetUniformLocation(p, "u_clip");
+  gp->gp_uniform_fader       = glGetUniformLocation(p, "u_fader");
+  gp->gp_uniform_fader_ab    = glGetUniformLocation(p, "u_fader_ab");
 
 #ifdef DEBUG_SHADERS
   printf("Loaded %s\n", title);
@@ -590,10 +962,10 @@ glw_make_program(glw_root_t *gr,
 
 
   SHADERPATH("v1.glsl");
-  vs = glw_compile_shader(vertex_shader ?: path, GL_VERTEX_SHADER, gr);
+  vs = glw_compile_shader(vertex_shader ?: path, GL_VERTEX_SHADER, gr, NULL);
   if(vs == 0)
     return NULL;
-  fs = glw_compile_shader(fragment_shader, GL_FRAGMENT_SHADER, gr);
+  fs = glw_compile_shader(fragment_shader, GL_FRAGMENT_SHADER, gr, NULL);
   if(fs == 0) {
     glDeleteShader(vs);
     return NULL;
@@ -633,58 +1005,96 @@ glw_opengl_shaders_init(glw_root_t *gr, int delayed)
   GLuint vs, fs;
 
   SHADERPATH("v1.glsl");
-  vs = glw_compile_shader(path, GL_VERTEX_SHADER, gr);
+  vs = glw_compile_shader(path, GL_VERTEX_SHADER, gr, NULL);
 
   SHADERPATH("f_tex.glsl");
-  fs = glw_compile_shader(path, GL_FRAGMENT_SHADER, gr);
+  fs = glw_compile_shader(path, GL_FRAGMENT_SHADER, gr, NULL);
   gbr->gbr_renderer_tex = glw_link_program(gbr, "Texture", vs, fs);
   glDeleteShader(fs);
 
   SHADERPATH("f_tex_stencil.glsl");
-  fs = glw_compile_shader(path, GL_FRAGMENT_SHADER, gr);
+  fs = glw_compile_shader(path, GL_FRAGMENT_SHADER, gr, NULL);
   gbr->gbr_renderer_tex_stencil = 
     glw_link_program(gbr, "TextureStencil", vs, fs);
   glDeleteShader(fs);
 
   SHADERPATH("f_tex_blur.glsl");
-  fs = glw_compile_shader(path, GL_FRAGMENT_SHADER, gr);
+  fs = glw_compile_shader(path, GL_FRAGMENT_SHADER, gr, NULL);
   gbr->gbr_renderer_tex_blur = glw_link_program(gbr, "TextureBlur", vs, fs);
   glDeleteShader(fs);
 
   SHADERPATH("f_tex_stencil_blur.glsl");
-  fs = glw_compile_shader(path, GL_FRAGMENT_SHADER, gr);
+  fs = glw_compile_shader(path, GL_FRAGMENT_SHADER, gr, NULL);
   gbr->gbr_renderer_tex_stencil_blur =
     glw_link_program(gbr, "TextureStencilBlur", vs, fs);
   glDeleteShader(fs);
 
   SHADERPATH("f_flat.glsl");
-  fs = glw_compile_shader(path, GL_FRAGMENT_SHADER, gr);
+  fs = glw_compile_shader(path, GL_FRAGMENT_SHADER, gr, NULL);
   gbr->gbr_renderer_flat = glw_link_program(gbr, "Flat", vs, fs);
   glDeleteShader(fs);
 
   SHADERPATH("f_flat_stencil.glsl");
-  fs = glw_compile_shader(path, GL_FRAGMENT_SHADER, gr);
+  fs = glw_compile_shader(path, GL_FRAGMENT_SHADER, gr, NULL);
   gbr->gbr_renderer_flat_stencil = glw_link_program(gbr, "FlatStencil", vs, fs);
   glDeleteShader(fs);
 
   glDeleteShader(vs);
 
+  // Variants of the above that clip and fade in the shader
+
+  SHADERPATH("v1.glsl");
+  vs = glw_compile_shader(path, GL_VERTEX_SHADER, gr, "#define CLIP\n");
+
+  const struct {
+    glw_program_t *gp;
+    const char *file;
+  } builtins[] = {
+    { gbr->gbr_renderer_tex,              "f_tex.glsl" },
+    { gbr->gbr_renderer_tex_stencil,      "f_tex_stencil.glsl" },
+    { gbr->gbr_renderer_tex_blur,         "f_tex_blur.glsl" },
+    { gbr->gbr_renderer_tex_stencil_blur, "f_tex_stencil_blur.glsl" },
+    { gbr->gbr_renderer_flat,             "f_flat.glsl" },
+    { gbr->gbr_renderer_flat_stencil,     "f_flat_stencil.glsl" },
+  };
+  int i, clipped = 0;
+
+  for(i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+    glw_program_t *gp = builtins[i].gp;
+    char title[64];
+
+    if(gp == NULL)
+      continue;
+
+    SHADERPATH(builtins[i].file);
+    fs = glw_compile_shader(path, GL_FRAGMENT_SHADER, gr, "#define CLIP\n");
+    snprintf(title, sizeof(title), "%sClip", gp->gp_title);
+    gp->gp_clipped = glw_link_program(gbr, title, vs, fs);
+    glDeleteShader(fs);
+
+    if(gp->gp_clipped != NULL)
+      clipped++;
+  }
+  glDeleteShader(vs);
+
+  gr->gr_shader_clipping = clipped == sizeof(builtins) / sizeof(builtins[0]);
+
   //    gbr->gbr_renderer_draw = glw_renderer_shader;
 
 
   // Video renderer
 
   SHADERPATH("yuv2rgb_v.glsl");
-  vs = glw_compile_shader(path, GL_VERTEX_SHADER, gr);
+  vs = glw_compile_shader(path, GL_VERTEX_SHADER, gr, NULL);
 
 
   SHADERPATH("yuv2rgb_1f_norm.glsl");
-  fs = glw_compile_shader(path, GL_FRAGMENT_SHADER, gr);
+  fs = glw_compile_shader(path, GL_FRAGMENT_SHADER, gr, NULL);
   gbr->gbr_yuv2rgb_1f = glw_link_program(gbr, "yuv2rgb_1f_norm", vs, fs);
   glDeleteShader(fs);
 
   SHADERPATH("yuv2rgb_2f_norm.glsl");
-  fs = glw_compile_shader(path, GL_FRAGMENT_SHADER, gr);
+  fs = glw_compile_shader(path, GL_FRAGMENT_SHADER, gr, NULL);
   gbr->gbr_yuv2rgb_2f = glw_link_program(gbr, "yuv2rgb_2f_norm", vs, fs);
   glDeleteShader(fs);
 
@@ -21,6 +21,9 @@
 
 static const glw_rgb_t white = {.r = 1,.g = 1,.b = 1};
 
+#define GLW_TESS_HASH_SIZE  256 // Must be a power of 2
+#define GLW_TESS_CACHE_SIZE (2 * 1024 * 1024) // Bytes of cached vertices
+
 
 /**
  *
@@ -99,13 +102,42 @@ glw_renderer_init_quad(glw_renderer_t *gr)
 }
 
 
+/**
+ *
+ */
+static void
+glw_renderer_cache_destroy(glw_renderer_cache_t *grc)
+{
+  glw_root_t *root = grc->grc_root;
+
+  LIST_REMOVE(grc, grc_hash_link);
+  LIST_REMOVE(grc, grc_renderer_link);
+  TAILQ_REMOVE(&root->gr_tess_lru, grc, grc_lru_link);
+  root->gr_tess_bytes -= grc->grc_num_vertices * VERTEX_SIZE * sizeof(float);
+  free(grc->grc_vertices);
+  free(grc);
+}
+
+
+/**
+ *
+ */
+static void
+glw_renderer_cache_flush(glw_renderer_t *gr)
+{
+  glw_renderer_cache_t *grc;
+
+  while((grc = LIST_FIRST(&gr->gr_caches)) != NULL)
+    glw_renderer_cache_destroy(grc);
+}
+
+
 /**
  * 
  */
 void
 glw_renderer_free(glw_renderer_t *gr)
 {
-  int i;
   free(gr->gr_vertices);
   gr->gr_vertices = NULL;
 
@@ -113,13 +145,7 @@ glw_renderer_free(glw_renderer_t *gr)
     free(gr->gr_indices);
     gr->gr_indices = NULL;
   }
-  for(i = 0; i < GLW_RENDERER_CACHES; i++) {
-    if(gr->gr_cache[i] != NULL) {
-      free(gr->gr_cache[i]->grc_vertices);
-      free(gr->gr_cache[i]);
-      gr->gr_cache[i] = NULL;
-    }
-  }
+  glw_renderer_cache_flush(gr);
 }
 
 
@@ -245,15 +271,15 @@ fader(glw_root_t *gr, glw_renderer_cache_t *grc,
   glw_vec4_copy(v3, V3);
 
   for(i = 0; i < NUM_FADERS; i++) {
-    if(!(grc->grc_active_faders & (1 << plane)))
+    if(!(grc->grc_key.grk_active_faders & (1 << i)))
       continue;
 
-    const float D1 = glw_vec34_dot(V1, grc->grc_fader[i]);
-    const float D2 = glw_vec34_dot(V2, grc->grc_fader[i]);
-    const float D3 = glw_vec34_dot(V3, grc->grc_fader[i]);
+    const float D1 = glw_vec34_dot(V1, grc->grc_key.grk_fader[i]);
+    const float D2 = glw_vec34_dot(V2, grc->grc_key.grk_fader[i]);
+    const float D3 = glw_vec34_dot(V3, grc->grc_key.grk_fader[i]);
 
-    float br = grc->grc_fader_blur[i];
-    float ar = grc->grc_fader_alpha[i];
+    float br = grc->grc_key.grk_fader_blur[i];
+    float ar = grc->grc_key.grk_fader_alpha[i];
 
 
     if(ar > 0) {
@@ -344,14 +370,14 @@ clipper(glw_root_t *gr, glw_renderer_cache_t *grc,
       fader(gr, grc, V1, V2, V3, C1, C2, C3, T1, T2, T3, 0);
       return;
     }
-    if(grc->grc_active_clippers & (1 << plane))
+    if(grc->grc_key.grk_active_clippers & (1 << plane))
       break;
     plane++;
   }
 
-  const float D1 = glw_vec34_dot(V1, grc->grc_clip[plane]);
-  const float D2 = glw_vec34_dot(V2, grc->grc_clip[plane]);
-  const float D3 = glw_vec34_dot(V3, grc->grc_clip[plane]);
+  const float D1 = glw_vec34_dot(V1, grc->grc_key.grk_clip[plane]);
+  const float D2 = glw_vec34_dot(V2, grc->grc_key.grk_clip[plane]);
+  const float D3 = glw_vec34_dot(V3, grc->grc_key.grk_clip[plane]);
 
   plane++;
 
@@ -467,7 +493,7 @@ stenciler(glw_root_t *gr, glw_renderer_cache_t *grc,
 {
   float D1, D2, D3;
 
-  if(grc->grc_stencil_width == 0 || plane == 4) {
+  if(grc->grc_key.grk_stencil_width == 0 || plane == 4) {
     clipper(gr, grc, V1, V2, V3, C1, C2, C3, t1, t2, t3, 0);
     return;
   }
@@ -481,17 +507,17 @@ stenciler(glw_root_t *gr, glw_renderer_cache_t *grc,
 
 #if 0
   if(plane == 0 && 0) {
-    D1 = glw_vec34_dot(V1, grc->grc_stencil[0]) * 0.5 + 0.5;
-    D2 = glw_vec34_dot(V2, grc->grc_stencil[0]) * 0.5 + 0.5;
-    D3 = glw_vec34_dot(V3, grc->grc_stencil[0]) * 0.5 + 0.5;
+    D1 = glw_vec34_dot(V1, grc->grc_key.grk_stencil[0]) * 0.5 + 0.5;
+    D2 = glw_vec34_dot(V2, grc->grc_key.grk_stencil[0]) * 0.5 + 0.5;
+    D3 = glw_vec34_dot(V3, grc->grc_key.grk_stencil[0]) * 0.5 + 0.5;
 
     glw_vec4_set(T1, 2, D1);
     glw_vec4_set(T2, 2, D2);
     glw_vec4_set(T3, 2, D3);
 
-    D1 = glw_vec34_dot(V1, grc->grc_stencil[1]) * 0.5 + 0.5;
-    D2 = glw_vec34_dot(V2, grc->grc_stencil[1]) * 0.5 + 0.5;
-    D3 = glw_vec34_dot(V3, grc->grc_stencil[1]) * 0.5 + 0.5;
+    D1 = glw_vec34_dot(V1, grc->grc_key.grk_stencil[1]) * 0.5 + 0.5;
+    D2 = glw_vec34_dot(V2, grc->grc_key.grk_stencil[1]) * 0.5 + 0.5;
+    D3 = glw_vec34_dot(V3, grc->grc_key.grk_stencil[1]) * 0.5 + 0.5;
 
     glw_vec4_set(T1, 3, D1);
     glw_vec4_set(T2, 3, D2);
@@ -523,12 +549,12 @@ stenciler(glw_root_t *gr, glw_renderer_cache_t *grc,
   switch(plane) {
   case 0:
     // Left side
-    a = 1 - grc->grc_stencil_edge[0];
-    D1 = glw_vec34_dot(V1, grc->grc_stencil[0]) + a;
-    D2 = glw_vec34_dot(V2, grc->grc_stencil[0]) + a;
-    D3 = glw_vec34_dot(V3, grc->grc_stencil[0]) + a;
+    a = 1 - grc->grc_key.grk_stencil_edge[0];
+    D1 = glw_vec34_dot(V1, grc->grc_key.grk_stencil[0]) + a;
+    D2 = glw_vec34_dot(V2, grc->grc_key.grk_stencil[0]) + a;
+    D3 = glw_vec34_dot(V3, grc->grc_key.grk_stencil[0]) + a;
 
-    a = 0.5 / grc->grc_stencil_edge[0];
+    a = 0.5 / grc->grc_key.grk_stencil_edge[0];
 
     if(D1 < 0)
       glw_vec4_set(To1, 2, 0.5 + D1 * a);
@@ -541,12 +567,12 @@ stenciler(glw_root_t *gr, glw_renderer_cache_t *grc,
 
   case 1:
     // Top
-    a = 1 - grc->grc_stencil_edge[1];
-    D1 = glw_vec34_dot(V1, grc->grc_stencil[1]) + a;
-    D2 = glw_vec34_dot(V2, grc->grc_stencil[1]) + a;
-    D3 = glw_vec34_dot(V3, grc->grc_stencil[1]) + a;
+    a = 1 - grc->grc_key.grk_stencil_edge[1];
+    D1 = glw_vec34_dot(V1, grc->grc_key.grk_stencil[1]) + a;
+    D2 = glw_vec34_dot(V2, grc->grc_key.grk_stencil[1]) + a;
+    D3 = glw_vec34_dot(V3, grc->grc_key.grk_stencil[1]) + a;
 
-    a = 0.5 / grc->grc_stencil_edge[1];
+    a = 0.5 / grc->grc_key.grk_stencil_edge[1];
 
     if(D1 < 0)
       glw_vec4_set(To1, 3, 0.5 + D1 * a);
@@ -559,12 +585,12 @@ stenciler(glw_root_t *gr, glw_renderer_cache_t *grc,
 
   case 2:
     // Right
-    a = 1 - grc->grc_stencil_edge[2];
-    D1 = -glw_vec34_dot(V1, grc->grc_stencil[0]) + a;
-    D2 = -glw_vec34_dot(V2, grc->grc_stencil[0]) + a;
-    D3 = -glw_vec34_dot(V3, grc->grc_stencil[0]) + a;
+    a = 1 - grc->grc_key.grk_stencil_edge[2];
+    D1 = -glw_vec34_dot(V1, grc->grc_key.grk_stencil[0]) + a;
+    D2 = -glw_vec34_dot(V2, grc->grc_key.grk_stencil[0]) + a;
+    D3 = -glw_vec34_dot(V3, grc->grc_key.grk_stencil[0]) + a;
 
-    a = 0.5 / grc->grc_stencil_edge[2];
+    a = 0.5 / grc->grc_key.grk_stencil_edge[2];
 
     if(D1 < 0)
       glw_vec4_set(To1, 2, 0.5 - D1 * a);
@@ -577,12 +603,12 @@ stenciler(glw_root_t *gr, glw_renderer_cache_t *grc,
 
   case 3:
     // Bottom
-    a = 1 - grc->grc_stencil_edge[3];
-    D1 = -glw_vec34_dot(V1, grc->grc_stencil[1]) + a;
-    D2 = -glw_vec34_dot(V2, grc->grc_stencil[1]) + a;
-    D3 = -glw_vec34_dot(V3, grc->grc_stencil[1]) + a;
+    a = 1 - grc->grc_key.grk_stencil_edge[3];
+    D1 = -glw_vec34_dot(V1, grc->grc_key.grk_stencil[1]) + a;
+    D2 = -glw_vec34_dot(V2, grc->grc_key.grk_stencil[1]) + a;
+    D3 = -glw_vec34_dot(V3, grc->grc_key.grk_stencil[1]) + a;
 
-    a = 0.5 / grc->grc_stencil_edge[3];
+    a = 0.5 / grc->grc_key.grk_stencil_edge[3];
 
     if(D1 < 0)
       glw_vec4_set(To1, 3, 0.5 - D1 * a);
@@ -724,65 +750,30 @@ stenciler(glw_root_t *gr, glw_renderer_cache_t *grc,
 
 
 /**
- *
+ * Tessellate the renderer's triangles against the clip planes,
+ * stencil and faders in the cache entry's key. Everything is done in
+ * object space so the result does not depend on the modelview matrix
  */
 static void
 glw_renderer_tesselate(glw_renderer_t *gr, glw_root_t *root,
-		       const glw_rctx_t *rc, glw_renderer_cache_t *grc)
+		       glw_renderer_cache_t *grc)
 {
   int i;
   uint16_t *ip = gr->gr_indices;
   const float *a = gr->gr_vertices;
-  PMtx pmtx;
   
   root->gr_vtmp_cur = 0;
-
-  memcpy(grc->grc_mtx, rc->rc_mtx, sizeof(Mtx));
-
-  grc->grc_active_clippers  = root->gr_active_clippers;
-  grc->grc_active_faders    = root->gr_active_faders;
   grc->grc_blurred = 0;
 
-  for(i = 0; i < NUM_CLIPPLANES; i++)
-    if((1 << i) & root->gr_active_clippers)
-      memcpy(&grc->grc_clip[i], &root->gr_clip[i], sizeof(Vec4));
-
-  grc->grc_stencil_width = root->gr_stencil_width;
-  if(grc->grc_stencil_width) {
-    grc->grc_stencil_height = root->gr_stencil_height;
-
-    for(i = 0; i < 2; i++)
-      memcpy(&grc->grc_stencil[i], &root->gr_stencil[i], sizeof(Vec4));
-
-    for(i = 0; i < 4; i++)
-      grc->grc_stencil_border[i] = root->gr_stencil_border[i];
-
-    for(i = 0; i < 4; i++)
-      grc->grc_stencil_edge[i] = root->gr_stencil_edge[i];
-  }
-
-  for(i = 0; i < NUM_FADERS; i++)
-    if((1 << i) & root->gr_active_faders) {
-      memcpy(&grc->grc_fader[i], &root->gr_fader[i], sizeof(Vec4));
-      grc->grc_fader_alpha[i] = root->gr_fader_alpha[i];
-      grc->grc_fader_blur[i] = root->gr_fader_blur[i];
-    }
-
-  glw_pmtx_mul_prepare(pmtx, rc->rc_mtx);
-
   for(i = 0; i < gr->gr_num_triangles; i++) {
     int v1 = *ip++;
     int v2 = *ip++;
     int v3 = *ip++;
 
-    Vec4 V1, V2, V3;
-
-    glw_pmtx_mul_vec4_i(V1, pmtx, glw_vec4_get(a + v1*VERTEX_SIZE));
-    glw_pmtx_mul_vec4_i(V2, pmtx, glw_vec4_get(a + v2*VERTEX_SIZE));
-    glw_pmtx_mul_vec4_i(V3, pmtx, glw_vec4_get(a + v3*VERTEX_SIZE));
-
     stenciler(root, grc,
-	      V1, V2, V3,
+	      glw_vec4_get(a + v1 * VERTEX_SIZE),
+	      glw_vec4_get(a + v2 * VERTEX_SIZE),
+	      glw_vec4_get(a + v3 * VERTEX_SIZE),
 	      glw_vec4_get(a + v1 * VERTEX_SIZE + 4),
 	      glw_vec4_get(a + v2 * VERTEX_SIZE + 4),
 	      glw_vec4_get(a + v3 * VERTEX_SIZE + 4),
@@ -794,101 +785,133 @@ glw_renderer_tesselate(glw_renderer_t *gr, glw_root_t *root,
 
   int size = root->gr_vtmp_cur * sizeof(float) * VERTEX_SIZE;
 
-  if(root->gr_vtmp_cur != grc->grc_num_vertices) {
-    grc->grc_num_vertices = root->gr_vtmp_cur;
-    grc->grc_vertices = realloc(grc->grc_vertices, size);
-  }
-
+  grc->grc_num_vertices = root->gr_vtmp_cur;
+  grc->grc_vertices = malloc(size);
   if(size)
     memcpy(grc->grc_vertices, root->gr_vtmp_buffer, size);
 }
 
 
 /**
+ * Transform the current clip planes, stencil and faders into the
+ * object space of the renderer. Clip planes that all vertices are
+ * inside of are dropped.
  *
+ * Returns -1 if all vertices are outside of a clip plane
  */
 static int
-glw_renderer_clippers_cmp(glw_renderer_cache_t *grc, glw_root_t *root)
+glw_renderer_make_key(glw_renderer_key_t *k, const glw_renderer_t *gr,
+		      const glw_root_t *root, const glw_rctx_t *rc)
 {
-  int i;
+  int i, j, inside;
+  Vec4 plane;
 
-  if(grc->grc_active_clippers != root->gr_active_clippers)
-    return 1;
+  memset(k, 0, sizeof(glw_renderer_key_t));
 
-  for(i = 0; i < NUM_CLIPPLANES; i++)
-    if((1 << i) & root->gr_active_clippers)
-      if(memcmp(&grc->grc_clip[i], &root->gr_clip[i], sizeof(Vec4)))
-	return 1;
-  return 0;
-}
+  if(root->gr_need_sw_clip) {
+    for(i = 0; i < NUM_CLIPPLANES; i++) {
+      if(!((1 << i) & root->gr_active_clippers))
+	continue;
 
+      glw_mtx_trans_mul_vec4(plane, rc->rc_mtx, root->gr_clip[i]);
 
+      inside = 0;
+      for(j = 0; j < gr->gr_num_vertices; j++)
+	if(glw_vec34_dot(glw_vec4_get(gr->gr_vertices + j * VERTEX_SIZE),
+			 plane) >= 0)
+	  inside++;
 
-/**
- *
- */
-static int
-glw_renderer_stencilers_cmp(glw_renderer_cache_t *grc, glw_root_t *root)
-{
-  int i;
+      if(inside == 0)
+	return -1;
 
-  if(grc->grc_stencil_width  != root->gr_stencil_width ||
-     grc->grc_stencil_height != root->gr_stencil_height)
-    return 1;
+      if(inside < gr->gr_num_vertices) {
+	glw_vec4_copy(k->grk_clip[i], plane);
+	k->grk_active_clippers |= 1 << i;
+      }
+    }
+  }
 
-  for(i = 0; i < 2; i++)
-    if(memcmp(&grc->grc_stencil[i], &root->gr_stencil[i], sizeof(Vec4)))
-      return 1;
+  k->grk_stencil_width = root->gr_stencil_width;
+  if(k->grk_stencil_width) {
+    k->grk_stencil_height = root->gr_stencil_height;
 
-  for(i = 0; i < 4; i++) {
-    if(grc->grc_stencil_border[i] != root->gr_stencil_border[i])
-      return 1;
-    if(grc->grc_stencil_edge[i] != root->gr_stencil_edge[i])
-      return 1;
+    for(i = 0; i < 2; i++)
+      glw_mtx_trans_mul_vec4(k->grk_stencil[i], rc->rc_mtx,
+			     root->gr_stencil[i]);
+
+    for(i = 0; i < 4; i++)
+      k->grk_stencil_edge[i] = root->gr_stencil_edge[i];
   }
+
+  k->grk_active_faders = root->gr_active_faders;
+  for(i = 0; i < NUM_FADERS; i++)
+    if((1 << i) & root->gr_active_faders) {
+      glw_mtx_trans_mul_vec4(k->grk_fader[i], rc->rc_mtx, root->gr_fader[i]);
+      k->grk_fader_alpha[i] = root->gr_fader_alpha[i];
+      k->grk_fader_blur[i] = root->gr_fader_blur[i];
+    }
   return 0;
 }
 
 
 /**
+ * Find or create the tessellation of 'gr' for the given key
  *
+ * Entries are hashed on renderer and key and shared in a LRU, which is
+ * trimmed to GLW_TESS_CACHE_SIZE bytes of vertices
  */
-static int
-glw_renderer_faders_cmp(glw_renderer_cache_t *grc, glw_root_t *root)
+static glw_renderer_cache_t *
+glw_renderer_get_cache(glw_root_t *root, glw_renderer_t *gr,
+		       const glw_renderer_key_t *k)
 {
+  const uint8_t *d = (const uint8_t *)k;
+  glw_renderer_cache_t *grc, *lru;
+  uint32_t h = 2166136261U;
   int i;
 
-  if(grc->grc_active_faders != root->gr_active_faders)
-    return 1;
+  for(i = 0; i < sizeof(glw_renderer_key_t); i++)
+    h = (h ^ d[i]) * 16777619;
+  h ^= (uintptr_t)gr >> 4;
 
-  for(i = 0; i < NUM_FADERS; i++)
-    if((1 << i) & root->gr_active_faders)
-      if(memcmp(&grc->grc_fader[i], &root->gr_fader[i], sizeof(Vec4)) ||
-	 grc->grc_fader_alpha[i] != root->gr_fader_alpha[i] ||
-	 grc->grc_fader_blur[i]  != root->gr_fader_blur[i])
-	return 1;
-  return 0;
-}
+  if(root->gr_tess_hash == NULL) {
+    root->gr_tess_hash = calloc(GLW_TESS_HASH_SIZE,
+				sizeof(struct glw_renderer_cache_list));
+    TAILQ_INIT(&root->gr_tess_lru);
+  }
 
+  struct glw_renderer_cache_list *bucket =
+    &root->gr_tess_hash[h & (GLW_TESS_HASH_SIZE - 1)];
 
-/**
- *
- */
-static glw_renderer_cache_t *
-glw_renderer_get_cache(glw_root_t *root, glw_renderer_t *gr)
-{
-  int idx;
-  if((root->gr_frames & 0xff ) != gr->gr_framecmp) {
-    gr->gr_cacheptr = 0;
-    gr->gr_framecmp = root->gr_frames & 0xff;
-  } else {
-    gr->gr_cacheptr = (gr->gr_cacheptr + 1) & (GLW_RENDERER_CACHES - 1);
+  LIST_FOREACH(grc, bucket, grc_hash_link)
+    if(grc->grc_renderer == gr && grc->grc_hash == h &&
+       !memcmp(&grc->grc_key, k, sizeof(glw_renderer_key_t)))
+      break;
+
+  if(grc != NULL) {
+    TAILQ_REMOVE(&root->gr_tess_lru, grc, grc_lru_link);
+    TAILQ_INSERT_HEAD(&root->gr_tess_lru, grc, grc_lru_link);
+    return grc;
   }
-  idx = gr->gr_cacheptr;
 
-  if(gr->gr_cache[idx] == NULL)
-    gr->gr_cache[idx] = calloc(1, sizeof(glw_renderer_cache_t));
-  return gr->gr_cache[idx];
+  grc = calloc(1, sizeof(glw_renderer_cache_t));
+  grc->grc_root = root;
+  grc->grc_renderer = gr;
+  grc->grc_hash = h;
+  memcpy(&grc->grc_key, k, sizeof(glw_renderer_key_t));
+
+  glw_renderer_tesselate(gr, root, grc);
+
+  LIST_INSERT_HEAD(bucket, grc, grc_hash_link);
+  LIST_INSERT_HEAD(&gr->gr_caches, grc, grc_renderer_link);
+  TAILQ_INSERT_HEAD(&root->gr_tess_lru, grc, grc_lru_link);
+  root->gr_tess_bytes += grc->grc_num_vertices * VERTEX_SIZE * sizeof(float);
+
+  while(root->gr_tess_bytes > GLW_TESS_CACHE_SIZE &&
+	(lru = TAILQ_LAST(&root->gr_tess_lru,
+			  glw_renderer_cache_queue)) != grc)
+    glw_renderer_cache_destroy(lru);
+
+  return grc;
 }
 
 
@@ -904,37 +927,60 @@ glw_renderer_draw(glw_renderer_t *gr, glw_root_t *root,
 		  float alpha, float blur,
 		  glw_program_t *p)
 {
+  glw_renderer_key_t k;
+
   rgb_mul = rgb_mul ?: &white;
 
   int flags = 
     gr->gr_color_attributes ? GLW_RENDER_COLOR_ATTRIBUTES : 0;
 
+  if(gr->gr_dirty) {
+    glw_renderer_cache_flush(gr);
+    gr->gr_dirty = 0;
+  }
+
   if(root->gr_need_sw_clip || root->gr_active_faders ||
      root->gr_stencil_width) {
-    glw_renderer_cache_t *grc = glw_renderer_get_cache(root, gr);
-
-    if(gr->gr_dirty || 
-       memcmp(grc->grc_mtx, rc->rc_mtx, sizeof(Mtx)) ||
-       glw_renderer_clippers_cmp(grc, root) ||
-       glw_renderer_stencilers_cmp(grc, root) ||
-       glw_renderer_faders_cmp(grc, root)) {
-      glw_renderer_tesselate(gr, root, rc, grc);
-    }
 
-    if(grc->grc_blurred)
-      flags |= GLW_RENDER_BLUR_ATTRIBUTE;
+    if(glw_renderer_make_key(&k, gr, root, rc))
+      return; // Entirely clipped
 
-    root->gr_render(root, NULL, tex, root->gr_stencil_texture,
-		    rgb_mul, rgb_off, alpha, blur,
-		    grc->grc_vertices, grc->grc_num_vertices,
-		    NULL, 0, flags, p, rc);
-  } else {
-    root->gr_render(root, rc->rc_mtx, tex, NULL, rgb_mul, rgb_off, alpha, blur,
-		    gr->gr_vertices, gr->gr_num_vertices,
-		    gr->gr_indices,  gr->gr_num_triangles,
-		    flags, p, rc);
+    if(k.grk_stencil_width == 0 && p == NULL && root->gr_shader_clipping) {
+
+      if(k.grk_active_clippers || k.grk_active_faders) {
+	int i;
+	root->gr_render_clippers = k.grk_active_clippers;
+	root->gr_render_faders   = k.grk_active_faders;
+	flags |= GLW_RENDER_CLIP_PLANES;
+
+	for(i = 0; i < NUM_FADERS; i++)
+	  if((1 << i) & k.grk_active_faders && k.grk_fader_blur[i] > 0)
+	    flags |= GLW_RENDER_BLUR_ATTRIBUTE;
+      }
+
+    } else if(k.grk_active_clippers || k.grk_active_faders ||
+	      k.grk_stencil_width) {
+
+      glw_renderer_cache_t *grc = glw_renderer_get_cache(root, gr, &k);
+
+      if(grc->grc_num_vertices == 0)
+	return;
+
+      if(grc->grc_blurred)
+	flags |= GLW_RENDER_BLUR_ATTRIBUTE;
+
+      root->gr_render(root, rc->rc_mtx, tex, root->gr_stencil_texture,
+		      rgb_mul, rgb_off, alpha, blur,
+		      grc->grc_vertices, grc->grc_num_vertices,
+		      NULL, 0, flags, p, rc);
+      return;
+    }
   }
-  gr->gr_dirty = 0;
+
+  root->gr_render(root, rc->rc_mtx, tex, NULL, rgb_mul, rgb_off, alpha, blur,
+		  gr->gr_vertices, gr->gr_num_vertices,
+		  gr->gr_indices,  gr->gr_num_triangles,
+		  flags, p, rc);
 }
 
 
@@ -38,29 +38,41 @@
  */
 
 
+/**
+ * Clip planes, stencil and faders affecting a draw, transformed to
+ * the object space of the renderer
+ */
+typedef struct glw_renderer_key {
+  Vec4 grk_clip[NUM_CLIPPLANES];
+  Vec4 grk_stencil[2];
+  Vec4 grk_fader[NUM_FADERS];
+  float grk_stencil_edge[4];
+  float grk_fader_alpha[NUM_FADERS];
+  float grk_fader_blur[NUM_FADERS];
+  uint16_t grk_active_clippers;
+  uint16_t grk_active_faders;
+  int16_t grk_stencil_width;
+  int16_t grk_stencil_height;
+} glw_renderer_key_t;
+
+
 /**
  * Renderer cache
  */
 typedef struct glw_renderer_cache {
-  Mtx grc_mtx; // ModelView matrix
-  uint16_t grc_active_clippers;
-  uint16_t grc_active_faders;
-  Vec4 grc_clip[NUM_CLIPPLANES];
+  LIST_ENTRY(glw_renderer_cache) grc_hash_link;
+  TAILQ_ENTRY(glw_renderer_cache) grc_lru_link;
+  LIST_ENTRY(glw_renderer_cache) grc_renderer_link;
+  struct glw_root *grc_root;
+  struct glw_renderer *grc_renderer;
+  uint32_t grc_hash;
 
-  Vec4 grc_stencil[2];
-  int16_t grc_stencil_width;
-  int16_t grc_stencil_height;
-  int16_t grc_stencil_border[4];
-  float grc_stencil_edge[4];
-
-  Vec4 grc_fader[NUM_FADERS];
-  float grc_fader_alpha[NUM_FADERS];
-  float grc_fader_blur[NUM_FADERS];
+  glw_renderer_key_t grc_key;
 
   char grc_blurred;
 
   float *grc_vertices;
-  uint16_t grc_num_vertices;
+  int grc_num_vertices;
 } glw_renderer_cache_t;
 
 /**
@@ -77,13 +89,8 @@ typedef struct glw_renderer {
   char gr_dirty;
   char gr_blended_attributes;
   char gr_color_attributes;
-  unsigned char gr_framecmp;
-  unsigned char gr_cacheptr;
-
-
-#define GLW_RENDERER_CACHES 4
 
-  glw_renderer_cache_t *gr_cache[GLW_RENDERER_CACHES];
+  struct glw_renderer_cache_list gr_caches;
   
 } glw_renderer_t;
 
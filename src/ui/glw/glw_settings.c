@@ -96,11 +96,21 @@ glw_settings_init(void)
 			SETTINGS_INITIAL_UPDATE, " min", NULL,
 			glw_settings_save, NULL);
 
+  glw_settings.gs_setting_texture_budget =
+    settings_create_int(glw_settings.gs_settings, "texturebudget",
+			_p("Texture memory"),
+			128, glw_settings.gs_settings_store, 16, 1024, 16,
+			settings_generic_set_int,
+			&glw_settings.gs_texture_budget,
+			SETTINGS_INITIAL_UPDATE, " MB", NULL,
+			glw_settings_save, NULL);
+
 }
 
 void
 glw_settings_fini(void)
 {
+  setting_destroy(glw_settings.gs_setting_texture_budget);
   setting_destroy(glw_settings.gs_setting_screensaver);
   setting_destroy(glw_settings.gs_setting_underscan_v);
   setting_destroy(glw_settings.gs_setting_underscan_h);
@@ -23,11 +23,13 @@ typedef struct glw_settings {
   int gs_underscan_h;
   int gs_underscan_v;
   int gs_screensaver_delay;
+  int gs_texture_budget;      // MB
 
   struct setting *gs_setting_size;
   struct setting *gs_setting_underscan_v;
   struct setting *gs_setting_underscan_h;
   struct setting *gs_setting_screensaver;
+  struct setting *gs_setting_texture_budget;
 
   struct prop *gs_settings;
   struct htsmsg *gs_settings_store;
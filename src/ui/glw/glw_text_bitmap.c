@@ -32,6 +32,7 @@
 #include "glw_texture.h"
 #include "glw_renderer.h"
 #include "glw_text_bitmap.h"
+#include "glw_glyph_atlas.h"
 #include "misc/str.h"
 #include "text/text.h"
 #include "event.h"
@@ -56,6 +57,10 @@ typedef struct glw_text_bitmap {
   glw_renderer_t gtb_text_renderer;
   glw_renderer_t gtb_cursor_renderer;
 
+  glw_renderer_t gtb_glyph_renderer;  // When gtb_pixmap is PIXMAP_GLYPHS
+  int gtb_glyph_quads;
+  glw_atlas_ref_t gtb_atlas_ref;
+
   TAILQ_ENTRY(glw_text_bitmap) gtb_workq_link;
   LIST_ENTRY(glw_text_bitmap) gtb_global_link;
 
@@ -71,6 +76,9 @@ typedef struct glw_text_bitmap {
      GTB_VALID
   } gtb_state;
 
+  int gtb_generation;   // Bumped when output must be rendered again
+  int gtb_layout_frame; // Last frame we were laid out, ie. on screen
+
   uint8_t gtb_frozen;
   uint8_t gtb_pending_updates;
 #define GTB_UPDATE_REALIZE      2
@@ -117,6 +125,116 @@ static void gtb_caption_refresh(glw_text_bitmap_t *gtb);
 static glw_class_t glw_text, glw_label;
 
 
+/**
+ * Build one quad per glyph in the glyph run from the shared atlas.
+ * (left, top) is where the top left corner of the pixmap goes and
+ * text_width * text_height is how much of it that is visible
+ */
+static void
+gtb_glyphs_layout(glw_text_bitmap_t *gtb, const glw_rctx_t *rc,
+		  int left, int top, int text_width, int text_height,
+		  int fade)
+{
+  glw_root_t *gr = gtb->w.glw_root;
+  const pixmap_t *pm = gtb->gtb_pixmap;
+  const text_glyph_t *tg = pm->pm_data;
+  glw_renderer_t *r = &gtb->gtb_glyph_renderer;
+  glw_atlas_ref_t *gar = &gtb->gtb_atlas_ref;
+  const float sx = 2.0f / rc->rc_width;
+  const float sy = 2.0f / rc->rc_height;
+  const float st = gr->gr_normalized_texture_coords ?
+    1.0f / GLW_ATLAS_SIZE : 1.0f;
+  const float fa = 1 + text_width / 20;
+  int i, n = 0;
+
+  const int num_glyphs = MIN(pm->pm_num_glyphs, 16383);
+
+  if(num_glyphs > gtb->gtb_glyph_quads || !glw_renderer_initialized(r)) {
+    if(glw_renderer_initialized(r))
+      glw_renderer_free(r);
+    glw_renderer_init(r, num_glyphs * 4, num_glyphs * 2, NULL);
+    gtb->gtb_glyph_quads = num_glyphs;
+  }
+
+  gar->gar_missing = 0;
+  gar->gar_bands = 0;
+
+  for(i = 0; i < num_glyphs; i++, tg++) {
+    const glw_atlas_glyph_t *gag = glw_glyph_atlas_get(gr, tg->tg_id);
+
+    if(gag == NULL) {
+      gar->gar_missing = 1;
+      continue;
+    }
+
+    if(gag->gag_band < 0)
+      continue;
+
+    // Also for glyphs without pixels so they are not evicted while used
+    gar->gar_bands |= 1 << gag->gag_band;
+    if(gag->gag_width == 0)
+      continue;
+
+    // Position in pixmap, y downwards
+    const int px1 = tg->tg_x + gag->gag_left;
+    const int py1 = tg->tg_y - gag->gag_top;
+    const int px2 = px1 + gag->gag_width;
+    const int py2 = py1 + gag->gag_height;
+
+    if(px1 >= text_width || py1 >= text_height)
+      continue;
+
+    const float x1 = -1.0f + (left + px1) * sx;
+    const float x2 = -1.0f + (left + px2) * sx;
+    const float y1 = -1.0f + (top - py2) * sy;
+    const float y2 = -1.0f + (top - py1) * sy;
+
+    const float s1 = gag->gag_x * st;
+    const float s2 = (gag->gag_x + gag->gag_width) * st;
+    const float t1 = gag->gag_y * st;
+    const float t2 = (gag->gag_y + gag->gag_height) * st;
+
+    const float cr = (tg->tg_color & 0xff) / 255.0f;
+    const float cg = ((tg->tg_color >> 8) & 0xff) / 255.0f;
+    const float cb = ((tg->tg_color >> 16) & 0xff) / 255.0f;
+    const float ca = (tg->tg_color >> 24) / 255.0f;
+
+    // Same fade out as when cutting a text pixmap
+    const float a1 = fade ? ca * fa * (1.0f - px1 / (float)text_width) : ca;
+    const float a2 = fade ? ca * fa * (1.0f - px2 / (float)text_width) : ca;
+
+    const int v = n * 4;
+
+    glw_renderer_vtx_pos(r, v + 0, x1, y1, 0.0);
+    glw_renderer_vtx_st (r, v + 0, s1, t2);
+    glw_renderer_vtx_col(r, v + 0, cr, cg, cb, a1);
+
+    glw_renderer_vtx_pos(r, v + 1, x2, y1, 0.0);
+    glw_renderer_vtx_st (r, v + 1, s2, t2);
+    glw_renderer_vtx_col(r, v + 1, cr, cg, cb, a2);
+
+    glw_renderer_vtx_pos(r, v + 2, x2, y2, 0.0);
+    glw_renderer_vtx_st (r, v + 2, s2, t1);
+    glw_renderer_vtx_col(r, v + 2, cr, cg, cb, a2);
+
+    glw_renderer_vtx_pos(r, v + 3, x1, y2, 0.0);
+    glw_renderer_vtx_st (r, v + 3, s1, t1);
+    glw_renderer_vtx_col(r, v + 3, cr, cg, cb, a1);
+
+    glw_renderer_triangle(r, n * 2 + 0, v + 0, v + 1, v + 2);
+    glw_renderer_triangle(r, n * 2 + 1, v + 0, v + 2, v + 3);
+
+    n++;
+  }
+
+  // Unused quads are left degenerate
+  for(i = n * 2; i < gtb->gtb_glyph_quads * 2; i++)
+    glw_renderer_triangle(r, i, 0, 0, 0);
+
+  glw_glyph_atlas_ref(gr, gar);
+}
+
+
 /**
  *
  */
@@ -127,6 +245,16 @@ glw_text_bitmap_layout(glw_t *w, glw_rctx_t *rc)
   glw_root_t *gr = w->glw_root;
   pixmap_t *pm = gtb->gtb_pixmap;
 
+  gtb->gtb_layout_frame = gr->gr_frames;
+
+  // Labels on screen are rendered before everything else
+
+  if(gtb->gtb_state == GTB_QUEUED_FOR_RENDERING &&
+     TAILQ_FIRST(&gr->gr_gtb_render_queue) != gtb) {
+    TAILQ_REMOVE(&gr->gr_gtb_render_queue, gtb, gtb_workq_link);
+    TAILQ_INSERT_HEAD(&gr->gr_gtb_render_queue, gtb, gtb_workq_link);
+  }
+
   // Initialize renderers
 
   if(!glw_renderer_initialized(&gtb->gtb_text_renderer))
@@ -139,7 +267,7 @@ glw_text_bitmap_layout(glw_t *w, glw_rctx_t *rc)
 
   // Upload texture
 
-  if(pm != NULL && pm->pm_pixels != NULL) {
+  if(pm != NULL && pm->pm_type != PIXMAP_GLYPHS && pm->pm_pixels != NULL) {
     glw_tex_upload(gr, &gtb->gtb_texture, pm, 0);
 
     free(pm->pm_pixels);
@@ -186,6 +314,10 @@ glw_text_bitmap_layout(glw_t *w, glw_rctx_t *rc)
 
   }
 
+  if(pm != NULL && pm->pm_type == PIXMAP_GLYPHS &&
+     glw_glyph_atlas_stale(gr, &gtb->gtb_atlas_ref))
+    gtb->gtb_need_layout = 1;
+
   if(pm != NULL && gtb->gtb_need_layout) {
 
     int left   =                 gtb->gtb_padding_left   - pm->pm_margin;
@@ -199,11 +331,14 @@ glw_text_bitmap_layout(glw_t *w, glw_rctx_t *rc)
     float x1, y1, x2, y2;
 
     // Horizontal 
+    int fade = 0;
+
     if(text_width > right - left || pm->pm_flags & PIXMAP_TEXT_TRUNCATED) {
       // Oversized, must cut
       text_width = right - left;
 
       if(!(gtb->gtb_flags & GTB_ELLIPSIZE)) {
+	fade = 1;
 	glw_renderer_vtx_col(&gtb->gtb_text_renderer, 0, 1,1,1,1+text_width/20);
 	glw_renderer_vtx_col(&gtb->gtb_text_renderer, 1, 1,1,1,0);
 	glw_renderer_vtx_col(&gtb->gtb_text_renderer, 2, 1,1,1,0);
@@ -268,6 +403,11 @@ glw_text_bitmap_layout(glw_t *w, glw_rctx_t *rc)
       }
     }
 
+    if(pm->pm_type == PIXMAP_GLYPHS) {
+      gtb_glyphs_layout(gtb, rc, left, top, text_width, text_height, fade);
+      goto laid_out;
+    }
+
     x1 = -1.0f + 2.0f * left   / (float)rc->rc_width;
     y1 = -1.0f + 2.0f * bottom / (float)rc->rc_height;
     x2 = -1.0f + 2.0f * right  / (float)rc->rc_width;
@@ -295,7 +435,8 @@ glw_text_bitmap_layout(glw_t *w, glw_rctx_t *rc)
     glw_renderer_vtx_pos(&gtb->gtb_text_renderer, 3, x1, y2, 0.0);
     glw_renderer_vtx_st (&gtb->gtb_text_renderer, 3, 0, 0);
   }
-  
+ laid_out:
+
   if(w->glw_class == &glw_text && gtb->gtb_update_cursor && 
      gtb->gtb_state == GTB_VALID) {
 
@@ -348,7 +489,7 @@ glw_text_bitmap_layout(glw_t *w, glw_rctx_t *rc)
   if(gtb->gtb_state != GTB_NEED_RENDER)
     return;
 
-  TAILQ_INSERT_TAIL(&gr->gr_gtb_render_queue, gtb, gtb_workq_link);
+  TAILQ_INSERT_HEAD(&gr->gr_gtb_render_queue, gtb, gtb_workq_link);
   gtb->gtb_state = GTB_QUEUED_FOR_RENDERING;
   
   hts_cond_signal(&gr->gr_gtb_work_cond);
@@ -377,7 +518,15 @@ glw_text_bitmap_render(glw_t *w, const glw_rctx_t *rc)
   if(w->glw_flags2 & GLW2_DEBUG)
     glw_wirebox(w->glw_root, rc);
 
-  if(glw_is_tex_inited(&gtb->gtb_texture) && pm != NULL) {
+  if(pm != NULL && pm->pm_type == PIXMAP_GLYPHS) {
+    const glw_backend_texture_t *tex =
+      glw_glyph_atlas_touch(w->glw_root, &gtb->gtb_atlas_ref);
+
+    if(tex != NULL && gtb->gtb_atlas_ref.gar_bands)
+      glw_renderer_draw(&gtb->gtb_glyph_renderer, w->glw_root, rc, tex,
+			&gtb->gtb_color, NULL, alpha, blur, NULL);
+
+  } else if(glw_is_tex_inited(&gtb->gtb_texture) && pm != NULL) {
     glw_renderer_draw(&gtb->gtb_text_renderer, w->glw_root, rc, 
 		      &gtb->gtb_texture,
 		      &gtb->gtb_color, NULL, alpha, blur, NULL);
@@ -415,6 +564,7 @@ glw_text_bitmap_dtor(glw_t *w)
 
   glw_renderer_free(&gtb->gtb_text_renderer);
   glw_renderer_free(&gtb->gtb_cursor_renderer);
+  glw_renderer_free(&gtb->gtb_glyph_renderer);
 
   switch(gtb->gtb_state) {
   case GTB_IDLE:
@@ -647,6 +797,8 @@ gtb_realize(glw_text_bitmap_t *gtb)
   glw_root_t *gr = gtb->w.glw_root;
   int direct = gtb->gtb_maxlines > 1;
 
+  // Anything being rendered right now is stale
+  gtb->gtb_generation++;
 
 #if 0
 
@@ -1047,6 +1199,8 @@ do_render(glw_text_bitmap_t *gtb, glw_root_t *gr, int no_output)
 
   /* We are going to render unlocked so we cannot use gtb at all */
 
+  const int generation = gtb->gtb_generation;
+
   len = gtb->gtb_uc_len;
   if(len > 0) {
     uc = malloc((len + 3) * sizeof(int));
@@ -1100,6 +1254,8 @@ do_render(glw_text_bitmap_t *gtb, glw_root_t *gr, int no_output)
     
   if(gtb->gtb_edit_ptr >= 0)
     flags |= TR_RENDER_CHARACTER_POS;
+  else
+    flags |= TR_RENDER_GLYPHS;
 
   tr_align = TR_ALIGN_JUSTIFIED;
 
@@ -1164,6 +1320,17 @@ do_render(glw_text_bitmap_t *gtb, glw_root_t *gr, int no_output)
 
   glw_unref(&gtb->w);
 
+  if(gtb->gtb_generation != generation) {
+    /* Text or style changed while we were away, start over. Any
+       previous pixmap is kept until the new one is done */
+    if(pm != NULL)
+      pixmap_release(pm);
+    gtb->gtb_state = GTB_IDLE;
+    gtb->gtb_deferred_realize = 0;
+    gtb_realize(gtb);
+    return;
+  }
+
   if(gtb->w.glw_flags2 & GLW2_DEBUG && pm != NULL)
     printf("   pm = %d x %d (m=%d)\n", pm->pm_width, pm->pm_height, pm->pm_margin);
 
@@ -1204,6 +1371,18 @@ font_render_thread(void *aux)
   glw_lock(gr);
 
   while(gr->gr_font_thread_running) {
+
+    /* Labels laid out recently are at the head of the render queue.
+       They are on screen so do them first */
+
+    gtb = TAILQ_FIRST(&gr->gr_gtb_render_queue);
+    if(gtb != NULL && gtb->gtb_layout_frame >= gr->gr_frames - 1) {
+      assert(gtb->gtb_state == GTB_QUEUED_FOR_RENDERING);
+      TAILQ_REMOVE(&gr->gr_gtb_render_queue, gtb, gtb_workq_link);
+      gtb->gtb_state = GTB_RENDERING;
+      do_render(gtb, gr, 0);
+      continue;
+    }
     
     if((gtb = TAILQ_FIRST(&gr->gr_gtb_dim_queue)) != NULL) {
 
@@ -1290,15 +1469,23 @@ gtb_caption_refresh(glw_text_bitmap_t *gtb)
 void
 glw_text_bitmap_init(glw_root_t *gr)
 {
+  int i;
+
+  glw_glyph_atlas_init(gr);
+
   TAILQ_INIT(&gr->gr_gtb_dim_queue);
   TAILQ_INIT(&gr->gr_gtb_render_queue);
 
   hts_cond_init(&gr->gr_gtb_work_cond, &gr->gr_mutex);
 
   gr->gr_font_thread_running = 1;
-  hts_thread_create_joinable("GLW font renderer", &gr->gr_font_thread,
-			     font_render_thread, gr,
-			     THREAD_PRIO_UI_WORKER_HIGH);
+  gr->gr_num_font_threads = MIN(MAX(gconf.concurrency, 1),
+				GLW_MAX_FONT_THREADS);
+
+  for(i = 0; i < gr->gr_num_font_threads; i++)
+    hts_thread_create_joinable("GLW font renderer", &gr->gr_font_threads[i],
+			       font_render_thread, gr,
+			       THREAD_PRIO_UI_WORKER_HIGH);
 }
 
 
@@ -1308,12 +1495,18 @@ glw_text_bitmap_init(glw_root_t *gr)
 void
 glw_text_bitmap_fini(glw_root_t *gr)
 {
+  int i;
+
   hts_mutex_lock(&gr->gr_mutex);
   gr->gr_font_thread_running = 0;
-  hts_cond_signal(&gr->gr_gtb_work_cond);
+  hts_cond_broadcast(&gr->gr_gtb_work_cond);
   hts_mutex_unlock(&gr->gr_mutex);
-  hts_thread_join(&gr->gr_font_thread);
+
+  for(i = 0; i < gr->gr_num_font_threads; i++)
+    hts_thread_join(&gr->gr_font_threads[i]);
   hts_cond_destroy(&gr->gr_gtb_work_cond);
+
+  glw_glyph_atlas_fini(gr);
 }
 
 
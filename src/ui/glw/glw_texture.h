@@ -31,12 +31,13 @@
 
 typedef struct glw_loadable_texture {
 
-  LIST_ENTRY(glw_loadable_texture) glt_global_link;
+  LIST_ENTRY(glw_loadable_texture) glt_global_link; // In gr_tex_hash
   LIST_ENTRY(glw_loadable_texture) glt_flush_link;
   TAILQ_ENTRY(glw_loadable_texture) glt_work_link;
   struct glw_loadable_texture_queue *glt_q;
 
   int glt_flags;
+  unsigned int glt_hash;
 
   enum {
     GLT_STATE_INACTIVE,
@@ -57,6 +58,7 @@ typedef struct glw_loadable_texture {
   rstr_t *glt_url;
 
   pixmap_t *glt_pixmap;
+  pixmap_t *glt_mip;      // Downscaled copy, kept on backend when evicted
 
   int16_t glt_req_xs;
   int16_t glt_req_ys;
@@ -78,6 +80,8 @@ typedef struct glw_loadable_texture {
   int16_t glt_shadow;
 
   int glt_size;
+  int glt_resident;       // Bytes currently held by the backend
+  int glt_last_frame;     // Last frame we were laid out
 
 } glw_loadable_texture_t;
 
@@ -100,6 +104,8 @@ void glw_tex_autoflush(glw_root_t *gr);
 
 void glw_tex_flush_all(glw_root_t *gr);
 
+void glw_tex_frame(glw_root_t *gr);
+
 
 /**
  * Backend interface
@@ -117,6 +123,13 @@ void glw_tex_backend_layout(glw_root_t *gr, glw_loadable_texture_t *glt);
 void glw_tex_upload(glw_root_t *gr, glw_backend_texture_t *tex,
 		    const pixmap_t *pm, int flags);
 
+/**
+ * Update rows y to y + height of a texture that has been uploaded from
+ * a pixmap of the same size and type
+ */
+void glw_tex_upload_rows(glw_root_t *gr, glw_backend_texture_t *tex,
+			 const pixmap_t *pm, int y, int height);
+
 void glw_tex_destroy(glw_root_t *gr, glw_backend_texture_t *tex);
 
 #endif /* GLW_TEXTURE_H */
@@ -24,9 +24,128 @@
 
 #include "glw.h"
 #include "glw_texture.h"
+#include "glw_settings.h"
 
 #include "backend/backend.h"
 
+/**
+ * Pixmaps are handed to the backend (glw_tex_backend_layout()) on the
+ * render thread when a texture is laid out. To keep the frame rate even
+ * when many images finish loading at once we stop uploading when the
+ * budget for the current frame is spent. Remaining textures are
+ * uploaded during the following frames.
+ */
+#define GLW_TEX_UPLOAD_BUDGET_BYTES (4 * 1024 * 1024)
+#define GLW_TEX_UPLOAD_BUDGET_TIME  4000  // µs
+
+/**
+ * Photos (decoded from JPEG) of at least GLW_TEX_MIP_MIN_PIXELS also
+ * get a copy downscaled by (1 << GLW_TEX_MIP_SHIFT). When the texture
+ * is evicted the copy is uploaded in its place so it can be shown
+ * directly, in low resolution, while the full image is loaded again.
+ */
+#define GLW_TEX_MIP_MIN_PIXELS (256 * 256)
+#define GLW_TEX_MIP_SHIFT      2
+
+
+/**
+ *
+ */
+static void
+glt_free_render_resources(glw_root_t *gr, glw_loadable_texture_t *glt)
+{
+  glw_tex_backend_free_render_resources(gr, glt);
+  gr->gr_tex_resident -= glt->glt_resident;
+  glt->glt_resident = 0;
+}
+
+
+/**
+ *
+ */
+static void
+glt_free_mip(glw_loadable_texture_t *glt)
+{
+  if(glt->glt_mip != NULL) {
+    pixmap_release(glt->glt_mip);
+    glt->glt_mip = NULL;
+  }
+}
+
+
+/**
+ * A texture that is no longer laid out can still hold backend memory,
+ * typically the downscaled copy of an evicted texture. Such textures
+ * are kept on gr_tex_parked so glw_tex_enforce_budget() can get the
+ * memory back
+ */
+static void
+glt_park(glw_root_t *gr, glw_loadable_texture_t *glt)
+{
+  if(glt->glt_resident == 0)
+    return;
+  glt->glt_q = &gr->gr_tex_parked;
+  TAILQ_INSERT_TAIL(glt->glt_q, glt, glt_work_link);
+}
+
+
+/**
+ *
+ */
+static void
+glt_unpark(glw_root_t *gr, glw_loadable_texture_t *glt)
+{
+  if(glt->glt_q != &gr->gr_tex_parked)
+    return;
+  TAILQ_REMOVE(glt->glt_q, glt, glt_work_link);
+  glt->glt_q = NULL;
+}
+
+
+/**
+ * Throw out a stashed texture. If it's still referenced and we have
+ * a downscaled copy, the copy replaces it on the backend
+ */
+static void
+glw_tex_evict(glw_root_t *gr, glw_loadable_texture_t *glt)
+{
+  const pixmap_t *mip = glt->glt_mip;
+
+  assert(glt->glt_state == GLT_STATE_STASHED);
+
+  TAILQ_REMOVE(glt->glt_q, glt, glt_work_link);
+  gr->gr_tex_stash[glt->glt_stash].size -= glt->glt_size;
+
+  glw_tex_backend_free_loader_resources(glt);
+  glt->glt_state = GLT_STATE_INACTIVE;
+  gr->gr_tex_evictions++;
+
+  if(glt->glt_refcnt == 0) {
+    glt_free_render_resources(gr, glt);
+    glt_free_mip(glt);
+
+    if(glt->glt_url != NULL) {
+      rstr_release(glt->glt_url);
+      glt->glt_url = NULL;
+      LIST_REMOVE(glt, glt_global_link);
+    }
+    free(glt);
+    return;
+  }
+
+  if(mip != NULL && gr->gr_normalized_texture_coords &&
+     glt->glt_s == 1 && glt->glt_t == 1) {
+    const int size = mip->pm_linesize * mip->pm_height;
+    glw_tex_upload(gr, &glt->glt_texture, mip, glt->glt_flags);
+    gr->gr_tex_resident += size - glt->glt_resident;
+    glt->glt_resident = size;
+    glt_park(gr, glt);
+  } else {
+    glt_free_render_resources(gr, glt);
+  }
+  glt_free_mip(glt);
+}
+
 
 /**
  *
@@ -40,23 +159,40 @@ glw_tex_purge_stash(glw_root_t *gr, int stash)
       break;
 
     assert(glt->glt_q == &gr->gr_tex_stash[stash].q);
+    glw_tex_evict(gr, glt);
+  }
+}
 
-    TAILQ_REMOVE(glt->glt_q, glt, glt_work_link);
-    gr->gr_tex_stash[stash].size -= glt->glt_size;
 
-    glw_tex_backend_free_loader_resources(glt);
-    glw_tex_backend_free_render_resources(gr, glt);
-    glt->glt_state = GLT_STATE_INACTIVE;
+/**
+ * Release parked textures and then evict the least recently used
+ * stashed textures until we are within the texture memory budget.
+ * Textures laid out the last frame are neither parked nor stashed so
+ * they are left alone even if the budget is exceeded
+ */
+static void
+glw_tex_enforce_budget(glw_root_t *gr)
+{
+  const int64_t budget = (int64_t)glw_settings.gs_texture_budget << 20;
+  glw_loadable_texture_t *glt;
 
-    if(glt->glt_refcnt == 0) {
+  while(gr->gr_tex_resident > budget &&
+        (glt = TAILQ_FIRST(&gr->gr_tex_parked)) != NULL) {
+    glt_unpark(gr, glt);
+    glt_free_render_resources(gr, glt);
+  }
 
-      if(glt->glt_url != NULL) {
-        rstr_release(glt->glt_url);
-        glt->glt_url = NULL;
-        LIST_REMOVE(glt, glt_global_link);
-      }
-      free(glt);
-    }
+  while(gr->gr_tex_resident > budget) {
+    glw_loadable_texture_t *a = TAILQ_FIRST(&gr->gr_tex_stash[0].q);
+    glw_loadable_texture_t *b = TAILQ_FIRST(&gr->gr_tex_stash[1].q);
+
+    if(a == NULL && b == NULL)
+      break;
+
+    if(a == NULL || (b != NULL && b->glt_last_frame < a->glt_last_frame))
+      a = b;
+
+    glw_tex_evict(gr, a);
   }
 }
 
@@ -109,7 +245,7 @@ glw_tex_autoflush(glw_root_t *gr)
     switch(glt->glt_state) {
     case GLT_STATE_VALID:
       if(glw_tex_stash(gr, glt, 0)) {
-        glw_tex_backend_free_render_resources(gr, glt);
+        glt_free_render_resources(gr, glt);
         glt->glt_state = GLT_STATE_INACTIVE;
       }
       break;
@@ -136,6 +272,8 @@ glw_tex_autoflush(glw_root_t *gr)
 
   LIST_MOVE(&gr->gr_tex_flush_list, &gr->gr_tex_active_list, glt_flush_link);
   LIST_INIT(&gr->gr_tex_active_list);
+
+  glw_tex_enforce_budget(gr);
 }
 
 
@@ -210,7 +348,7 @@ loader_thread(void *aux)
   loaderaux_t *la = aux;
   glw_root_t *gr = la->la_gr;
   glw_loadable_texture_t *glt;
-  pixmap_t *pm;
+  pixmap_t *pm, *mip;
   char errbuf[128];
   image_meta_t im = {0};
   int cache_control = 0;
@@ -250,6 +388,12 @@ loader_thread(void *aux)
       pm = backend_imageloader(url, &im, gr->gr_vpaths, errbuf, sizeof(errbuf),
 			       ccptr, img_load_cb, glt);
 
+      mip = NULL;
+      if(pm != NULL && pm != NOT_MODIFIED && !pixmap_is_coded(pm) &&
+	 pm->pm_original_type == PIXMAP_JPEG &&
+	 pm->pm_width * pm->pm_height >= GLW_TEX_MIP_MIN_PIXELS)
+	mip = pixmap_downscale(pm, GLW_TEX_MIP_SHIFT);
+
       glw_lock(gr);
 
 #if 0
@@ -270,6 +414,7 @@ loader_thread(void *aux)
 	  pixmap_release(pm);
 	TRACE(TRACE_DEBUG, "GLW", "Load of %s was aborted", rstr_get(url));
 	glt->glt_state = GLT_STATE_INACTIVE;
+	glt_park(gr, glt);
       } else if(pm == NULL) {
 
 	if(glt->glt_q == &gr->gr_tex_load_queue[LQ_TENTATIVE]) {
@@ -290,6 +435,7 @@ loader_thread(void *aux)
 	  
 	  glt->glt_state = GLT_STATE_ERROR;
 	  LIST_REMOVE(glt, glt_flush_link);
+	  glt_park(gr, glt);
 	}
 
       } else {
@@ -316,12 +462,18 @@ loader_thread(void *aux)
             glt->glt_ys            = pm->pm_height;
 
 	    glt->glt_size          = glw_tex_backend_load(gr, glt, pm);
+
+	    glt_free_mip(glt);
+	    glt->glt_mip = mip;
+	    mip = NULL;
 	  }
 	}
 
 	if(pm != NOT_MODIFIED)
 	  pixmap_release(pm);
       }
+      if(mip != NULL)
+	pixmap_release(mip);
       rstr_release(url);
     }
     glw_tex_deref(gr, glt);
@@ -357,6 +509,7 @@ glw_tex_init(glw_root_t *gr)
   TAILQ_INIT(&gr->gr_tex_rel_queue);
   TAILQ_INIT(&gr->gr_tex_stash[0].q);
   TAILQ_INIT(&gr->gr_tex_stash[1].q);
+  TAILQ_INIT(&gr->gr_tex_parked);
 
   gr->gr_tex_stash[0].limit = 16 * 1024 * 1024;
   gr->gr_tex_stash[1].limit = 16 * 1024 * 1024;
@@ -392,39 +545,47 @@ void
 glw_tex_flush_all(glw_root_t *gr)
 {
   glw_loadable_texture_t *glt;
+  int i;
 
-  LIST_FOREACH(glt, &gr->gr_tex_list, glt_global_link) {
-    switch(glt->glt_state) {
+  for(i = 0; i < GLW_TEX_HASH_SIZE; i++) {
+    LIST_FOREACH(glt, &gr->gr_tex_hash[i], glt_global_link) {
+      switch(glt->glt_state) {
 
-    case GLT_STATE_INACTIVE:
-      break;
+      case GLT_STATE_INACTIVE:
+        glt_unpark(gr, glt);
+        glt_free_render_resources(gr, glt);
+        break;
 
-    case GLT_STATE_STASHED:
-      glw_tex_unstash(gr, glt);
+      case GLT_STATE_STASHED:
+        glw_tex_unstash(gr, glt);
 
-      if(0)
-    case GLT_STATE_VALID:
-        LIST_REMOVE(glt, glt_flush_link);
-      glw_tex_backend_free_render_resources(gr, glt);
-      glt->glt_state = GLT_STATE_INACTIVE;
-      break;
+        if(0)
+      case GLT_STATE_VALID:
+          LIST_REMOVE(glt, glt_flush_link);
+        glt_free_render_resources(gr, glt);
+        glt->glt_state = GLT_STATE_INACTIVE;
+        break;
 
-    case GLT_STATE_QUEUED:
-      LIST_REMOVE(glt, glt_flush_link);
-      TAILQ_REMOVE(glt->glt_q, glt, glt_work_link);
-      glt->glt_state = GLT_STATE_INACTIVE;
-      glw_tex_deref(gr, glt);
-      break;
+      case GLT_STATE_QUEUED:
+        LIST_REMOVE(glt, glt_flush_link);
+        TAILQ_REMOVE(glt->glt_q, glt, glt_work_link);
+        glt->glt_state = GLT_STATE_INACTIVE;
+        glw_tex_deref(gr, glt);
+        break;
 
-    case GLT_STATE_LOADING:
-      LIST_REMOVE(glt, glt_flush_link);
-      glt->glt_state = GLT_STATE_INACTIVE;
-      break;
+      case GLT_STATE_LOADING:
+        LIST_REMOVE(glt, glt_flush_link);
+        glt->glt_state = GLT_STATE_INACTIVE;
+        break;
 
-    case GLT_STATE_ERROR:
-    case GLT_STATE_LOAD_ABORT:
-      glt->glt_state = GLT_STATE_INACTIVE;
-      break;
+      case GLT_STATE_ERROR:
+        glt_unpark(gr, glt);
+        glt_free_render_resources(gr, glt);
+        // FALLTHRU
+      case GLT_STATE_LOAD_ABORT:
+        glt->glt_state = GLT_STATE_INACTIVE;
+        break;
+      }
     }
   }
 }
@@ -440,7 +601,8 @@ glw_tex_purge(glw_root_t *gr)
 
   while((glt = TAILQ_FIRST(&gr->gr_tex_rel_queue)) != NULL) {
     TAILQ_REMOVE(&gr->gr_tex_rel_queue, glt, glt_work_link);
-    glw_tex_backend_free_render_resources(gr, glt);
+    glt_free_render_resources(gr, glt);
+    glt_free_mip(glt);
     free(glt);
   }
 }
@@ -476,6 +638,8 @@ glw_tex_deref(glw_root_t *gr, glw_loadable_texture_t *glt)
     break;
   case GLT_STATE_INACTIVE:
   case GLT_STATE_ERROR:
+    glt_unpark(gr, glt);
+    break;
   case GLT_STATE_LOAD_ABORT:
     break;
   }
@@ -500,23 +664,32 @@ glw_tex_create(glw_root_t *gr, rstr_t *filename, int flags, int xs, int ys,
 	       int radius, int shadow)
 {
   glw_loadable_texture_t *glt;
+  unsigned int hash;
 
   assert(xs == -1 || xs > 0);
   assert(ys == -1 || ys > 0);
 
-  LIST_FOREACH(glt, &gr->gr_tex_list, glt_global_link)
-    if(!strcmp(rstr_get(glt->glt_url), rstr_get(filename)) &&
+  hash = mystrhash(rstr_get(filename)) ^ flags ^ (xs << 8) ^ (ys << 20) ^
+    (radius << 4) ^ (shadow << 12);
+
+  struct glw_loadable_texture_list *l =
+    &gr->gr_tex_hash[hash & (GLW_TEX_HASH_SIZE - 1)];
+
+  LIST_FOREACH(glt, l, glt_global_link)
+    if(glt->glt_hash == hash &&
        glt->glt_flags == flags &&
        glt->glt_req_xs == xs &&
        glt->glt_req_ys == ys &&
        glt->glt_radius == radius &&
-       glt->glt_shadow == shadow)
+       glt->glt_shadow == shadow &&
+       !strcmp(rstr_get(glt->glt_url), rstr_get(filename)))
       break;
 
   if(glt == NULL) {
     glt = calloc(1, sizeof(glw_loadable_texture_t));
     glt->glt_url = rstr_dup(filename);
-    LIST_INSERT_HEAD(&gr->gr_tex_list, glt, glt_global_link);
+    glt->glt_hash = hash;
+    LIST_INSERT_HEAD(l, glt, glt_global_link);
     glt->glt_state = GLT_STATE_INACTIVE;
     glt->glt_flags = flags;
     glt->glt_req_xs = xs;
@@ -555,11 +728,30 @@ gl_tex_req_load(glw_root_t *gr, glw_loadable_texture_t *glt)
 void
 glw_tex_layout(glw_root_t *gr, glw_loadable_texture_t *glt)
 {
-  if(glt->glt_pixmap != NULL)
-    glw_tex_backend_layout(gr, glt);
+  if(glt->glt_pixmap != NULL) {
+
+    if(gr->gr_tex_upload_bytes == 0 ||
+       (gr->gr_tex_upload_bytes < GLW_TEX_UPLOAD_BUDGET_BYTES &&
+	gr->gr_tex_upload_time  < GLW_TEX_UPLOAD_BUDGET_TIME)) {
+
+      int64_t ts = showtime_get_ts();
+      glw_tex_backend_layout(gr, glt);
+      gr->gr_tex_upload_time += showtime_get_ts() - ts;
+      gr->gr_tex_resident += glt->glt_size - glt->glt_resident;
+      glt->glt_resident = glt->glt_size;
+      gr->gr_tex_upload_bytes += MAX(glt->glt_size, 1);
+      gr->gr_tex_stat_uploads++;
+
+    } else {
+      gr->gr_tex_stat_deferred++;
+    }
+  }
+
+  glt->glt_last_frame = gr->gr_frames;
 
   switch(glt->glt_state) {
   case GLT_STATE_INACTIVE:
+    glt_unpark(gr, glt);
     gl_tex_req_load(gr, glt);
     break;
 
@@ -583,3 +775,38 @@ glw_tex_layout(glw_root_t *gr, glw_loadable_texture_t *glt)
   }
   LIST_INSERT_HEAD(&gr->gr_tex_active_list, glt, glt_flush_link);
 }
+
+
+/**
+ * Start of a new frame, reset upload budget and publish statistics
+ */
+void
+glw_tex_frame(glw_root_t *gr)
+{
+  gr->gr_tex_stat_bytes += gr->gr_tex_upload_bytes;
+  gr->gr_tex_stat_time  += gr->gr_tex_upload_time;
+  gr->gr_tex_stat_maxtime = MAX(gr->gr_tex_stat_maxtime,
+				gr->gr_tex_upload_time);
+
+  gr->gr_tex_upload_bytes = 0;
+  gr->gr_tex_upload_time = 0;
+
+  if((gr->gr_frames & 0x7f) == 0) {
+    prop_t *p = prop_create(gr->gr_prop_ui, "texturestats");
+    prop_set(p, "uploads",  PROP_SET_INT, gr->gr_tex_stat_uploads);
+    prop_set(p, "deferred", PROP_SET_INT, gr->gr_tex_stat_deferred);
+    prop_set(p, "kbytes",   PROP_SET_INT, (int)(gr->gr_tex_stat_bytes / 1024));
+    // Time spent uploading, average and worst case per frame in µs
+    prop_set(p, "avgtime",  PROP_SET_INT, (int)(gr->gr_tex_stat_time / 128));
+    prop_set(p, "maxtime",  PROP_SET_INT, gr->gr_tex_stat_maxtime);
+    // Backend memory held by textures and number of evictions so far
+    prop_set(p, "resident", PROP_SET_INT, (int)(gr->gr_tex_resident / 1024));
+    prop_set(p, "evictions", PROP_SET_INT, gr->gr_tex_evictions);
+
+    gr->gr_tex_stat_uploads = 0;
+    gr->gr_tex_stat_deferred = 0;
+    gr->gr_tex_stat_bytes = 0;
+    gr->gr_tex_stat_time = 0;
+    gr->gr_tex_stat_maxtime = 0;
+  }
+}
@@ -52,20 +52,77 @@ glw_tex_backend_free_loader_resources(glw_loadable_texture_t *glt)
 
 
 /**
- * Invoked on every frame when status == VALID
+ * Textures smaller than this are not worth the extra buffer setup
+ */
+#define GLW_TEX_PBO_MIN_SIZE (64 * 1024)
+
+/**
+ * Copy pixels into a pixel buffer object and return the pointer to
+ * pass to glTexImage2D(). The texture upload call can then return
+ * directly and the driver transfers the data asynchronously.
+ * Finish with pbo_unbind()
+ */
+static const void *
+pbo_stage(glw_backend_root_t *gbr, const void *src, int size)
+{
+#if !ENABLE_GLW_BACKEND_OPENGL_ES
+  void *dst;
+
+  if(!gbr->gbr_use_pbo || size < GLW_TEX_PBO_MIN_SIZE)
+    return src;
+
+  if(gbr->gbr_tex_pbo == 0)
+    glGenBuffers(1, &gbr->gbr_tex_pbo);
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, gbr->gbr_tex_pbo);
+
+  // Orphan the old storage so we never wait for a previous transfer
+  glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+  dst = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+  if(dst == NULL) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    return src;
+  }
+  memcpy(dst, src, size);
+  glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+  return NULL; // Offset 0 in the bound buffer
+#else
+  return src;
+#endif
+}
+
+
+/**
+ *
+ */
+static void
+pbo_unbind(glw_backend_root_t *gbr, const void *p)
+{
+#if !ENABLE_GLW_BACKEND_OPENGL_ES
+  if(p == NULL)
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+#endif
+}
+
+
+/**
+ * Invoked on every frame when status == VALID and we have a pixmap
+ * that's not uploaded yet
  */
 void
 glw_tex_backend_layout(glw_root_t *gr, glw_loadable_texture_t *glt)
 {
-  void *p;
-  int m = gr->gr_be.gbr_primary_texture_mode;
+  glw_backend_root_t *gbr = &gr->gr_be;
+  const void *p;
+  int m = gbr->gbr_primary_texture_mode;
+  const pixmap_t *pm = glt->glt_pixmap;
 
-  if(glt->glt_texture.tex != 0)
-    return;
+  p = pbo_stage(gbr, pm->pm_data, pm->pm_linesize * pm->pm_height);
 
-  p = glt->glt_pixmap->pm_data;
+  // Textures refreshed from the network are uploaded again
 
-  glGenTextures(1, &glt->glt_texture.tex);
+  if(glt->glt_texture.tex == 0)
+    glGenTextures(1, &glt->glt_texture.tex);
   glBindTexture(m, glt->glt_texture.tex);
 
 
@@ -114,6 +171,7 @@ glw_tex_backend_layout(glw_root_t *gr, glw_loadable_texture_t *glt)
 
 
   glBindTexture(m, 0);
+  pbo_unbind(gbr, p);
 
   glw_tex_backend_free_loader_resources(glt);
 }
@@ -211,6 +269,39 @@ glw_tex_upload(glw_root_t *gr, glw_backend_texture_t *tex,
 }
 
 
+/**
+ *
+ */
+void
+glw_tex_upload_rows(glw_root_t *gr, glw_backend_texture_t *tex,
+		    const pixmap_t *pm, int y, int height)
+{
+  int format;
+  int m = gr->gr_be.gbr_primary_texture_mode;
+
+  switch(pm->pm_type) {
+  case PIXMAP_BGR32:
+    format = GL_RGBA;
+    break;
+
+  case PIXMAP_RGB24:
+    format = GL_RGB;
+    break;
+
+  case PIXMAP_IA:
+    format = GL_LUMINANCE_ALPHA;
+    break;
+
+  default:
+    return;
+  }
+
+  glBindTexture(m, tex->tex);
+  glTexSubImage2D(m, 0, 0, y, pm->pm_width, height, format, GL_UNSIGNED_BYTE,
+		  pm->pm_pixels + y * pm->pm_linesize);
+}
+
+
 /**
  *
  */
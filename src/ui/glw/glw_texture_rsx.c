@@ -38,21 +38,15 @@ glw_tex_backend_free_render_resources(glw_root_t *gr,
 
 
 /**
- * Free resources created by glw_tex_backend_decode()
+ * Free resources created by glw_tex_backend_load()
  */
 void
 glw_tex_backend_free_loader_resources(glw_loadable_texture_t *glt)
 {
-}
-
-
-/**
- * Invoked on every frame when status == VALID
- */
-void
-glw_tex_backend_layout(glw_root_t *gr, glw_loadable_texture_t *glt)
-{
-
+  if(glt->glt_pixmap != NULL) {
+    pixmap_release(glt->glt_pixmap);
+    glt->glt_pixmap = NULL;
+  }
 }
 
 
@@ -236,7 +230,6 @@ int
 glw_tex_backend_load(glw_root_t *gr, glw_loadable_texture_t *glt,
 		     pixmap_t *pm)
 {
-  int repeat = glt->glt_flags & GLW_TEX_REPEAT;
   int size;
 
   glt->glt_s = 1;
@@ -244,27 +237,59 @@ glw_tex_backend_load(glw_root_t *gr, glw_loadable_texture_t *glt,
 
   switch(pm->pm_type) {
   case PIXMAP_BGR32:
+  case PIXMAP_IA:
     size = pm->pm_linesize * pm->pm_height;
+    break;
+
+  case PIXMAP_RGB24:
+    size = pm->pm_width * pm->pm_height * 4;
+    break;
+
+  default:
+    return 0;
+  }
+
+  // Copied to RSX memory by glw_tex_backend_layout() on render thread
+
+  if(glt->glt_pixmap != NULL)
+    pixmap_release(glt->glt_pixmap);
+
+  glt->glt_pixmap = pixmap_dup(pm);
+  return size;
+}
+
+
+/**
+ * Invoked on every frame when status == VALID and we have a pixmap
+ * that's not uploaded yet
+ */
+void
+glw_tex_backend_layout(glw_root_t *gr, glw_loadable_texture_t *glt)
+{
+  const pixmap_t *pm = glt->glt_pixmap;
+  int repeat = glt->glt_flags & GLW_TEX_REPEAT;
+
+  switch(pm->pm_type) {
+  case PIXMAP_BGR32:
     init_abgr(gr, &glt->glt_texture, pm->pm_data, pm->pm_linesize,
 	      pm->pm_width, pm->pm_height, repeat);
     break;
 
   case PIXMAP_RGB24:
-    size = pm->pm_width * pm->pm_height * 4;
     init_rgb(gr, &glt->glt_texture, pm->pm_data, pm->pm_linesize,
 	      pm->pm_width, pm->pm_height, repeat);
     break;
 
   case PIXMAP_IA:
-    size = pm->pm_linesize * pm->pm_height;
     init_i8a8(gr, &glt->glt_texture, pm->pm_data, pm->pm_linesize,
 	      pm->pm_width, pm->pm_height, repeat);
     break;
 
   default:
-    return 0;
+    break;
   }
-  return size;
+
+  glw_tex_backend_free_loader_resources(glt);
 }
 
 /**
@@ -298,6 +323,49 @@ glw_tex_upload(glw_root_t *gr, glw_backend_texture_t *tex,
 }
 
 
+/**
+ *
+ */
+void
+glw_tex_upload_rows(glw_root_t *gr, glw_backend_texture_t *tex,
+		    const pixmap_t *pm, int y, int height)
+{
+  const uint8_t *src = pm->pm_pixels + y * pm->pm_linesize;
+  uint8_t *mem;
+  int i, x;
+
+  if(tex->size == 0)
+    return;
+
+  mem = rsx_to_ppu(tex->tex.offset);
+
+  switch(pm->pm_type) {
+  case PIXMAP_IA:
+  case PIXMAP_BGR32:
+    memcpy(mem + y * pm->pm_linesize, src, height * pm->pm_linesize);
+    break;
+
+  case PIXMAP_RGB24:
+    // Expanded to 32 bit as in init_rgb()
+    for(i = 0; i < height; i++) {
+      const uint8_t *s = src;
+      uint32_t *dst = (uint32_t *)mem + (y + i) * pm->pm_width;
+      for(x = 0; x < pm->pm_width; x++) {
+	uint8_t r = *s++;
+	uint8_t g = *s++;
+	uint8_t b = *s++;
+	*dst++ = 0xff000000 | (r << 16) | (g << 8) | b;
+      }
+      src += pm->pm_linesize;
+    }
+    break;
+
+  default:
+    break;
+  }
+}
+
+
 /**
  *
  */
@@ -147,26 +147,55 @@ glw_view_create(glw_root_t *gr, rstr_t *url,
   }
 
   if(gcv == NULL) {
-    int nofile = 0;
+    int nofile = 0, cached = 0;
+    int64_t ts = showtime_get_ts();
     token_t *sof = glw_view_token_alloc(gr);
     sof->type = TOKEN_START;
     sof->file = rstr_dup(url);
-    if((l = glw_view_load1(gr, url, &ei, sof, &nofile)) == NULL) {
-      glw_view_free_chain(gr, sof);
-      if(nofile && !nofail)
-	return NULL;
-      return glw_view_error(gr, &ei, parent);
+
+    if((l = glw_view_bincache_load(gr, url, sof)) != NULL) {
+
+      cached = 1;
+      eof = glw_view_token_alloc(gr);
+      eof->type = TOKEN_END;
+      eof->file = rstr_dup(url);
+      l->next = eof;
+
+    } else {
+
+      glw_view_bincache_track_start(gr);
+
+      if((l = glw_view_load1(gr, url, &ei, sof, &nofile)) == NULL) {
+        glw_view_bincache_track_stop(gr);
+        glw_view_free_chain(gr, sof);
+        if(nofile && !nofail)
+          return NULL;
+        return glw_view_error(gr, &ei, parent);
+      }
+      eof = glw_view_token_alloc(gr);
+      eof->type = TOKEN_END;
+      eof->file = rstr_dup(url);
+      l->next = eof;
+
+      if(glw_view_preproc(gr, sof, &ei)) {
+        glw_view_bincache_track_stop(gr);
+        glw_view_free_chain(gr, sof);
+        return glw_view_error(gr, &ei, parent);
+      }
+
+      glw_view_bincache_store(gr, url, sof, eof);
+      glw_view_bincache_track_stop(gr);
     }
-    eof = glw_view_token_alloc(gr);
-    eof->type = TOKEN_END;
-    eof->file = rstr_dup(url);
-    l->next = eof;
-  
-    if(glw_view_preproc(gr, sof, &ei) || glw_view_parse(sof, &ei, gr)) {
+
+    if(glw_view_parse(sof, &ei, gr)) {
       glw_view_free_chain(gr, sof);
       return glw_view_error(gr, &ei, parent);
     }
 
+    TRACE(TRACE_DEBUG, "GLW", "Compiled %s in %d us (%s)", rstr_get(url),
+          (int)(showtime_get_ts() - ts),
+          cached ? "from cache" : "from text");
+
     if(cache) {
       gcv = malloc(sizeof(glw_cached_view_t));
       gcv->gcv_sof = sof;
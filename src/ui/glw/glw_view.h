@@ -168,6 +168,13 @@ typedef struct token {
       int set;
       int clr;
     } modflags;
+
+    struct {
+      int16_t width;
+      int16_t height;
+      int16_t layer;
+      int16_t valid;
+    } layout;  // Geometry a dynamic TOKEN_RPN was last evaluated with
   } u;
 
 #define t_set             u.modflags.set
@@ -187,6 +194,7 @@ typedef struct token {
 #define t_pixmap          u.pixmap
 #define t_link_rtitle     u.link.rtitle
 #define t_link_rurl       u.link.rurl
+#define t_layout          u.layout
 
 } token_t;
 
@@ -220,6 +228,7 @@ typedef struct glw_view_eval_context {
 #define GLW_VIEW_DYNAMIC_EVAL_FHP_CHANGE           0x8
 #define GLW_VIEW_DYNAMIC_KEEP                      0x10
 #define GLW_VIEW_DYNAMIC_EVAL_WIDGET_META          0x20
+#define GLW_VIEW_DYNAMIC_EVAL_LAYOUT               0x40
 
   token_t *rpn; 
 
@@ -248,6 +257,8 @@ typedef struct glw_clone {
   prop_t *c_prop;
 
   char c_evaluated;
+  char c_parked;
+  TAILQ_ENTRY(glw_clone) c_parked_link;
 
   prop_t *c_clone_root;
 
@@ -317,6 +328,21 @@ token_t *glw_view_clone_chain(glw_root_t *gr, token_t *src, token_t **lp);
 
 void glw_view_cache_flush(glw_root_t *gr);
 
+void glw_view_bincache_track_start(glw_root_t *gr);
+
+void glw_view_bincache_track_stop(glw_root_t *gr);
+
+void glw_view_bincache_track(glw_root_t *gr, rstr_t *path, const buf_t *b);
+
+void glw_view_bincache_store(glw_root_t *gr, rstr_t *url,
+			     const token_t *sof, const token_t *eof);
+
+token_t *glw_view_bincache_load(glw_root_t *gr, rstr_t *url, token_t *sof);
+
+int glw_view_bincache_test(glw_root_t *gr);
+
+void glw_view_eval_stats_report(glw_root_t *gr, int frames);
+
 struct glw_prop_sub_list;
 void glw_prop_subscription_destroy_list(glw_root_t *gr, 
 					struct glw_prop_sub_list *l);
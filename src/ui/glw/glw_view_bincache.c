@@ -0,0 +1,751 @@
+/*
+ *  GL Widgets, view loader, cache of preprocessed views
+ *  Copyright (C) 2013 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "glw.h"
+#include "glw_view.h"
+#include "blobcache.h"
+#include "fileaccess/fileaccess.h"
+#include "htsmsg/htsbuf.h"
+
+/**
+ * A view is stored in the blobcache as the token stream we get after
+ * lexing and preprocessing, that is, with all includes, imports and
+ * macros expanded. Loading it back skips lexing each included file
+ * as well as the macro expansion.
+ *
+ * The parser is still run on the loaded stream. It resolves functions
+ * and attributes into pointers and runs token constructors that set up
+ * runtime state, none of which can be stored on disk.
+ *
+ * Along with the tokens we store the path, modification time, size
+ * and a hash of the contents of every file that went into the view.
+ * An entry is only used if all of them are unchanged and the view
+ * search paths (which decide what skin:// etc resolve to) are the same.
+ * A file is only loaded and hashed again if its modification time or
+ * size differs. Macros are only defined from within view files so they
+ * are covered by the file hashes.
+ *
+ * glw_view_create() traces how long each view took to compile and
+ * whether it came from here or from text.
+ */
+
+#define GVB_MAGIC   0x47564231  // GVB1
+#define GVB_VERSION 2
+#define GVB_STASH   "glwview"
+
+typedef struct gvb_header {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t env;
+  uint32_t num_deps;
+  uint32_t num_files;
+  uint32_t num_tokens;
+} gvb_header_t;
+
+
+typedef struct gvb_token {
+  uint8_t type;
+  uint8_t strtype;
+  uint16_t flags;
+  uint16_t file;
+  uint16_t pad;
+  uint32_t line;
+} gvb_token_t;
+
+
+typedef struct glw_view_dep {
+  rstr_t *path;
+  uint64_t hash;
+  int64_t mtime;
+  int64_t size;
+} glw_view_dep_t;
+
+
+typedef struct glw_view_deps {
+  glw_view_dep_t *deps;
+  int num_deps;
+  int capacity;
+} glw_view_deps_t;
+
+
+/**
+ *
+ */
+static uint64_t
+gvb_hash(uint64_t h, const void *data, size_t len)
+{
+  const uint8_t *d = data;
+  while(len--) {
+    h ^= *d++;
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+
+/**
+ *
+ */
+static uint64_t
+gvb_env(glw_root_t *gr)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+  int i;
+
+  for(i = 0; gr->gr_vpaths[i] != NULL; i++)
+    h = gvb_hash(h, gr->gr_vpaths[i], strlen(gr->gr_vpaths[i]) + 1);
+  return h;
+}
+
+
+/**
+ *
+ */
+static uint64_t
+gvb_file_hash(const buf_t *b)
+{
+  return gvb_hash(0xcbf29ce484222325ULL, b->b_ptr, b->b_size);
+}
+
+
+/**
+ *
+ */
+static void
+gvb_file_stat(glw_root_t *gr, rstr_t *path, int64_t *mtime, int64_t *size)
+{
+  struct fa_stat fs;
+  char errbuf[256];
+
+  if(fa_stat_vpaths(rstr_get(path), gr->gr_vpaths, &fs,
+		    errbuf, sizeof(errbuf))) {
+    *mtime = -1;
+    *size = -1;
+  } else {
+    *mtime = fs.fs_mtime;
+    *size = fs.fs_size;
+  }
+}
+
+
+/**
+ * Start recording the files loaded by glw_view_load1()
+ */
+void
+glw_view_bincache_track_start(glw_root_t *gr)
+{
+  gr->gr_view_deps = calloc(1, sizeof(glw_view_deps_t));
+}
+
+
+/**
+ *
+ */
+void
+glw_view_bincache_track_stop(glw_root_t *gr)
+{
+  glw_view_deps_t *gvd = gr->gr_view_deps;
+  int i;
+
+  if(gvd == NULL)
+    return;
+
+  for(i = 0; i < gvd->num_deps; i++)
+    rstr_release(gvd->deps[i].path);
+  free(gvd->deps);
+  free(gvd);
+  gr->gr_view_deps = NULL;
+}
+
+
+/**
+ * Called by glw_view_load1() for each file it loads
+ */
+void
+glw_view_bincache_track(glw_root_t *gr, rstr_t *path, const buf_t *b)
+{
+  glw_view_deps_t *gvd = gr->gr_view_deps;
+  glw_view_dep_t *d;
+
+  if(gvd == NULL)
+    return;
+
+  if(gvd->num_deps == gvd->capacity) {
+    gvd->capacity = 2 * gvd->capacity + 8;
+    gvd->deps = realloc(gvd->deps, gvd->capacity * sizeof(glw_view_dep_t));
+  }
+
+  d = &gvd->deps[gvd->num_deps++];
+  d->path = rstr_dup(path);
+  d->hash = gvb_file_hash(b);
+  gvb_file_stat(gr, path, &d->mtime, &d->size);
+
+  // If the file changed after we loaded it, make sure it's hashed on load
+  if(d->size != b->b_size)
+    d->mtime = -1;
+}
+
+
+/**
+ * Only token types produced by the lexer are stored
+ */
+typedef enum {
+  GVB_UNSUPPORTED,
+  GVB_SIMPLE,
+  GVB_STRING,
+  GVB_FLOAT,
+  GVB_INT,
+} gvb_kind_t;
+
+static gvb_kind_t
+gvb_token_kind(int type)
+{
+  switch(type) {
+  case TOKEN_RSTRING:
+  case TOKEN_IDENTIFIER:
+    return GVB_STRING;
+
+  case TOKEN_FLOAT:
+    return GVB_FLOAT;
+
+  case TOKEN_INT:
+    return GVB_INT;
+
+  case TOKEN_VOID:
+  case TOKEN_HASH:
+  case TOKEN_ASSIGNMENT:
+  case TOKEN_COND_ASSIGNMENT:
+  case TOKEN_END_OF_EXPR:
+  case TOKEN_SEPARATOR:
+  case TOKEN_BLOCK_OPEN:
+  case TOKEN_BLOCK_CLOSE:
+  case TOKEN_LEFT_PARENTHESIS:
+  case TOKEN_RIGHT_PARENTHESIS:
+  case TOKEN_LEFT_BRACKET:
+  case TOKEN_RIGHT_BRACKET:
+  case TOKEN_DOT:
+  case TOKEN_ADD:
+  case TOKEN_SUB:
+  case TOKEN_MULTIPLY:
+  case TOKEN_DIVIDE:
+  case TOKEN_MODULO:
+  case TOKEN_DOLLAR:
+  case TOKEN_AMPERSAND:
+  case TOKEN_BOOLEAN_AND:
+  case TOKEN_BOOLEAN_OR:
+  case TOKEN_BOOLEAN_XOR:
+  case TOKEN_EQ:
+  case TOKEN_NEQ:
+  case TOKEN_BOOLEAN_NOT:
+  case TOKEN_NULL_COALESCE:
+  case TOKEN_LT:
+  case TOKEN_GT:
+  case TOKEN_COLON:
+    return GVB_SIMPLE;
+
+  default:
+    return GVB_UNSUPPORTED;
+  }
+}
+
+
+/**
+ *
+ */
+static int
+gvb_put_string(htsbuf_queue_t *q, const char *str)
+{
+  size_t len = strlen(str);
+  uint16_t l16 = len;
+
+  if(len > UINT16_MAX)
+    return -1;
+  htsbuf_append(q, &l16, sizeof(l16));
+  htsbuf_append(q, str, len);
+  return 0;
+}
+
+
+/**
+ * Store the preprocessed tokens between 'sof' and 'eof'
+ */
+void
+glw_view_bincache_store(glw_root_t *gr, rstr_t *url,
+			const token_t *sof, const token_t *eof)
+{
+  glw_view_deps_t *gvd = gr->gr_view_deps;
+  const token_t *t;
+  rstr_t **files = NULL;
+  int num_files = 0, i;
+  gvb_header_t h = {0};
+  gvb_token_t gt = {0};
+  htsbuf_queue_t hdr, q;
+  buf_t *b;
+
+  if(gvd == NULL)
+    return;
+
+  htsbuf_queue_init(&q, 0);
+
+  for(t = sof->next; t != eof; t = t->next) {
+
+    for(i = num_files - 1; i >= 0; i--)
+      if(files[i] == t->file)
+	break;
+
+    if(i < 0) {
+      if(num_files == UINT16_MAX)
+	goto bad;
+      files = realloc(files, (num_files + 1) * sizeof(rstr_t *));
+      files[num_files] = t->file;
+      i = num_files++;
+    }
+
+    gt.type    = t->type;
+    gt.strtype = 0;
+    gt.flags   = t->t_flags;
+    gt.file    = i;
+    gt.line    = t->line;
+
+    switch(gvb_token_kind(t->type)) {
+    case GVB_STRING:
+      if(t->type == TOKEN_RSTRING)
+	gt.strtype = t->t_rstrtype;
+      htsbuf_append(&q, &gt, sizeof(gt));
+      if(gvb_put_string(&q, rstr_get(t->t_rstring)))
+	goto bad;
+      break;
+
+    case GVB_FLOAT:
+      htsbuf_append(&q, &gt, sizeof(gt));
+      htsbuf_append(&q, &t->t_float, sizeof(float));
+      break;
+
+    case GVB_INT:
+      htsbuf_append(&q, &gt, sizeof(gt));
+      htsbuf_append(&q, &t->t_int, sizeof(int));
+      break;
+
+    case GVB_SIMPLE:
+      htsbuf_append(&q, &gt, sizeof(gt));
+      break;
+
+    default:
+      // Not something the lexer produces, don't know how to store it
+      goto bad;
+    }
+    h.num_tokens++;
+  }
+
+  htsbuf_queue_init(&hdr, 0);
+
+  h.magic     = GVB_MAGIC;
+  h.version   = GVB_VERSION;
+  h.env       = gvb_env(gr);
+  h.num_deps  = gvd->num_deps;
+  h.num_files = num_files;
+  htsbuf_append(&hdr, &h, sizeof(h));
+
+  for(i = 0; i < gvd->num_deps; i++) {
+    if(gvb_put_string(&hdr, rstr_get(gvd->deps[i].path)))
+      goto bad2;
+    htsbuf_append(&hdr, &gvd->deps[i].hash,  sizeof(uint64_t));
+    htsbuf_append(&hdr, &gvd->deps[i].mtime, sizeof(int64_t));
+    htsbuf_append(&hdr, &gvd->deps[i].size,  sizeof(int64_t));
+  }
+
+  for(i = 0; i < num_files; i++)
+    if(gvb_put_string(&hdr, rstr_get(files[i])))
+      goto bad2;
+
+  htsbuf_appendq(&hdr, &q);
+
+  b = buf_create(hdr.hq_size);
+  htsbuf_read(&hdr, b->b_ptr, b->b_size);
+  blobcache_put(rstr_get(url), GVB_STASH, b, INT32_MAX, NULL, 0);
+  buf_release(b);
+
+ bad2:
+  htsbuf_queue_flush(&hdr);
+ bad:
+  htsbuf_queue_flush(&q);
+  free(files);
+}
+
+
+/**
+ *
+ */
+typedef struct gvb_reader {
+  const uint8_t *ptr;
+  size_t left;
+} gvb_reader_t;
+
+
+/**
+ *
+ */
+static int
+gvb_read(gvb_reader_t *r, void *out, size_t len)
+{
+  if(r->left < len)
+    return -1;
+  memcpy(out, r->ptr, len);
+  r->ptr  += len;
+  r->left -= len;
+  return 0;
+}
+
+
+/**
+ *
+ */
+static rstr_t *
+gvb_read_rstr(gvb_reader_t *r)
+{
+  uint16_t len;
+  rstr_t *rs;
+
+  if(gvb_read(r, &len, sizeof(len)) || r->left < len)
+    return NULL;
+
+  rs = rstr_allocl((const char *)r->ptr, len);
+  r->ptr  += len;
+  r->left -= len;
+  return rs;
+}
+
+
+/**
+ * Make sure none of the files the view was built from has changed
+ */
+static int
+gvb_check_deps(glw_root_t *gr, gvb_reader_t *r, int num_deps)
+{
+  char errbuf[256];
+  uint64_t hash;
+  int64_t mtime, size, cur_mtime, cur_size;
+  rstr_t *path;
+  buf_t *b;
+  int i;
+
+  for(i = 0; i < num_deps; i++) {
+    if((path = gvb_read_rstr(r)) == NULL)
+      return -1;
+
+    if(gvb_read(r, &hash,  sizeof(hash)) ||
+       gvb_read(r, &mtime, sizeof(mtime)) ||
+       gvb_read(r, &size,  sizeof(size))) {
+      rstr_release(path);
+      return -1;
+    }
+
+    gvb_file_stat(gr, path, &cur_mtime, &cur_size);
+
+    if(mtime != -1 && cur_mtime == mtime && cur_size == size) {
+      rstr_release(path);
+      continue;
+    }
+
+    b = fa_load(rstr_get(path), gr->gr_vpaths, errbuf, sizeof(errbuf),
+		NULL, 0, NULL, NULL);
+    rstr_release(path);
+
+    if(b == NULL)
+      return -1;
+
+    if(gvb_file_hash(b) != hash) {
+      buf_release(b);
+      return -1;
+    }
+    buf_release(b);
+  }
+  return 0;
+}
+
+
+/**
+ * Load tokens for 'url' and link them after 'sof'
+ *
+ * Returns pointer to last token or NULL if there is no usable entry
+ */
+token_t *
+glw_view_bincache_load(glw_root_t *gr, rstr_t *url, token_t *sof)
+{
+  buf_t *b = blobcache_get(rstr_get(url), GVB_STASH, 0, NULL, NULL, NULL);
+  gvb_header_t h;
+  gvb_token_t gt;
+  gvb_reader_t r;
+  rstr_t **files = NULL;
+  token_t *prev = sof, *t;
+  int i;
+
+  if(b == NULL)
+    return NULL;
+
+  r.ptr  = b->b_ptr;
+  r.left = b->b_size;
+
+  if(gvb_read(&r, &h, sizeof(h)) ||
+     h.magic != GVB_MAGIC || h.version != GVB_VERSION ||
+     h.env != gvb_env(gr) || h.num_files > UINT16_MAX ||
+     gvb_check_deps(gr, &r, h.num_deps))
+    goto bad;
+
+  files = calloc(h.num_files, sizeof(rstr_t *));
+  for(i = 0; i < h.num_files; i++)
+    if((files[i] = gvb_read_rstr(&r)) == NULL)
+      goto bad;
+
+  for(i = 0; i < h.num_tokens; i++) {
+    if(gvb_read(&r, &gt, sizeof(gt)) || gt.file >= h.num_files)
+      goto bad;
+
+    const gvb_kind_t kind = gvb_token_kind(gt.type);
+    if(kind == GVB_UNSUPPORTED)
+      goto bad;
+
+    t = glw_view_token_alloc(gr);
+    t->type    = kind == GVB_STRING ? TOKEN_NOP : gt.type;
+    t->t_flags = gt.flags;
+    t->file    = rstr_dup(files[gt.file]);
+    t->line    = gt.line;
+    prev->next = t;
+    prev = t;
+
+    switch(kind) {
+    case GVB_STRING:
+      if((t->t_rstring = gvb_read_rstr(&r)) == NULL)
+	goto bad;
+      t->type = gt.type;
+      if(t->type == TOKEN_RSTRING)
+	t->t_rstrtype = gt.strtype;
+      break;
+
+    case GVB_FLOAT:
+      if(gvb_read(&r, &t->t_float, sizeof(float)))
+	goto bad;
+      break;
+
+    case GVB_INT:
+      if(gvb_read(&r, &t->t_int, sizeof(int)))
+	goto bad;
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  if(r.left != 0)
+    goto bad;
+
+  for(i = 0; i < h.num_files; i++)
+    rstr_release(files[i]);
+  free(files);
+  buf_release(b);
+  return prev;
+
+ bad:
+  if(sof->next != NULL) {
+    glw_view_free_chain(gr, sof->next);
+    sof->next = NULL;
+  }
+
+  if(files != NULL) {
+    for(i = 0; i < h.num_files; i++)
+      rstr_release(files[i]);
+    free(files);
+  }
+  buf_release(b);
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static int
+gvb_token_cmp(const token_t *a, const token_t *b)
+{
+  if(a->type != b->type || a->t_flags != b->t_flags || a->line != b->line ||
+     strcmp(rstr_get(a->file), rstr_get(b->file)))
+    return 1;
+
+  switch(gvb_token_kind(a->type)) {
+  case GVB_STRING:
+    if(a->type == TOKEN_RSTRING && a->t_rstrtype != b->t_rstrtype)
+      return 1;
+    return strcmp(rstr_get(a->t_rstring), rstr_get(b->t_rstring));
+  case GVB_FLOAT:
+    return a->t_float != b->t_float;
+  case GVB_INT:
+    return a->t_int != b->t_int;
+  default:
+    return 0;
+  }
+}
+
+
+/**
+ * Compile 'url' from text, store it and load it back from the cache.
+ * The loaded token stream must be identical to the compiled one
+ */
+static int
+gvb_test_view(glw_root_t *gr, rstr_t *url)
+{
+  token_t *sof = glw_view_token_alloc(gr);
+  token_t *sof2 = glw_view_token_alloc(gr);
+  token_t *eof, *l, *a, *b;
+  errorinfo_t ei;
+  int nofile = 0, r = -1;
+
+  sof->type = TOKEN_START;
+  sof->file = rstr_dup(url);
+  sof2->type = TOKEN_START;
+  sof2->file = rstr_dup(url);
+
+  glw_view_bincache_track_start(gr);
+
+  if((l = glw_view_load1(gr, url, &ei, sof, &nofile)) == NULL) {
+    glw_view_bincache_track_stop(gr);
+    TRACE(TRACE_ERROR, "GLW", "%s: Unable to load -- %s:%d: %s",
+	  rstr_get(url), ei.file, ei.line, ei.error);
+    goto out;
+  }
+
+  eof = glw_view_token_alloc(gr);
+  eof->type = TOKEN_END;
+  eof->file = rstr_dup(url);
+  l->next = eof;
+
+  if(glw_view_preproc(gr, sof, &ei)) {
+    glw_view_bincache_track_stop(gr);
+    TRACE(TRACE_ERROR, "GLW", "%s: Unable to preprocess -- %s:%d: %s",
+	  rstr_get(url), ei.file, ei.line, ei.error);
+    goto out;
+  }
+
+  glw_view_bincache_store(gr, url, sof, eof);
+  glw_view_bincache_track_stop(gr);
+
+  if(glw_view_bincache_load(gr, url, sof2) == NULL) {
+    TRACE(TRACE_ERROR, "GLW", "%s: Not stored in view cache", rstr_get(url));
+    goto out;
+  }
+
+  for(a = sof->next, b = sof2->next; a != eof && b != NULL;
+      a = a->next, b = b->next) {
+    if(gvb_token_cmp(a, b)) {
+      TRACE(TRACE_ERROR, "GLW", "%s: Token at %s:%d differs in view cache",
+	    rstr_get(url), rstr_get(a->file), a->line);
+      goto out;
+    }
+  }
+
+  if(a != eof || b != NULL) {
+    TRACE(TRACE_ERROR, "GLW", "%s: Token count differs in view cache",
+	  rstr_get(url));
+    goto out;
+  }
+  r = 0;
+
+ out:
+  glw_view_free_chain(gr, sof);
+  glw_view_free_chain(gr, sof2);
+  return r;
+}
+
+
+/**
+ *
+ */
+static void
+gvb_test_dir(glw_root_t *gr, const char *path, int *views, int *fails)
+{
+  char errbuf[256];
+  char url[PATH_MAX];
+  fa_dir_entry_t *fde;
+  fa_dir_t *fd;
+
+  if(snprintf(url, sizeof(url), "%s%s", gr->gr_skin, path) >= sizeof(url)) {
+    TRACE(TRACE_ERROR, "GLW", "Path too long: %s%s", gr->gr_skin, path);
+    (*fails)++;
+    return;
+  }
+
+  if((fd = fa_scandir(url, errbuf, sizeof(errbuf))) == NULL) {
+    TRACE(TRACE_ERROR, "GLW", "Unable to scan %s -- %s", url, errbuf);
+    (*fails)++;
+    return;
+  }
+
+  RB_FOREACH(fde, &fd->fd_entries, fde_link) {
+    const char *fname = rstr_get(fde->fde_filename);
+    const char *ext = strrchr(fname, '.');
+
+    if(snprintf(url, sizeof(url), "%s/%s", path, fname) >= sizeof(url)) {
+      TRACE(TRACE_ERROR, "GLW", "Path too long: %s/%s", path, fname);
+      (*fails)++;
+      continue;
+    }
+
+    if(fde->fde_type == CONTENT_DIR) {
+      gvb_test_dir(gr, url, views, fails);
+
+    } else if(ext != NULL && !strcmp(ext, ".view")) {
+      char skinurl[PATH_MAX];
+      rstr_t *u;
+
+      if(snprintf(skinurl, sizeof(skinurl), "skin:/%s", url) >=
+         sizeof(skinurl)) {
+        TRACE(TRACE_ERROR, "GLW", "Path too long: skin:/%s", url);
+        (*fails)++;
+        continue;
+      }
+
+      u = rstr_alloc(skinurl);
+      (*views)++;
+      if(gvb_test_view(gr, u))
+	(*fails)++;
+      rstr_release(u);
+    }
+  }
+  fa_dir_free(fd);
+}
+
+
+/**
+ * Run every view in the skin through the view cache
+ *
+ * Returns the number of views that failed
+ */
+int
+glw_view_bincache_test(glw_root_t *gr)
+{
+  int views = 0, fails = 0;
+
+  gvb_test_dir(gr, "", &views, &fails);
+
+  TRACE(fails ? TRACE_ERROR : TRACE_INFO, "GLW",
+	"View cache test: %d of %d views OK", views - fails, views);
+  return fails;
+}
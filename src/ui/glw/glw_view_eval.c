@@ -36,6 +36,7 @@
 #include "glw_text_bitmap.h"
 
 LIST_HEAD(clone_list, glw_clone);
+TAILQ_HEAD(clone_queue, glw_clone);
 TAILQ_HEAD(vectorizer_element_queue, vectorizer_element);
 
 static token_t t_zero = {
@@ -111,6 +112,9 @@ typedef struct sub_cloner {
 
   struct clone_list sc_clones;
 
+  struct clone_queue sc_parked;
+  int sc_num_parked;
+
 } sub_cloner_t;
 
 
@@ -264,6 +268,11 @@ glw_prop_subscription_suspend_list(struct glw_prop_sub_list *l)
 static void eval_dynamic(glw_t *w, token_t *rpn, struct glw_rctx *rc,
 			 prop_t *prop, prop_t *view, prop_t *clone);
 
+static void eval_dynamic_setup(glw_t *w, token_t *rpn, const glw_rctx_t *rc,
+			       int flags);
+
+static void glw_view_eval_stats_count(glw_root_t *gr, const token_t *rpn);
+
 static int glw_view_eval_rpn0(token_t *t0, glw_view_eval_context_t *ec);
 
 /**
@@ -982,6 +991,45 @@ eval_dynamic_every_frame_sig(glw_t *w, void *opaque,
   return 0;
 }
 
+
+/**
+ * Width and height as seen by getWidth() and getHeight()
+ */
+static int
+eval_layout_width(const glw_t *w, const glw_rctx_t *rc)
+{
+  return w->glw_flags & GLW_CONSTRAINT_CONF_X ?
+    w->glw_req_size_x : rc->rc_width;
+}
+
+static int
+eval_layout_height(const glw_t *w, const glw_rctx_t *rc)
+{
+  return w->glw_flags & GLW_CONSTRAINT_CONF_Y ?
+    w->glw_req_size_y : rc->rc_height;
+}
+
+
+/**
+ * Expressions that only depend on the widget geometry are rerun
+ * when it differs from what they were last evaluated with
+ */
+static int
+eval_dynamic_layout_sig(glw_t *w, void *opaque,
+			glw_signal_t signal, void *extra)
+{
+  token_t *rpn = opaque;
+  const glw_rctx_t *rc = extra;
+
+  if(signal == GLW_SIGNAL_LAYOUT &&
+     (!rpn->t_layout.valid ||
+      rpn->t_layout.width  != eval_layout_width(w, rc) ||
+      rpn->t_layout.height != eval_layout_height(w, rc) ||
+      rpn->t_layout.layer  != rc->rc_layer))
+    eval_dynamic(w, rpn, extra, NULL, NULL, NULL);
+  return 0;
+}
+
 /**
  *
  */
@@ -1045,37 +1093,184 @@ eval_dynamic(glw_t *w, token_t *rpn, struct glw_rctx *rc,
 
   ec.sublist = &w->glw_prop_subscriptions;
 
+  if(gconf.enable_glw_eval_stats)
+    glw_view_eval_stats_count(ec.gr, rpn);
+
   glw_view_eval_rpn0(rpn, &ec);
 
   glw_view_free_chain(ec.gr, ec.alloc);
 
-  if(ec.dynamic_eval & GLW_VIEW_DYNAMIC_EVAL_EVERY_FRAME)
+  eval_dynamic_setup(w, rpn, rc, ec.dynamic_eval);
+}
+
+
+/**
+ * (Un)register the signal handlers that rerun 'rpn' depending on
+ * what it looked at during its last evaluation
+ */
+static void
+eval_dynamic_setup(glw_t *w, token_t *rpn, const glw_rctx_t *rc, int flags)
+{
+  if(flags & GLW_VIEW_DYNAMIC_EVAL_EVERY_FRAME)
     glw_signal_handler_register(w, eval_dynamic_every_frame_sig, rpn, 1000);
   else
     glw_signal_handler_unregister(w, eval_dynamic_every_frame_sig, rpn);
 
-  if(ec.dynamic_eval & GLW_VIEW_DYNAMIC_EVAL_FOCUSED_CHILD_CHANGE)
+  if(flags & GLW_VIEW_DYNAMIC_EVAL_LAYOUT) {
+    if(rc != NULL) {
+      rpn->t_layout.width  = eval_layout_width(w, rc);
+      rpn->t_layout.height = eval_layout_height(w, rc);
+      rpn->t_layout.layer  = rc->rc_layer;
+      rpn->t_layout.valid  = 1;
+    } else {
+      rpn->t_layout.valid  = 0;
+    }
+  }
+
+  // Every frame implies every layout so no need for both
+  if(flags & GLW_VIEW_DYNAMIC_EVAL_LAYOUT &&
+     !(flags & GLW_VIEW_DYNAMIC_EVAL_EVERY_FRAME))
+    glw_signal_handler_register(w, eval_dynamic_layout_sig, rpn, 1000);
+  else
+    glw_signal_handler_unregister(w, eval_dynamic_layout_sig, rpn);
+
+  if(flags & GLW_VIEW_DYNAMIC_EVAL_FOCUSED_CHILD_CHANGE)
     glw_signal_handler_register(w, eval_dynamic_focused_child_change_sig,
 				rpn, 1000);
   else
     glw_signal_handler_unregister(w, eval_dynamic_focused_child_change_sig,
 				  rpn);
 
-  if(ec.dynamic_eval & GLW_VIEW_DYNAMIC_EVAL_FHP_CHANGE)
+  if(flags & GLW_VIEW_DYNAMIC_EVAL_FHP_CHANGE)
     glw_signal_handler_register(w, eval_dynamic_fhp_change_sig, rpn, 1000);
   else
     glw_signal_handler_unregister(w, eval_dynamic_fhp_change_sig, rpn);
 
-  if(ec.dynamic_eval & GLW_VIEW_DYNAMIC_EVAL_WIDGET_META)
+  if(flags & GLW_VIEW_DYNAMIC_EVAL_WIDGET_META)
     glw_signal_handler_register(w, eval_dynamic_widget_meta_sig, rpn, 1000);
   else
     glw_signal_handler_unregister(w, eval_dynamic_widget_meta_sig, rpn);
 }
 
 
+/**
+ * Number of times each dynamic expression has been rerun, keyed on
+ * where it is in the view source. Enabled from the developer settings
+ * and dumped to the log with glw_view_eval_stats_report() so skin
+ * authors can find the expressions that cost the most.
+ */
+typedef struct glw_view_eval_stat {
+  LIST_ENTRY(glw_view_eval_stat) ges_link;
+  rstr_t *ges_file;
+  int ges_line;
+  int ges_count;
+} glw_view_eval_stat_t;
+
+
+/**
+ *
+ */
+static void
+glw_view_eval_stats_count(glw_root_t *gr, const token_t *rpn)
+{
+  glw_view_eval_stat_t *ges;
+
+  LIST_FOREACH(ges, &gr->gr_eval_stats, ges_link)
+    if(ges->ges_line == rpn->line &&
+       (ges->ges_file == rpn->file ||
+        !strcmp(rstr_get(ges->ges_file), rstr_get(rpn->file))))
+      break;
+
+  if(ges == NULL) {
+    ges = calloc(1, sizeof(glw_view_eval_stat_t));
+    ges->ges_file = rstr_dup(rpn->file);
+    ges->ges_line = rpn->line;
+  } else {
+    LIST_REMOVE(ges, ges_link);
+  }
+  // Keep hot entries first
+  LIST_INSERT_HEAD(&gr->gr_eval_stats, ges, ges_link);
+  ges->ges_count++;
+}
+
+
+/**
+ *
+ */
+static int
+ges_cmp(const void *A, const void *B)
+{
+  const glw_view_eval_stat_t *a = *(const glw_view_eval_stat_t **)A;
+  const glw_view_eval_stat_t *b = *(const glw_view_eval_stat_t **)B;
+  return b->ges_count - a->ges_count;
+}
+
+
+/**
+ * Log the most evaluated expressions since last call and reset.
+ * 'frames' is the number of frames that passed, 0 just frees the stats
+ */
+void
+glw_view_eval_stats_report(glw_root_t *gr, int frames)
+{
+  glw_view_eval_stat_t *ges, **v;
+  int i, n = 0, total = 0;
+
+  LIST_FOREACH(ges, &gr->gr_eval_stats, ges_link)
+    n++;
+
+  if(n == 0)
+    return;
+
+  v = malloc(sizeof(glw_view_eval_stat_t *) * n);
+  i = 0;
+  while((ges = LIST_FIRST(&gr->gr_eval_stats)) != NULL) {
+    LIST_REMOVE(ges, ges_link);
+    total += ges->ges_count;
+    v[i++] = ges;
+  }
+
+  qsort(v, n, sizeof(glw_view_eval_stat_t *), ges_cmp);
+
+  if(frames > 0) {
+    TRACE(TRACE_DEBUG, "GLW",
+	  "%.1f dynamic evaluations/frame in %d expressions",
+	  (float)total / frames, n);
+
+    for(i = 0; i < n && i < 10; i++)
+      TRACE(TRACE_DEBUG, "GLW", "  %6.1f/frame  %s:%d",
+	    (float)v[i]->ges_count / frames,
+	    rstr_get(v[i]->ges_file), v[i]->ges_line);
+  }
+
+  for(i = 0; i < n; i++) {
+    rstr_release(v[i]->ges_file);
+    free(v[i]);
+  }
+  free(v);
+}
+
+
 
 static void cloner_resequence(sub_cloner_t *sc);
 
+static int clone_sig_handler(glw_t *w, void *opaque, glw_signal_t signal,
+			     void *extra);
+
+/**
+ * When cloning into a widget with GLW_VIRTUAL_CHILDS only the first
+ * CLONER_EAGER_ITEMS items past the highest active one are instantiated
+ * right away. The rest get a placeholder widget that is instantiated
+ * once the parent lays it out.
+ *
+ * Instantiated clones that go inactive are parked. When more than
+ * CLONER_MAX_PARKED are parked the oldest half is turned back into
+ * placeholders, keeping their sizes so the layout does not move.
+ * Doing it in batches keeps the number of relayouts of the parent down.
+ */
+#define CLONER_EAGER_ITEMS 32
+#define CLONER_MAX_PARKED  128
+
 
 
 /**
@@ -1113,6 +1308,109 @@ clone_eval(glw_clone_t *c)
 }
 
 
+/**
+ *
+ */
+static void
+clone_instantiate(glw_clone_t *c)
+{
+  glw_t *w = c->c_w;
+
+  c->c_evaluated = 1;
+  clone_eval(c);
+
+  if(w->glw_flags & GLW_PLACEHOLDER) {
+    w->glw_flags &= ~GLW_PLACEHOLDER;
+    glw_signal0(w->glw_parent, GLW_SIGNAL_CHILD_CONSTRAINTS_CHANGED, w);
+  }
+}
+
+
+/**
+ *
+ */
+static void
+clone_unpark(glw_clone_t *c)
+{
+  sub_cloner_t *sc = c->c_sc;
+
+  if(!c->c_parked)
+    return;
+  TAILQ_REMOVE(&sc->sc_parked, c, c_parked_link);
+  sc->sc_num_parked--;
+  c->c_parked = 0;
+}
+
+
+/**
+ *
+ */
+static glw_t *
+clone_create_widget(glw_clone_t *c, glw_t *parent, glw_t *before)
+{
+  sub_cloner_t *sc = c->c_sc;
+  glw_t *w = glw_create(parent->glw_root, sc->sc_cloner_class,
+                        parent, before, c->c_prop);
+  w->glw_clone = c;
+
+  glw_set(w,
+	  GLW_ATTRIB_PROPROOTS3, c->c_prop, sc->sc_originating_prop,
+          c->c_clone_root,
+	  NULL);
+
+  glw_signal_handler_register(w, clone_sig_handler, c, 1000);
+  return w;
+}
+
+
+/**
+ * Replace the widget tree of a parked clone with a placeholder
+ */
+static void
+clone_recycle(glw_clone_t *c)
+{
+  glw_t *old = c->c_w;
+  glw_t *parent = old->glw_parent;
+
+  clone_unpark(c);
+
+  if(old->glw_flags & (GLW_ACTIVE | GLW_IN_FOCUS_PATH) ||
+     parent->glw_focused == old || parent->glw_selected == old)
+    return;
+
+  c->c_w = clone_create_widget(c, parent, old);
+  c->c_w->glw_flags |= GLW_PLACEHOLDER;
+  glw_copy_constraints(c->c_w, old);
+  c->c_evaluated = 0;
+
+  old->glw_clone = NULL;
+  glw_signal_handler_unregister(old, clone_sig_handler, c);
+  glw_retire_child(old);
+}
+
+
+/**
+ *
+ */
+static void
+clone_park(glw_clone_t *c)
+{
+  sub_cloner_t *sc = c->c_sc;
+
+  if(c->c_parked || !c->c_evaluated ||
+     !(c->c_w->glw_parent->glw_class->gc_flags & GLW_VIRTUAL_CHILDS))
+    return;
+
+  TAILQ_INSERT_TAIL(&sc->sc_parked, c, c_parked_link);
+  sc->sc_num_parked++;
+  c->c_parked = 1;
+
+  if(sc->sc_num_parked > CLONER_MAX_PARKED)
+    while(sc->sc_num_parked > CLONER_MAX_PARKED / 2)
+      clone_recycle(TAILQ_FIRST(&sc->sc_parked));
+}
+
+
 /**
  *
  */
@@ -1178,6 +1476,10 @@ clone_sig_handler(glw_t *w, void *opaque, glw_signal_t signal, void *extra)
   glw_root_t *gr;
   switch(signal) {
   case GLW_SIGNAL_ACTIVE:
+    clone_unpark(c);
+    if(!c->c_evaluated)
+      clone_instantiate(c);
+
     if(!sc->sc_positions_valid)
       cloner_resequence(sc);
     
@@ -1201,12 +1503,20 @@ clone_sig_handler(glw_t *w, void *opaque, glw_signal_t signal, void *extra)
       sc->sc_highest_active = c->c_pos - 1;
 
     cloner_pagination_check(sc);
+    clone_park(c);
     break;
 
   case GLW_SIGNAL_MOVE:
     clone_req_move(sc, w, extra);
     return 1;
 
+  case GLW_SIGNAL_INSTANTIATE:
+    if(!c->c_evaluated) {
+      clone_unpark(c);
+      clone_instantiate(c);
+    }
+    return 1;
+
   case GLW_SIGNAL_DESTROY:
     gr = w->glw_root;
     sc->sc_entries--;
@@ -1259,6 +1569,7 @@ cloner_add_child0(sub_cloner_t *sc, prop_t *p, prop_t *before,
   glw_t *b;
   glw_root_t *gr = parent->glw_root;
   glw_clone_t *c = pool_get(gr->gr_clone_pool);
+  int defer = 0;
 
   LIST_INSERT_HEAD(&sc->sc_clones, c, c_link);
 
@@ -1267,10 +1578,17 @@ cloner_add_child0(sub_cloner_t *sc, prop_t *p, prop_t *before,
     assert(bb != NULL);
     sc->sc_positions_valid = 0;
     b = bb->c_w;
+    defer = !bb->c_evaluated;
   } else {
     b = sc->sc_anchor;
     c->c_pos = sc->sc_entries;
+    defer = c->c_pos > sc->sc_highest_active + CLONER_EAGER_ITEMS;
   }
+
+  if(!(parent->glw_class->gc_flags & GLW_VIRTUAL_CHILDS) ||
+     flags & PROP_ADD_SELECTED)
+    defer = 0;
+
   c->c_sc = sc;
 
   c->c_prop = prop_ref_inc(p);
@@ -1279,21 +1597,17 @@ cloner_add_child0(sub_cloner_t *sc, prop_t *p, prop_t *before,
 
   c->c_clone_root = prop_create_root(NULL);
 
-  c->c_w = glw_create(gr, sc->sc_cloner_class, parent, b, p);
-  c->c_w->glw_clone = c;
-
-  glw_set(c->c_w,
-	  GLW_ATTRIB_PROPROOTS3, p, sc->sc_originating_prop, c->c_clone_root,
-	  NULL);
+  c->c_w = clone_create_widget(c, parent, b);
 
   prop_tag_set(p, sc, c);
 
-  glw_signal_handler_register(c->c_w, clone_sig_handler, c, 1000);
-
   if(flags & PROP_ADD_SELECTED && parent->glw_class->gc_select_child != NULL)
     parent->glw_class->gc_select_child(parent, c->c_w, NULL);
 
-  clone_eval(c);
+  if(defer)
+    c->c_w->glw_flags |= GLW_PLACEHOLDER;
+  else
+    clone_instantiate(c);
 }
 
 
@@ -1390,6 +1704,7 @@ clone_free(glw_root_t *gr, glw_clone_t *c)
     glw_retire_child(w);
   }
 
+  clone_unpark(c);
   LIST_REMOVE(c, c_link);
   prop_ref_dec(c->c_prop);
   prop_destroy(c->c_clone_root);
@@ -1442,6 +1757,8 @@ cloner_select_child(sub_cloner_t *sc, prop_t *p, glw_t *parent, prop_t *extra)
   }
 
   if((c = prop_tag_get(p, sc)) != NULL) {
+    if(!c->c_evaluated)
+      clone_instantiate(c);
     if(parent->glw_class->gc_select_child != NULL)
       parent->glw_class->gc_select_child(parent, c->c_w, extra);
     sc->sc_pending_select = NULL;
@@ -1461,6 +1778,8 @@ cloner_suggest_focus(sub_cloner_t *sc, prop_t *p, glw_t *parent)
   glw_clone_t *c;
   
   if((c = prop_tag_get(p, sc)) != NULL) {
+    if(!c->c_evaluated)
+      clone_instantiate(c);
     if(parent->glw_class->gc_suggest_focus != NULL)
       parent->glw_class->gc_suggest_focus(parent, c->c_w);
   }
@@ -2247,6 +2566,7 @@ subscribe_prop(glw_view_eval_context_t *ec, struct token *self, int type)
       sc->sc_view_args        = prop_ref_inc(ec->prop_args);
       
       TAILQ_INIT(&sc->sc_pending);
+      TAILQ_INIT(&sc->sc_parked);
     } while(0);
     cb = prop_callback_cloner;
     f |= PROP_SUB_DIRECT_UPDATE;
@@ -2550,19 +2870,7 @@ glw_view_eval_block(token_t *t, glw_view_eval_context_t *ec)
       t->next =  w->glw_dynamic_expressions;
       w->glw_dynamic_expressions = t;
 
-      if(copy & GLW_VIEW_DYNAMIC_EVAL_EVERY_FRAME)
-	glw_signal_handler_register(w, eval_dynamic_every_frame_sig, t, 1000);
-
-      if(copy & GLW_VIEW_DYNAMIC_EVAL_FOCUSED_CHILD_CHANGE)
-	glw_signal_handler_register(w, eval_dynamic_focused_child_change_sig,
-				    t, 1000);
-
-      if(copy & GLW_VIEW_DYNAMIC_EVAL_FHP_CHANGE)
-	glw_signal_handler_register(w, eval_dynamic_fhp_change_sig, t, 1000);
-
-      if(copy & GLW_VIEW_DYNAMIC_EVAL_WIDGET_META)
-	glw_signal_handler_register(w, eval_dynamic_widget_meta_sig, t, 1000);
-
+      eval_dynamic_setup(w, t, ec->rc, copy);
       continue;
       
     case TOKEN_FLOAT:
@@ -5160,7 +5468,7 @@ glwf_getLayer(glw_view_eval_context_t *ec, struct token *self,
 {
   token_t *r;
 
-  ec->dynamic_eval |= GLW_VIEW_DYNAMIC_EVAL_EVERY_FRAME;
+  ec->dynamic_eval |= GLW_VIEW_DYNAMIC_EVAL_LAYOUT;
 
   r = eval_alloc(self, ec, TOKEN_INT);
 
@@ -5184,7 +5492,7 @@ glwf_getWidth(glw_view_eval_context_t *ec, struct token *self,
   token_t *r;
   glw_t *w = ec->w;
 
-  ec->dynamic_eval |= GLW_VIEW_DYNAMIC_EVAL_EVERY_FRAME;
+  ec->dynamic_eval |= GLW_VIEW_DYNAMIC_EVAL_LAYOUT;
 
   if(w->glw_flags & GLW_CONSTRAINT_CONF_X) {
     r = eval_alloc(self, ec, TOKEN_INT);
@@ -5210,7 +5518,7 @@ glwf_getHeight(glw_view_eval_context_t *ec, struct token *self,
   token_t *r;
   glw_t *w = ec->w;
 
-  ec->dynamic_eval |= GLW_VIEW_DYNAMIC_EVAL_EVERY_FRAME;
+  ec->dynamic_eval |= GLW_VIEW_DYNAMIC_EVAL_LAYOUT;
 
   if(w->glw_flags & GLW_CONSTRAINT_CONF_Y) {
     r = eval_alloc(self, ec, TOKEN_INT);
@@ -388,6 +388,7 @@ glw_view_load1(glw_root_t *gr, rstr_t *url, errorinfo_t *ei, token_t *prev,
     return NULL;
   }
 
+  glw_view_bincache_track(gr, p, b);
   last = lexer(gr, buf_cstr(b), ei, p, prev);
   buf_release(b);
   rstr_release(p);
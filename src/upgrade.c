@@ -28,7 +28,6 @@
 #include "arch/arch.h"
 #include "arch/halloc.h"
 #include "fileaccess/fileaccess.h"
-#include "htsmsg/htsmsg_json.h"
 #include "htsmsg/htsmsg_store.h"
 #include "misc/sha.h"
 #include "misc/str.h"
@@ -91,11 +90,10 @@ static void
 check_upgrade(int set_news)
 {
   char url[1024];
-  buf_t *b;
   htsmsg_t *json;
   char errbuf[1024];
 
-  if(inhibit_checks)
+  if(inhibit_checks || artifact_type == NULL || archname == NULL)
     return;
 
   if(upgrade_track == NULL) {
@@ -111,23 +109,14 @@ check_upgrade(int set_news)
   snprintf(url, sizeof(url), "%s/%s-%s.json", ctrlbase, upgrade_track,
 	   archname);
 
-  b = fa_load(url, NULL, errbuf, sizeof(errbuf),
-              NULL, FA_DISABLE_AUTH, NULL, NULL);
-  if(b == NULL) {
+  json = fa_load_json(url, NULL, errbuf, sizeof(errbuf), FA_DISABLE_AUTH);
+  if(json == NULL) {
     prop_set_string(upgrade_error, errbuf);
   err:
     prop_set_string(upgrade_status, "checkError");
     return;
   }
 
-  json = htsmsg_json_deserialize(buf_cstr(b));
-  buf_release(b);
-
-  if(json == NULL) {
-    prop_set_string(upgrade_error, "Malformed JSON in repository");
-    goto err;
-  }
-
   // Find an artifact for us
 
   const char *dlurl = NULL;
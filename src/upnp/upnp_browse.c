@@ -199,24 +199,24 @@ make_imageItem(prop_t *c, prop_t *m, htsmsg_t *item)
 /**
  *
  */
-static void
-add_item(htsmsg_t *item, prop_t *root, const char *trackid, prop_t **trackptr,
-	 prop_sub_t *skip, const char *baseurl, void *db)
+static prop_vec_t *
+add_item(htsmsg_t *item, prop_vec_t *pv, const char *trackid, prop_t **trackptr,
+	 const char *baseurl, void *db)
 {
   const char *cls, *id, *url;
 
   id = htsmsg_get_str_multi(item, "attrib", "id", NULL);
   if(id == NULL)
-    return;
+    return pv;
 
   if((item = htsmsg_get_map(item, "tags")) == NULL)
-    return;
+    return pv;
     
   cls = htsmsg_get_str_multi(item, 
 			     "urn:schemas-upnp-org:metadata-1-0/upnp/class",
 			     "cdata", NULL);
   if(cls == NULL)
-    return;
+    return pv;
 
   url = htsmsg_get_str_multi(item, "res", "cdata", NULL);
 
@@ -247,29 +247,30 @@ add_item(htsmsg_t *item, prop_t *root, const char *trackid, prop_t **trackptr,
   } else {
     TRACE(TRACE_DEBUG, "UPNP", "Cant handle upnp:class %s (%s)", cls, url);
     prop_destroy(c);
-    return;
+    return pv;
   }
 
-  if(prop_set_parent_ex(c, root, NULL, skip))
-    prop_destroy(c);
-  else if(trackid != NULL && !strcmp(trackid, id) && *trackptr == NULL)
+  if(trackid != NULL && !strcmp(trackid, id) && *trackptr == NULL)
     *trackptr = c;
+  return prop_vec_append(pv, c);
 }
 
 
 /**
  *
  */
-static void
-add_container(htsmsg_t *item, prop_t *root, const char *baseurl,
-	      prop_sub_t *skip)
+static prop_vec_t *
+add_container(htsmsg_t *item, prop_vec_t *pv, const char *baseurl)
 {
   char url[URL_MAX];
   const char *cls;
 
   const char *id = htsmsg_get_str_multi(item, "attrib", "id", NULL);
   if(id == NULL)
-    return;
+    return pv;
+
+  if((item = htsmsg_get_map(item, "tags")) == NULL)
+    return pv;
 
   snprintf(url, sizeof(url), "%s:%s", baseurl, id);
 
@@ -278,9 +279,6 @@ add_container(htsmsg_t *item, prop_t *root, const char *baseurl,
 
   prop_t *m = prop_create(c, "metadata");
 
-  if((item = htsmsg_get_map(item, "tags")) == NULL)
-    return;
-
   item_set_str(m, item, "title",
 	       "http://purl.org/dc/elements/1.1/title");
 
@@ -290,38 +288,71 @@ add_container(htsmsg_t *item, prop_t *root, const char *baseurl,
   const char *type = cls ? cls_to_type(cls) : "directory";
   prop_set_string(prop_create(c, "type"), type);
 
-  if(prop_set_parent_ex(c, root, NULL, skip))
-    prop_destroy(c);
+  return prop_vec_append(pv, c);
 }
 
 /**
  *
  */
+typedef struct nodes_aux {
+  prop_vec_t *pv;
+  const char *trackid;
+  prop_t **trackptr;
+  const char *baseurl;
+  void *db;
+} nodes_aux_t;
+
+
+/**
+ * Called for each child of <DIDL-Lite> as soon as it has been parsed
+ */
 static void
-nodes_from_meta(htsmsg_t *meta, prop_t *root, const char *trackid,
-		prop_t **trackptr, const char *baseurl, prop_sub_t *skip)
+nodes_from_element(void *opaque, const char *name, htsmsg_t *m)
 {
-  htsmsg_t *items;
-  htsmsg_field_t *f;
+  nodes_aux_t *na = opaque;
 
-  items = htsmsg_get_map_multi(meta, "tags", "DIDL-Lite", "tags", NULL);
-  if(items == NULL)
-    return;
+  if(!strcmp(name, "item"))
+    na->pv = add_item(m, na->pv, na->trackid, na->trackptr, na->baseurl,
+		      na->db);
+  else if(na->baseurl != NULL && !strcmp(name, "container"))
+    na->pv = add_container(m, na->pv, na->baseurl);
+}
 
-  void *db = metadb_get();
-
-  HTSMSG_FOREACH(f, items) {
-    if(!strcmp(f->hmf_name, "item")) {
-      htsmsg_t *item = htsmsg_get_map_by_field(f);
-      if(item != NULL)
-	add_item(item, root, trackid, trackptr, skip, baseurl, db);
-    } else if(baseurl != NULL && !strcmp(f->hmf_name, "container")) {
-      htsmsg_t *container = htsmsg_get_map_by_field(f);
-      if(container != NULL)
-	add_container(container, root, baseurl, skip);
-    }
+
+/**
+ * Takes ownership of 'didl'
+ *
+ * The nodes are collected while parsing and only added to 'root' once
+ * the whole document has been parsed, so a broken response doesn't
+ * leave half of it in the list
+ */
+static int
+nodes_from_didl(char *didl, prop_t *root, const char *trackid,
+		prop_t **trackptr, const char *baseurl, prop_sub_t *skip,
+		char *errbuf, size_t errlen)
+{
+  nodes_aux_t na;
+  int r;
+
+  na.pv = prop_vec_create(100);
+  na.trackid = trackid;
+  na.trackptr = trackptr;
+  na.baseurl = baseurl;
+  na.db = metadb_get();
+
+  r = htsmsg_xml_parse_elements(didl, 2, nodes_from_element, &na,
+				errbuf, errlen);
+  metadb_close(na.db);
+
+  if(r) {
+    prop_vec_destroy_entries(na.pv);
+    if(trackptr != NULL)
+      *trackptr = NULL;
+  } else if(prop_vec_len(na.pv) > 0) {
+    prop_set_parent_vector(na.pv, root, NULL, skip);
   }
-  metadb_close(db);
+  prop_vec_release(na.pv);
+  return r;
 }
 
 
@@ -336,7 +367,6 @@ upnp_browse_children(const char *uri, const char *id, prop_t *nodes,
   htsmsg_t *in = htsmsg_create_map(), *out;
   char errbuf[200];
   const char *result;
-  htsmsg_t *meta;
 
   if(trackptr != NULL)
     *trackptr = NULL;
@@ -369,16 +399,14 @@ upnp_browse_children(const char *uri, const char *id, prop_t *nodes,
     return -1;
   }
 
-  meta = htsmsg_xml_deserialize(strdup(result), errbuf, sizeof(errbuf));
-  if(meta == NULL) {
+  if(nodes_from_didl(strdup(result), nodes, trackid, trackptr, NULL, NULL,
+		     errbuf, sizeof(errbuf))) {
     TRACE(TRACE_ERROR, "UPNP", 
 	  "Browse %s via %s -- XML error %s", uri, id, errbuf);
     htsmsg_destroy(out);
     return -1;
   }
 
-  nodes_from_meta(meta, nodes, trackid, trackptr, NULL, NULL);
-  htsmsg_destroy(meta);
   htsmsg_destroy(out);
   return 0;
 }
@@ -414,7 +442,6 @@ browse_items(upnp_browse_t *ub)
   htsmsg_t *in = htsmsg_create_map(), *out;
   char errbuf[200];
   const char *result, *str;
-  htsmsg_t *meta;
 
   htsmsg_add_str(in, "ObjectID", ub->ub_id);
   htsmsg_add_str(in, "BrowseFlag", "BrowseDirectChildren");
@@ -447,20 +474,21 @@ browse_items(upnp_browse_t *ub)
     ub->ub_run = 0;
   }
 
-  if((result = htsmsg_get_str(out, "Result")) == NULL)
+  if((result = htsmsg_get_str(out, "Result")) == NULL) {
+    htsmsg_destroy(out);
     return browse_fail(ub, "No SOAP result");
+  }
 
-  meta = htsmsg_xml_deserialize(strdup(result), errbuf, sizeof(errbuf));
-  if(meta == NULL)
+  if(nodes_from_didl(strdup(result), ub->ub_items, NULL, NULL,
+		     ub->ub_base_url, ub->ub_itemsub,
+		     errbuf, sizeof(errbuf))) {
+    htsmsg_destroy(out);
     return browse_fail(ub, "Malformed XML: %s", errbuf);
-
-  nodes_from_meta(meta, ub->ub_items, NULL, NULL, 
-		  ub->ub_base_url, ub->ub_itemsub);
+  }
 
   TRACE(TRACE_DEBUG, "UPNP", "Browsed %d of %d items",
 	ub->ub_loaded_entries, ub->ub_total_entries);
 
-  htsmsg_destroy(meta);
   if(ub->ub_loaded_entries < ub->ub_total_entries)
     prop_have_more_childs(ub->ub_items);
   htsmsg_destroy(out);
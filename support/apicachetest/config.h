@@ -0,0 +1,10 @@
+/*
+ * Minimal configuration for building apicache.c outside the tree.
+ */
+#define ENABLE_LIBAV                0
+#define ENABLE_POLARSSL             1
+#define ENABLE_EMU_THREAD_SPECIFICS 0
+#define ENABLE_TLSF                 0
+#define ENABLE_BUGHUNT              0
+#define ENABLE_VALGRIND             0
+#define ENABLE_RELEASE              1
@@ -0,0 +1,429 @@
+/*
+ *  apicache test against a stub server
+ *  Copyright (C) 2013 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Runs apicache_load() against a stub HTTP server on localhost that
+ * logs when each request arrives:
+ *
+ *   burst      Threads loading distinct URLs for a second, far more
+ *              often than the bucket refills. No call may block, and
+ *              the server must never see more requests in any window
+ *              than the token bucket allows
+ *   cache      Loading the same URLs again doesn't reach the server
+ *   limited    With the bucket empty an expired response is returned
+ *              as is, and a URL that isn't cached fails right away
+ *   refill     Once the bucket has refilled, the expired response is
+ *              revalidated with If-None-Match
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <sqlite3.h>
+
+#include "showtime.h"
+#include "misc/buf.h"
+#include "api/apicache.h"
+
+extern sqlite3 *test_db;
+
+#define BURST_THREADS  4
+#define BURST_TIME     1000000  // µs
+#define BURST_REQUESTS 2000     // Max per thread
+#define MAX_HITS       1000
+
+static int server_port;
+static hts_mutex_t server_mutex;
+static int64_t server_hits[MAX_HITS];
+static int server_num_hits;
+static int server_num_not_modified;
+
+static int failures;
+
+static apicache_provider_t burst_api = {
+  .ap_name = "burst",
+  .ap_ttl = 3600,
+  .ap_negative_ttl = 60,
+  .ap_interval = 100,
+  .ap_burst = 5,
+};
+
+// Responses expire right away
+static apicache_provider_t expire_api = {
+  .ap_name = "expire",
+  .ap_ttl = 0,
+  .ap_negative_ttl = 0,
+  .ap_interval = 100,
+  .ap_burst = 2,
+};
+
+
+/**
+ *
+ */
+static void
+check(int ok, const char *what, ...)
+{
+  va_list ap;
+
+  printf("%-4s ", ok ? "ok" : "FAIL");
+  va_start(ap, what);
+  vprintf(what, ap);
+  va_end(ap);
+  printf("\n");
+
+  if(!ok)
+    failures++;
+}
+
+
+/**
+ * One request per connection. Everything gets the same ETag
+ */
+static void *
+server_thread(void *aux)
+{
+  int lfd = (intptr_t)aux;
+  char buf[4096], path[256], rsp[512];
+  int fd, len, r;
+
+  while((fd = accept(lfd, NULL, NULL)) != -1) {
+    len = 0;
+    while(len < sizeof(buf) - 1 &&
+          (r = read(fd, buf + len, sizeof(buf) - 1 - len)) > 0) {
+      len += r;
+      buf[len] = 0;
+      if(strstr(buf, "\r\n\r\n"))
+        break;
+    }
+    buf[len] = 0;
+
+    hts_mutex_lock(&server_mutex);
+    if(server_num_hits < MAX_HITS)
+      server_hits[server_num_hits] = showtime_get_ts();
+    server_num_hits++;
+
+    if(strstr(buf, "\r\nIf-None-Match: \"v1\"\r\n")) {
+      server_num_not_modified++;
+      snprintf(rsp, sizeof(rsp), "HTTP/1.0 304 Not Modified\r\n\r\n");
+    } else {
+      if(sscanf(buf, "GET %255s", path) != 1)
+        strcpy(path, "?");
+      snprintf(rsp, sizeof(rsp),
+               "HTTP/1.0 200 OK\r\n"
+               "ETag: \"v1\"\r\n"
+               "\r\n"
+               "{\"path\":\"%s\"}", path);
+    }
+    hts_mutex_unlock(&server_mutex);
+
+    if(write(fd, rsp, strlen(rsp)) < 0)
+      perror("write");
+    close(fd);
+  }
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static void
+server_start(void)
+{
+  struct sockaddr_in sin = {0};
+  socklen_t slen = sizeof(sin);
+  pthread_t tid;
+  int fd;
+
+  hts_mutex_init(&server_mutex);
+
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if(bind(fd, (struct sockaddr *)&sin, sizeof(sin)) ||
+     listen(fd, 64) ||
+     getsockname(fd, (struct sockaddr *)&sin, &slen)) {
+    perror("stub server");
+    exit(1);
+  }
+  server_port = ntohs(sin.sin_port);
+  pthread_create(&tid, NULL, server_thread, (void *)(intptr_t)fd);
+}
+
+
+/**
+ *
+ */
+static int
+server_get_hits(void)
+{
+  int r;
+  hts_mutex_lock(&server_mutex);
+  r = server_num_hits;
+  hts_mutex_unlock(&server_mutex);
+  return r;
+}
+
+
+/**
+ *
+ */
+static buf_t *
+load(apicache_provider_t *ap, const char *path, int *fetched,
+     char *errbuf, size_t errlen)
+{
+  char url[256];
+  snprintf(url, sizeof(url), "http://127.0.0.1:%d%s", server_port, path);
+  return apicache_load(ap, url, NULL, errbuf, errlen, 0, fetched);
+}
+
+
+typedef struct burst_thread {
+  pthread_t bt_tid;
+  int bt_id;
+  int bt_num_calls;
+  int bt_loaded[BURST_REQUESTS];
+  int bt_num_loaded;
+  int bt_num_limited;
+  int bt_num_other;
+  int64_t bt_max_call;
+} burst_thread_t;
+
+
+/**
+ *
+ */
+static void *
+burst_thread(void *aux)
+{
+  burst_thread_t *bt = aux;
+  char path[64], errbuf[256];
+  int i, fetched;
+  int64_t deadline = showtime_get_ts() + BURST_TIME;
+
+  for(i = 0; i < BURST_REQUESTS && showtime_get_ts() < deadline; i++) {
+    snprintf(path, sizeof(path), "/burst/%d/%d", bt->bt_id, i);
+
+    int64_t ts = showtime_get_ts();
+    buf_t *b = load(&burst_api, path, &fetched, errbuf, sizeof(errbuf));
+    ts = showtime_get_ts() - ts;
+    bt->bt_max_call = MAX(bt->bt_max_call, ts);
+
+    if(b != NULL) {
+      bt->bt_loaded[i] = 1;
+      bt->bt_num_loaded++;
+      buf_release(b);
+    } else if(!strncmp(errbuf, "Rate limited", 12)) {
+      bt->bt_num_limited++;
+    } else {
+      fprintf(stderr, "%s: %s\n", path, errbuf);
+      bt->bt_num_other++;
+    }
+    usleep(1000);
+  }
+  bt->bt_num_calls = i;
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static void
+test_burst(void)
+{
+  burst_thread_t bts[BURST_THREADS] = {};
+  int i, j, calls = 0, loaded = 0, limited = 0, other = 0, worst = 0;
+  int64_t max_call = 0, t0, elapsed;
+  int hits0 = server_get_hits();
+  char errbuf[256], path[64];
+
+  t0 = showtime_get_ts();
+  for(i = 0; i < BURST_THREADS; i++) {
+    bts[i].bt_id = i;
+    pthread_create(&bts[i].bt_tid, NULL, burst_thread, &bts[i]);
+  }
+
+  for(i = 0; i < BURST_THREADS; i++) {
+    pthread_join(bts[i].bt_tid, NULL);
+    calls    += bts[i].bt_num_calls;
+    loaded   += bts[i].bt_num_loaded;
+    limited  += bts[i].bt_num_limited;
+    other    += bts[i].bt_num_other;
+    max_call  = MAX(max_call, bts[i].bt_max_call);
+  }
+  elapsed = showtime_get_ts() - t0;
+
+  int hits = server_get_hits() - hits0;
+  int64_t interval = burst_api.ap_interval * 1000LL;
+
+  printf("burst: %d requests in %.1f ms, %d loaded, %d rate limited, "
+         "slowest call %.1f ms\n", calls,
+         elapsed / 1000.0, loaded, limited, max_call / 1000.0);
+
+  check(other == 0, "burst: no other errors");
+  check(max_call < interval / 2, "burst: no call waits for the bucket");
+  check(loaded >= burst_api.ap_burst + elapsed / interval - 1,
+        "burst: the bucket is used as it refills");
+  check(hits == loaded, "burst: the server saw %d requests", hits);
+
+  // Allow one extra for the time between taking a token and the
+  // request arriving at the server
+  int end = MIN(hits0 + hits, MAX_HITS);
+  for(i = hits0; i < end; i++) {
+    for(j = i; j < end; j++) {
+      int allowed = burst_api.ap_burst +
+        (server_hits[j] - server_hits[i]) / interval + 1;
+      worst = MAX(worst, j - i + 1 - allowed);
+    }
+  }
+  check(worst <= 0, "burst: never more than %d + 1 per %d ms in a window",
+        burst_api.ap_burst, burst_api.ap_interval);
+
+  // Everything loaded is now cached and fresh
+  hits0 = server_get_hits();
+  int cached = 0, fetched;
+
+  for(i = 0; i < BURST_THREADS; i++) {
+    for(j = 0; j < bts[i].bt_num_calls; j++) {
+      if(!bts[i].bt_loaded[j])
+        continue;
+      snprintf(path, sizeof(path), "/burst/%d/%d", i, j);
+      buf_t *b = load(&burst_api, path, &fetched, errbuf, sizeof(errbuf));
+      if(b != NULL && !fetched && strstr(buf_cstr(b), path))
+        cached++;
+      buf_release(b);
+    }
+  }
+  check(cached == loaded, "cache: %d of %d served from the cache",
+        cached, loaded);
+  check(server_get_hits() == hits0, "cache: the server saw no requests");
+}
+
+
+/**
+ *
+ */
+static void
+test_expired(void)
+{
+  char errbuf[256];
+  int fetched, hits0;
+  buf_t *b;
+
+  usleep(expire_api.ap_burst * expire_api.ap_interval * 1000);
+
+  // Takes both requests in the bucket
+  b = load(&expire_api, "/expire/1", &fetched, errbuf, sizeof(errbuf));
+  check(b != NULL && fetched, "limited: first load is fetched");
+  buf_release(b);
+  b = load(&expire_api, "/expire/2", &fetched, errbuf, sizeof(errbuf));
+  check(b != NULL && fetched, "limited: second load is fetched");
+  buf_release(b);
+
+  hits0 = server_get_hits();
+  b = load(&expire_api, "/expire/1", &fetched, errbuf, sizeof(errbuf));
+  check(b != NULL && !fetched && strstr(buf_cstr(b), "/expire/1"),
+        "limited: expired response is returned");
+  buf_release(b);
+
+  b = load(&expire_api, "/expire/3", &fetched, errbuf, sizeof(errbuf));
+  check(b == NULL && !strncmp(errbuf, "Rate limited", 12),
+        "limited: uncached load fails (%s)", b ? "loaded" : errbuf);
+  buf_release(b);
+  check(server_get_hits() == hits0, "limited: the server saw no requests");
+
+  usleep(expire_api.ap_interval * 1000);
+
+  b = load(&expire_api, "/expire/1", &fetched, errbuf, sizeof(errbuf));
+  check(b != NULL && fetched && strstr(buf_cstr(b), "/expire/1"),
+        "refill: expired response is revalidated");
+  buf_release(b);
+  check(server_get_hits() == hits0 + 1 && server_num_not_modified == 1,
+        "refill: the server answered 304 Not Modified");
+}
+
+
+/**
+ *
+ */
+static void
+init_db(const char *schema)
+{
+  char *sql, *errmsg;
+  FILE *fp;
+  long len;
+
+  if((fp = fopen(schema, "r")) == NULL) {
+    perror(schema);
+    exit(1);
+  }
+  fseek(fp, 0, SEEK_END);
+  len = ftell(fp);
+  rewind(fp);
+  sql = calloc(1, len + 1);
+  if(fread(sql, 1, len, fp) != len) {
+    perror(schema);
+    exit(1);
+  }
+  fclose(fp);
+
+  if(sqlite3_open(":memory:", &test_db) != SQLITE_OK ||
+     sqlite3_exec(test_db, sql, NULL, NULL, &errmsg) != SQLITE_OK) {
+    fprintf(stderr, "%s: %s\n", schema, sqlite3_errmsg(test_db));
+    exit(1);
+  }
+  free(sql);
+}
+
+
+/**
+ *
+ */
+int
+main(int argc, char **argv)
+{
+  inithelper_t *ih;
+
+  if(argc != 2) {
+    fprintf(stderr, "Usage: %s <metadb/017.sql>\n", argv[0]);
+    return 1;
+  }
+
+  init_db(argv[1]);
+
+  for(ih = inithelpers; ih != NULL; ih = ih->next)
+    if(ih->group == INIT_GROUP_API)
+      ih->fn();
+
+  setvbuf(stdout, NULL, _IOLBF, 0);
+
+  server_start();
+  test_burst();
+  test_expired();
+
+  printf("%s\n", failures ? "FAILED" : "PASSED");
+  return !!failures;
+}
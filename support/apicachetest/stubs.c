@@ -0,0 +1,217 @@
+/*
+ *  apicache test against a stub server
+ *  Copyright (C) 2013 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * The parts of the rest of Showtime that apicache.c calls into.
+ *
+ * http_request() is a bare HTTP/1.0 client, enough to talk to the stub
+ * server in main.c. The metadb is a single in-memory sqlite connection
+ * with only the apicache table.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <sqlite3.h>
+
+#include "showtime.h"
+#include "fileaccess/fileaccess.h"
+#include "networking/http.h"
+#include "htsmsg/htsbuf.h"
+#include "db/db_support.h"
+#include "metadata/metadata.h"
+
+inithelper_t *inithelpers;
+
+sqlite3 *test_db;
+
+
+/**
+ *
+ */
+void
+trace(int flags, int level, const char *subsys, const char *fmt, ...)
+{
+  va_list ap;
+
+  if(level > TRACE_ERROR)
+    return;
+
+  va_start(ap, fmt);
+  fprintf(stderr, "%s: ", subsys);
+  vfprintf(stderr, fmt, ap);
+  fprintf(stderr, "\n");
+  va_end(ap);
+}
+
+
+/**
+ *
+ */
+void
+hexdump(const char *pfx, const void *data_, int len)
+{
+}
+
+
+/**
+ *
+ */
+int64_t
+showtime_get_ts(void)
+{
+  struct timespec tv;
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return (int64_t)tv.tv_sec * 1000000LL + (tv.tv_nsec / 1000);
+}
+
+
+/**
+ *
+ */
+void *
+metadb_get(void)
+{
+  return test_db;
+}
+
+void
+metadb_close(void *db)
+{
+}
+
+
+/**
+ *
+ */
+int
+db_preparex(sqlite3 *db, sqlite3_stmt **ppStmt, const char *zSql,
+            const char *file, int line)
+{
+  return sqlite3_prepare_v2(db, zSql, -1, ppStmt, NULL) != SQLITE_OK;
+}
+
+int
+db_step(sqlite3_stmt *pStmt)
+{
+  return sqlite3_step(pStmt);
+}
+
+void
+db_finalize(sqlite3_stmt *pStmt)
+{
+  sqlite3_finalize(pStmt);
+}
+
+
+/**
+ * Only GET to http://<ipv4>:<port>/... is supported
+ */
+int
+http_request(const char *url, const char **arguments,
+             buf_t **result,
+             char *errbuf, size_t errlen,
+             struct htsbuf_queue *postdata, const char *postcontenttype,
+             int flags, struct http_header_list *headers_out,
+             const struct http_header_list *headers_in, const char *method,
+             fa_load_cb_t *cb, void *opaque)
+{
+  struct sockaddr_in sin = {0};
+  http_header_t *hh;
+  htsbuf_queue_t q;
+  char host[64], buf[4096];
+  const char *path;
+  int port, fd, len = 0, r, status;
+
+  if(sscanf(url, "http://%63[0-9.]:%d", host, &port) != 2 ||
+     (path = strchr(url + 7, '/')) == NULL) {
+    snprintf(errbuf, errlen, "Unsupported URL %s", url);
+    return -1;
+  }
+
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons(port);
+  inet_pton(AF_INET, host, &sin.sin_addr);
+
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  if(connect(fd, (struct sockaddr *)&sin, sizeof(sin))) {
+    snprintf(errbuf, errlen, "Connection failed");
+    close(fd);
+    return -1;
+  }
+
+  htsbuf_queue_init(&q, 0);
+  htsbuf_qprintf(&q, "GET %s HTTP/1.0\r\n", path);
+  if(headers_in != NULL)
+    LIST_FOREACH(hh, headers_in, hh_link)
+      htsbuf_qprintf(&q, "%s: %s\r\n", hh->hh_key, hh->hh_value);
+  htsbuf_qprintf(&q, "\r\n");
+
+  char *req = htsbuf_to_string(&q);
+  htsbuf_queue_flush(&q);
+  r = write(fd, req, strlen(req));
+  free(req);
+
+  // The server closes the connection after the response
+  while(r > 0 && len < sizeof(buf) - 1 &&
+        (r = read(fd, buf + len, sizeof(buf) - 1 - len)) > 0)
+    len += r;
+  close(fd);
+  buf[len] = 0;
+
+  char *body = strstr(buf, "\r\n\r\n");
+  if(body == NULL || sscanf(buf, "HTTP/1.%*d %d", &status) != 1) {
+    snprintf(errbuf, errlen, "Malformed response");
+    return -1;
+  }
+  *body = 0;
+  body += 4;
+
+  if(headers_out != NULL) {
+    char *line = strstr(buf, "\r\n"), *next;
+    for(; line != NULL; line = next) {
+      line += 2;
+      if((next = strstr(line, "\r\n")) != NULL)
+        *next = 0;
+      char *v = strchr(line, ':');
+      if(v == NULL)
+        continue;
+      *v++ = 0;
+      while(*v == ' ')
+        v++;
+      http_header_add(headers_out, line, v, 0);
+    }
+  }
+
+  if(status == 304)
+    return 304;
+
+  if(status != 200) {
+    snprintf(errbuf, errlen, "HTTP error %d", status);
+    return -1;
+  }
+
+  *result = buf_create_and_copy(strlen(body), body);
+  return 0;
+}
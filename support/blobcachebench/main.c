@@ -0,0 +1,322 @@
+/*
+ *  Blob cache benchmark
+ *  Copyright (C) 2013 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Drives blobcache_file.c directly with a synthetic workload.
+ *
+ * Every phase runs in a forked child so blobcache_init() always starts
+ * from a cold process, the same way Showtime does at boot:
+ *
+ *   fill     put N items on an empty cache, then blobcache_fini()
+ *   startup  blobcache_init() on the filled cache
+ *   get      T threads doing random gets, verifying content
+ *
+ * Item content is derived from its index so gets can be verified
+ * without keeping a copy around.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <errno.h>
+
+#include "showtime.h"
+#include "blobcache.h"
+
+extern int bench_verbose;
+
+static int num_items = 20000;
+static int avg_size = 16384;
+static int num_threads = 4;
+static int num_reads = 100000;
+
+#define VERIFY_BYTES 64
+
+
+/**
+ *
+ */
+static uint32_t
+lcg(uint32_t x)
+{
+  return x * 1664525 + 1013904223;
+}
+
+
+/**
+ *
+ */
+static int
+item_size(int idx)
+{
+  return 64 + lcg(idx * 7 + 1) % (avg_size * 2 - 128);
+}
+
+
+/**
+ *
+ */
+static void
+item_key(char *buf, size_t len, int idx)
+{
+  snprintf(buf, len, "http://bench.example.com/item/%d.jpg", idx);
+}
+
+
+/**
+ *
+ */
+static void
+item_fill(uint8_t *p, int size, int idx)
+{
+  uint32_t x = idx;
+  int i;
+  for(i = 0; i < size; i++) {
+    x = lcg(x);
+    p[i] = x >> 24;
+  }
+}
+
+
+/**
+ *
+ */
+static double
+elapsed(int64_t ts)
+{
+  return (showtime_get_ts() - ts) / 1000000.0;
+}
+
+
+/**
+ *
+ */
+static void
+phase_fill(void)
+{
+  char key[128];
+  int64_t bytes = 0;
+  int i;
+
+  int64_t ts = showtime_get_ts();
+  blobcache_init();
+  double t_init = elapsed(ts);
+
+  ts = showtime_get_ts();
+  for(i = 0; i < num_items; i++) {
+    int size = item_size(i);
+    buf_t *b = buf_create(size);
+    item_fill(b->b_ptr, size, i);
+    item_key(key, sizeof(key), i);
+    blobcache_put(key, "bench", b, 86400, NULL, 0);
+    buf_release(b);
+    bytes += size;
+  }
+  double t_put = elapsed(ts);
+
+  ts = showtime_get_ts();
+  blobcache_fini();
+  double t_fini = elapsed(ts);
+
+  printf("fill:    %d items, %.1f MB\n", num_items, bytes / 1e6);
+  printf("         init (empty) %8.3f s\n", t_init);
+  printf("         put          %8.3f s  %9.0f puts/s  %7.1f MB/s\n",
+         t_put, num_items / t_put, bytes / 1e6 / t_put);
+  printf("         fini         %8.3f s\n", t_fini);
+}
+
+
+/**
+ *
+ */
+static void
+phase_startup(void)
+{
+  int64_t ts = showtime_get_ts();
+  blobcache_init();
+  printf("startup: init         %8.3f s\n", elapsed(ts));
+  blobcache_fini();
+}
+
+
+typedef struct reader {
+  pthread_t tid;
+  uint32_t seed;
+  int hits;
+  int misses;
+  int corrupt;
+  int64_t bytes;
+} reader_t;
+
+
+/**
+ *
+ */
+static void *
+reader_thread(void *aux)
+{
+  reader_t *r = aux;
+  char key[128];
+  int reads = num_reads / num_threads;
+  int i;
+
+  for(i = 0; i < reads; i++) {
+    r->seed = lcg(r->seed);
+    int idx = r->seed % num_items;
+    item_key(key, sizeof(key), idx);
+    buf_t *b = blobcache_get(key, "bench", 0, NULL, NULL, NULL);
+    if(b == NULL) {
+      r->misses++;
+      continue;
+    }
+
+    // Only the head is compared, regenerating whole items would
+    // dominate the timing. The cache checksums the payload itself.
+    uint8_t ref[VERIFY_BYTES];
+    item_fill(ref, VERIFY_BYTES, idx);
+    if(b->b_size != item_size(idx) || memcmp(b->b_ptr, ref, VERIFY_BYTES))
+      r->corrupt++;
+    else
+      r->hits++;
+    r->bytes += b->b_size;
+    buf_release(b);
+  }
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static void
+phase_get(void)
+{
+  reader_t *readers = calloc(num_threads, sizeof(reader_t));
+  int hits = 0, misses = 0, corrupt = 0;
+  int64_t bytes = 0;
+  int i;
+
+  blobcache_init();
+
+  int64_t ts = showtime_get_ts();
+  for(i = 0; i < num_threads; i++) {
+    readers[i].seed = i + 1;
+    pthread_create(&readers[i].tid, NULL, reader_thread, &readers[i]);
+  }
+  for(i = 0; i < num_threads; i++) {
+    pthread_join(readers[i].tid, NULL);
+    hits    += readers[i].hits;
+    misses  += readers[i].misses;
+    corrupt += readers[i].corrupt;
+    bytes   += readers[i].bytes;
+  }
+  double t_get = elapsed(ts);
+
+  blobcache_fini();
+
+  int gets = hits + misses + corrupt;
+  printf("get:     %d threads   %8.3f s  %9.0f gets/s  %7.1f MB/s\n",
+         num_threads, t_get, gets / t_get, bytes / 1e6 / t_get);
+  printf("         %d hits, %d misses, %d corrupt\n", hits, misses, corrupt);
+  free(readers);
+}
+
+
+/**
+ *
+ */
+static int
+run(void (*fn)(void))
+{
+  int status;
+  pid_t pid = fork();
+  if(pid == -1) {
+    perror("fork");
+    return 1;
+  }
+  if(pid == 0) {
+    fn();
+    fflush(stdout);
+    _exit(0);
+  }
+  if(waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) ||
+     WEXITSTATUS(status)) {
+    fprintf(stderr, "Benchmark phase failed\n");
+    return 1;
+  }
+  return 0;
+}
+
+
+/**
+ *
+ */
+static void
+usage(const char *argv0)
+{
+  fprintf(stderr,
+          "Usage: %s [-n items] [-s avgsize] [-t threads] [-r reads] "
+          "[-v] <cachedir>\n"
+          "The cache directory should be empty (or not exist)\n",
+          argv0);
+  exit(1);
+}
+
+
+/**
+ *
+ */
+int
+main(int argc, char **argv)
+{
+  int c;
+
+  while((c = getopt(argc, argv, "n:s:t:r:v")) != -1) {
+    switch(c) {
+    case 'n': num_items   = atoi(optarg); break;
+    case 's': avg_size    = atoi(optarg); break;
+    case 't': num_threads = atoi(optarg); break;
+    case 'r': num_reads   = atoi(optarg); break;
+    case 'v': bench_verbose = 1; break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  if(optind != argc - 1 || num_items < 1 || avg_size < 128 ||
+     num_threads < 1)
+    usage(argv[0]);
+
+  gconf.cache_path = argv[optind];
+
+  if(mkdir(gconf.cache_path, 0777) && errno != EEXIST) {
+    perror(gconf.cache_path);
+    return 1;
+  }
+
+  setvbuf(stdout, NULL, _IOLBF, 0);
+
+  if(run(phase_fill) || run(phase_startup) || run(phase_get))
+    return 1;
+  return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ *  Blob cache benchmark
+ *  Copyright (C) 2013 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * The parts of the rest of Showtime that the blob cache calls into
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "showtime.h"
+#include "arch/arch.h"
+#include "arch/halloc.h"
+#include "settings.h"
+#include "notifications.h"
+
+gconf_t gconf;
+
+int bench_verbose;
+
+void
+trace(int flags, int level, const char *subsys, const char *fmt, ...)
+{
+  va_list ap;
+
+  if(level > (bench_verbose ? TRACE_DEBUG : TRACE_ERROR))
+    return;
+
+  va_start(ap, fmt);
+  fprintf(stderr, "%s: ", subsys);
+  vfprintf(stderr, fmt, ap);
+  fprintf(stderr, "\n");
+  va_end(ap);
+}
+
+int64_t
+showtime_get_ts(void)
+{
+  struct timespec tv;
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return (int64_t)tv.tv_sec * 1000000LL + (tv.tv_nsec / 1000);
+}
+
+/**
+ * Large enough for the cache to hit its upper limit
+ */
+int64_t
+arch_cache_avail_bytes(void)
+{
+  return 100LL * 1000 * 1000 * 1000;
+}
+
+void *
+halloc(size_t size)
+{
+  return malloc(size);
+}
+
+void
+hfree(void *ptr, size_t size)
+{
+  free(ptr);
+}
+
+rstr_t *
+nls_get_rstring(const char *string)
+{
+  return NULL;
+}
+
+struct prop *
+nls_get_prop(const char *string)
+{
+  return NULL;
+}
+
+setting_t *
+settings_create_action(prop_t *parent, prop_t *title,
+                       prop_callback_t *cb, void *opaque,
+                       int flags, prop_courier_t *pc)
+{
+  return NULL;
+}
+
+void *
+notify_add(prop_t *root, notify_type_t type, const char *icon, int delay,
+           rstr_t *fmt, ...)
+{
+  return NULL;
+}
@@ -0,0 +1,193 @@
+/*
+ *  Callout benchmark
+ *  Copyright (C) 2013 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Drives callout.c directly with a large number of timers:
+ *
+ *   arm     arm N callouts with deadlines an hour or more away
+ *   rearm   move each of them to a new random deadline
+ *   disarm  disarm them all
+ *   fire    arm N callouts due within the next few seconds and wait
+ *           for all of them to fire, reporting how late they were
+ *
+ * Arming is done from a single thread while the callout thread is
+ * running, so the timings include the locking in callout.c.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "showtime.h"
+#include "misc/callout.h"
+
+static int num_callouts = 1000000;
+static int fire_window = 2000000; // µs
+
+static int fired;
+static int64_t late_sum;
+static int64_t late_max;
+
+
+/**
+ *
+ */
+static uint32_t
+lcg(uint32_t x)
+{
+  return x * 1664525 + 1013904223;
+}
+
+
+/**
+ *
+ */
+static double
+elapsed(int64_t ts)
+{
+  return (showtime_get_ts() - ts) / 1000000.0;
+}
+
+
+/**
+ *
+ */
+static void
+report(const char *what, double t)
+{
+  printf("%-8s %8.3f s  %10.0f ops/s  %7.3f µs/op\n",
+         what, t, num_callouts / t, t * 1e6 / num_callouts);
+}
+
+
+/**
+ *
+ */
+static void
+never_called(callout_t *c, void *opaque)
+{
+  fprintf(stderr, "Callout fired unexpectedly\n");
+  exit(1);
+}
+
+
+/**
+ * Only called from the callout thread
+ */
+static void
+fire_cb(callout_t *c, void *opaque)
+{
+  int64_t deadline = (intptr_t)opaque;
+  int64_t late = showtime_get_ts() - deadline;
+  late_sum += late;
+  if(late > late_max)
+    late_max = late;
+  __sync_fetch_and_add(&fired, 1);
+}
+
+
+/**
+ *
+ */
+static void
+usage(const char *argv0)
+{
+  fprintf(stderr, "Usage: %s [-n callouts] [-w fire window in ms]\n", argv0);
+  exit(1);
+}
+
+
+/**
+ *
+ */
+int
+main(int argc, char **argv)
+{
+  callout_t *co;
+  uint32_t seed = 1;
+  int64_t ts;
+  int c, i;
+
+  while((c = getopt(argc, argv, "n:w:")) != -1) {
+    switch(c) {
+    case 'n': num_callouts = atoi(optarg); break;
+    case 'w': fire_window  = atoi(optarg) * 1000; break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  if(num_callouts < 1 || fire_window < 1000)
+    usage(argv[0]);
+
+  setvbuf(stdout, NULL, _IOLBF, 0);
+
+  callout_init();
+
+  co = calloc(num_callouts, sizeof(callout_t));
+
+  printf("%d callouts\n", num_callouts);
+
+  ts = showtime_get_ts();
+  for(i = 0; i < num_callouts; i++) {
+    seed = lcg(seed);
+    callout_arm_hires(&co[i], never_called, NULL,
+                      3600000000ULL + (seed % 3600000000U));
+  }
+  report("arm", elapsed(ts));
+
+  ts = showtime_get_ts();
+  for(i = 0; i < num_callouts; i++) {
+    seed = lcg(seed);
+    callout_arm_hires(&co[i], never_called, NULL,
+                      3600000000ULL + (seed % 3600000000U));
+  }
+  report("rearm", elapsed(ts));
+
+  ts = showtime_get_ts();
+  for(i = 0; i < num_callouts; i++)
+    callout_disarm(&co[i]);
+  report("disarm", elapsed(ts));
+
+  // Deadlines are spread over fire_window starting a second from now,
+  // arming must not take longer than that for the lateness to be fair
+  int64_t start = showtime_get_ts() + 1000000;
+  ts = showtime_get_ts();
+  for(i = 0; i < num_callouts; i++) {
+    seed = lcg(seed);
+    int64_t deadline = start + seed % fire_window;
+    callout_arm_hires(&co[i], fire_cb, (void *)(intptr_t)deadline,
+                      deadline - showtime_get_ts());
+  }
+  double t_arm = elapsed(ts);
+
+  while(__sync_fetch_and_add(&fired, 0) < num_callouts)
+    usleep(10000);
+
+  printf("fire     %8.3f s to arm, then %.3f s window\n",
+         t_arm, fire_window / 1e6);
+  printf("         lateness avg %.1f µs, max %.1f ms\n",
+         (double)late_sum / num_callouts, late_max / 1000.0);
+  if(t_arm > 1.0)
+    printf("         arming overran the window start, "
+           "lateness includes that\n");
+
+  free(co);
+  return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ *  Callout benchmark
+ *  Copyright (C) 2013 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * The parts of the rest of Showtime that callout.c calls into
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "showtime.h"
+#include "prop/prop.h"
+
+
+/**
+ *
+ */
+void
+trace(int flags, int level, const char *subsys, const char *fmt, ...)
+{
+  va_list ap;
+
+  if(level > TRACE_ERROR)
+    return;
+
+  va_start(ap, fmt);
+  fprintf(stderr, "%s: ", subsys);
+  vfprintf(stderr, fmt, ap);
+  fprintf(stderr, "\n");
+  va_end(ap);
+}
+
+
+/**
+ *
+ */
+int64_t
+showtime_get_ts(void)
+{
+  struct timespec tv;
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return (int64_t)tv.tv_sec * 1000000LL + (tv.tv_nsec / 1000);
+}
+
+
+/**
+ *
+ */
+void
+my_localtime(const time_t *timep, struct tm *tm)
+{
+  localtime_r(timep, tm);
+}
+
+
+/**
+ * The clock properties are not used by the benchmark
+ */
+prop_t *
+prop_get_global(void)
+{
+  return NULL;
+}
+
+prop_t *
+prop_create_ex(prop_t *parent, const char *name, prop_sub_t *skipme,
+               int noalloc, int incref)
+{
+  return NULL;
+}
+
+void
+prop_set_int_ex(prop_t *p, prop_sub_t *skipme, int v)
+{
+}
@@ -0,0 +1,57 @@
+/*
+ *  GLW Math test harness
+ *  Copyright (C) 2013 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/**
+ * Every primitive wrapped to work on plain float arrays so the two
+ * builds of ops.c can be compared with each other.
+ * Matrices are 16 floats in column major order.
+ */
+typedef struct glwmath_ops {
+  const char *name;
+
+  void (*translate)(float *m, float x, float y, float z);
+  void (*scale)(float *m, float x, float y, float z);
+  void (*rotate)(float *m, float a, float x, float y, float z);
+  void (*identity)(float *m);
+  int  (*invert)(float *dst, const float *src);
+  void (*lerp_matrix)(float *dst, float v, const float *a, const float *b);
+
+  void (*mul_vec3)(float *dst, const float *m, const float *v);
+  void (*mul_vec4)(float *dst, const float *m, const float *v);
+  void (*mul_vec4_i)(float *dst, const float *m, const float *v);
+  void (*trans_mul_vec4)(float *dst, const float *m, const float *v);
+
+  void (*vec3_addmul)(float *dst, const float *a, const float *b, float s);
+  void (*vec3_sub)(float *dst, const float *a, const float *b);
+  void (*vec3_cross)(float *dst, const float *a, const float *b);
+  float (*vec3_dot)(const float *a, const float *b);
+  float (*vec34_dot)(const float *a, const float *b);
+  void (*vec4_lerp)(float *dst, float s, const float *a, const float *b);
+  void (*vec4_mul_c3)(float *dst, const float *a, float s);
+  void (*vec4_set)(float *dst, const float *a, int i, float s);
+  void (*vec4_roundtrip)(float *dst, const float *a);
+  void (*mtx_copy)(float *dst, const float *src);
+
+  double (*bench)(int iterations, float *sink);
+
+} glwmath_ops_t;
+
+extern const glwmath_ops_t glwmath_ops_c;
+extern const glwmath_ops_t glwmath_ops_simd;
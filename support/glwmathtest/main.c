@@ -0,0 +1,256 @@
+/*
+ *  GLW Math test harness
+ *  Copyright (C) 2013 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Checks the SIMD (SSE or NEON) flavour of the GLW math primitives
+ * against the plain C code in glw_math_c.h using random matrices and
+ * vectors, and then times the two against each other.
+ *
+ * Usage: glwmathtest [rounds] [bench-iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "glwmathtest.h"
+
+static const glwmath_ops_t *C = &glwmath_ops_c;
+static const glwmath_ops_t *S = &glwmath_ops_simd;
+
+static int failures;
+static unsigned int seed = 1;
+
+
+/**
+ * Deterministic so a failure can be reproduced
+ */
+static float
+rnd(float lo, float hi)
+{
+  seed = seed * 1103515245 + 12345;
+  return lo + (hi - lo) * ((seed >> 8) & 0xffffff) / (float)0xffffff;
+}
+
+static void
+rnd_vec(float *v, int n)
+{
+  int i;
+  for(i = 0; i < n; i++)
+    v[i] = rnd(-10, 10);
+}
+
+/**
+ * Last row is 0,0,0,1 as for all matrices built by translate, scale
+ * and rotate
+ */
+static void
+rnd_affine(float *m)
+{
+  rnd_vec(m, 16);
+  m[3] = m[7] = m[11] = 0;
+  m[15] = 1;
+}
+
+
+/**
+ *
+ */
+static int
+close_enough(float a, float b)
+{
+  float m = fmaxf(1.0f, fmaxf(fabsf(a), fabsf(b)));
+  return fabsf(a - b) <= 1e-4f * m;
+}
+
+
+/**
+ *
+ */
+static void
+check(const char *what, int round, const float *ref, const float *got, int n)
+{
+  int i;
+  for(i = 0; i < n; i++) {
+    if(close_enough(ref[i], got[i]))
+      continue;
+    failures++;
+    printf("FAIL %-14s round %d: [%d] %s=%g %s=%g\n",
+	   what, round, i, C->name, ref[i], S->name, got[i]);
+    return;
+  }
+}
+
+
+/**
+ *
+ */
+static void
+test_round(int r)
+{
+  float m[16], m2[16], a[4], b[4], ref[16], got[16];
+  float x, y, z, s;
+  int i;
+
+  rnd_affine(m);
+  rnd_vec(m2, 16);
+  rnd_vec(a, 4);
+  rnd_vec(b, 4);
+  x = rnd(-10, 10);
+  y = rnd(-10, 10);
+  z = rnd(-10, 10);
+  s = rnd(0, 1);
+
+  // The C code only touches the upper 3x4 part so use affine matrices
+  memcpy(ref, m, sizeof(m));
+  memcpy(got, m, sizeof(m));
+  C->translate(ref, x, y, z);
+  S->translate(got, x, y, z);
+  check("translate", r, ref, got, 16);
+
+  memcpy(ref, m, sizeof(m));
+  memcpy(got, m, sizeof(m));
+  C->scale(ref, x, y, z);
+  S->scale(got, x, y, z);
+  check("scale", r, ref, got, 16);
+
+  memcpy(ref, m, sizeof(m));
+  memcpy(got, m, sizeof(m));
+  C->rotate(ref, s * 720 - 360, x, y, z);
+  S->rotate(got, s * 720 - 360, x, y, z);
+  check("rotate", r, ref, got, 16);
+
+  C->identity(ref);
+  S->identity(got);
+  check("identity", r, ref, got, 16);
+
+  rnd_affine(m2);
+  if(C->invert(ref, m2) == S->invert(got, m2)) {
+    check("invert", r, ref, got, 16);
+  } else {
+    failures++;
+    printf("FAIL %-14s round %d: return value differs\n", "invert", r);
+  }
+
+  rnd_vec(m, 16);
+  rnd_vec(m2, 16);
+  C->lerp_matrix(ref, s, m, m2);
+  S->lerp_matrix(got, s, m, m2);
+  check("lerp_matrix", r, ref, got, 16);
+
+  C->mul_vec3(ref, m, a);
+  S->mul_vec3(got, m, a);
+  check("mul_vec3", r, ref, got, 3);
+
+  C->mul_vec4(ref, m, a);
+  S->mul_vec4(got, m, a);
+  check("mul_vec4", r, ref, got, 4);
+
+  // The SIMD code does a full multiply here, only equal for w = 1
+  rnd_affine(m2);
+  memcpy(b, a, sizeof(a));
+  b[3] = 1;
+  C->mul_vec4_i(ref, m2, b);
+  S->mul_vec4_i(got, m2, b);
+  check("mul_vec4_i", r, ref, got, 4);
+
+  C->trans_mul_vec4(ref, m, a);
+  S->trans_mul_vec4(got, m, a);
+  check("trans_mul_vec4", r, ref, got, 4);
+
+  rnd_vec(b, 4);
+
+  C->vec3_addmul(ref, a, b, x);
+  S->vec3_addmul(got, a, b, x);
+  check("vec3_addmul", r, ref, got, 3);
+
+  C->vec3_sub(ref, a, b);
+  S->vec3_sub(got, a, b);
+  check("vec3_sub", r, ref, got, 3);
+
+  C->vec3_cross(ref, a, b);
+  S->vec3_cross(got, a, b);
+  check("vec3_cross", r, ref, got, 3);
+
+  ref[0] = C->vec3_dot(a, b);
+  got[0] = S->vec3_dot(a, b);
+  check("vec3_dot", r, ref, got, 1);
+
+  ref[0] = C->vec34_dot(a, b);
+  got[0] = S->vec34_dot(a, b);
+  check("vec34_dot", r, ref, got, 1);
+
+  C->vec4_lerp(ref, s, a, b);
+  S->vec4_lerp(got, s, a, b);
+  check("vec4_lerp", r, ref, got, 4);
+
+  C->vec4_mul_c3(ref, a, x);
+  S->vec4_mul_c3(got, a, x);
+  check("vec4_mul_c3", r, ref, got, 4);
+
+  for(i = 0; i < 4; i++) {
+    C->vec4_set(ref, a, i, x);
+    S->vec4_set(got, a, i, x);
+    check("vec4_set", r, ref, got, 4);
+  }
+
+  C->vec4_roundtrip(ref, a);
+  S->vec4_roundtrip(got, a);
+  check("vec4_get", r, ref, got, 4);
+
+  C->mtx_copy(ref, m);
+  S->mtx_copy(got, m);
+  check("mtx_copy", r, ref, got, 16);
+}
+
+
+/**
+ *
+ */
+int
+main(int argc, char **argv)
+{
+  int rounds = argc > 1 ? atoi(argv[1]) : 100000;
+  int iterations = argc > 2 ? atoi(argv[2]) : 20000000;
+  double tc, ts;
+  float sc, ss;
+  int r;
+
+  if(C == S || !strcmp(C->name, S->name))
+    printf("Warning: No SIMD math for this target, comparing C with C\n");
+
+  for(r = 0; r < rounds && failures < 50; r++)
+    test_round(r);
+
+  printf("%d rounds, %d failures (%s vs %s)\n",
+	 r, failures, C->name, S->name);
+
+  tc = C->bench(iterations, &sc);
+  ts = S->bench(iterations, &ss);
+
+  printf("%-4s: %d iterations in %.3fs (%.1f Mops/s)\n",
+	 C->name, iterations, tc, iterations / tc / 1e6);
+  printf("%-4s: %d iterations in %.3fs (%.1f Mops/s), %.2fx\n",
+	 S->name, iterations, ts, iterations / ts / 1e6, tc / ts);
+
+  if(!close_enough(sc / iterations, ss / iterations))
+    printf("Note: benchmark results differ (%g vs %g)\n", sc, ss);
+
+  return failures ? 1 : 0;
+}
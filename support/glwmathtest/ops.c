@@ -0,0 +1,462 @@
+/*
+ *  GLW Math test harness
+ *  Copyright (C) 2013 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Built twice by the Makefile. With GLWMATH_FORCE_C the plain C code
+ * from glw_math_c.h is used, otherwise the same selection as glw.h is
+ * done based on the target flags of the compiler (SSE or NEON).
+ */
+
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "glwmathtest.h"
+
+#if !defined(GLWMATH_FORCE_C) && defined(__SSE2__)
+#define ENABLE_GLW_MATH_SSE 1
+#else
+#define ENABLE_GLW_MATH_SSE 0
+#endif
+
+#if !defined(GLWMATH_FORCE_C) && !ENABLE_GLW_MATH_SSE && \
+  (defined(__ARM_NEON__) || defined(__ARM_NEON))
+#define ENABLE_GLW_MATH_NEON 1
+#else
+#define ENABLE_GLW_MATH_NEON 0
+#endif
+
+#if ENABLE_GLW_MATH_SSE
+#include <xmmintrin.h>
+typedef __m128 Mtx[4];
+typedef __m128 Vec4;
+typedef __m128 Vec3;
+typedef __m128 Vec2;
+#define OPS_NAME "SSE"
+#elif ENABLE_GLW_MATH_NEON
+#include <arm_neon.h>
+typedef float32x4_t Mtx[4];
+typedef float32x4_t Vec4;
+typedef float32x4_t Vec3;
+typedef float32x4_t Vec2;
+#define OPS_NAME "NEON"
+#else
+typedef float Mtx[16];
+typedef float Vec4[4];
+typedef float Vec3[3];
+typedef float Vec2[2];
+#define OPS_NAME "C"
+#endif
+
+#ifdef GLWMATH_FORCE_C
+#define OPS_SYMBOL glwmath_ops_c
+#define OPS_PREFIX(x) c_ ## x
+#else
+#define OPS_SYMBOL glwmath_ops_simd
+#define OPS_PREFIX(x) simd_ ## x
+#endif
+
+// Both builds are linked into the same binary
+#define glw_mtx_invert   OPS_PREFIX(glw_mtx_invert)
+#define glw_Rotatef      OPS_PREFIX(glw_Rotatef)
+#define glw_LoadIdentity OPS_PREFIX(glw_LoadIdentity)
+
+/**
+ * The part of glw.h the math code depends on
+ */
+#define GLW_LERP(a, y0, y1) ((y0) + (a) * ((y1) - (y0)))
+#define GLW_DEG2RAD(a) ((a) * M_PI * 2.0f / 360.0f)
+
+typedef struct glw_rctx {
+  Mtx rc_mtx;
+} glw_rctx_t;
+
+// Keep the math .c files from pulling in the real glw.h
+#define GLW_H
+
+#if ENABLE_GLW_MATH_SSE
+#include "glw_math_sse.h"
+#include "glw_math_simd.c"
+#elif ENABLE_GLW_MATH_NEON
+#include "glw_math_neon.h"
+#include "glw_math_simd.c"
+#else
+#include "glw_math_c.h"
+#include "glw_math_c.c"
+#endif
+
+
+#define load_vec3(dst, p) glw_vec3_copy(dst, glw_vec3_make(p[0], p[1], p[2]))
+#define load_vec4(dst, p) \
+  glw_vec4_copy(dst, glw_vec4_make(p[0], p[1], p[2], p[3]))
+
+#define store_vec3(p, v) do {			\
+    p[0] = glw_vec3_extract(v, 0);		\
+    p[1] = glw_vec3_extract(v, 1);		\
+    p[2] = glw_vec3_extract(v, 2);		\
+  } while(0)
+
+
+/**
+ *
+ */
+static void
+op_translate(float *m, float x, float y, float z)
+{
+  glw_rctx_t rc;
+  glw_LoadMatrixf(&rc, m);
+  glw_Translatef(&rc, x, y, z);
+  memcpy(m, glw_mtx_get(rc.rc_mtx), sizeof(float) * 16);
+}
+
+
+/**
+ *
+ */
+static void
+op_scale(float *m, float x, float y, float z)
+{
+  glw_rctx_t rc;
+  glw_LoadMatrixf(&rc, m);
+  glw_Scalef(&rc, x, y, z);
+  memcpy(m, glw_mtx_get(rc.rc_mtx), sizeof(float) * 16);
+}
+
+
+/**
+ *
+ */
+static void
+op_rotate(float *m, float a, float x, float y, float z)
+{
+  glw_rctx_t rc;
+  glw_LoadMatrixf(&rc, m);
+  glw_Rotatef(&rc, a, x, y, z);
+  memcpy(m, glw_mtx_get(rc.rc_mtx), sizeof(float) * 16);
+}
+
+
+/**
+ *
+ */
+static void
+op_identity(float *m)
+{
+  glw_rctx_t rc;
+  glw_LoadIdentity(&rc);
+  memcpy(m, glw_mtx_get(rc.rc_mtx), sizeof(float) * 16);
+}
+
+
+/**
+ *
+ */
+static int
+op_invert(float *dst, const float *src)
+{
+  Mtx d, s;
+  int r;
+  memcpy(s, src, sizeof(float) * 16);
+  r = glw_mtx_invert(d, s);
+  memcpy(dst, glw_mtx_get(d), sizeof(float) * 16);
+  return r;
+}
+
+
+/**
+ *
+ */
+static void
+op_lerp_matrix(float *dst, float v, const float *a, const float *b)
+{
+  Mtx d, ma, mb;
+  memcpy(ma, a, sizeof(float) * 16);
+  memcpy(mb, b, sizeof(float) * 16);
+  glw_LerpMatrix(d, v, ma, mb);
+  memcpy(dst, glw_mtx_get(d), sizeof(float) * 16);
+}
+
+
+/**
+ *
+ */
+static void
+op_mul_vec3(float *dst, const float *m, const float *v)
+{
+  Mtx mtx;
+  PMtx pm;
+  Vec3 a, r;
+  memcpy(mtx, m, sizeof(float) * 16);
+  glw_pmtx_mul_prepare(pm, mtx);
+  load_vec3(a, v);
+  glw_pmtx_mul_vec3(r, pm, a);
+  store_vec3(dst, r);
+}
+
+
+/**
+ *
+ */
+static void
+op_mul_vec4(float *dst, const float *m, const float *v)
+{
+  Mtx mtx;
+  PMtx pm;
+  Vec4 a, r;
+  memcpy(mtx, m, sizeof(float) * 16);
+  glw_pmtx_mul_prepare(pm, mtx);
+  load_vec4(a, v);
+  glw_pmtx_mul_vec4(r, pm, a);
+  glw_vec4_store(dst, r);
+}
+
+
+/**
+ *
+ */
+static void
+op_mul_vec4_i(float *dst, const float *m, const float *v)
+{
+  Mtx mtx;
+  PMtx pm;
+  Vec4 a, r;
+  memcpy(mtx, m, sizeof(float) * 16);
+  glw_pmtx_mul_prepare(pm, mtx);
+  load_vec4(a, v);
+  glw_pmtx_mul_vec4_i(r, pm, a);
+  glw_vec4_store(dst, r);
+}
+
+
+/**
+ *
+ */
+static void
+op_trans_mul_vec4(float *dst, const float *m, const float *v)
+{
+  Mtx mtx;
+  Vec4 a, r;
+  memcpy(mtx, m, sizeof(float) * 16);
+  load_vec4(a, v);
+  glw_mtx_trans_mul_vec4(r, mtx, a);
+  glw_vec4_store(dst, r);
+}
+
+
+/**
+ *
+ */
+static void
+op_vec3_addmul(float *dst, const float *a, const float *b, float s)
+{
+  Vec3 va, vb, r;
+  load_vec3(va, a);
+  load_vec3(vb, b);
+  glw_vec3_addmul(r, va, vb, s);
+  store_vec3(dst, r);
+}
+
+
+/**
+ *
+ */
+static void
+op_vec3_sub(float *dst, const float *a, const float *b)
+{
+  Vec3 va, vb, r;
+  load_vec3(va, a);
+  load_vec3(vb, b);
+  glw_vec3_sub(r, va, vb);
+  store_vec3(dst, r);
+}
+
+
+/**
+ *
+ */
+static void
+op_vec3_cross(float *dst, const float *a, const float *b)
+{
+  Vec3 va, vb, r;
+  load_vec3(va, a);
+  load_vec3(vb, b);
+  glw_vec3_cross(r, va, vb);
+  store_vec3(dst, r);
+}
+
+
+/**
+ *
+ */
+static float
+op_vec3_dot(const float *a, const float *b)
+{
+  Vec3 va, vb;
+  load_vec3(va, a);
+  load_vec3(vb, b);
+  return glw_vec3_dot(va, vb);
+}
+
+
+/**
+ *
+ */
+static float
+op_vec34_dot(const float *a, const float *b)
+{
+  Vec3 va;
+  Vec4 vb;
+  load_vec3(va, a);
+  load_vec4(vb, b);
+  return glw_vec34_dot(va, vb);
+}
+
+
+/**
+ *
+ */
+static void
+op_vec4_lerp(float *dst, float s, const float *a, const float *b)
+{
+  Vec4 va, vb, r;
+  load_vec4(va, a);
+  load_vec4(vb, b);
+  glw_vec4_lerp(r, s, va, vb);
+  glw_vec4_store(dst, r);
+}
+
+
+/**
+ *
+ */
+static void
+op_vec4_mul_c3(float *dst, const float *a, float s)
+{
+  Vec4 v;
+  load_vec4(v, a);
+  glw_vec4_mul_c3(v, s);
+  glw_vec4_store(dst, v);
+}
+
+
+/**
+ * NEON wants the lane as a constant
+ */
+static void
+op_vec4_set(float *dst, const float *a, int i, float s)
+{
+  Vec4 v;
+  load_vec4(v, a);
+  switch(i) {
+  case 0: glw_vec4_set(v, 0, s); break;
+  case 1: glw_vec4_set(v, 1, s); break;
+  case 2: glw_vec4_set(v, 2, s); break;
+  case 3: glw_vec4_set(v, 3, s); break;
+  }
+  glw_vec4_store(dst, v);
+}
+
+
+/**
+ *
+ */
+static void
+op_vec4_roundtrip(float *dst, const float *a)
+{
+  Vec4 v;
+  glw_vec4_copy(v, glw_vec4_get(a));
+  dst[0] = glw_vec4_extract(v, 0);
+  dst[1] = glw_vec4_extract(v, 1);
+  dst[2] = glw_vec4_extract(v, 2);
+  dst[3] = glw_vec4_extract(v, 3);
+}
+
+
+/**
+ *
+ */
+static void
+op_mtx_copy(float *dst, const float *src)
+{
+  Mtx d, s;
+  memcpy(s, src, sizeof(float) * 16);
+  glw_mtx_copy(d, s);
+  memcpy(dst, glw_mtx_get(d), sizeof(float) * 16);
+}
+
+
+/**
+ * Roughly what a widget does when rendering: move and scale the
+ * current matrix and project a few vertices through it.
+ * Returns elapsed wall time in seconds.
+ */
+static double
+op_bench(int iterations, float *sink)
+{
+  struct timespec t0, t1;
+  glw_rctx_t parent, rc;
+  PMtx pm;
+  Vec3 v, r;
+  float acc = 0;
+  int i;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  glw_LoadIdentity(&parent);
+  glw_Rotatef(&parent, 30, 0, 0, 1);
+  glw_vec3_copy(v, glw_vec3_make(1, 2, 3));
+
+  for(i = 0; i < iterations; i++) {
+    glw_mtx_copy(rc.rc_mtx, parent.rc_mtx);
+    glw_Translatef(&rc, (i & 1023) * 0.001f, -0.5f, 0.25f);
+    glw_Scalef(&rc, 0.5f, 0.75f, 1.0f);
+    glw_pmtx_mul_prepare(pm, rc.rc_mtx);
+    glw_pmtx_mul_vec3(r, pm, v);
+    acc += glw_vec3_extract(r, 0) + glw_vec3_extract(r, 1);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  *sink = acc;
+  return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+
+const glwmath_ops_t OPS_SYMBOL = {
+  .name           = OPS_NAME,
+  .translate      = op_translate,
+  .scale          = op_scale,
+  .rotate         = op_rotate,
+  .identity       = op_identity,
+  .invert         = op_invert,
+  .lerp_matrix    = op_lerp_matrix,
+  .mul_vec3       = op_mul_vec3,
+  .mul_vec4       = op_mul_vec4,
+  .mul_vec4_i     = op_mul_vec4_i,
+  .trans_mul_vec4 = op_trans_mul_vec4,
+  .vec3_addmul    = op_vec3_addmul,
+  .vec3_sub       = op_vec3_sub,
+  .vec3_cross     = op_vec3_cross,
+  .vec3_dot       = op_vec3_dot,
+  .vec34_dot      = op_vec34_dot,
+  .vec4_lerp      = op_vec4_lerp,
+  .vec4_mul_c3    = op_vec4_mul_c3,
+  .vec4_set       = op_vec4_set,
+  .vec4_roundtrip = op_vec4_roundtrip,
+  .mtx_copy       = op_mtx_copy,
+  .bench          = op_bench,
+};
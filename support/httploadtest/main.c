@@ -0,0 +1,410 @@
+/*
+ *  HTTP server load test
+ *  Copyright (C) 2013 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Load test client for the built-in HTTP server (http_server.c)
+ *
+ * Keeps a number of keep-alive connections busy with GET requests for
+ * a fixed time, then reports requests per second and the latency
+ * distribution. Run it against a running Showtime, e.g.
+ *
+ *   httploadtest -c 64 -d 10 http://127.0.0.1:42000/showtime/static/...
+ *
+ * With -r, each request asks for a byte range to exercise the
+ * 206 path of http_send_file().
+ *
+ * The server always sends a Content-Length, so that is all this
+ * client understands.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <stdint.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define RECV_BUF 65536
+
+typedef struct conn {
+  int fd;
+  int64_t sent;       // When the current request was sent
+  int hdrlen;         // Bytes buffered while waiting for the header
+  int64_t remain;     // Body bytes left of the current response
+  int close;          // Server will close after this response
+  int status;
+  char hdr[8192];
+} conn_t;
+
+static struct addrinfo *addr;
+static char request[1024];
+static int requestlen;
+
+static uint32_t *latencies;
+static int num_latencies;
+static int max_latencies;
+
+static int64_t bytes;
+static int status_ok;
+static int status_other;
+static int errors;
+static int reconnects;
+
+
+/**
+ *
+ */
+static int64_t
+get_ts(void)
+{
+  struct timespec tv;
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return (int64_t)tv.tv_sec * 1000000LL + (tv.tv_nsec / 1000);
+}
+
+
+/**
+ *
+ */
+static void
+record_latency(int64_t us)
+{
+  if(num_latencies == max_latencies) {
+    max_latencies = max_latencies ? max_latencies * 2 : 65536;
+    latencies = realloc(latencies, max_latencies * sizeof(uint32_t));
+  }
+  latencies[num_latencies++] = us;
+}
+
+
+/**
+ *
+ */
+static int
+send_request(conn_t *c)
+{
+  c->sent = get_ts();
+  c->hdrlen = 0;
+  c->remain = -1;
+  c->close = 0;
+  // The request is small enough to always fit in the socket buffer
+  return write(c->fd, request, requestlen) == requestlen ? 0 : -1;
+}
+
+
+/**
+ *
+ */
+static int
+conn_open(conn_t *c)
+{
+  const int one = 1;
+
+  c->fd = socket(addr->ai_family, SOCK_STREAM, 0);
+  if(c->fd == -1)
+    return -1;
+
+  if(connect(c->fd, addr->ai_addr, addr->ai_addrlen)) {
+    close(c->fd);
+    c->fd = -1;
+    return -1;
+  }
+  setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+  return send_request(c);
+}
+
+
+/**
+ *
+ */
+static void
+conn_reopen(conn_t *c)
+{
+  if(c->fd != -1)
+    close(c->fd);
+  reconnects++;
+  if(conn_open(c))
+    errors++;
+}
+
+
+/**
+ * Parse status line and headers, returns -1 if malformed
+ */
+static int
+parse_header(conn_t *c)
+{
+  char *s, *e;
+  int code;
+
+  c->hdr[c->hdrlen] = 0;
+  e = strstr(c->hdr, "\r\n\r\n");
+
+  if(sscanf(c->hdr, "HTTP/1.%*d %d", &code) != 1)
+    return -1;
+  c->status = code;
+
+  c->remain = 0;
+  for(s = strstr(c->hdr, "\r\n"); s != NULL && s < e;
+      s = strstr(s + 2, "\r\n")) {
+    if(!strncasecmp(s + 2, "Content-Length:", 15))
+      c->remain = strtoll(s + 17, NULL, 10);
+    else if(!strncasecmp(s + 2, "Connection: close", 17))
+      c->close = 1;
+  }
+  return 0;
+}
+
+
+/**
+ * Returns -1 if the connection should be reopened
+ */
+static int
+conn_read(conn_t *c, char *buf)
+{
+  ssize_t r = read(c->fd, buf, RECV_BUF);
+  if(r == 0)
+    return -1;
+  if(r < 0)
+    return errno == EAGAIN ? 0 : -1;
+
+  char *p = buf;
+
+  if(c->remain == -1) {
+    // Still in the header
+    int n = r;
+    if(n > sizeof(c->hdr) - 1 - c->hdrlen)
+      n = sizeof(c->hdr) - 1 - c->hdrlen;
+    memcpy(c->hdr + c->hdrlen, buf, n);
+    c->hdrlen += n;
+    c->hdr[c->hdrlen] = 0;
+
+    char *e = strstr(c->hdr, "\r\n\r\n");
+    if(e == NULL)
+      return c->hdrlen == sizeof(c->hdr) - 1 ? -1 : 0;
+
+    int used = (e + 4 - c->hdr) - (c->hdrlen - n);
+    if(parse_header(c))
+      return -1;
+    p += used;
+    r -= used;
+  }
+
+  // Pipelining is not used, so anything past the body is an error
+  if(r > c->remain)
+    return -1;
+
+  bytes += r;
+  c->remain -= r;
+
+  if(c->remain > 0)
+    return 0;
+
+  record_latency(get_ts() - c->sent);
+  if(c->status / 100 == 2)
+    status_ok++;
+  else
+    status_other++;
+
+  if(c->close)
+    return -1;
+  return send_request(c);
+}
+
+
+/**
+ *
+ */
+static int
+u32cmp(const void *A, const void *B)
+{
+  uint32_t a = *(const uint32_t *)A, b = *(const uint32_t *)B;
+  return a < b ? -1 : a > b;
+}
+
+
+/**
+ *
+ */
+static double
+percentile(double p)
+{
+  int i = p * (num_latencies - 1);
+  return latencies[i] / 1000.0;
+}
+
+
+/**
+ * http://host[:port][/path]
+ */
+static int
+parse_url(const char *url, char *host, size_t hostlen, char *port,
+          size_t portlen, char *path, size_t pathlen)
+{
+  const char *p, *e;
+
+  if(strncmp(url, "http://", 7))
+    return -1;
+  url += 7;
+
+  p = strchr(url, '/');
+  if(p == NULL)
+    p = url + strlen(url);
+  snprintf(path, pathlen, "%s", *p ? p : "/");
+
+  e = memchr(url, ':', p - url);
+  if(e != NULL) {
+    snprintf(port, portlen, "%.*s", (int)(p - e - 1), e + 1);
+    p = e;
+  }
+  if(p == url || p - url >= hostlen)
+    return -1;
+  snprintf(host, hostlen, "%.*s", (int)(p - url), url);
+  return 0;
+}
+
+
+/**
+ *
+ */
+static void
+usage(const char *argv0)
+{
+  fprintf(stderr,
+          "Usage: %s [-c connections] [-d seconds] [-r bytes] <url>\n"
+          "  -r   Request the last 'bytes' of the resource (Range: bytes=-N)\n",
+          argv0);
+  exit(1);
+}
+
+
+/**
+ *
+ */
+int
+main(int argc, char **argv)
+{
+  int num_conns = 16, duration = 10, range = 0;
+  char host[256], port[16] = "80", path[512] = "/";
+  struct addrinfo hints = {0};
+  int c, i;
+
+  while((c = getopt(argc, argv, "c:d:r:")) != -1) {
+    switch(c) {
+    case 'c': num_conns = atoi(optarg); break;
+    case 'd': duration  = atoi(optarg); break;
+    case 'r': range     = atoi(optarg); break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  if(optind != argc - 1 || num_conns < 1 || duration < 1 ||
+     parse_url(argv[optind], host, sizeof(host), port, sizeof(port),
+               path, sizeof(path)))
+    usage(argv[0]);
+
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if((i = getaddrinfo(host, port, &hints, &addr)) != 0) {
+    fprintf(stderr, "%s: %s\n", host, gai_strerror(i));
+    return 1;
+  }
+
+  if(range)
+    // The server only honours single ranges, suffix ranges work
+    // for files of any size
+    requestlen = snprintf(request, sizeof(request),
+                          "GET %s HTTP/1.1\r\nHost: %s\r\n"
+                          "Range: bytes=-%d\r\n\r\n", path, host, range);
+  else
+    requestlen = snprintf(request, sizeof(request),
+                          "GET %s HTTP/1.1\r\nHost: %s\r\n\r\n", path, host);
+
+  conn_t *conns = calloc(num_conns, sizeof(conn_t));
+  struct pollfd *fds = calloc(num_conns, sizeof(struct pollfd));
+  char *buf = malloc(RECV_BUF);
+
+  for(i = 0; i < num_conns; i++) {
+    if(conn_open(&conns[i])) {
+      fprintf(stderr, "Unable to connect to %s:%s -- %s\n",
+              host, port, strerror(errno));
+      return 1;
+    }
+  }
+
+  int64_t start = get_ts();
+  int64_t end = start + duration * 1000000LL;
+
+  while(get_ts() < end) {
+    for(i = 0; i < num_conns; i++) {
+      fds[i].fd = conns[i].fd;
+      fds[i].events = POLLIN;
+      fds[i].revents = 0;
+    }
+
+    if(poll(fds, num_conns, 100) < 0)
+      continue;
+
+    for(i = 0; i < num_conns; i++) {
+      if(fds[i].revents == 0)
+        continue;
+      if(conn_read(&conns[i], buf)) {
+        if(conns[i].remain != 0 || conns[i].hdrlen == 0)
+          errors++;
+        conn_reopen(&conns[i]);
+      }
+    }
+  }
+
+  double t = (get_ts() - start) / 1e6;
+
+  for(i = 0; i < num_conns; i++)
+    if(conns[i].fd != -1)
+      close(conns[i].fd);
+
+  printf("%d connections, %.1f s\n", num_conns, t);
+  printf("requests:  %d (%d 2xx, %d other), %d errors, %d reconnects\n",
+         num_latencies, status_ok, status_other, errors, reconnects);
+  printf("rate:      %.0f req/s, %.1f MB/s\n",
+         num_latencies / t, bytes / 1e6 / t);
+
+  if(num_latencies > 0) {
+    qsort(latencies, num_latencies, sizeof(uint32_t), u32cmp);
+    printf("latency:   p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, "
+           "p99.9 %.2f ms, max %.2f ms\n",
+           percentile(0.5), percentile(0.9), percentile(0.99),
+           percentile(0.999), percentile(1));
+  }
+
+  free(buf);
+  free(fds);
+  free(conns);
+  free(latencies);
+  freeaddrinfo(addr);
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,11 @@
+/*
+ * Minimal configuration for building the JSON parsers outside the tree.
+ * PolarSSL provides SHA1 so libav is not needed.
+ */
+#define ENABLE_LIBAV                0
+#define ENABLE_POLARSSL             1
+#define ENABLE_EMU_THREAD_SPECIFICS 0
+#define ENABLE_TLSF                 0
+#define ENABLE_BUGHUNT              0
+#define ENABLE_VALGRIND             0
+#define ENABLE_RELEASE              1
@@ -0,0 +1,331 @@
+/*
+ *  JSON parser benchmark
+ *  Copyright (C) 2013 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Compares the JSON parsers on a large synthetic document shaped like
+ * a TMDB search response (a list of objects with a mix of strings,
+ * numbers, escapes and nested lists):
+ *
+ *   dom        htsmsg_json_deserialize() on the whole document
+ *   stream     htsmsg_json_parser_feed() in fragments, full tree
+ *   paths      same, keeping only the fields tmdb.c asks for
+ *   sax        json_parser_feed() with no callbacks, parsing only
+ *
+ * 'heap' is what the resulting tree holds on to. Before timing, the
+ * dom and stream results are serialized back and compared.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "showtime.h"
+#include "misc/str.h"
+#include "misc/json.h"
+#include "htsmsg/htsmsg_json.h"
+
+gconf_t gconf;
+
+static int num_entries = 100000;
+static int chunk_size = 16384;
+static int rounds = 5;
+
+// Same as tmdb_query_by_title_and_year()
+static const char *tmdb_paths[] = {
+  "total_results",
+  "total_pages",
+  "results/*/id",
+  "results/*/title",
+  "results/*/original_title",
+  "results/*/release_date",
+  "results/*/popularity",
+  "results/*/poster_path",
+  "results/*/backdrop_path",
+  NULL
+};
+
+
+/**
+ *
+ */
+int64_t
+showtime_get_ts(void)
+{
+  struct timespec tv;
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return (int64_t)tv.tv_sec * 1000000LL + (tv.tv_nsec / 1000);
+}
+
+
+/**
+ * Used by htsbuf_hexdump()
+ */
+void
+hexdump(const char *pfx, const void *data, int len)
+{
+}
+
+
+/**
+ *
+ */
+static size_t
+heap_used(void)
+{
+  struct mallinfo2 mi = mallinfo2();
+  return mi.uordblks;
+}
+
+
+/**
+ *
+ */
+static char *
+make_document(void)
+{
+  htsbuf_queue_t hq;
+  int i;
+
+  htsbuf_queue_init(&hq, 0);
+  htsbuf_qprintf(&hq, "{\"page\":1,\"results\":[");
+
+  for(i = 0; i < num_entries; i++) {
+    htsbuf_qprintf(&hq,
+                   "%s{\"adult\":false,"
+                   "\"backdrop_path\":\"/b%07d.jpg\","
+                   "\"genre_ids\":[%d,%d,%d],"
+                   "\"id\":%d,"
+                   "\"original_language\":\"en\","
+                   "\"original_title\":\"Le film \\u00e9trange n\\u00b0%d\","
+                   "\"overview\":\"A \\\"quoted\\\" overview of movie %d, "
+                   "spanning\\na couple of lines with some \\ud83c\\udfac "
+                   "and a tab\\there. Lorem ipsum dolor sit amet, "
+                   "consectetur adipiscing elit.\","
+                   "\"popularity\":%d.%03d,"
+                   "\"poster_path\":\"/p%07d.jpg\","
+                   "\"release_date\":\"%04d-%02d-%02d\","
+                   "\"title\":\"Strange movie #%d\","
+                   "\"video\":false,"
+                   "\"vote_average\":%d.%d,"
+                   "\"vote_count\":%d,"
+                   "\"credits\":null}",
+                   i ? "," : "", i, i % 20, i % 7 + 20, i % 11 + 30, i, i, i,
+                   i % 1000, i % 997, i, 1950 + i % 70, 1 + i % 12,
+                   1 + i % 28, i, i % 10, i % 9, i * 7 % 10000);
+  }
+  htsbuf_qprintf(&hq, "],\"total_pages\":%d,\"total_results\":%d}",
+                 num_entries / 20, num_entries);
+
+  size_t len = hq.hq_size;
+  char *doc = malloc(len + 1);
+  htsbuf_read(&hq, doc, len);
+  doc[len] = 0;
+  return doc;
+}
+
+
+/**
+ *
+ */
+static htsmsg_t *
+parse_stream(const char *doc, size_t len, const char **paths)
+{
+  htsmsg_json_parser_t *hjp = htsmsg_json_parser_create(paths);
+  size_t off;
+
+  for(off = 0; off < len; off += chunk_size)
+    if(htsmsg_json_parser_feed(hjp, doc + off, MIN(chunk_size, len - off)))
+      break;
+  return htsmsg_json_parser_finish(hjp, NULL, 0);
+}
+
+
+/**
+ *
+ */
+static int
+parse_sax(const char *doc, size_t len)
+{
+  static const json_sax_t nop = {};
+  json_parser_t *jp = json_parser_create(&nop, NULL);
+  size_t off;
+
+  for(off = 0; off < len; off += chunk_size)
+    if(json_parser_feed(jp, doc + off, MIN(chunk_size, len - off)))
+      break;
+  int r = json_parser_finish(jp, NULL, 0);
+  json_parser_destroy(jp);
+  return r;
+}
+
+
+/**
+ * Parse once and report the time and the heap held by the result
+ */
+static void
+bench_once(const char *name, const char *doc, size_t len, int mode,
+           int64_t *tsp, size_t *heapp)
+{
+  size_t before = heap_used();
+  htsmsg_t *m = NULL;
+  int64_t ts = showtime_get_ts();
+
+  switch(mode) {
+  case 0: m = htsmsg_json_deserialize(doc); break;
+  case 1: m = parse_stream(doc, len, NULL); break;
+  case 2: m = parse_stream(doc, len, tmdb_paths); break;
+  case 3:
+    if(parse_sax(doc, len)) {
+      fprintf(stderr, "%s: Parse error\n", name);
+      exit(1);
+    }
+    break;
+  }
+
+  *tsp = showtime_get_ts() - ts;
+  *heapp = 0;
+
+  if(mode != 3) {
+    if(m == NULL) {
+      fprintf(stderr, "%s: Parse error\n", name);
+      exit(1);
+    }
+    *heapp = heap_used() - before;
+    htsmsg_destroy(m);
+  }
+}
+
+
+/**
+ * Each round runs in a forked child. Otherwise the heap left behind
+ * by freeing one large tree skews the timing of the next parse
+ */
+static void
+bench(const char *name, const char *doc, size_t len, int mode)
+{
+  int64_t best = INT64_MAX, ts;
+  size_t heap = 0;
+  int i, fd[2];
+
+  for(i = 0; i < rounds; i++) {
+    if(pipe(fd)) {
+      perror("pipe");
+      exit(1);
+    }
+
+    pid_t pid = fork();
+    if(pid == 0) {
+      close(fd[0]);
+      bench_once(name, doc, len, mode, &ts, &heap);
+      if(write(fd[1], &ts, sizeof(ts)) != sizeof(ts) ||
+         write(fd[1], &heap, sizeof(heap)) != sizeof(heap))
+        _exit(1);
+      _exit(0);
+    }
+    close(fd[1]);
+
+    if(pid == -1 ||
+       read(fd[0], &ts, sizeof(ts)) != sizeof(ts) ||
+       read(fd[0], &heap, sizeof(heap)) != sizeof(heap)) {
+      fprintf(stderr, "%s: Benchmark failed\n", name);
+      exit(1);
+    }
+    close(fd[0]);
+    waitpid(pid, NULL, 0);
+    best = MIN(best, ts);
+  }
+
+  printf("%-8s %9.1f ms %8.1f MB/s", name, best / 1000.0,
+         len / (double)best);
+  if(mode != 3)
+    printf(" %9.1f MB heap", heap / 1e6);
+  printf("\n");
+}
+
+
+/**
+ *
+ */
+static void
+usage(const char *argv0)
+{
+  fprintf(stderr, "Usage: %s [-n entries] [-c chunksize] [-r rounds]\n",
+          argv0);
+  exit(1);
+}
+
+
+/**
+ *
+ */
+int
+main(int argc, char **argv)
+{
+  int c;
+
+  while((c = getopt(argc, argv, "n:c:r:")) != -1) {
+    switch(c) {
+    case 'n': num_entries = atoi(optarg); break;
+    case 'c': chunk_size  = atoi(optarg); break;
+    case 'r': rounds      = atoi(optarg); break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  if(num_entries < 1 || chunk_size < 1 || rounds < 1)
+    usage(argv[0]);
+
+  unicode_init();
+
+  char *doc = make_document();
+  size_t len = strlen(doc);
+
+  // Both parsers must agree before comparing their speed
+  htsmsg_t *a = htsmsg_json_deserialize(doc);
+  htsmsg_t *b = parse_stream(doc, len, NULL);
+  char *sa = a ? htsmsg_json_serialize_to_str(a, 0) : NULL;
+  char *sb = b ? htsmsg_json_serialize_to_str(b, 0) : NULL;
+
+  if(sa == NULL || sb == NULL || strcmp(sa, sb)) {
+    fprintf(stderr, "Parsers disagree on the document\n");
+    return 1;
+  }
+  free(sa);
+  free(sb);
+  htsmsg_destroy(a);
+  htsmsg_destroy(b);
+
+  setvbuf(stdout, NULL, _IOLBF, 0);
+
+  printf("%d entries, %.1f MB, fed in %d byte fragments, best of %d\n",
+         num_entries, len / 1e6, chunk_size, rounds);
+
+  bench("dom",    doc, len, 0);
+  bench("stream", doc, len, 1);
+  bench("paths",  doc, len, 2);
+  bench("sax",    doc, len, 3);
+
+  free(doc);
+  return 0;
+}
@@ -0,0 +1,392 @@
+/*
+ *  Library search benchmark
+ *  Copyright (C) 2013 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Builds a synthetic library with the metadb schema from
+ * resources/metadb and times building the itemsearch index and
+ * searching it the same way browsemdb.c does (query building and
+ * ranking come from src/metadata/library_search.c)
+ *
+ * Text is made up from word lists that include diacritics so folding
+ * is exercised both when indexing and when querying.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <time.h>
+
+#include <sqlite3.h>
+
+#include "showtime.h"
+#include "misc/str.h"
+#include "metadata/library_search.h"
+
+#define MAX_HITS 100  // LIBRARY_SEARCH_MAX_HITS in browsemdb.c
+
+gconf_t gconf;
+
+static int num_items = 500000;
+static int rounds = 20;
+
+static const char *words[] = {
+  "love", "night", "blue", "heart", "city", "dream", "fire", "rain",
+  "summer", "road", "river", "light", "shadow", "golden", "wild",
+  "café", "été", "über", "señor", "mañana", "björk", "motörhead",
+  "ångström", "smörgås", "naïve", "déjà", "crème", "brûlée", "zoë",
+  "kaleidoscope", "quasar", "zephyr", "nocturne", "rhapsody",
+  "symphony", "electric", "midnight", "paradise", "thunder", "echo",
+};
+
+#define NUM_WORDS (sizeof(words) / sizeof(words[0]))
+
+static const char *queries[] = {
+  "love",
+  "lo",
+  "cafe",
+  "Café Night",
+  "motorhead",
+  "BJÖRK",
+  "smorgas ang",
+  "quasar zephyr nocturne",
+  "e",
+  "track 4242",
+  "nomatchatall",
+};
+
+#define NUM_QUERIES (sizeof(queries) / sizeof(queries[0]))
+
+
+/**
+ *
+ */
+int64_t
+showtime_get_ts(void)
+{
+  struct timespec tv;
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return (int64_t)tv.tv_sec * 1000000LL + (tv.tv_nsec / 1000);
+}
+
+
+/**
+ *
+ */
+static uint32_t
+lcg(uint32_t x)
+{
+  return x * 1664525 + 1013904223;
+}
+
+
+/**
+ *
+ */
+static void
+make_text(char *buf, size_t len, uint32_t *seed, int nwords)
+{
+  int i;
+  buf[0] = 0;
+  for(i = 0; i < nwords; i++) {
+    *seed = lcg(*seed);
+    const char *w = words[(*seed >> 8) % NUM_WORDS];
+    size_t l = strlen(buf);
+    snprintf(buf + l, len - l, "%s%s", i ? " " : "", w);
+  }
+}
+
+
+/**
+ *
+ */
+static void
+bind_folded(sqlite3_stmt *stmt, int col, const char *str)
+{
+  sqlite3_bind_text(stmt, col, utf8_fold(str), -1, free);
+}
+
+
+/**
+ *
+ */
+static int
+exec(sqlite3 *db, const char *sql)
+{
+  char *err;
+  if(sqlite3_exec(db, sql, NULL, NULL, &err) != SQLITE_OK) {
+    fprintf(stderr, "%s\n", err);
+    sqlite3_free(err);
+    return -1;
+  }
+  return 0;
+}
+
+
+/**
+ *
+ */
+static int
+filter_sql(const struct dirent *d)
+{
+  const char *p = strrchr(d->d_name, '.');
+  return p != NULL && !strcmp(p, ".sql");
+}
+
+
+/**
+ * Same as db_upgrade_schema() does for a new database
+ */
+static int
+load_schema(sqlite3 *db, const char *dir)
+{
+  struct dirent **names;
+  char path[PATH_MAX];
+  int n, i, r = 0;
+
+  n = scandir(dir, &names, filter_sql, alphasort);
+  if(n <= 0) {
+    fprintf(stderr, "No schema files in %s\n", dir);
+    return -1;
+  }
+
+  for(i = 0; i < n; i++) {
+    if(!r) {
+      snprintf(path, sizeof(path), "%s/%s", dir, names[i]->d_name);
+      FILE *f = fopen(path, "r");
+      char *sql = NULL;
+      if(f != NULL) {
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        sql = calloc(1, size + 1);
+        if(fread(sql, 1, size, f) != size)
+          r = -1;
+        fclose(f);
+      } else {
+        r = -1;
+      }
+      if(!r)
+        r = exec(db, sql);
+      free(sql);
+    }
+    free(names[i]);
+  }
+  free(names);
+  return r;
+}
+
+
+/**
+ *
+ */
+static int
+populate(sqlite3 *db)
+{
+  sqlite3_stmt *item, *search;
+  char url[256], title[256], artist[128], album[128];
+  uint32_t seed = 1;
+  int i;
+
+  if(exec(db, "BEGIN") ||
+     sqlite3_prepare_v2(db,
+                        "INSERT INTO item (id, url, contenttype) "
+                        "VALUES (?1, ?2, ?3)", -1, &item, NULL) ||
+     sqlite3_prepare_v2(db,
+                        "INSERT INTO itemsearch (docid, title, artist, album) "
+                        "VALUES (?1, ?2, ?3, ?4)", -1, &search, NULL)) {
+    fprintf(stderr, "%s\n", sqlite3_errmsg(db));
+    return -1;
+  }
+
+  int64_t ts = showtime_get_ts();
+
+  for(i = 1; i <= num_items; i++) {
+    make_text(title, sizeof(title), &seed, 2 + seed % 3);
+    snprintf(title + strlen(title), sizeof(title) - strlen(title),
+             " track %d", i);
+    make_text(artist, sizeof(artist), &seed, 1 + seed % 2);
+    make_text(album, sizeof(album), &seed, 2);
+
+    snprintf(url, sizeof(url), "file:///music/%s/%s/%d.mp3",
+             artist, album, i);
+
+    sqlite3_bind_int64(item, 1, i);
+    sqlite3_bind_text(item, 2, url, -1, SQLITE_STATIC);
+    sqlite3_bind_int(item, 3, 2);
+    if(sqlite3_step(item) != SQLITE_DONE) {
+      fprintf(stderr, "item: %s\n", sqlite3_errmsg(db));
+      return -1;
+    }
+    sqlite3_reset(item);
+
+    sqlite3_bind_int64(search, 1, i);
+    bind_folded(search, 2, title);
+    bind_folded(search, 3, artist);
+    bind_folded(search, 4, album);
+    if(sqlite3_step(search) != SQLITE_DONE) {
+      fprintf(stderr, "itemsearch: %s\n", sqlite3_errmsg(db));
+      return -1;
+    }
+    sqlite3_reset(search);
+  }
+  sqlite3_finalize(item);
+  sqlite3_finalize(search);
+
+  if(exec(db, "COMMIT"))
+    return -1;
+
+  printf("index:   %d items in %.2f s\n", num_items,
+         (showtime_get_ts() - ts) / 1e6);
+  return 0;
+}
+
+
+typedef struct hit {
+  int64_t id;
+  double score;
+} hit_t;
+
+
+/**
+ *
+ */
+static int
+hit_cmp(const void *A, const void *B)
+{
+  const hit_t *a = A, *b = B;
+  if(a->score > b->score)
+    return -1;
+  return a->score < b->score;
+}
+
+
+/**
+ * Mirrors library_search_query() and library_search_urls() in
+ * browsemdb.c. Returns number of matching items
+ */
+static int
+search(sqlite3 *db, const char *query)
+{
+  sqlite3_stmt *stmt, *url;
+  hit_t *hits = NULL;
+  int num = 0, max = 0, i;
+  char *q = library_search_make_query(query);
+
+  sqlite3_prepare_v2(db, "SELECT docid, matchinfo(itemsearch) "
+                     "FROM itemsearch WHERE itemsearch MATCH ?1",
+                     -1, &stmt, NULL);
+  sqlite3_bind_text(stmt, 1, q, -1, SQLITE_STATIC);
+
+  while(sqlite3_step(stmt) == SQLITE_ROW) {
+    if(num == max) {
+      max = MAX(max * 2, 64);
+      hits = realloc(hits, max * sizeof(hit_t));
+    }
+    hits[num].id = sqlite3_column_int64(stmt, 0);
+    hits[num].score = library_search_score(sqlite3_column_blob(stmt, 1),
+                                           sqlite3_column_bytes(stmt, 1));
+    num++;
+  }
+  sqlite3_finalize(stmt);
+  free(q);
+
+  qsort(hits, num, sizeof(hit_t), hit_cmp);
+
+  sqlite3_prepare_v2(db, "SELECT url FROM item WHERE id = ?1", -1, &url, NULL);
+  for(i = 0; i < MIN(num, MAX_HITS); i++) {
+    sqlite3_bind_int64(url, 1, hits[i].id);
+    sqlite3_step(url);
+    sqlite3_reset(url);
+  }
+  sqlite3_finalize(url);
+  free(hits);
+  return num;
+}
+
+
+/**
+ *
+ */
+static void
+usage(const char *argv0)
+{
+  fprintf(stderr,
+          "Usage: %s [-n items] [-r rounds] <schemadir> <dbfile>\n"
+          "<schemadir> is resources/metadb, <dbfile> is overwritten\n",
+          argv0);
+  exit(1);
+}
+
+
+/**
+ *
+ */
+int
+main(int argc, char **argv)
+{
+  sqlite3 *db;
+  int c, i, j;
+
+  while((c = getopt(argc, argv, "n:r:")) != -1) {
+    switch(c) {
+    case 'n': num_items = atoi(optarg); break;
+    case 'r': rounds    = atoi(optarg); break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  if(optind != argc - 2 || num_items < 1 || rounds < 1)
+    usage(argv[0]);
+
+  unicode_init();
+
+  unlink(argv[optind + 1]);
+  if(sqlite3_open(argv[optind + 1], &db) != SQLITE_OK) {
+    fprintf(stderr, "%s: %s\n", argv[optind + 1], sqlite3_errmsg(db));
+    return 1;
+  }
+
+  exec(db, "PRAGMA journal_mode=WAL");
+  exec(db, "PRAGMA synchronous=NORMAL");
+
+  if(load_schema(db, argv[optind]) || populate(db))
+    return 1;
+
+  printf("%-24s %8s %10s %10s\n", "query", "hits", "avg ms", "max ms");
+
+  for(i = 0; i < NUM_QUERIES; i++) {
+    int64_t total = 0, worst = 0;
+    int hits = 0;
+    for(j = 0; j < rounds; j++) {
+      int64_t ts = showtime_get_ts();
+      hits = search(db, queries[i]);
+      ts = showtime_get_ts() - ts;
+      total += ts;
+      worst = MAX(worst, ts);
+    }
+    printf("%-24s %8d %10.2f %10.2f\n", queries[i], hits,
+           total / 1000.0 / rounds, worst / 1000.0);
+  }
+
+  sqlite3_close(db);
+  return 0;
+}
@@ -0,0 +1,11 @@
+/*
+ * Minimal configuration for building the image decoders outside the
+ * tree. Unlike the other benchmarks this one needs libav.
+ */
+#define ENABLE_LIBAV                1
+#define ENABLE_POLARSSL             1
+#define ENABLE_EMU_THREAD_SPECIFICS 0
+#define ENABLE_TLSF                 0
+#define ENABLE_BUGHUNT              0
+#define ENABLE_VALGRIND             0
+#define ENABLE_RELEASE              1
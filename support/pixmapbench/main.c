@@ -0,0 +1,321 @@
+/*
+ *  Image decoder benchmark
+ *  Copyright (C) 2013 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Decodes PNG and JPEG images from 100x100 up to 1920x1080 through
+ * pixmap_decode(), the same path the image loader takes, and reports
+ * the time per image. The images are generated at startup (JPEG with
+ * libav's own encoder) and a few variants of each size are decoded
+ * in turn so no two consecutive decodes see the same data.
+ *
+ * Small images are where reusing the opened codec contexts matters,
+ * for large ones the decoding itself dominates.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <zlib.h>
+
+#include <libavcodec/avcodec.h>
+
+#include "showtime.h"
+#include "misc/pixmap.h"
+
+gconf_t gconf;
+
+#define NUM_VARIANTS 4
+
+static double duration = 1.0;
+
+static const struct {
+  int width;
+  int height;
+} sizes[] = {
+  {  100,  100 },
+  {  320,  240 },
+  {  640,  480 },
+  { 1280,  720 },
+  { 1920, 1080 },
+};
+
+typedef struct image {
+  uint8_t *data;
+  size_t size;
+} image_t;
+
+
+/**
+ *
+ */
+int64_t
+showtime_get_ts(void)
+{
+  struct timespec tv;
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return (int64_t)tv.tv_sec * 1000000LL + (tv.tv_nsec / 1000);
+}
+
+
+/**
+ * Gradients with some noise, so the images neither compress to nothing
+ * nor look like random data to the encoders
+ */
+static uint8_t
+sample(int x, int y, int c, int seed)
+{
+  unsigned int r = (x * 1103515245u) ^ (y * 12345u) ^ (c * 2654435761u) ^
+    (seed * 40503u);
+  return ((x * (c + 1) + y * (3 - c)) / 4 + seed * 32 + (r >> 28)) & 0xff;
+}
+
+
+/**
+ *
+ */
+static void
+png_chunk(uint8_t *out, size_t *pos, const char *type,
+          const void *data, uint32_t len)
+{
+  uint32_t v = htonl(len);
+  uint8_t *p = out + *pos;
+
+  memcpy(p, &v, 4);
+  memcpy(p + 4, type, 4);
+  memcpy(p + 8, data, len);
+  v = htonl(crc32(0, p + 4, len + 4));
+  memcpy(p + 8 + len, &v, 4);
+  *pos += len + 12;
+}
+
+
+/**
+ * RGB, 8 bits per channel, no filtering
+ */
+static void
+make_png(image_t *img, int width, int height, int seed)
+{
+  size_t rawlen = (width * 3 + 1) * height;
+  uint8_t *raw = malloc(rawlen);
+  uint8_t *p = raw;
+  int x, y;
+
+  for(y = 0; y < height; y++) {
+    *p++ = 0;
+    for(x = 0; x < width; x++) {
+      *p++ = sample(x, y, 0, seed);
+      *p++ = sample(x, y, 1, seed);
+      *p++ = sample(x, y, 2, seed);
+    }
+  }
+
+  uLongf zlen = compressBound(rawlen);
+  uint8_t *z = malloc(zlen);
+  if(compress2(z, &zlen, raw, rawlen, 6) != Z_OK) {
+    fprintf(stderr, "Unable to compress PNG data\n");
+    exit(1);
+  }
+  free(raw);
+
+  uint8_t ihdr[13];
+  uint32_t v;
+  v = htonl(width);  memcpy(ihdr, &v, 4);
+  v = htonl(height); memcpy(ihdr + 4, &v, 4);
+  ihdr[8] = 8;   // Bit depth
+  ihdr[9] = 2;   // RGB
+  ihdr[10] = 0;  // Deflate
+  ihdr[11] = 0;  // Adaptive filtering
+  ihdr[12] = 0;  // No interlace
+
+  size_t pos = 8;
+  img->data = malloc(8 + 25 + zlen + 12 + 12);
+  memcpy(img->data, "\x89PNG\r\n\x1a\n", 8);
+  png_chunk(img->data, &pos, "IHDR", ihdr, sizeof(ihdr));
+  png_chunk(img->data, &pos, "IDAT", z, zlen);
+  png_chunk(img->data, &pos, "IEND", NULL, 0);
+  img->size = pos;
+  free(z);
+}
+
+
+/**
+ * Same encoder setup as the video thumbnail writer in fa_imageloader.c
+ */
+static void
+make_jpeg(image_t *img, int width, int height, int seed)
+{
+  AVCodec *codec = avcodec_find_encoder(CODEC_ID_MJPEG);
+  AVCodecContext *ctx;
+  AVFrame *frame;
+  AVPacket pkt;
+  int x, y, got_packet;
+
+  if(codec == NULL) {
+    fprintf(stderr, "No MJPEG encoder in libav\n");
+    exit(1);
+  }
+
+  ctx = avcodec_alloc_context3(codec);
+  ctx->pix_fmt = PIX_FMT_YUVJ420P;
+  ctx->time_base.den = 1;
+  ctx->time_base.num = 1;
+  ctx->width  = width;
+  ctx->height = height;
+
+  if(avcodec_open2(ctx, codec, NULL) < 0) {
+    fprintf(stderr, "Unable to open MJPEG encoder\n");
+    exit(1);
+  }
+
+  frame = avcodec_alloc_frame();
+  avpicture_alloc((AVPicture *)frame, ctx->pix_fmt, width, height);
+
+  for(y = 0; y < height; y++)
+    for(x = 0; x < width; x++)
+      frame->data[0][y * frame->linesize[0] + x] = sample(x, y, 0, seed);
+
+  for(y = 0; y < height / 2; y++) {
+    for(x = 0; x < width / 2; x++) {
+      frame->data[1][y * frame->linesize[1] + x] = sample(x, y, 1, seed);
+      frame->data[2][y * frame->linesize[2] + x] = sample(x, y, 2, seed);
+    }
+  }
+
+  frame->pts = AV_NOPTS_VALUE;
+  memset(&pkt, 0, sizeof(pkt));
+  if(avcodec_encode_video2(ctx, &pkt, frame, &got_packet) < 0 ||
+     !got_packet) {
+    fprintf(stderr, "Unable to encode %dx%d JPEG\n", width, height);
+    exit(1);
+  }
+
+  img->data = malloc(pkt.size);
+  memcpy(img->data, pkt.data, pkt.size);
+  img->size = pkt.size;
+
+  av_free_packet(&pkt);
+  avpicture_free((AVPicture *)frame);
+  av_free(frame);
+  avcodec_close(ctx);
+  av_free(ctx);
+}
+
+
+/**
+ *
+ */
+static void
+bench(const char *name, pixmap_type_t type, int width, int height,
+      image_t *imgs)
+{
+  image_meta_t im = {0};
+  char errbuf[256];
+  int64_t ts, elapsed;
+  int n = 0;
+
+  // Decode at the original size
+  im.im_req_width  = -1;
+  im.im_req_height = -1;
+
+  ts = showtime_get_ts();
+
+  do {
+    const image_t *img = &imgs[n % NUM_VARIANTS];
+    pixmap_t *pm = pixmap_alloc_coded(img->data, img->size, type);
+
+    pm = pixmap_decode(pm, &im, errbuf, sizeof(errbuf));
+    if(pm == NULL) {
+      fprintf(stderr, "%s %dx%d: %s\n", name, width, height, errbuf);
+      exit(1);
+    }
+    if(pm->pm_width != width || pm->pm_height != height) {
+      fprintf(stderr, "%s %dx%d: Decoded as %dx%d\n", name, width, height,
+              pm->pm_width, pm->pm_height);
+      exit(1);
+    }
+    pixmap_release(pm);
+    n++;
+    elapsed = showtime_get_ts() - ts;
+  } while(elapsed < duration * 1000000);
+
+  printf("%-5s %4dx%-4d %8zu bytes %8d images %9.1f us/image %7.1f Mpix/s\n",
+         name, width, height, imgs[0].size, n, elapsed / (double)n,
+         (double)width * height * n / elapsed);
+}
+
+
+/**
+ *
+ */
+static void
+usage(const char *argv0)
+{
+  fprintf(stderr, "Usage: %s [-d seconds per size]\n", argv0);
+  exit(1);
+}
+
+
+/**
+ *
+ */
+int
+main(int argc, char **argv)
+{
+  image_t png[NUM_VARIANTS], jpeg[NUM_VARIANTS];
+  int c, i, j;
+
+  while((c = getopt(argc, argv, "d:")) != -1) {
+    switch(c) {
+    case 'd': duration = atof(optarg); break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  if(duration <= 0)
+    usage(argv[0]);
+
+  avcodec_register_all();
+#ifndef PIXMAPBENCH_OLD
+  pixmap_decoder_init();
+#endif
+
+  setvbuf(stdout, NULL, _IOLBF, 0);
+
+  for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    int w = sizes[i].width;
+    int h = sizes[i].height;
+
+    for(j = 0; j < NUM_VARIANTS; j++) {
+      make_png(&png[j], w, h, j);
+      make_jpeg(&jpeg[j], w, h, j);
+    }
+
+    bench("png",  PIXMAP_PNG,  w, h, png);
+    bench("jpeg", PIXMAP_JPEG, w, h, jpeg);
+
+    for(j = 0; j < NUM_VARIANTS; j++) {
+      free(png[j].data);
+      free(jpeg[j].data);
+    }
+  }
+  return 0;
+}
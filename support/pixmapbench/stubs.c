@@ -0,0 +1,69 @@
+/*
+ *  Image decoder benchmark
+ *  Copyright (C) 2013 Andreas Öman
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * The parts of the rest of Showtime that pixmap.c calls into
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "showtime.h"
+#include "backend/backend.h"
+#include "misc/pixmap.h"
+
+
+/**
+ *
+ */
+void
+trace(int flags, int level, const char *subsys, const char *fmt, ...)
+{
+  va_list ap;
+
+  if(level > TRACE_ERROR)
+    return;
+
+  va_start(ap, fmt);
+  fprintf(stderr, "%s: ", subsys);
+  vfprintf(stderr, fmt, ap);
+  fprintf(stderr, "\n");
+  va_end(ap);
+}
+
+
+/**
+ * pixmap.c registers itself as a backend for image loading
+ */
+void
+backend_register(backend_t *be)
+{
+}
+
+
+/**
+ * The benchmark only feeds PNG and JPEG
+ */
+pixmap_t *
+svg_decode(pixmap_t *pm, const image_meta_t *im,
+	   char *errbuf, size_t errlen)
+{
+  pixmap_release(pm);
+  snprintf(errbuf, errlen, "SVG not supported");
+  return NULL;
+}